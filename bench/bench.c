@@ -0,0 +1,491 @@
+// Benchmarks for the request/parse pipeline
+// Microbenchmarks envelope building, response parsing and snapshots on synthetic data,
+// then (with --endpoint) measures end-to-end throughput and latency against a
+// DNSAPI.asmx server such as bench/mock_server.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "gidinet_internal.h"
+
+// CLI output paths, from main.c compiled with main() renamed
+void parse_and_display_list_result(const char *response_data);
+void parse_and_display_simple_result(const char *response_data);
+int set_output_format(const char *name);
+
+// Minimum time spent on each microbenchmark, in seconds
+#define BENCH_MIN_TIME 0.3
+
+static FILE *report;
+
+static const char *simple_response =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+    "<soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\"><soap:Body>"
+    "<recordAddResponse xmlns=\"" API_NAMESPACE "\"><recordAddResult>"
+    "<resultCode>0</resultCode><resultSubCode>0</resultSubCode><resultText>Ok</resultText>"
+    "</recordAddResult></recordAddResponse></soap:Body></soap:Envelope>";
+
+// A recordGetList response with count records, shaped like the API's (caller frees)
+static char* synthetic_list_response(long count, size_t *size) {
+    struct GrowBuffer buf = {0};
+    char item[512];
+    
+    static const char head[] =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\"><soap:Body>"
+        "<recordGetListResponse xmlns=\"" API_NAMESPACE "\"><recordGetListResult>"
+        "<resultCode>0</resultCode><resultSubCode>0</resultSubCode><resultText>Ok</resultText><resultItems>";
+    if (buffer_append(&buf, head, sizeof(head) - 1) != 0) return NULL;
+    
+    for (long i = 0; i < count; i++) {
+        int len;
+        if (i % 3) {
+            len = snprintf(item, sizeof(item),
+                "<DNSRecordListItem><DomainName>bench.com</DomainName><HostName>h%ld</HostName>"
+                "<RecordType>A</RecordType><Data>10.%ld.%ld.%ld</Data><TTL>300</TTL><Priority>0</Priority>"
+                "<ReadOnly>false</ReadOnly><Suspended>false</Suspended><SuspensionReason /></DNSRecordListItem>",
+                i, (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        } else {
+            len = snprintf(item, sizeof(item),
+                "<DNSRecordListItem><DomainName>bench.com</DomainName><HostName>h%ld</HostName>"
+                "<RecordType>TXT</RecordType><Data>v=spf1 include:_spf.example.com &amp; ~all %ld</Data>"
+                "<TTL>300</TTL><Priority>0</Priority><ReadOnly>false</ReadOnly><Suspended>false</Suspended>"
+                "<SuspensionReason /></DNSRecordListItem>",
+                i, i);
+        }
+        if (buffer_append(&buf, item, (size_t)len) != 0) {
+            free(buf.data);
+            return NULL;
+        }
+    }
+    
+    int len = snprintf(item, sizeof(item),
+        "</resultItems><resultItemCount>%ld</resultItemCount></recordGetListResult></recordGetListResponse>"
+        "</soap:Body></soap:Envelope>", count);
+    if (buffer_append(&buf, item, (size_t)len) != 0) {
+        free(buf.data);
+        return NULL;
+    }
+    *size = buf.len;
+    return buf.data;
+}
+
+static void count_record(void *ctx, const struct ListRecord *record) {
+    (void)record;
+    (*(long *)ctx)++;
+}
+
+// Report one microbenchmark: iterations of work covering bytes and items in total
+static void report_rate(const char *name, long iterations, double elapsed, double bytes, double items) {
+    fprintf(report, "%-36s %12.0f ns/op", name, elapsed / iterations * 1e9);
+    if (bytes > 0) fprintf(report, " %10.1f MB/s", bytes / elapsed / 1e6);
+    if (items > 0) fprintf(report, " %12.0f records/s", items / elapsed);
+    fprintf(report, "\n");
+}
+
+static void bench_envelopes(void) {
+    struct DNSRecord old_record = { "bench.com", "www", "A", "192.0.2.1", 300, 0 };
+    struct DNSRecord new_record = { "bench.com", "www", "A", "192.0.2.2", 300, 0 };
+    struct DNSRecord txt_record = { "bench.com", "_dmarc", "TXT", "v=DMARC1; p=reject; rua=mailto:<a@b.c> & more",
+                                    300, 0 };
+    struct GrowBuffer out = {0};
+    
+    fprintf(report, "Envelope building\n");
+    for (int kind = 0; kind < 4; kind++) {
+        static const char *names[] = { "  recordAdd", "  recordAdd (escaped TXT)", "  recordUpdate",
+                                       "  recordGetList" };
+        long iterations = 0;
+        double bytes = 0;
+        double started = monotonic_seconds(), elapsed;
+        do {
+            for (int i = 0; i < 10000; i++) {
+                switch (kind) {
+                    case 0: build_record_add_request(&out, "user", "cGFzcw==", &old_record); break;
+                    case 1: build_record_add_request(&out, "user", "cGFzcw==", &txt_record); break;
+                    case 2: build_record_update_request(&out, "user", "cGFzcw==", &old_record, &new_record); break;
+                    case 3: build_record_list_request(&out, "user", "cGFzcw==", "bench.com"); break;
+                }
+                bytes += out.len;
+            }
+            iterations += 10000;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        report_rate(names[kind], iterations, elapsed, bytes, 0);
+    }
+    free(out.data);
+}
+
+static void bench_parsing(void) {
+    static const long sizes[] = { 10, 100, 1000, 10000, 100000 };
+    
+    fprintf(report, "\nResponse parsing\n");
+    long iterations = 0;
+    double started = monotonic_seconds(), elapsed;
+    do {
+        for (int i = 0; i < 1000; i++) parse_and_display_simple_result(simple_response);
+        iterations += 1000;
+        elapsed = monotonic_seconds() - started;
+    } while (elapsed < BENCH_MIN_TIME);
+    report_rate("  parse_and_display_simple_result", iterations, elapsed,
+                (double)strlen(simple_response) * iterations, 0);
+    
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size;
+        char *response = synthetic_list_response(sizes[s], &size);
+        if (!response) {
+            fprintf(stderr, "Not enough memory for %ld records\n", sizes[s]);
+            return;
+        }
+        char name[64];
+        
+        // Parser alone, fed in 16 KiB chunks as libcurl delivers them
+        iterations = 0;
+        started = monotonic_seconds();
+        do {
+            long records = 0;
+            struct SoapParser parser;
+            soap_parser_init(&parser, NULL, count_record, &records);
+            for (size_t off = 0; off < size; off += 16384) {
+                soap_parser_feed(&parser, response + off, size - off < 16384 ? size - off : 16384);
+            }
+            soap_parser_finish(&parser);
+            soap_parser_free(&parser);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        snprintf(name, sizeof(name), "  parse %ld records", sizes[s]);
+        report_rate(name, iterations, elapsed, (double)size * iterations, (double)sizes[s] * iterations);
+        
+        // Parser collecting into a RecordSet, as sync and transactions do, then freed
+        iterations = 0;
+        started = monotonic_seconds();
+        do {
+            struct RecordSet set = {0};
+            struct SoapParser parser;
+            soap_parser_init(&parser, NULL, record_set_collect, &set);
+            soap_parser_feed(&parser, response, size);
+            soap_parser_finish(&parser);
+            soap_parser_free(&parser);
+            gidinet_record_set_free(&set);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        snprintf(name, sizeof(name), "  collect %ld records", sizes[s]);
+        report_rate(name, iterations, elapsed, (double)size * iterations, (double)sizes[s] * iterations);
+        
+        // Parser plus JSON output (to /dev/null)
+        iterations = 0;
+        started = monotonic_seconds();
+        do {
+            parse_and_display_list_result(response);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        snprintf(name, sizeof(name), "  parse_and_display %ld records", sizes[s]);
+        report_rate(name, iterations, elapsed, (double)size * iterations, (double)sizes[s] * iterations);
+        
+        free(response);
+    }
+}
+
+// The list output formats over one response of 10000 records
+static void bench_formats(void) {
+    static const char *formats[] = { "json", "ndjson", "csv", "bind", "binary" };
+    const long count = 10000;
+    size_t size;
+    char *response = synthetic_list_response(count, &size);
+    if (!response) {
+        fprintf(stderr, "Not enough memory for %ld records\n", count);
+        return;
+    }
+    
+    fprintf(report, "\nOutput formats (parse and display %ld records)\n", count);
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        set_output_format(formats[f]);
+        long iterations = 0;
+        double started = monotonic_seconds(), elapsed;
+        do {
+            parse_and_display_list_result(response);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        char name[64];
+        snprintf(name, sizeof(name), "  --format %s", formats[f]);
+        report_rate(name, iterations, elapsed, (double)size * iterations, (double)count * iterations);
+    }
+    set_output_format("json");
+    free(response);
+}
+
+// list filters evaluated by the parser over one response of 100000 records
+static void bench_filters(void) {
+    static const struct { const char *name, *host, *type; long limit; } cases[] = {
+        { "  no filter", NULL, NULL, 0 },
+        { "  --type TXT", NULL, "TXT", 0 },
+        { "  --host h1*", "h1*", NULL, 0 },
+        { "  --host 'h*[05]'", "h*[05]", NULL, 0 },
+        { "  --host h99999", "h99999", NULL, 0 },
+        { "  --limit 10", NULL, NULL, 10 },
+    };
+    const long count = 100000;
+    size_t size;
+    char *response = synthetic_list_response(count, &size);
+    if (!response) {
+        fprintf(stderr, "Not enough memory for %ld records\n", count);
+        return;
+    }
+    
+    fprintf(report, "\nList filters (parse %ld records, fed in 16 KiB chunks)\n", count);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        struct RecordFilter filter = {0};
+        if (cases[c].host) record_filter_set_host(&filter, cases[c].host);
+        filter.type = cases[c].type;
+        filter.limit = cases[c].limit;
+        
+        long iterations = 0, matched = 0;
+        double started = monotonic_seconds(), elapsed;
+        do {
+            struct SoapParser parser;
+            matched = 0;
+            soap_parser_init(&parser, NULL, count_record, &matched);
+            parser.filter = record_filter_active(&filter) ? &filter : NULL;
+            for (size_t off = 0; off < size && !parser.done; off += 16384) {
+                soap_parser_feed(&parser, response + off, size - off < 16384 ? size - off : 16384);
+            }
+            soap_parser_finish(&parser);
+            soap_parser_free(&parser);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        char name[64];
+        snprintf(name, sizeof(name), "%s (%ld)", cases[c].name, matched);
+        report_rate(name, iterations, elapsed, 0, cases[c].limit ? 0 : (double)count * iterations);
+    }
+    free(response);
+}
+
+// Parse a listing response into a snapshot file
+static int write_snapshot(const char *response, size_t size, const char *path) {
+    struct SnapshotWriter writer;
+    struct SoapParser parser;
+    int rc = snapshot_writer_init(&writer);
+    soap_parser_init(&parser, NULL, snapshot_writer_add, &writer);
+    soap_parser_feed(&parser, response, size);
+    soap_parser_finish(&parser);
+    if (rc == 0) rc = snapshot_writer_save(&writer, "bench.com", path);
+    soap_parser_free(&parser);
+    snapshot_writer_free(&writer);
+    return rc;
+}
+
+// Open both snapshots and diff them without reporting the changes
+static int diff_snapshots(const char *old_path, const char *new_path) {
+    struct Snapshot from, to;
+    struct SnapshotDiffStats stats;
+    if (snapshot_open(&from, old_path) != 0) return -1;
+    if (snapshot_open(&to, new_path) != 0) {
+        snapshot_close(&from);
+        return -1;
+    }
+    int rc = snapshot_diff(&from, &to, NULL, NULL, &stats);
+    snapshot_close(&from);
+    snapshot_close(&to);
+    return rc;
+}
+
+static void bench_snapshots(void) {
+    static const long sizes[] = { 1000, 100000 };
+    char old_path[] = "/tmp/gidinet-bench-old-XXXXXX", new_path[] = "/tmp/gidinet-bench-new-XXXXXX";
+    int old_fd = mkstemp(old_path), new_fd = mkstemp(new_path);
+    
+    fprintf(report, "\nSnapshots\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && old_fd >= 0 && new_fd >= 0; s++) {
+        // The newer listing has 1% more records
+        size_t old_size, new_size;
+        char *old_response = synthetic_list_response(sizes[s], &old_size);
+        char *new_response = synthetic_list_response(sizes[s] + sizes[s] / 100, &new_size);
+        if (!old_response || !new_response || write_snapshot(new_response, new_size, new_path) != 0) {
+            fprintf(stderr, "Cannot write snapshots of %ld records\n", sizes[s]);
+            free(old_response);
+            free(new_response);
+            break;
+        }
+        char name[64];
+        
+        // Parse, intern, sort and write
+        long iterations = 0;
+        double started = monotonic_seconds(), elapsed;
+        do {
+            write_snapshot(old_response, old_size, old_path);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        snprintf(name, sizeof(name), "  parse + snapshot %ld records", sizes[s]);
+        report_rate(name, iterations, elapsed, (double)old_size * iterations, (double)sizes[s] * iterations);
+        
+        // Map both files and diff them
+        iterations = 0;
+        started = monotonic_seconds();
+        do {
+            diff_snapshots(old_path, new_path);
+            iterations++;
+            elapsed = monotonic_seconds() - started;
+        } while (elapsed < BENCH_MIN_TIME);
+        snprintf(name, sizeof(name), "  open + diff %ld records", sizes[s]);
+        report_rate(name, iterations, elapsed, 0, (double)sizes[s] * iterations);
+        
+        free(old_response);
+        free(new_response);
+    }
+    
+    if (old_fd >= 0) {
+        close(old_fd);
+        unlink(old_path);
+    }
+    if (new_fd >= 0) {
+        close(new_fd);
+        unlink(new_path);
+    }
+}
+
+// End-to-end run of one operation type through the request engine
+struct E2EContext {
+    enum SoapAction action;
+    long ops;
+    long next;
+    long completed;
+    long failed;
+    double *latencies;
+};
+
+static int e2e_source(void *ctx, struct PendingRequest *request) {
+    struct E2EContext *e2e = ctx;
+    if (e2e->next >= e2e->ops) return 1;
+    
+    char host[32], data[32], new_data[32];
+    long i = e2e->next++;
+    snprintf(host, sizeof(host), "bench-%ld", i);
+    snprintf(data, sizeof(data), "198.51.%ld.%ld", (i >> 8) & 255, i & 255);
+    snprintf(new_data, sizeof(new_data), "203.0.%ld.%ld", (i >> 8) & 255, i & 255);
+    struct DNSRecord record = { "bench.com", host, "A", data, 300, 0 };
+    struct DNSRecord updated = { "bench.com", host, "A", new_data, 300, 0 };
+    
+    int rc = -1;
+    request->action = e2e->action;
+    switch (e2e->action) {
+        case SOAP_ACTION_ADD: rc = build_record_add_request(&request->body, "bench", "YmVuY2g=", &record); break;
+        case SOAP_ACTION_UPDATE:
+            rc = build_record_update_request(&request->body, "bench", "YmVuY2g=", &record, &updated);
+            break;
+        case SOAP_ACTION_DELETE:
+            rc = build_record_delete_request(&request->body, "bench", "YmVuY2g=", &updated);
+            break;
+        case SOAP_ACTION_LIST:
+            rc = build_record_list_request(&request->body, "bench", "YmVuY2g=", "bench.com");
+            break;
+        default: break;
+    }
+    if (rc != 0) request->action = SOAP_ACTION_NONE;
+    return 0;
+}
+
+static void e2e_done(void *ctx, struct PendingRequest *request) {
+    struct E2EContext *e2e = ctx;
+    
+    if (request->action == SOAP_ACTION_NONE || request->curl_result != CURLE_OK || request->result.code != 0) {
+        e2e->failed++;
+    }
+    e2e->latencies[e2e->completed++] = request->timings.total;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t count, double p) {
+    if (count == 0) return 0;
+    size_t index = (size_t)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static int bench_end_to_end(const char *endpoint, long ops, int parallel) {
+    static const enum SoapAction actions[] = { SOAP_ACTION_ADD, SOAP_ACTION_UPDATE, SOAP_ACTION_LIST,
+                                               SOAP_ACTION_DELETE };
+    struct RequestEngine engine;
+    if (engine_init(&engine, parallel, endpoint) != 0) {
+        fprintf(stderr, "Failed to initialize CURL\n");
+        return 1;
+    }
+    
+    fprintf(report, "\nEnd to end against %s, %d in flight\n", endpoint, parallel);
+    int rc = 0;
+    for (size_t a = 0; a < sizeof(actions) / sizeof(actions[0]); a++) {
+        struct E2EContext e2e = {0};
+        e2e.action = actions[a];
+        e2e.ops = actions[a] == SOAP_ACTION_LIST ? (ops / 10 > 0 ? ops / 10 : 1) : ops;
+        e2e.latencies = calloc(e2e.ops, sizeof(double));
+        if (!e2e.latencies) {
+            engine_cleanup(&engine);
+            return 1;
+        }
+        
+        double started = monotonic_seconds();
+        engine_run(&engine, e2e_source, e2e_done, &e2e);
+        double elapsed = monotonic_seconds() - started;
+        
+        size_t count = (size_t)e2e.completed;
+        qsort(e2e.latencies, count, sizeof(double), compare_double);
+        fprintf(report, "  %-8s %7ld ops %10.0f ops/s   p50 %8.3f ms   p99 %8.3f ms   failed %ld\n",
+                soap_action_name(actions[a]), e2e.ops, e2e.ops / elapsed,
+                percentile(e2e.latencies, count, 0.50) * 1e3, percentile(e2e.latencies, count, 0.99) * 1e3,
+                e2e.failed);
+        if (e2e.failed) rc = 1;
+        free(e2e.latencies);
+    }
+    
+    engine_cleanup(&engine);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    const char *endpoint = NULL;
+    long ops = 2000;
+    int parallel = 8;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--endpoint") == 0 && i + 1 < argc) endpoint = argv[++i];
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) ops = atol(argv[++i]);
+        else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) parallel = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--endpoint URL] [--ops N] [--parallel N]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    // Results go to the original stdout; the JSON printed by the CLI paths is discarded
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen("/dev/null", "w", stdout)) {
+        fprintf(stderr, "Cannot redirect stdout\n");
+        return 1;
+    }
+    setvbuf(report, NULL, _IOLBF, 0);
+    
+    bench_envelopes();
+    bench_parsing();
+    bench_formats();
+    bench_filters();
+    bench_snapshots();
+    
+    int rc = 0;
+    if (endpoint) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        rc = bench_end_to_end(endpoint, ops, 1);
+        if (parallel > 1) rc |= bench_end_to_end(endpoint, ops, parallel);
+        curl_global_cleanup();
+    }
+    fclose(report);
+    return rc;
+}
@@ -0,0 +1,498 @@
+// Local stand-in for DNSAPI.asmx, used by the benchmarks
+// Serves recordGetList / recordAdd / recordUpdate / recordDelete over HTTP/1.1
+// keep-alive from an in-memory zone, on a single thread with poll().
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MAX_CLIENTS 1024
+#define API_NAMESPACE "https://api.quickservicebox.com/DNS/DNSAPI"
+
+struct MockRecord {
+    char *domain;
+    char *host;
+    char *type;
+    char *data;
+    int ttl;
+    int priority;
+};
+
+struct MockZone {
+    struct MockRecord *items;
+    size_t count;
+    size_t cap;
+};
+
+struct Buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct Connection {
+    int fd;
+    struct Buffer in;
+    struct Buffer out;
+    size_t out_sent;
+};
+
+static struct MockZone zone;
+static int delay_ms = 0;
+// Every fail_every-th request fails without touching the zone, alternately with
+// HTTP 503 and with result code 4 (undefined error); 0 disables failures
+static long fail_every = 0;
+static long request_count = 0;
+// Requests beyond throttle per second are answered with HTTP 429, as a provider
+// enforcing a rate limit would; 0 disables throttling
+static long throttle = 0;
+static struct timespec throttle_window;
+static long throttle_count = 0;
+
+static void buffer_reserve(struct Buffer *buf, size_t extra) {
+    if (buf->len + extra + 1 <= buf->cap) return;
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (buf->len + extra + 1 > cap) cap *= 2;
+    char *ptr = realloc(buf->data, cap);
+    if (!ptr) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    buf->data = ptr;
+    buf->cap = cap;
+}
+
+static void buffer_append(struct Buffer *buf, const char *bytes, size_t len) {
+    buffer_reserve(buf, len);
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buffer_printf(struct Buffer *buf, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void buffer_printf(struct Buffer *buf, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    buffer_reserve(buf, (size_t)needed);
+    va_start(args, format);
+    vsnprintf(buf->data + buf->len, (size_t)needed + 1, format, args);
+    va_end(args);
+    buf->len += (size_t)needed;
+}
+
+static void buffer_append_xml(struct Buffer *buf, const char *text) {
+    for (const char *p = text; *p; p++) {
+        switch (*p) {
+            case '&': buffer_append(buf, "&amp;", 5); break;
+            case '<': buffer_append(buf, "&lt;", 4); break;
+            case '>': buffer_append(buf, "&gt;", 4); break;
+            default: buffer_append(buf, p, 1); break;
+        }
+    }
+}
+
+// Value of <tag>...</tag> within [start, end), unescaped (caller frees); "" if absent
+static char* xml_value(const char *start, const char *end, const char *tag) {
+    char open[64], close[64];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+    
+    const char *from = memmem(start, end - start, open, strlen(open));
+    if (!from) return strdup("");
+    from += strlen(open);
+    const char *to = memmem(from, end - from, close, strlen(close));
+    if (!to) return strdup("");
+    
+    char *value = malloc(to - from + 1);
+    size_t len = 0;
+    for (const char *p = from; p < to; p++) {
+        static const struct { const char *entity; char c; } entities[] = {
+            { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+        };
+        int matched = 0;
+        if (*p == '&') {
+            for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+                size_t n = strlen(entities[i].entity);
+                if ((size_t)(to - p) >= n && memcmp(p, entities[i].entity, n) == 0) {
+                    value[len++] = entities[i].c;
+                    p += n - 1;
+                    matched = 1;
+                    break;
+                }
+            }
+        }
+        if (!matched) value[len++] = *p;
+    }
+    value[len] = '\0';
+    return value;
+}
+
+static void parse_record(const char *start, const char *end, struct MockRecord *record) {
+    record->domain = xml_value(start, end, "DomainName");
+    record->host = xml_value(start, end, "HostName");
+    record->type = xml_value(start, end, "RecordType");
+    record->data = xml_value(start, end, "Data");
+    char *ttl = xml_value(start, end, "TTL");
+    char *priority = xml_value(start, end, "Priority");
+    record->ttl = atoi(ttl);
+    record->priority = atoi(priority);
+    free(ttl);
+    free(priority);
+}
+
+static void free_record(struct MockRecord *record) {
+    free(record->domain);
+    free(record->host);
+    free(record->type);
+    free(record->data);
+}
+
+static int record_equal(const struct MockRecord *a, const struct MockRecord *b) {
+    return strcasecmp(a->domain, b->domain) == 0 && strcasecmp(a->host, b->host) == 0 &&
+           strcasecmp(a->type, b->type) == 0 && strcmp(a->data, b->data) == 0;
+}
+
+static long zone_find(const struct MockRecord *record) {
+    for (size_t i = 0; i < zone.count; i++) {
+        if (record_equal(&zone.items[i], record)) return (long)i;
+    }
+    return -1;
+}
+
+static void zone_add(struct MockRecord *record) {
+    if (zone.count == zone.cap) {
+        zone.cap = zone.cap ? zone.cap * 2 : 256;
+        zone.items = realloc(zone.items, zone.cap * sizeof(*zone.items));
+        if (!zone.items) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    zone.items[zone.count++] = *record;
+}
+
+static void zone_seed(const char *domain, long count) {
+    for (long i = 0; i < count; i++) {
+        struct MockRecord record;
+        char host[32], data[64];
+        snprintf(host, sizeof(host), "h%ld", i);
+        if (i % 3) snprintf(data, sizeof(data), "10.%ld.%ld.%ld", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        else snprintf(data, sizeof(data), "v=spf1 include:_spf.example.com ~all %ld", i);
+        record.domain = strdup(domain);
+        record.host = strdup(host);
+        record.type = strdup(i % 3 ? "A" : "TXT");
+        record.data = strdup(data);
+        record.ttl = 300;
+        record.priority = 0;
+        zone_add(&record);
+    }
+}
+
+// Write an HTTP response carrying the SOAP result of action to out
+static void write_response(struct Buffer *out, const char *action, int code, const char *domain) {
+    struct Buffer body = {0};
+    buffer_printf(&body,
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\"><soap:Body>"
+        "<%sResponse xmlns=\"" API_NAMESPACE "\"><%sResult>"
+        "<resultCode>%d</resultCode><resultSubCode>0</resultSubCode><resultText>%s</resultText>",
+        action, action, code, code == 0 ? "Ok" : "Err");
+    
+    if (domain && code == 0) {
+        long listed = 0;
+        buffer_printf(&body, "<resultItems>");
+        for (size_t i = 0; i < zone.count; i++) {
+            const struct MockRecord *record = &zone.items[i];
+            if (strcasecmp(record->domain, domain) != 0) continue;
+            buffer_printf(&body, "<DNSRecordListItem><DomainName>");
+            buffer_append_xml(&body, record->domain);
+            buffer_printf(&body, "</DomainName><HostName>");
+            buffer_append_xml(&body, record->host);
+            buffer_printf(&body, "</HostName><RecordType>");
+            buffer_append_xml(&body, record->type);
+            buffer_printf(&body, "</RecordType><Data>");
+            buffer_append_xml(&body, record->data);
+            buffer_printf(&body, "</Data><TTL>%d</TTL><Priority>%d</Priority><ReadOnly>false</ReadOnly>"
+                          "<Suspended>false</Suspended><SuspensionReason /></DNSRecordListItem>",
+                          record->ttl, record->priority);
+            listed++;
+        }
+        buffer_printf(&body, "</resultItems><resultItemCount>%ld</resultItemCount>", listed);
+    }
+    buffer_printf(&body, "</%sResult></%sResponse></soap:Body></soap:Envelope>", action, action);
+    
+    buffer_printf(out, "HTTP/1.1 200 OK\r\nContent-Type: text/xml; charset=utf-8\r\n"
+                  "Content-Length: %zu\r\n\r\n", body.len);
+    buffer_append(out, body.data, body.len);
+    free(body.data);
+}
+
+static void handle_request(struct Buffer *out, const char *action, const char *body, size_t body_len) {
+    const char *end = body + body_len;
+    
+    if (strcmp(action, "recordGetList") == 0) {
+        char *domain = xml_value(body, end, "domainName");
+        int found = 0;
+        for (size_t i = 0; i < zone.count && !found; i++) found = strcasecmp(zone.items[i].domain, domain) == 0;
+        write_response(out, action, found ? 0 : 5, domain);
+        free(domain);
+    } else if (strcmp(action, "recordAdd") == 0 || strcmp(action, "recordDelete") == 0) {
+        struct MockRecord record;
+        parse_record(body, end, &record);
+        long index = zone_find(&record);
+        int code;
+        if (action[6] == 'A') {
+            code = index >= 0 ? 6 : 0;
+            if (code == 0) zone_add(&record);
+            else free_record(&record);
+        } else {
+            code = index >= 0 ? 0 : 5;
+            if (code == 0) {
+                free_record(&zone.items[index]);
+                zone.items[index] = zone.items[--zone.count];
+            }
+            free_record(&record);
+        }
+        write_response(out, action, code, NULL);
+    } else if (strcmp(action, "recordUpdate") == 0) {
+        const char *old_start = strstr(body, "<oldRecord>");
+        const char *new_start = strstr(body, "<newRecord>");
+        if (!old_start || !new_start) {
+            write_response(out, action, 3, NULL);
+            return;
+        }
+        struct MockRecord old_record, new_record;
+        parse_record(old_start, new_start, &old_record);
+        parse_record(new_start, end, &new_record);
+        long index = zone_find(&old_record);
+        if (index >= 0) {
+            free_record(&zone.items[index]);
+            zone.items[index] = new_record;
+        } else {
+            free_record(&new_record);
+        }
+        free_record(&old_record);
+        write_response(out, action, index >= 0 ? 0 : 5, NULL);
+    } else {
+        write_response(out, "unknown", 3, NULL);
+    }
+}
+
+// Value of an HTTP header within the request head (caller frees), or NULL
+static char* header_value(const char *head, size_t head_len, const char *name) {
+    size_t name_len = strlen(name);
+    const char *p = head;
+    const char *end = head + head_len;
+    while (p < end) {
+        const char *eol = memmem(p, end - p, "\r\n", 2);
+        if (!eol) eol = end;
+        if ((size_t)(eol - p) > name_len && strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            const char *v = p + name_len + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) v++;
+            return strndup(v, eol - v);
+        }
+        p = eol + 2;
+    }
+    return NULL;
+}
+
+// Whether the current request is over the throttle rate (fixed one-second windows)
+static int throttled(void) {
+    if (throttle <= 0) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec != throttle_window.tv_sec) {
+        throttle_window = now;
+        throttle_count = 0;
+    }
+    return ++throttle_count > throttle;
+}
+
+// Handle every complete request buffered on the connection
+static void process_input(struct Connection *conn) {
+    for (;;) {
+        char *head_end = conn->in.len ? memmem(conn->in.data, conn->in.len, "\r\n\r\n", 4) : NULL;
+        if (!head_end) return;
+        size_t head_len = head_end - conn->in.data;
+        
+        char *length = header_value(conn->in.data, head_len, "Content-Length");
+        size_t body_len = length ? strtoul(length, NULL, 10) : 0;
+        free(length);
+        if (conn->in.len < head_len + 4 + body_len) return;
+        
+        char *action = header_value(conn->in.data, head_len, "SOAPAction");
+        const char *name = "";
+        if (action) {
+            char *quote = strrchr(action, '"');
+            if (quote) *quote = '\0';
+            char *slash = strrchr(action, '/');
+            name = slash ? slash + 1 : action;
+        }
+        
+        if (delay_ms > 0) {
+            struct timespec ts = { delay_ms / 1000, (delay_ms % 1000) * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+        
+        // Terminate the body in place for the string searches
+        char *body = head_end + 4;
+        char saved = body[body_len];
+        body[body_len] = '\0';
+        request_count++;
+        if (strncmp(conn->in.data, "HEAD ", 5) == 0) {
+            // Connection pre-warm
+            buffer_printf(&conn->out, "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n");
+        } else if (throttled()) {
+            buffer_printf(&conn->out, "HTTP/1.1 429 Too Many Requests\r\nContent-Length: 0\r\n\r\n");
+        } else if (fail_every > 0 && request_count % fail_every == 0) {
+            if ((request_count / fail_every) % 2) {
+                buffer_printf(&conn->out, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            } else {
+                write_response(&conn->out, name, 4, NULL);
+            }
+        } else {
+            handle_request(&conn->out, name, body, body_len);
+        }
+        body[body_len] = saved;
+        free(action);
+        
+        size_t consumed = head_len + 4 + body_len;
+        memmove(conn->in.data, conn->in.data + consumed, conn->in.len - consumed);
+        conn->in.len -= consumed;
+    }
+}
+
+static void close_connection(struct Connection *conn) {
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+}
+
+int main(int argc, char **argv) {
+    int port = 18099;
+    const char *domain = "bench.com";
+    long records = 100;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--domain") == 0 && i + 1 < argc) domain = argv[++i];
+        else if (strcmp(argv[i], "--records") == 0 && i + 1 < argc) records = atol(argv[++i]);
+        else if (strcmp(argv[i], "--delay-ms") == 0 && i + 1 < argc) delay_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fail-every") == 0 && i + 1 < argc) fail_every = atol(argv[++i]);
+        else if (strcmp(argv[i], "--throttle") == 0 && i + 1 < argc) throttle = atol(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--port N] [--domain NAME] [--records N] [--delay-ms N]"
+                    " [--fail-every N] [--throttle N]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    zone_seed(domain, records);
+    
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0) {
+        fprintf(stderr, "Cannot listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    fprintf(stderr, "mock DNSAPI.asmx on http://127.0.0.1:%d/API/Beta/DNSAPI.asmx (%ld records in %s)\n",
+            port, records, domain);
+    
+    static struct Connection conns[MAX_CLIENTS];
+    static struct pollfd fds[MAX_CLIENTS + 1];
+    for (int i = 0; i < MAX_CLIENTS; i++) conns[i].fd = -1;
+    
+    for (;;) {
+        int nfds = 0;
+        fds[nfds].fd = listener;
+        fds[nfds].events = POLLIN;
+        nfds++;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            fds[nfds].fd = conns[i].fd;
+            fds[nfds].events = conns[i].out.len > conns[i].out_sent ? POLLOUT : POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return 1;
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, NULL, NULL)) >= 0) {
+                int slot = 0;
+                while (slot < MAX_CLIENTS && conns[slot].fd >= 0) slot++;
+                if (slot == MAX_CLIENTS) {
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                conns[slot].fd = fd;
+            }
+        }
+        
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            struct Connection *conn = &conns[i];
+            short revents = fds[i + 1].revents;
+            if (conn->fd < 0 || !revents) continue;
+            
+            if (revents & POLLIN) {
+                buffer_reserve(&conn->in, 65536);
+                ssize_t n = read(conn->fd, conn->in.data + conn->in.len, conn->in.cap - conn->in.len - 1);
+                if (n <= 0) {
+                    if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                    close_connection(conn);
+                    continue;
+                }
+                conn->in.len += (size_t)n;
+                process_input(conn);
+            } else if (revents & (POLLERR | POLLHUP)) {
+                close_connection(conn);
+                continue;
+            }
+            
+            // Send what is pending; the rest goes out once the socket is writable again
+            while (conn->out.len > conn->out_sent) {
+                ssize_t n = write(conn->fd, conn->out.data + conn->out_sent, conn->out.len - conn->out_sent);
+                if (n < 0) {
+                    if (errno != EAGAIN && errno != EINTR) close_connection(conn);
+                    break;
+                }
+                conn->out_sent += (size_t)n;
+            }
+            if (conn->fd >= 0 && conn->out_sent == conn->out.len) {
+                conn->out.len = 0;
+                conn->out_sent = 0;
+                // Requests that arrived while the response was being written
+                if (conn->in.len) process_input(conn);
+            }
+        }
+    }
+}
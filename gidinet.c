@@ -0,0 +1,2093 @@
+// libgidinet - DIGINET DNS API client library
+// Manual SOAP XML construction for exact format compatibility
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "gidinet_internal.h"
+
+// Function to translate result codes to human-readable messages
+const char* gidinet_result_code_message(int result_code) {
+    switch (result_code) {
+        case 0: return "Operation successful";
+        case 1: return "Authentication failed";
+        case 2: return "Operation failed - cannot modify read-only value";
+        case 3: return "Operation failed - invalid parameters";
+        case 4: return "Operation failed - undefined error";
+        case 5: return "Operation failed - object not found";
+        case 6: return "Operation failed - object in use";
+        default: return "Unknown result code";
+    }
+}
+
+static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct APIResponse *response = (struct APIResponse *)userp;
+    
+    // Returning short makes libcurl abort the transfer with CURLE_WRITE_ERROR
+    if (response->size + realsize + 1 > response->cap) {
+        size_t cap = response->cap ? response->cap : 4096;
+        while (response->size + realsize + 1 > cap) cap *= 2;
+        char *ptr = realloc(response->data, cap);
+        if (!ptr) return 0;
+        response->data = ptr;
+        response->cap = cap;
+    }
+    
+    memcpy(&(response->data[response->size]), contents, realsize);
+    response->size += realsize;
+    response->data[response->size] = 0;
+    
+    return realsize;
+}
+
+// Append bytes to a growable buffer, keeping it NUL-terminated
+int buffer_append(struct GrowBuffer *buf, const char *bytes, size_t len) {
+    if (buf->len + len + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 64;
+        while (buf->len + len + 1 > cap) cap *= 2;
+        char *ptr = realloc(buf->data, cap);
+        if (!ptr) return -1;
+        buf->data = ptr;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+// Empty a response, keeping its buffer for the next one
+void api_response_reset(struct APIResponse *response) {
+    response->size = 0;
+    if (response->data) response->data[0] = '\0';
+}
+
+#define ARENA_MIN_BLOCK 16384
+#define ARENA_MAX_BLOCK (1024 * 1024)
+
+// Allocate size bytes, aligned for any type, that live until the arena is reset or freed
+void* arena_alloc(struct Arena *arena, size_t size) {
+    size_t align = sizeof(max_align_t);
+    size_t offset = (arena->used + align - 1) & ~(align - 1);
+    
+    if (!arena->head || offset + size > arena->head->size) {
+        // Blocks double up to a limit; larger requests get a block of their own
+        size_t block = arena->head ? arena->head->size * 2 : ARENA_MIN_BLOCK;
+        if (block > ARENA_MAX_BLOCK) block = ARENA_MAX_BLOCK;
+        if (block < size) block = size;
+        struct ArenaBlock *next = malloc(sizeof(*next) + block);
+        if (!next) return NULL;
+        next->next = arena->head;
+        next->size = block;
+        arena->head = next;
+        offset = 0;
+    }
+    arena->used = offset + size;
+    return arena->head->data + offset;
+}
+
+char* arena_strdup(struct Arena *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
+
+// Release everything allocated from the arena but keep its newest (largest)
+// block, so that a region reused per request stops calling malloc
+void arena_reset(struct Arena *arena) {
+    if (!arena->head) return;
+    struct ArenaBlock *block = arena->head->next;
+    while (block) {
+        struct ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->used = 0;
+}
+
+void arena_free(struct Arena *arena) {
+    arena_reset(arena);
+    free(arena->head);
+    memset(arena, 0, sizeof(*arena));
+}
+
+static void buffer_reset(struct GrowBuffer *buf) {
+    buf->len = 0;
+    if (buf->data) buf->data[0] = '\0';
+}
+
+void soap_parser_init(struct SoapParser *parser, soap_header_cb on_header, soap_record_cb on_record, void *ctx) {
+    memset(parser, 0, sizeof(*parser));
+    parser->result_code = -1;
+    parser->item_count = -1;
+    parser->on_header = on_header;
+    parser->on_record = on_record;
+    parser->ctx = ctx;
+}
+
+// Set the parser up for another response, keeping the storage of its fields
+void soap_parser_reset(struct SoapParser *parser, soap_header_cb on_header, soap_record_cb on_record, void *ctx) {
+    struct GrowBuffer fields[SOAP_FIELD_COUNT];
+    memcpy(fields, parser->fields, sizeof(fields));
+    soap_parser_init(parser, on_header, on_record, ctx);
+    for (int i = 0; i < SOAP_FIELD_COUNT; i++) {
+        fields[i].len = 0;
+        if (fields[i].data) fields[i].data[0] = '\0';
+        parser->fields[i] = fields[i];
+    }
+}
+
+void soap_parser_free(struct SoapParser *parser) {
+    for (int i = 0; i < SOAP_FIELD_COUNT; i++) {
+        free(parser->fields[i].data);
+    }
+    memset(parser, 0, sizeof(*parser));
+}
+
+static void soap_parser_emit_header(struct SoapParser *parser) {
+    if (parser->header_done) return;
+    parser->header_done = 1;
+    if (parser->on_header) parser->on_header(parser->ctx, parser);
+}
+
+static int soap_field_for_tag(const char *name, int in_record) {
+    static const char *record_tags[] = {
+        "DomainName", "HostName", "RecordType", "Data", "TTL", "Priority",
+        "ReadOnly", "Suspended", "SuspensionReason"
+    };
+    static const char *result_tags[] = {
+        "resultCode", "resultSubCode", "resultText", "resultItemCount"
+    };
+    
+    if (in_record) {
+        for (int i = 0; i < 9; i++) {
+            if (strcmp(name, record_tags[i]) == 0) return SOAP_FIELD_DOMAIN + i;
+        }
+    } else {
+        for (int i = 0; i < 4; i++) {
+            if (strcmp(name, result_tags[i]) == 0) return SOAP_FIELD_RESULT_CODE + i;
+        }
+    }
+    return SOAP_FIELD_NONE;
+}
+
+// Set the host pattern: a single trailing * is a prefix match, any other
+// wildcard makes it a glob, anything else is an exact name
+void record_filter_set_host(struct RecordFilter *filter, const char *pattern) {
+    size_t len = strlen(pattern);
+    size_t plain = strcspn(pattern, "*?[");
+    
+    filter->host = pattern;
+    filter->host_len = plain;
+    if (plain == len) filter->host_match = HOST_MATCH_EXACT;
+    else if (plain == len - 1 && pattern[plain] == '*') filter->host_match = HOST_MATCH_PREFIX;
+    else filter->host_match = HOST_MATCH_GLOB;
+}
+
+int record_filter_active(const struct RecordFilter *filter) {
+    return filter && (filter->host || filter->type || filter->data || filter->limit > 0);
+}
+
+// Check one field of the current record against the filter
+static int record_filter_field(const struct RecordFilter *filter, int field, const char *value) {
+    switch (field) {
+        case SOAP_FIELD_HOST:
+            if (!filter->host) return 1;
+            switch (filter->host_match) {
+                case HOST_MATCH_EXACT: return strcasecmp(value, filter->host) == 0;
+                case HOST_MATCH_PREFIX: return strncasecmp(value, filter->host, filter->host_len) == 0;
+                case HOST_MATCH_GLOB: return fnmatch(filter->host, value, FNM_CASEFOLD) == 0;
+            }
+            return 0;
+        case SOAP_FIELD_TYPE: return !filter->type || strcasecmp(value, filter->type) == 0;
+        case SOAP_FIELD_DATA: return !filter->data || strcmp(value, filter->data) == 0;
+        default: return 1;
+    }
+}
+
+// A record with a filtered field missing does not match
+static int record_filter_complete(const struct RecordFilter *filter, unsigned int fields) {
+    if (filter->host && !(fields & LIST_FIELD_BIT(SOAP_FIELD_HOST))) return 0;
+    if (filter->type && !(fields & LIST_FIELD_BIT(SOAP_FIELD_TYPE))) return 0;
+    if (filter->data && !(fields & LIST_FIELD_BIT(SOAP_FIELD_DATA))) return 0;
+    return 1;
+}
+
+// Apply the filter predicates to a complete record (the limit is up to the caller)
+int record_filter_match(const struct RecordFilter *filter, const struct ListRecord *record) {
+    return record_filter_complete(filter, record->fields) &&
+           record_filter_field(filter, SOAP_FIELD_HOST, record->host) &&
+           record_filter_field(filter, SOAP_FIELD_TYPE, record->type) &&
+           record_filter_field(filter, SOAP_FIELD_DATA, record->data);
+}
+
+static void soap_parser_open_tag(struct SoapParser *parser, const char *name) {
+    if (strcmp(name, "resultItems") == 0) {
+        // Everything preceding the items is known now, so the header can be emitted
+        soap_parser_emit_header(parser);
+        parser->in_items = 1;
+    } else if (parser->in_items && strcmp(name, "DNSRecordListItem") == 0) {
+        parser->in_record = 1;
+        parser->record_fields = 0;
+        parser->skip_record = 0;
+        for (int i = SOAP_FIELD_DOMAIN; i < SOAP_FIELD_COUNT; i++) {
+            buffer_reset(&parser->fields[i]);
+        }
+    } else if (parser->in_record && parser->skip_record) {
+        // Filtered out: the remaining fields are not worth copying
+        parser->capture = SOAP_FIELD_NONE;
+    } else {
+        int field = soap_field_for_tag(name, parser->in_record);
+        if (field != SOAP_FIELD_NONE) {
+            buffer_reset(&parser->fields[field]);
+        }
+        parser->capture = field;
+    }
+}
+
+static void soap_parser_close_tag(struct SoapParser *parser, const char *name) {
+    int field = parser->capture;
+    parser->capture = SOAP_FIELD_NONE;
+    
+    if (field != SOAP_FIELD_NONE) {
+        const char *value = parser->fields[field].data ? parser->fields[field].data : "";
+        switch (field) {
+            case SOAP_FIELD_RESULT_CODE: parser->result_code = atoi(value); break;
+            case SOAP_FIELD_RESULT_SUBCODE: parser->result_subcode = atoi(value); break;
+            case SOAP_FIELD_RESULT_TEXT: parser->has_result_text = 1; break;
+            case SOAP_FIELD_RESULT_ITEM_COUNT: parser->item_count = atoi(value); break;
+            default:
+                parser->record_fields |= 1u << (field - SOAP_FIELD_DOMAIN);
+                if (parser->filter && !record_filter_field(parser->filter, field, value)) parser->skip_record = 1;
+                break;
+        }
+        return;
+    }
+    
+    if (parser->in_record && strcmp(name, "DNSRecordListItem") == 0) {
+        parser->in_record = 0;
+        parser->record_count++;
+        if (parser->filter) {
+            if (parser->skip_record || !record_filter_complete(parser->filter, parser->record_fields)) return;
+            parser->matched++;
+            if (parser->filter->limit > 0 && parser->matched >= parser->filter->limit) parser->done = 1;
+        }
+        if (parser->on_record) {
+            struct ListRecord record;
+            const struct GrowBuffer *f = parser->fields;
+            record.fields = parser->record_fields;
+            record.domain = f[SOAP_FIELD_DOMAIN].data ? f[SOAP_FIELD_DOMAIN].data : "";
+            record.host = f[SOAP_FIELD_HOST].data ? f[SOAP_FIELD_HOST].data : "";
+            record.type = f[SOAP_FIELD_TYPE].data ? f[SOAP_FIELD_TYPE].data : "";
+            record.data = f[SOAP_FIELD_DATA].data ? f[SOAP_FIELD_DATA].data : "";
+            record.suspension_reason = f[SOAP_FIELD_SUSPENSION_REASON].data ?
+                                       f[SOAP_FIELD_SUSPENSION_REASON].data : "";
+            record.ttl = f[SOAP_FIELD_TTL].data ? atoi(f[SOAP_FIELD_TTL].data) : 0;
+            record.priority = f[SOAP_FIELD_PRIORITY].data ? atoi(f[SOAP_FIELD_PRIORITY].data) : 0;
+            record.read_only = f[SOAP_FIELD_READONLY].data && strcmp(f[SOAP_FIELD_READONLY].data, "true") == 0;
+            record.suspended = f[SOAP_FIELD_SUSPENDED].data && strcmp(f[SOAP_FIELD_SUSPENDED].data, "true") == 0;
+            parser->on_record(parser->ctx, &record);
+        }
+    } else if (parser->in_items && strcmp(name, "resultItems") == 0) {
+        parser->in_items = 0;
+    }
+}
+
+// Decode a character or entity reference (without & and ;) into the capture buffer.
+// A character reference that is malformed or names no valid character (NUL, a
+// surrogate, beyond U+10FFFF) becomes U+FFFD, so a value never holds a NUL or
+// invalid UTF-8.
+static int soap_parser_append_entity(struct SoapParser *parser, struct GrowBuffer *out) {
+    const char *e = parser->entity;
+    char utf8[4];
+    size_t len = 0;
+    
+    if (strcmp(e, "amp") == 0) utf8[len++] = '&';
+    else if (strcmp(e, "lt") == 0) utf8[len++] = '<';
+    else if (strcmp(e, "gt") == 0) utf8[len++] = '>';
+    else if (strcmp(e, "quot") == 0) utf8[len++] = '"';
+    else if (strcmp(e, "apos") == 0) utf8[len++] = '\'';
+    else if (e[0] == '#') {
+        int hex = e[1] == 'x' || e[1] == 'X';
+        const char *digits = e + 1 + hex;
+        char *digits_end;
+        unsigned long cp = strtoul(digits, &digits_end, hex ? 16 : 10);
+        if (!isxdigit((unsigned char)*digits) || *digits_end != '\0' || cp == 0 || cp > 0x10FFFF ||
+            (cp >= 0xD800 && cp <= 0xDFFF)) {
+            cp = 0xFFFD;
+        }
+        if (cp < 0x80) {
+            utf8[len++] = (char)cp;
+        } else if (cp < 0x800) {
+            utf8[len++] = (char)(0xC0 | (cp >> 6));
+            utf8[len++] = (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            utf8[len++] = (char)(0xE0 | (cp >> 12));
+            utf8[len++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            utf8[len++] = (char)(0x80 | (cp & 0x3F));
+        } else {
+            utf8[len++] = (char)(0xF0 | (cp >> 18));
+            utf8[len++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+            utf8[len++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+            utf8[len++] = (char)(0x80 | (cp & 0x3F));
+        }
+    } else {
+        // Unknown entity: keep it verbatim
+        if (buffer_append(out, "&", 1) != 0) return -1;
+        if (buffer_append(out, e, parser->entity_len) != 0) return -1;
+        return buffer_append(out, ";", 1);
+    }
+    return buffer_append(out, utf8, len);
+}
+
+// Feed the next chunk of a SOAP response. The tokenizer keeps its state between
+// calls, so chunks may split tags, entities and values anywhere. Only the values
+// of known fields are copied, into per-field buffers that are reused record after
+// record. Once a filter limit is reached the rest of the input is ignored.
+// Returns 0, or -1 if memory ran out.
+int soap_parser_feed(struct SoapParser *parser, const char *data, size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+    
+    while (p < end && !parser->done) {
+        switch (parser->state) {
+            case SOAP_STATE_TEXT: {
+                if (parser->capture == SOAP_FIELD_NONE) {
+                    const char *lt = memchr(p, '<', end - p);
+                    if (!lt) return 0;
+                    p = lt;
+                }
+                // Copy the run of plain text in one go
+                const char *run = p;
+                while (p < end && *p != '<' && *p != '&') p++;
+                if (p > run && buffer_append(&parser->fields[parser->capture], run, p - run) != 0) return -1;
+                if (p == end) return 0;
+                if (*p == '&') {
+                    parser->entity_len = 0;
+                    parser->state = SOAP_STATE_ENTITY;
+                } else {
+                    parser->tag_len = 0;
+                    parser->closing = 0;
+                    parser->self_closing = 0;
+                    parser->state = SOAP_STATE_TAG_START;
+                }
+                p++;
+                break;
+            }
+            case SOAP_STATE_ENTITY:
+                if (*p == ';') {
+                    parser->entity[parser->entity_len] = '\0';
+                    if (soap_parser_append_entity(parser, &parser->fields[parser->capture]) != 0) return -1;
+                    parser->state = SOAP_STATE_TEXT;
+                } else if (parser->entity_len < sizeof(parser->entity) - 1) {
+                    parser->entity[parser->entity_len++] = *p;
+                }
+                p++;
+                break;
+            case SOAP_STATE_TAG_START:
+                if (*p == '/') {
+                    parser->closing = 1;
+                    parser->state = SOAP_STATE_TAG_NAME;
+                    p++;
+                } else if (*p == '!') {
+                    parser->tag_len = 0;
+                    parser->state = SOAP_STATE_MARKUP;
+                    p++;
+                } else if (*p == '?') {
+                    // XML declaration or processing instruction
+                    parser->state = SOAP_STATE_SKIP;
+                    p++;
+                } else {
+                    parser->state = SOAP_STATE_TAG_NAME;
+                }
+                break;
+            case SOAP_STATE_TAG_NAME:
+                if (*p == '>' || *p == '/' || isspace((unsigned char)*p)) {
+                    parser->tag[parser->tag_len] = '\0';
+                    parser->state = SOAP_STATE_TAG_ATTRS;
+                    break;
+                }
+                if (*p == ':') {
+                    parser->tag_len = 0; // Drop the namespace prefix
+                } else if (parser->tag_len < sizeof(parser->tag) - 1) {
+                    parser->tag[parser->tag_len++] = *p;
+                }
+                p++;
+                break;
+            case SOAP_STATE_TAG_ATTRS:
+                if (parser->quote) {
+                    if (*p == parser->quote) parser->quote = 0;
+                } else if (*p == '"' || *p == '\'') {
+                    parser->quote = *p;
+                } else if (*p == '/') {
+                    parser->self_closing = 1;
+                } else if (*p == '>') {
+                    if (parser->closing) {
+                        soap_parser_close_tag(parser, parser->tag);
+                    } else {
+                        soap_parser_open_tag(parser, parser->tag);
+                        if (parser->self_closing) soap_parser_close_tag(parser, parser->tag);
+                    }
+                    parser->state = SOAP_STATE_TEXT;
+                } else if (!isspace((unsigned char)*p)) {
+                    parser->self_closing = 0;
+                }
+                p++;
+                break;
+            case SOAP_STATE_MARKUP: {
+                // tag_len counts the characters of "[CDATA[" matched so far
+                static const char cdata_open[] = "[CDATA[";
+                if (*p != cdata_open[parser->tag_len]) {
+                    // Comment or DOCTYPE
+                    parser->state = SOAP_STATE_SKIP;
+                    break;
+                }
+                if (++parser->tag_len == sizeof(cdata_open) - 1) {
+                    parser->cdata_brackets = 0;
+                    parser->state = SOAP_STATE_CDATA;
+                }
+                p++;
+                break;
+            }
+            case SOAP_STATE_CDATA: {
+                // Raw text up to "]]>". A "]" is held back until the next character
+                // tells whether it starts the terminator.
+                struct GrowBuffer *out = &parser->fields[parser->capture];
+                int keep = parser->capture != SOAP_FIELD_NONE;
+                if (*p == ']') {
+                    if (parser->cdata_brackets == 2 && keep && buffer_append(out, "]", 1) != 0) return -1;
+                    if (parser->cdata_brackets < 2) parser->cdata_brackets++;
+                    p++;
+                    break;
+                }
+                if (*p == '>' && parser->cdata_brackets == 2) {
+                    parser->state = SOAP_STATE_TEXT;
+                    p++;
+                    break;
+                }
+                if (keep && parser->cdata_brackets > 0 && buffer_append(out, "]]", parser->cdata_brackets) != 0) {
+                    return -1;
+                }
+                parser->cdata_brackets = 0;
+                const char *run = p;
+                const char *bracket = memchr(p, ']', end - p);
+                p = bracket ? bracket : end;
+                if (keep && buffer_append(out, run, p - run) != 0) return -1;
+                break;
+            }
+            case SOAP_STATE_SKIP:
+                if (*p == '>') parser->state = SOAP_STATE_TEXT;
+                p++;
+                break;
+        }
+    }
+    return 0;
+}
+
+// Signal the end of the response, emitting the header if no items were seen
+void soap_parser_finish(struct SoapParser *parser) {
+    soap_parser_emit_header(parser);
+}
+
+// CURL write callback feeding a response straight into a SoapParser
+size_t SoapParserWriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct SoapParser *parser = (struct SoapParser *)userp;
+    
+    double started = monotonic_seconds();
+    int rc = soap_parser_feed(parser, contents, realsize);
+    parser->parse_time += monotonic_seconds() - started;
+    
+    // Out of memory, or the filter limit was reached: abort the transfer
+    return rc == 0 && !parser->done ? realsize : 0;
+}
+
+// Fill an APIResult from a parser (the text is copied; caller frees result->text)
+void soap_parser_get_result(const struct SoapParser *parser, struct APIResult *result) {
+    result->code = parser->result_code;
+    result->subcode = parser->result_subcode;
+    result->text = NULL;
+    if (parser->has_result_text) {
+        const char *text = parser->fields[SOAP_FIELD_RESULT_TEXT].data;
+        result->text = strdup(text ? text : "");
+    }
+}
+
+// Extract resultCode, resultSubCode and resultText (caller frees result->text)
+void parse_simple_result(const char *response_data, struct APIResult *result) {
+    struct SoapParser parser;
+    soap_parser_init(&parser, NULL, NULL, NULL);
+    if (response_data) {
+        // The result precedes the records of a listing, which need not be tokenized here
+        size_t len = strlen(response_data);
+        const char *items = memmem(response_data, len, "<resultItems", 12);
+        soap_parser_feed(&parser, response_data, items ? (size_t)(items - response_data) : len);
+    }
+    soap_parser_get_result(&parser, result);
+    soap_parser_free(&parser);
+}
+
+// 64-bit FNV-1a hash, continuing from seed
+uint64_t fnv1a_hash(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = data;
+    uint64_t hash = seed;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Values substituted into a SOAP template
+enum SoapSlot {
+    SOAP_SLOT_END = 0,
+    SOAP_SLOT_USERNAME,
+    SOAP_SLOT_PASSWORD,
+    SOAP_SLOT_LIST_DOMAIN,
+    SOAP_SLOT_DOMAIN,
+    SOAP_SLOT_HOST,
+    SOAP_SLOT_TYPE,
+    SOAP_SLOT_DATA,
+    SOAP_SLOT_TTL,
+    SOAP_SLOT_PRIORITY,
+    SOAP_SLOT_NEW_DOMAIN,
+    SOAP_SLOT_NEW_HOST,
+    SOAP_SLOT_NEW_TYPE,
+    SOAP_SLOT_NEW_DATA,
+    SOAP_SLOT_NEW_TTL,
+    SOAP_SLOT_NEW_PRIORITY
+};
+
+// Constant markup followed by the value of one slot; lengths are known at compile time
+struct SoapTemplatePart {
+    const char *text;
+    size_t len;
+    enum SoapSlot slot;
+};
+
+#define SOAP_PART(text, slot) { text, sizeof(text) - 1, slot }
+
+#define SOAP_ENVELOPE_HEAD \
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" \
+    "<soap:Envelope xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" " \
+    "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" " \
+    "xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
+
+// recordAdd and recordDelete share the same body
+#define SOAP_SINGLE_RECORD_TEMPLATE(action) { \
+    SOAP_PART(SOAP_ENVELOPE_HEAD "<soap:Body>\n<" action " xmlns=\"" API_NAMESPACE "\">\n<accountUsername>", \
+              SOAP_SLOT_USERNAME), \
+    SOAP_PART("</accountUsername>\n<accountPasswordB64>", SOAP_SLOT_PASSWORD), \
+    SOAP_PART("</accountPasswordB64>\n<record>\n<DomainName>", SOAP_SLOT_DOMAIN), \
+    SOAP_PART("</DomainName>\n<HostName>", SOAP_SLOT_HOST), \
+    SOAP_PART("</HostName>\n<RecordType>", SOAP_SLOT_TYPE), \
+    SOAP_PART("</RecordType>\n<Data>", SOAP_SLOT_DATA), \
+    SOAP_PART("</Data>\n<TTL>", SOAP_SLOT_TTL), \
+    SOAP_PART("</TTL>\n<Priority>", SOAP_SLOT_PRIORITY), \
+    SOAP_PART("</Priority>\n</record>\n</" action ">\n</soap:Body>\n</soap:Envelope>", SOAP_SLOT_END) \
+}
+
+static const struct SoapTemplatePart soap_add_template[] = SOAP_SINGLE_RECORD_TEMPLATE("recordAdd");
+static const struct SoapTemplatePart soap_delete_template[] = SOAP_SINGLE_RECORD_TEMPLATE("recordDelete");
+
+static const struct SoapTemplatePart soap_update_template[] = {
+    SOAP_PART(SOAP_ENVELOPE_HEAD " <soap:Body>\n  <recordUpdate xmlns=\"" API_NAMESPACE "\">\n"
+              "   <accountUsername>", SOAP_SLOT_USERNAME),
+    SOAP_PART("</accountUsername>\n   <accountPasswordB64>", SOAP_SLOT_PASSWORD),
+    SOAP_PART("</accountPasswordB64>\n   <oldRecord>\n    <DomainName>", SOAP_SLOT_DOMAIN),
+    SOAP_PART("</DomainName>\n    <HostName>", SOAP_SLOT_HOST),
+    SOAP_PART("</HostName>\n    <RecordType>", SOAP_SLOT_TYPE),
+    SOAP_PART("</RecordType>\n    <Data>", SOAP_SLOT_DATA),
+    SOAP_PART("</Data>\n    <TTL>", SOAP_SLOT_TTL),
+    SOAP_PART("</TTL>\n    <Priority>", SOAP_SLOT_PRIORITY),
+    SOAP_PART("</Priority>\n   </oldRecord>\n   <newRecord>\n    <DomainName>", SOAP_SLOT_NEW_DOMAIN),
+    SOAP_PART("</DomainName>\n    <HostName>", SOAP_SLOT_NEW_HOST),
+    SOAP_PART("</HostName>\n    <RecordType>", SOAP_SLOT_NEW_TYPE),
+    SOAP_PART("</RecordType>\n    <Data>", SOAP_SLOT_NEW_DATA),
+    SOAP_PART("</Data>\n    <TTL>", SOAP_SLOT_NEW_TTL),
+    SOAP_PART("</TTL>\n    <Priority>", SOAP_SLOT_NEW_PRIORITY),
+    SOAP_PART("</Priority>\n   </newRecord>\n  </recordUpdate>\n </soap:Body>\n</soap:Envelope>", SOAP_SLOT_END)
+};
+
+static const struct SoapTemplatePart soap_list_template[] = {
+    SOAP_PART(SOAP_ENVELOPE_HEAD "<soap:Body>\n<recordGetList xmlns=\"" API_NAMESPACE "\">\n<accountUsername>",
+              SOAP_SLOT_USERNAME),
+    SOAP_PART("</accountUsername>\n<accountPasswordB64>", SOAP_SLOT_PASSWORD),
+    SOAP_PART("</accountPasswordB64>\n<domainName>", SOAP_SLOT_LIST_DOMAIN),
+    SOAP_PART("</domainName>\n</recordGetList>\n</soap:Body>\n</soap:Envelope>", SOAP_SLOT_END)
+};
+
+// Request headers never change for an action, so the lists are static and shared by
+// every transfer. libcurl only reads them.
+static struct curl_slist soap_content_type = { (char *)"Content-Type: text/xml; charset=utf-8", NULL };
+
+static struct curl_slist soap_headers[SOAP_ACTION_COUNT] = {
+    [SOAP_ACTION_ADD] = { (char *)"SOAPAction: \"" API_NAMESPACE "/recordAdd\"", &soap_content_type },
+    [SOAP_ACTION_DELETE] = { (char *)"SOAPAction: \"" API_NAMESPACE "/recordDelete\"", &soap_content_type },
+    [SOAP_ACTION_UPDATE] = { (char *)"SOAPAction: \"" API_NAMESPACE "/recordUpdate\"", &soap_content_type },
+    [SOAP_ACTION_LIST] = { (char *)"SOAPAction: \"" API_NAMESPACE "/recordGetList\"", &soap_content_type }
+};
+
+// Append text with XML special characters escaped, copying clean runs in bulk
+static int buffer_append_xml(struct GrowBuffer *buf, const char *text) {
+    if (!text) return 0;
+    for (;;) {
+        size_t run = strcspn(text, "&<>");
+        if (run && buffer_append(buf, text, run) != 0) return -1;
+        text += run;
+        
+        const char *entity;
+        switch (*text) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            default: return 0;
+        }
+        if (buffer_append(buf, entity, strlen(entity)) != 0) return -1;
+        text++;
+    }
+}
+
+static int buffer_append_int(struct GrowBuffer *buf, int value) {
+    char digits[16];
+    char *p = digits + sizeof(digits);
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *--p = '-';
+    return buffer_append(buf, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+// Render a template into out, replacing its previous contents. Once out has grown
+// to the size of an envelope, building further envelopes allocates nothing.
+static int soap_render(struct GrowBuffer *out, const struct SoapTemplatePart *part,
+                       const char *username, const char *passwordB64, const char *domain,
+                       const struct DNSRecord *record, const struct DNSRecord *newRecord) {
+    out->len = 0;
+    for (;; part++) {
+        if (buffer_append(out, part->text, part->len) != 0) return -1;
+        
+        int rc = 0;
+        switch (part->slot) {
+            case SOAP_SLOT_END: return 0;
+            case SOAP_SLOT_USERNAME: rc = buffer_append_xml(out, username); break;
+            case SOAP_SLOT_PASSWORD: rc = buffer_append_xml(out, passwordB64); break;
+            case SOAP_SLOT_LIST_DOMAIN: rc = buffer_append_xml(out, domain); break;
+            case SOAP_SLOT_DOMAIN: rc = buffer_append_xml(out, record->domain); break;
+            case SOAP_SLOT_HOST: rc = buffer_append_xml(out, record->host); break;
+            case SOAP_SLOT_TYPE: rc = buffer_append_xml(out, record->type); break;
+            case SOAP_SLOT_DATA: rc = buffer_append_xml(out, record->data); break;
+            case SOAP_SLOT_TTL: rc = buffer_append_int(out, record->ttl); break;
+            case SOAP_SLOT_PRIORITY: rc = buffer_append_int(out, record->priority); break;
+            case SOAP_SLOT_NEW_DOMAIN: rc = buffer_append_xml(out, newRecord->domain); break;
+            case SOAP_SLOT_NEW_HOST: rc = buffer_append_xml(out, newRecord->host); break;
+            case SOAP_SLOT_NEW_TYPE: rc = buffer_append_xml(out, newRecord->type); break;
+            case SOAP_SLOT_NEW_DATA: rc = buffer_append_xml(out, newRecord->data); break;
+            case SOAP_SLOT_NEW_TTL: rc = buffer_append_int(out, newRecord->ttl); break;
+            case SOAP_SLOT_NEW_PRIORITY: rc = buffer_append_int(out, newRecord->priority); break;
+        }
+        if (rc != 0) return -1;
+    }
+}
+
+// Build the SOAP envelope for recordUpdate into out
+int build_record_update_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                                const struct DNSRecord *oldRecord, const struct DNSRecord *newRecord) {
+    return soap_render(out, soap_update_template, username, passwordB64, NULL, oldRecord, newRecord);
+}
+
+int build_record_add_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                             const struct DNSRecord *record) {
+    return soap_render(out, soap_add_template, username, passwordB64, NULL, record, NULL);
+}
+
+int build_record_delete_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                                const struct DNSRecord *record) {
+    return soap_render(out, soap_delete_template, username, passwordB64, NULL, record, NULL);
+}
+
+// Build the SOAP envelope for recordGetList into out
+int build_record_list_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                              const char *domain) {
+    return soap_render(out, soap_list_template, username, passwordB64, domain, NULL, NULL);
+}
+
+// Endpoint used when none is given: $GIDINET_ENDPOINT, or the built-in API_ENDPOINT
+const char* gidinet_default_endpoint(void) {
+    const char *endpoint = getenv("GIDINET_ENDPOINT");
+    return endpoint && *endpoint ? endpoint : API_ENDPOINT;
+}
+
+// Options shared by every request made on a handle; set once when the handle is created.
+// endpoint may be NULL for the default one.
+void soap_handle_init(CURL *curl, const char *endpoint) {
+    curl_easy_setopt(curl, CURLOPT_URL, endpoint ? endpoint : gidinet_default_endpoint());
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    // HTTP/2 when the server offers it in the TLS handshake. Concurrent requests wait
+    // for a connection being set up, so that they multiplex over it instead of
+    // each opening its own.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+}
+
+// Point a handle prepared by soap_handle_init() at an envelope. The body is not
+// copied and must stay unchanged until the transfer has finished.
+void setup_soap_request(CURL *curl, enum SoapAction action, const struct GrowBuffer *body,
+                        size_t (*write_fn)(void *, size_t, size_t, void *), void *write_data) {
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->data);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)body->len);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, &soap_headers[action]);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_fn);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_data);
+}
+
+// Post a SOAP envelope on an existing CURL handle. The handle is left configured
+// so that it can be reused: libcurl keeps the connection (and TLS session) alive
+// between calls made on the same handle.
+CURLcode perform_soap_request(CURL *curl, enum SoapAction action, const struct GrowBuffer *body,
+                              struct APIResponse *response) {
+    setup_soap_request(curl, action, body, WriteCallback, response);
+    return curl_easy_perform(curl);
+}
+
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+const char* soap_action_name(enum SoapAction action) {
+    switch (action) {
+        case SOAP_ACTION_ADD: return "add";
+        case SOAP_ACTION_DELETE: return "delete";
+        case SOAP_ACTION_UPDATE: return "update";
+        case SOAP_ACTION_LIST: return "list";
+        default: return "none";
+    }
+}
+
+const char* request_lane_name(enum RequestLane lane) {
+    switch (lane) {
+        case LANE_URGENT: return "urgent";
+        case LANE_NORMAL: return "normal";
+        case LANE_BULK: return "bulk";
+        default: return "none";
+    }
+}
+
+static double timing_seconds(CURL *curl, CURLINFO info) {
+    curl_off_t usec = 0;
+    curl_easy_getinfo(curl, info, &usec);
+    return usec / 1e6;
+}
+
+// Read the timings of the transfer just performed on curl. The parse time is
+// left for the caller, which knows how the response was parsed.
+void request_timings_collect(CURL *curl, CURLcode res, struct RequestTimings *timings) {
+    memset(timings, 0, sizeof(*timings));
+    timings->curl_result = res;
+    timings->name_lookup = timing_seconds(curl, CURLINFO_NAMELOOKUP_TIME_T);
+    timings->connect = timing_seconds(curl, CURLINFO_CONNECT_TIME_T);
+    timings->app_connect = timing_seconds(curl, CURLINFO_APPCONNECT_TIME_T);
+    timings->start_transfer = timing_seconds(curl, CURLINFO_STARTTRANSFER_TIME_T);
+    timings->total = timing_seconds(curl, CURLINFO_TOTAL_TIME_T);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &timings->bytes_sent);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &timings->bytes_received);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &timings->http_code);
+}
+
+// Upper bounds of the latency histogram buckets, in seconds
+static const double metrics_buckets[METRICS_BUCKET_COUNT] = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+};
+
+static const char *const metrics_phase_names[REQUEST_PHASE_COUNT] = {
+    "dns", "connect", "tls", "server", "transfer", "parse"
+};
+
+// Account one request; result_code is the API result code, or -1 if the transfer failed
+void metrics_observe(struct RequestMetrics *metrics, enum SoapAction action, const struct RequestTimings *timings,
+                     int result_code) {
+    if (action <= SOAP_ACTION_NONE || action >= SOAP_ACTION_COUNT) return;
+    struct OperationMetrics *op = &metrics->ops[action];
+    
+    op->requests++;
+    if (timings->curl_result != CURLE_OK || result_code < 0) op->transport_errors++;
+    else if (result_code != 0) op->api_errors++;
+    if (timings->attempts > 1) op->retries += timings->attempts - 1;
+    
+    double duration = timings->total + timings->parse;
+    op->duration_sum += duration;
+    for (int i = 0; i < METRICS_BUCKET_COUNT; i++) {
+        if (duration <= metrics_buckets[i]) {
+            op->buckets[i]++;
+            break;
+        }
+    }
+    
+    // Turn libcurl's cumulative times into the duration of each phase
+    double connected = timings->app_connect > timings->connect ? timings->app_connect : timings->connect;
+    if (timings->name_lookup > connected) connected = timings->name_lookup;
+    op->phase_sum[REQUEST_PHASE_DNS] += timings->name_lookup;
+    if (timings->connect > timings->name_lookup) {
+        op->phase_sum[REQUEST_PHASE_CONNECT] += timings->connect - timings->name_lookup;
+    }
+    if (timings->app_connect > timings->connect) {
+        op->phase_sum[REQUEST_PHASE_TLS] += timings->app_connect - timings->connect;
+    }
+    if (timings->start_transfer > connected) {
+        op->phase_sum[REQUEST_PHASE_SERVER] += timings->start_transfer - connected;
+    }
+    if (timings->total > timings->start_transfer) {
+        op->phase_sum[REQUEST_PHASE_TRANSFER] += timings->total - timings->start_transfer;
+    }
+    op->phase_sum[REQUEST_PHASE_PARSE] += timings->parse;
+    op->bytes_sent += timings->bytes_sent;
+    op->bytes_received += timings->bytes_received;
+}
+
+// Account the time an operation of lane waited in its queue before it was dispatched
+void metrics_observe_queue_wait(struct RequestMetrics *metrics, enum RequestLane lane, double wait) {
+    if ((unsigned int)lane >= LANE_COUNT) return;
+    struct LaneMetrics *metric = &metrics->lanes[lane];
+    
+    metric->dispatched++;
+    metric->wait_sum += wait;
+    for (int i = 0; i < METRICS_BUCKET_COUNT; i++) {
+        if (wait <= metrics_buckets[i]) {
+            metric->buckets[i]++;
+            break;
+        }
+    }
+}
+
+// Write the metrics in the Prometheus text exposition format. The file is
+// replaced atomically, so a textfile collector never reads a partial one.
+int metrics_write_prometheus(const struct RequestMetrics *metrics, const char *path) {
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) return -1;
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return -1;
+    
+    fprintf(fp, "# HELP gidinet_request_duration_seconds Time of a SOAP request, response parsing included.\n");
+    fprintf(fp, "# TYPE gidinet_request_duration_seconds histogram\n");
+    for (int action = SOAP_ACTION_NONE + 1; action < SOAP_ACTION_COUNT; action++) {
+        const struct OperationMetrics *op = &metrics->ops[action];
+        const char *name = soap_action_name(action);
+        unsigned long cumulative = 0;
+        for (int i = 0; i < METRICS_BUCKET_COUNT; i++) {
+            cumulative += op->buckets[i];
+            fprintf(fp, "gidinet_request_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %lu\n",
+                    name, metrics_buckets[i], cumulative);
+        }
+        fprintf(fp, "gidinet_request_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %lu\n", name, op->requests);
+        fprintf(fp, "gidinet_request_duration_seconds_sum{op=\"%s\"} %.6f\n", name, op->duration_sum);
+        fprintf(fp, "gidinet_request_duration_seconds_count{op=\"%s\"} %lu\n", name, op->requests);
+    }
+    
+    fprintf(fp, "# HELP gidinet_request_phase_seconds_total Time spent in each phase of SOAP requests.\n");
+    fprintf(fp, "# TYPE gidinet_request_phase_seconds_total counter\n");
+    for (int action = SOAP_ACTION_NONE + 1; action < SOAP_ACTION_COUNT; action++) {
+        for (int phase = 0; phase < REQUEST_PHASE_COUNT; phase++) {
+            fprintf(fp, "gidinet_request_phase_seconds_total{op=\"%s\",phase=\"%s\"} %.6f\n",
+                    soap_action_name(action), metrics_phase_names[phase], metrics->ops[action].phase_sum[phase]);
+        }
+    }
+    
+    fprintf(fp, "# HELP gidinet_requests_total SOAP requests by outcome.\n");
+    fprintf(fp, "# TYPE gidinet_requests_total counter\n");
+    for (int action = SOAP_ACTION_NONE + 1; action < SOAP_ACTION_COUNT; action++) {
+        const struct OperationMetrics *op = &metrics->ops[action];
+        const char *name = soap_action_name(action);
+        fprintf(fp, "gidinet_requests_total{op=\"%s\",outcome=\"ok\"} %lu\n",
+                name, op->requests - op->api_errors - op->transport_errors);
+        fprintf(fp, "gidinet_requests_total{op=\"%s\",outcome=\"api_error\"} %lu\n", name, op->api_errors);
+        fprintf(fp, "gidinet_requests_total{op=\"%s\",outcome=\"transport_error\"} %lu\n",
+                name, op->transport_errors);
+    }
+    
+    fprintf(fp, "# HELP gidinet_request_retries_total Attempts repeated after a transient failure.\n");
+    fprintf(fp, "# TYPE gidinet_request_retries_total counter\n");
+    for (int action = SOAP_ACTION_NONE + 1; action < SOAP_ACTION_COUNT; action++) {
+        fprintf(fp, "gidinet_request_retries_total{op=\"%s\"} %lu\n", soap_action_name(action),
+                metrics->ops[action].retries);
+    }
+    
+    fprintf(fp, "# HELP gidinet_request_bytes_total Bytes of SOAP request and response bodies.\n");
+    fprintf(fp, "# TYPE gidinet_request_bytes_total counter\n");
+    for (int action = SOAP_ACTION_NONE + 1; action < SOAP_ACTION_COUNT; action++) {
+        const struct OperationMetrics *op = &metrics->ops[action];
+        fprintf(fp, "gidinet_request_bytes_total{op=\"%s\",direction=\"sent\"} %" CURL_FORMAT_CURL_OFF_T "\n",
+                soap_action_name(action), op->bytes_sent);
+        fprintf(fp, "gidinet_request_bytes_total{op=\"%s\",direction=\"received\"} %" CURL_FORMAT_CURL_OFF_T "\n",
+                soap_action_name(action), op->bytes_received);
+    }
+    
+    fprintf(fp, "# HELP gidinet_queue_wait_seconds Time an operation was queued before it was dispatched.\n");
+    fprintf(fp, "# TYPE gidinet_queue_wait_seconds histogram\n");
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        const struct LaneMetrics *metric = &metrics->lanes[lane];
+        const char *name = request_lane_name(lane);
+        unsigned long cumulative = 0;
+        for (int i = 0; i < METRICS_BUCKET_COUNT; i++) {
+            cumulative += metric->buckets[i];
+            fprintf(fp, "gidinet_queue_wait_seconds_bucket{lane=\"%s\",le=\"%g\"} %lu\n",
+                    name, metrics_buckets[i], cumulative);
+        }
+        fprintf(fp, "gidinet_queue_wait_seconds_bucket{lane=\"%s\",le=\"+Inf\"} %lu\n", name, metric->dispatched);
+        fprintf(fp, "gidinet_queue_wait_seconds_sum{lane=\"%s\"} %.6f\n", name, metric->wait_sum);
+        fprintf(fp, "gidinet_queue_wait_seconds_count{lane=\"%s\"} %lu\n", name, metric->dispatched);
+    }
+    
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Defaults: two retries, 30s per attempt, 60s per operation, and a circuit that
+// opens after 5 consecutive failures for 10s
+void retry_policy_default(struct RetryPolicy *policy) {
+    policy->retries = 2;
+    policy->base_delay = 0.25;
+    policy->max_delay = 8;
+    policy->attempt_timeout = 30;
+    policy->connect_timeout = 10;
+    policy->operation_budget = 60;
+    policy->breaker_threshold = 5;
+    policy->breaker_cooldown = 10;
+}
+
+// Classify the outcome of one attempt. body_len is the size of the envelope, so that
+// a transfer that failed before sending all of it is known not to have reached the API.
+// result_code is the API result, or -1 when there is none.
+enum FailureClass classify_failure(CURLcode res, const struct RequestTimings *timings, size_t body_len,
+                                   int result_code) {
+    switch (res) {
+        case CURLE_OK:
+            if (timings->http_code >= 500 || timings->http_code == 429) return FAILURE_HTTP_5XX;
+            if (result_code == 0) return FAILURE_NONE;
+            return result_code == 4 ? FAILURE_API_TRANSIENT : FAILURE_API;
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return timings->bytes_sent < (curl_off_t)body_len ? FAILURE_CONNECT : FAILURE_TRANSPORT;
+        default:
+            return FAILURE_PERMANENT;
+    }
+}
+
+const char* failure_class_name(enum FailureClass failure) {
+    switch (failure) {
+        case FAILURE_NONE: return "none";
+        case FAILURE_CONNECT: return "connect";
+        case FAILURE_TRANSPORT: return "transport";
+        case FAILURE_HTTP_5XX: return "http";
+        case FAILURE_API_TRANSIENT: return "api_transient";
+        case FAILURE_API: return "api";
+        case FAILURE_PERMANENT: return "permanent";
+        case FAILURE_CIRCUIT_OPEN: return "circuit_open";
+        case FAILURE_DEADLINE: return "deadline";
+    }
+    return "unknown";
+}
+
+// Whether an attempt that failed this way may be repeated. A request that never
+// reached the API always can. Otherwise the API may already have acted on it, and
+// only a list is retried: a repeated add, delete or update would report 6 or 5 if
+// the first one landed, hiding that the operation was applied.
+int failure_retryable(enum FailureClass failure, enum SoapAction action) {
+    switch (failure) {
+        case FAILURE_CONNECT:
+            return 1;
+        case FAILURE_TRANSPORT:
+        case FAILURE_HTTP_5XX:
+        case FAILURE_API_TRANSIENT:
+            return action == SOAP_ACTION_LIST;
+        default:
+            return 0;
+    }
+}
+
+// xorshift64*, seeded by the caller
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state ? *state : FNV1A_SEED;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t random_seed(const void *owner) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return fnv1a_hash(&owner, sizeof(owner), (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// Backoff before retry number attempt (1 for the first retry): exponential with
+// "equal jitter", so that clients failing together do not retry in lockstep. A
+// Retry-After header sent with the failed response is honoured when it is longer.
+double retry_delay(const struct RetryPolicy *policy, int attempt, CURL *curl, uint64_t *rng) {
+    double delay = policy->base_delay;
+    for (int i = 1; i < attempt && delay < policy->max_delay; i++) delay *= 2;
+    if (policy->max_delay > 0 && delay > policy->max_delay) delay = policy->max_delay;
+    delay = delay / 2 + delay / 2 * ((next_random(rng) >> 11) / 9007199254740992.0);
+    
+    curl_off_t retry_after = 0;
+    if (curl && curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK && retry_after > delay) {
+        delay = (double)retry_after;
+    }
+    return delay;
+}
+
+// Whether a request may be sent now: 0 if so, -1 to fail it fast
+int circuit_allow(struct CircuitBreaker *breaker, const struct RetryPolicy *policy, double now) {
+    if (policy->breaker_threshold <= 0 || breaker->open_until == 0) return 0;
+    if (now >= breaker->open_until && !breaker->trial) {
+        breaker->trial = 1;
+        return 0;
+    }
+    breaker->rejected++;
+    return -1;
+}
+
+// Account the outcome of an attempt. Only failures that point at the endpoint count:
+// an API error means it is up and answering.
+void circuit_record(struct CircuitBreaker *breaker, const struct RetryPolicy *policy, enum FailureClass failure,
+                    double now) {
+    if (failure == FAILURE_CIRCUIT_OPEN || failure == FAILURE_DEADLINE) return;
+    int trial = breaker->trial;
+    breaker->trial = 0;
+    if (failure == FAILURE_NONE || failure == FAILURE_API) {
+        breaker->failures = 0;
+        breaker->open_until = 0;
+        return;
+    }
+    
+    breaker->failures++;
+    if (policy->breaker_threshold > 0 && (trial || breaker->failures >= policy->breaker_threshold)) {
+        if (breaker->open_until == 0) breaker->opened++;
+        breaker->open_until = now + policy->breaker_cooldown;
+    }
+}
+
+// Completions per latency window
+#define RATE_LIMITER_WINDOW 64
+// Latency within twice the baseline plus this many seconds is healthy; smaller
+// differences are noise rather than queueing
+#define RATE_LIMITER_SLACK 0.005
+    
+// A rate of 0 disables the token bucket. The burst defaults to max_limit, enough
+// to start a full set of transfers at once.
+void rate_limiter_init(struct RateLimiter *limiter, double rate, double burst, int adaptive, int max_limit) {
+    memset(limiter, 0, sizeof(*limiter));
+    limiter->rate = rate > 0 ? rate : 0;
+    limiter->burst = burst >= 1 ? burst : (max_limit > 1 ? max_limit : 1);
+    limiter->tokens = limiter->burst;
+    limiter->refilled_at = monotonic_seconds();
+    limiter->adaptive = adaptive;
+    limiter->max_limit = max_limit < 1 ? 1 : max_limit;
+    limiter->limit = adaptive ? 1 : limiter->max_limit;
+    limiter->peak = (int)limiter->limit;
+    limiter->slow_start = 1;
+}
+
+int rate_limiter_concurrency(const struct RateLimiter *limiter) {
+    return (int)limiter->limit;
+}
+
+// Whether another attempt may start with in_flight attempts running. Returns 0 if
+// so; otherwise -1, and when a token is what is missing, lowers *wake (0 for none)
+// to the time the next one is due.
+int rate_limiter_ready(struct RateLimiter *limiter, int in_flight, double now, double *wake) {
+    if (in_flight >= (int)limiter->limit) return -1;
+    if (limiter->rate == 0) return 0;
+    
+    limiter->tokens += (now - limiter->refilled_at) * limiter->rate;
+    if (limiter->tokens > limiter->burst) limiter->tokens = limiter->burst;
+    limiter->refilled_at = now;
+    if (limiter->tokens >= 1) return 0;
+    
+    double due = now + (1 - limiter->tokens) / limiter->rate;
+    if (*wake == 0 || due < *wake) *wake = due;
+    return -1;
+}
+
+void rate_limiter_take(struct RateLimiter *limiter) {
+    if (limiter->rate > 0) limiter->tokens -= 1;
+}
+
+// Adapt the concurrency limit to the outcome of an attempt that took latency seconds
+void rate_limiter_record(struct RateLimiter *limiter, enum FailureClass failure, CURLcode res, double latency,
+                         double now) {
+    if (!limiter->adaptive) return;
+    
+    if (failure == FAILURE_HTTP_5XX || failure == FAILURE_API_TRANSIENT || res == CURLE_OPERATION_TIMEDOUT) {
+        // Attempts already running when the limit was cut report the same overload
+        if (now - latency < limiter->cut_at) return;
+        limiter->limit = limiter->limit / 2 < 1 ? 1 : limiter->limit / 2;
+        limiter->slow_start = 0;
+        limiter->cut_at = now;
+        limiter->decreases++;
+        return;
+    }
+    // Other failures say nothing about how loaded the API is
+    if (failure != FAILURE_NONE && failure != FAILURE_API) return;
+    
+    if (limiter->baseline == 0 || latency < limiter->baseline) limiter->baseline = latency;
+    if (limiter->window_count == 0 || latency < limiter->window_min) limiter->window_min = latency;
+    if (++limiter->window_count == RATE_LIMITER_WINDOW) {
+        limiter->window_count = 0;
+        if (limiter->window_min > limiter->baseline * 2 + RATE_LIMITER_SLACK) {
+            // Not one fast completion in a whole window: requests are queueing, so
+            // step down. Alone, they cannot queue behind each other, so the API
+            // itself got slower and that is the new baseline.
+            if (limiter->limit >= 2) {
+                limiter->limit -= 1;
+                limiter->decreases++;
+            } else {
+                limiter->baseline = limiter->window_min;
+            }
+            return;
+        }
+    }
+    
+    if (latency > limiter->baseline * 2 + RATE_LIMITER_SLACK) {
+        // Queueing somewhere: stop growing, but this is no reason to back off yet
+        limiter->slow_start = 0;
+        return;
+    }
+    // Per completion, +1 doubles the limit every round trip and +1/limit adds one
+    limiter->limit += limiter->slow_start ? 1 : 1 / limiter->limit;
+    if (limiter->limit > limiter->max_limit) limiter->limit = limiter->max_limit;
+    if ((int)limiter->limit > limiter->peak) limiter->peak = (int)limiter->limit;
+}
+
+// Message for an HTTP error status that came without an API result
+static const char* http_status_error(long http_code) {
+    switch (http_code) {
+        case 429: return "HTTP 429 Too Many Requests";
+        case 500: return "HTTP 500 Internal Server Error";
+        case 502: return "HTTP 502 Bad Gateway";
+        case 503: return "HTTP 503 Service Unavailable";
+        case 504: return "HTTP 504 Gateway Timeout";
+        default: return "HTTP error status without an API result";
+    }
+}
+
+// Message for a request that did not get an API answer
+const char* pending_request_error(const struct PendingRequest *request) {
+    if (request->failure == FAILURE_CIRCUIT_OPEN) return "Circuit breaker open, request not sent";
+    if (request->failure == FAILURE_DEADLINE) return "Deadline exceeded, request not sent";
+    if (request->curl_result == CURLE_HTTP_RETURNED_ERROR) return http_status_error(request->timings.http_code);
+    return curl_easy_strerror(request->curl_result);
+}
+
+// Time left for the next attempt before deadline (0 for none), capped by the attempt
+// timeout; 0 for no limit and -1 once the deadline has passed
+static double attempt_time_left(const struct RetryPolicy *policy, double deadline, double now) {
+    double left = policy->attempt_timeout;
+    if (deadline > 0) {
+        if (now >= deadline) return -1;
+        if (left <= 0 || deadline - now < left) left = deadline - now;
+    }
+    return left;
+}
+
+static void set_attempt_timeouts(CURL *curl, const struct RetryPolicy *policy, double left) {
+    double connect = policy->connect_timeout;
+    if (left > 0 && (connect <= 0 || connect > left)) connect = left;
+    // A zero value means no timeout to libcurl, so round sub-millisecond budgets up
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, left > 0 ? (long)(left * 1000) + 1 : 0L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect > 0 ? (long)(connect * 1000) + 1 : 0L);
+}
+
+static size_t discard_body(void *contents, size_t size, size_t nmemb, void *userp) {
+    (void)contents;
+    (void)userp;
+    return size * nmemb;
+}
+
+static void* prewarm_thread(void *arg) {
+    struct Prewarm *prewarm = arg;
+    prewarm->result = curl_easy_perform(prewarm->curl);
+    return NULL;
+}
+
+// Clone from (endpoint, HTTP version and timeouts included) into a HEAD request run on
+// its own thread. Cloning does not carry the share over, so it is passed separately:
+// the connection is left in its connection cache, where the first real request finds it.
+int prewarm_start(struct Prewarm *prewarm, CURL *from, CURLSH *share) {
+    memset(prewarm, 0, sizeof(*prewarm));
+    prewarm->curl = curl_easy_duphandle(from);
+    if (!prewarm->curl) return -1;
+    
+    curl_easy_setopt(prewarm->curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(prewarm->curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(prewarm->curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(prewarm->curl, CURLOPT_HTTPHEADER, NULL);
+    curl_easy_setopt(prewarm->curl, CURLOPT_WRITEFUNCTION, discard_body);
+    curl_easy_setopt(prewarm->curl, CURLOPT_ERRORBUFFER, NULL);
+    curl_easy_setopt(prewarm->curl, CURLOPT_PRIVATE, NULL);
+    
+    if (pthread_create(&prewarm->thread, NULL, prewarm_thread, prewarm) != 0) {
+        curl_easy_cleanup(prewarm->curl);
+        prewarm->curl = NULL;
+        return -1;
+    }
+    prewarm->running = 1;
+    return 0;
+}
+
+// Wait for a pre-warm to complete; a no-op if none is running
+CURLcode prewarm_finish(struct Prewarm *prewarm) {
+    if (!prewarm->running) return prewarm->result;
+    pthread_join(prewarm->thread, NULL);
+    curl_easy_cleanup(prewarm->curl);
+    prewarm->curl = NULL;
+    prewarm->running = 0;
+    return prewarm->result;
+}
+
+// Persisted TLS sessions, so that a later process resumes the session with an
+// abbreviated handshake. The file holds one record per session, in host byte order:
+// key, shmac and data lengths (uint32), expiry (int64 seconds since the epoch), then
+// the three byte strings.
+#define TLS_SESSIONS_MAGIC "GDSSLS01"
+
+struct TlsSessionHeader {
+    uint32_t key_len;
+    uint32_t shmac_len;
+    uint32_t data_len;
+    int64_t valid_until;
+};
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+// The libcurl loaded at run time may be older than the headers
+static int tls_sessions_supported(void) {
+    return curl_version_info(CURLVERSION_NOW)->version_num >= 0x080c00;
+}
+
+static CURLcode tls_session_export(CURL *curl, void *userptr, const char *session_key, const unsigned char *shmac,
+                                   size_t shmac_len, const unsigned char *sdata, size_t sdata_len,
+                                   curl_off_t valid_until, int ietf_tls_id, const char *alpn, size_t earlydata_max) {
+    (void)curl;
+    (void)ietf_tls_id;
+    (void)alpn;
+    (void)earlydata_max;
+    struct GrowBuffer *out = userptr;
+    
+    if (valid_until > 0 && valid_until <= (curl_off_t)time(NULL)) return CURLE_OK;
+    struct TlsSessionHeader header = { (uint32_t)strlen(session_key), (uint32_t)shmac_len, (uint32_t)sdata_len,
+                                       (int64_t)valid_until };
+    if (buffer_append(out, (const char *)&header, sizeof(header)) != 0 ||
+        buffer_append(out, session_key, header.key_len) != 0 ||
+        buffer_append(out, (const char *)shmac, shmac_len) != 0 ||
+        buffer_append(out, (const char *)sdata, sdata_len) != 0) {
+        return CURLE_OUT_OF_MEMORY;
+    }
+    return CURLE_OK;
+}
+#endif
+
+// Import the sessions saved in path into the session cache of curl (or its share).
+// Expired sessions are skipped. Returns -1 if nothing could be read or libcurl
+// cannot import sessions.
+int tls_sessions_load(CURL *curl, const char *path) {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    if (!tls_sessions_supported()) return -1;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    
+    char magic[sizeof(TLS_SESSIONS_MAGIC) - 1];
+    int rc = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+             memcmp(magic, TLS_SESSIONS_MAGIC, sizeof(magic)) == 0 ? 0 : -1;
+    
+    struct TlsSessionHeader header;
+    while (rc == 0 && fread(&header, sizeof(header), 1, fp) == 1) {
+        // Session keys and tickets are small; anything larger is a corrupt file
+        if (header.key_len > 4096 || header.shmac_len > 4096 || header.data_len > 65536) {
+            rc = -1;
+            break;
+        }
+        size_t len = (size_t)header.key_len + 1 + header.shmac_len + header.data_len;
+        char *record = malloc(len);
+        if (!record) {
+            rc = -1;
+            break;
+        }
+        unsigned char *shmac = (unsigned char *)record + header.key_len + 1;
+        unsigned char *sdata = shmac + header.shmac_len;
+        if (fread(record, 1, header.key_len, fp) != header.key_len ||
+            fread(shmac, 1, header.shmac_len + header.data_len, fp) != header.shmac_len + header.data_len) {
+            free(record);
+            rc = -1;
+            break;
+        }
+        record[header.key_len] = '\0';
+        if (header.valid_until <= 0 || header.valid_until > (int64_t)time(NULL)) {
+            if (curl_easy_ssls_import(curl, record, shmac, header.shmac_len, sdata, header.data_len) != CURLE_OK) {
+                rc = -1;
+            }
+        }
+        free(record);
+    }
+    fclose(fp);
+    return rc;
+#else
+    (void)curl;
+    (void)path;
+    return -1;
+#endif
+}
+
+// Save the TLS sessions of curl (or its share) to path, readable by the owner only
+int tls_sessions_save(CURL *curl, const char *path) {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    if (!tls_sessions_supported()) return -1;
+    struct GrowBuffer out = {0};
+    if (buffer_append(&out, TLS_SESSIONS_MAGIC, sizeof(TLS_SESSIONS_MAGIC) - 1) != 0) return -1;
+    if (curl_easy_ssls_export(curl, tls_session_export, &out) != CURLE_OK) {
+        free(out.data);
+        return -1;
+    }
+    
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int rc = -1;
+    if (fd >= 0) {
+        rc = write(fd, out.data, out.len) == (ssize_t)out.len ? 0 : -1;
+        if (close(fd) != 0) rc = -1;
+        if (rc == 0 && rename(tmp_path, path) != 0) rc = -1;
+        if (rc != 0) unlink(tmp_path);
+    }
+    free(out.data);
+    return rc;
+#else
+    (void)curl;
+    (void)path;
+    return -1;
+#endif
+}
+
+int engine_init(struct RequestEngine *engine, int parallel, const char *endpoint) {
+    memset(engine, 0, sizeof(*engine));
+    engine->parallel = parallel < 1 ? 1 : parallel;
+    retry_policy_default(&engine->policy);
+    rate_limiter_init(&engine->limiter, 0, 0, 0, engine->parallel);
+    engine->rng = random_seed(engine);
+    
+    engine->multi = curl_multi_init();
+    engine->share = curl_share_init();
+    engine->idle = calloc(engine->parallel, sizeof(CURL *));
+    if (!engine->multi || !engine->share || !engine->idle) {
+        engine_cleanup(engine);
+        return -1;
+    }
+    
+    // Handles share DNS, TLS sessions and connections (which lets a pre-warm on
+    // another thread hand its connection over)
+    curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)engine->parallel);
+    
+    for (int i = 0; i < engine->parallel; i++) {
+        CURL *curl = curl_easy_init();
+        if (!curl) {
+            engine_cleanup(engine);
+            return -1;
+        }
+        curl_easy_setopt(curl, CURLOPT_SHARE, engine->share);
+        soap_handle_init(curl, endpoint);
+        engine->idle[engine->idle_count++] = curl;
+    }
+    return 0;
+}
+
+void engine_cleanup(struct RequestEngine *engine) {
+    prewarm_finish(&engine->prewarm);
+    for (int i = 0; i < engine->idle_count; i++) {
+        curl_easy_cleanup(engine->idle[i]);
+    }
+    free(engine->idle);
+    if (engine->multi) curl_multi_cleanup(engine->multi);
+    if (engine->share) curl_share_cleanup(engine->share);
+    memset(engine, 0, sizeof(*engine));
+}
+
+// CURL_HTTP_VERSION_* for every handle, e.g. CURL_HTTP_VERSION_1_1 to rule out HTTP/2
+void engine_set_http_version(struct RequestEngine *engine, long version) {
+    for (int i = 0; i < engine->idle_count; i++) {
+        curl_easy_setopt(engine->idle[i], CURLOPT_HTTP_VERSION, version);
+    }
+}
+
+// Limit attempts to rate per second (0: unlimited) in bursts of up to burst and,
+// when adaptive, adapt the number of transfers in flight between 1 and parallel
+void engine_set_rate_limit(struct RequestEngine *engine, double rate, double burst, int adaptive) {
+    rate_limiter_init(&engine->limiter, rate, burst, adaptive, engine->parallel);
+}
+
+// Set up a connection in the background; engine_run() waits for it before its first request
+int engine_prewarm(struct RequestEngine *engine) {
+    if (engine->prewarm.running || engine->idle_count == 0) return -1;
+    set_attempt_timeouts(engine->idle[0], &engine->policy, engine->policy.attempt_timeout);
+    return prewarm_start(&engine->prewarm, engine->idle[0], engine->share);
+}
+
+// Reset a slot for its next request, keeping the envelope storage for reuse
+static void release_pending_request(struct PendingRequest *request) {
+    struct GrowBuffer body = request->body;
+    struct APIResponse response = request->response;
+    free(request->result.text);
+    memset(request, 0, sizeof(*request));
+    body.len = 0;
+    request->body = body;
+    api_response_reset(&response);
+    request->response = response;
+}
+
+// Complete a request without sending it
+static void fail_pending_request(struct PendingRequest *request, enum FailureClass failure) {
+    request->failure = failure;
+    request->curl_result = failure == FAILURE_DEADLINE ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT;
+    request->timings.curl_result = request->curl_result;
+    request->done = 1;
+}
+
+// Deadline of a request: its operation budget or the engine's deadline, whichever comes first
+static double request_deadline(const struct RequestEngine *engine, const struct PendingRequest *request) {
+    double deadline = engine->deadline;
+    if (engine->policy.operation_budget > 0) {
+        double budget_end = request->started + engine->policy.operation_budget;
+        if (deadline == 0 || budget_end < deadline) deadline = budget_end;
+    }
+    return deadline;
+}
+
+// Start the next attempt of a request on an idle handle. Returns 0 if a transfer
+// was started; otherwise the request failed fast and is done.
+static int engine_start(struct RequestEngine *engine, struct PendingRequest *request, double now) {
+    double left = attempt_time_left(&engine->policy, request_deadline(engine, request), now);
+    if (left < 0) {
+        fail_pending_request(request, FAILURE_DEADLINE);
+        return -1;
+    }
+    if (circuit_allow(&engine->breaker, &engine->policy, now) != 0) {
+        fail_pending_request(request, FAILURE_CIRCUIT_OPEN);
+        return -1;
+    }
+    
+    CURL *curl = engine->idle[--engine->idle_count];
+    rate_limiter_take(&engine->limiter);
+    request->curl = curl;
+    request->timings.attempts++;
+    if (request->parser) {
+        setup_soap_request(curl, request->action, &request->body, SoapParserWriteCallback, request->parser);
+    } else {
+        setup_soap_request(curl, request->action, &request->body, WriteCallback, &request->response);
+    }
+    set_attempt_timeouts(curl, &engine->policy, left);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, request);
+    curl_multi_add_handle(engine->multi, curl);
+    return 0;
+}
+
+// Account a finished attempt; either completes the request or schedules a retry
+static void engine_finish(struct RequestEngine *engine, struct PendingRequest *request, CURLcode res) {
+    CURL *curl = request->curl;
+    int attempts = request->timings.attempts;
+    double retry_wait = request->timings.retry_wait;
+    
+    // The parser stopped the transfer on purpose at its filter limit
+    if (res == CURLE_WRITE_ERROR && request->parser && request->parser->done) res = CURLE_OK;
+    request->curl_result = res;
+    request_timings_collect(curl, res, &request->timings);
+    request->timings.attempts = attempts;
+    request->timings.retry_wait = retry_wait;
+    
+    int result_code = -1;
+    if (request->parser) {
+        request->timings.parse = request->parser->parse_time;
+        result_code = request->parser->result_code;
+    } else if (res == CURLE_OK) {
+        double started = monotonic_seconds();
+        parse_simple_result(request->response.data, &request->result);
+        request->timings.parse = monotonic_seconds() - started;
+        result_code = request->result.code;
+    }
+    request->failure = classify_failure(res, &request->timings, request->body.len, result_code);
+    
+    double now = monotonic_seconds();
+    circuit_record(&engine->breaker, &engine->policy, request->failure, now);
+    rate_limiter_record(&engine->limiter, request->failure, res, request->timings.total, now);
+    
+    // A streamed response cannot be taken back from the parser once it saw part of it
+    int retry = attempts <= engine->policy.retries && failure_retryable(request->failure, request->action) &&
+                !(request->parser && request->timings.bytes_received > 0);
+    if (retry) {
+        double delay = retry_delay(&engine->policy, attempts, curl, &engine->rng);
+        double deadline = request_deadline(engine, request);
+        if (deadline > 0 && now + delay >= deadline) retry = 0;
+        else {
+            api_response_reset(&request->response);
+            free(request->result.text);
+            memset(&request->result, 0, sizeof(request->result));
+            request->timings.retry_wait += delay;
+            request->retry_at = now + delay;
+            engine->retries++;
+        }
+    }
+    request->curl = NULL;
+    if (retry) return;
+    // An error status without an API result fails like a transport error
+    if (request->failure == FAILURE_HTTP_5XX && result_code == -1) request->curl_result = CURLE_HTTP_RETURNED_ERROR;
+    request->done = 1;
+}
+
+// Whether another attempt may start: a handle is idle and the rate limiter lets it
+// through. *wake is lowered to when the next token is due if that is what is missing.
+static int engine_may_start(struct RequestEngine *engine, double now, double *wake) {
+    if (engine->idle_count == 0) return -1;
+    return rate_limiter_ready(&engine->limiter, engine->parallel - engine->idle_count, now, wake);
+}
+
+// Whether a source may hand over a request now. Only urgent requests may take the
+// last engine->reserved slots under the concurrency limit; at a limit of one there
+// is nothing to reserve. The engine only calls its source while some slot is free.
+int engine_has_room(const struct RequestEngine *engine, int urgent) {
+    int limit = rate_limiter_concurrency(&engine->limiter);
+    if (limit > engine->parallel) limit = engine->parallel;
+    int reserved = engine->reserved < limit ? engine->reserved : limit - 1;
+    int in_flight = engine->parallel - engine->idle_count;
+    return in_flight < limit - (urgent ? 0 : reserved);
+}
+
+// Wait for transfer activity, for the descriptors of a waiting source, or until
+// wake (0 for none), at most a second
+static void engine_wait(struct RequestEngine *engine, int source_waiting, double wake, double now) {
+    int timeout = 1000;
+    if (wake > 0 && (wake - now) * 1000 < timeout) timeout = wake > now ? (int)((wake - now) * 1000) + 1 : 0;
+    
+    unsigned int count = source_waiting || engine->tick ? engine->source_fd_count : 0;
+    curl_multi_poll(engine->multi, count ? engine->source_fds : NULL, count, timeout, NULL);
+}
+
+// Hand every finished request not yet delivered to done, ahead of earlier ones
+static void engine_deliver_unordered(struct PendingRequest *slots, int window, long next_emit, long next_submit,
+                                     request_done_cb done, void *ctx) {
+    for (long i = next_emit; i < next_submit; i++) {
+        struct PendingRequest *request = &slots[i % window];
+        if (!request->done || request->delivered) continue;
+        done(ctx, request);
+        request->delivered = 1;
+    }
+}
+
+// Run requests pulled from source with at most engine->parallel transfers in flight
+// (fewer while the rate limiter holds them back). Completed requests are handed to
+// done strictly in the order source produced them, so output stays deterministic
+// regardless of which transfer finishes first, unless engine->unordered asks for
+// each as soon as it finishes. Failed attempts are retried under engine->policy
+// while later requests keep flowing. engine->tick lets a caller serve its own
+// descriptors even while every slot is busy.
+int engine_run(struct RequestEngine *engine, request_source_cb source, request_done_cb done, void *ctx) {
+    // Bound the number of requests waiting for an earlier one to complete
+    int window = engine->parallel * 4 < 16 ? 16 : engine->parallel * 4;
+    struct PendingRequest *slots = calloc(window, sizeof(*slots));
+    if (!slots) return -1;
+    prewarm_finish(&engine->prewarm);
+    
+    long next_submit = 0, next_emit = 0;
+    int in_flight = 0, exhausted = 0;
+    
+    for (;;) {
+        double now = monotonic_seconds();
+        
+        // Unordered requests that finished on the last turn are seen by done before
+        // the source is asked for more
+        if (engine->unordered) engine_deliver_unordered(slots, window, next_emit, next_submit, done, ctx);
+        
+        // Retries whose backoff elapsed go first, then new requests while there is room
+        double next_retry = 0, token_due = 0;
+        int waiting = 0;
+        for (long i = next_emit; i < next_submit; i++) {
+            struct PendingRequest *request = &slots[i % window];
+            if (request->retry_at == 0) continue;
+            if (request->retry_at > now) {
+                if (next_retry == 0 || request->retry_at < next_retry) next_retry = request->retry_at;
+                continue;
+            }
+            // Due, but held back: the next completion or token lets it through
+            if (engine_may_start(engine, now, &token_due) != 0) continue;
+            request->retry_at = 0;
+            if (engine_start(engine, request, now) == 0) in_flight++;
+        }
+        
+        while (!exhausted && next_submit - next_emit < window && engine_may_start(engine, now, &token_due) == 0) {
+            struct PendingRequest *request = &slots[next_submit % window];
+            int rc = source(ctx, request);
+            if (rc == REQUEST_SOURCE_WAIT) {
+                waiting = 1;
+                break;
+            }
+            if (rc != 0) {
+                exhausted = 1;
+                break;
+            }
+            next_submit++;
+            
+            // Items without a request (e.g. invalid input) complete immediately
+            if (request->action == SOAP_ACTION_NONE) {
+                request->done = 1;
+                continue;
+            }
+            request->started = now;
+            if (engine_start(engine, request, now) == 0) in_flight++;
+        }
+        
+        // Deliver finished requests in submission order, or all of them when unordered
+        if (engine->unordered) engine_deliver_unordered(slots, window, next_emit, next_submit, done, ctx);
+        while (next_emit < next_submit && slots[next_emit % window].done) {
+            struct PendingRequest *request = &slots[next_emit % window];
+            if (!request->delivered) done(ctx, request);
+            release_pending_request(request);
+            next_emit++;
+        }
+        
+        if (exhausted && next_emit == next_submit) break;
+        // A ready source is pulled from on the next turn instead of waiting
+        int ready = engine->tick && engine->tick(ctx) && !exhausted && next_submit - next_emit < window &&
+                    engine_may_start(engine, now, &token_due) == 0;
+        double wake = next_retry;
+        if (token_due > 0 && (wake == 0 || token_due < wake)) wake = token_due;
+        if (waiting && engine->source_wake > 0 && (wake == 0 || engine->source_wake < wake)) {
+            wake = engine->source_wake;
+        }
+        if (in_flight == 0) {
+            // Only backoffs or a waiting source are pending: sleep until one is due
+            if (!ready && (waiting || wake > now)) engine_wait(engine, waiting, wake, now);
+            continue;
+        }
+        
+        int running = 0;
+        curl_multi_perform(engine->multi, &running);
+        
+        int completed = 0;
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(engine->multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            
+            CURL *curl = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            struct PendingRequest *request = NULL;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&request);
+            curl_multi_remove_handle(engine->multi, curl);
+            engine_finish(engine, request, res);
+            
+            engine->idle[engine->idle_count++] = curl;
+            in_flight--;
+            completed++;
+        }
+        
+        if (!completed && running && !ready) engine_wait(engine, waiting, wake, now);
+    }
+    
+    for (int i = 0; i < window; i++) {
+        free(slots[i].body.data);
+        free(slots[i].response.data);
+    }
+    free(slots);
+    return 0;
+}
+
+void free_dns_record(struct DNSRecord *record) {
+    free(record->domain);
+    free(record->host);
+    free(record->type);
+    free(record->data);
+    memset(record, 0, sizeof(*record));
+}
+
+int hash_index_init(struct HashIndex *index, size_t expected) {
+    size_t cap = 16;
+    while (cap < expected * 2) cap *= 2;
+    
+    memset(index, 0, sizeof(*index));
+    index->hashes = malloc(cap * sizeof(uint64_t));
+    index->values = malloc(cap * sizeof(size_t));
+    if (!index->hashes || !index->values) {
+        hash_index_free(index);
+        return -1;
+    }
+    for (size_t i = 0; i < cap; i++) index->values[i] = HASH_INDEX_EMPTY;
+    index->mask = cap - 1;
+    return 0;
+}
+
+void hash_index_free(struct HashIndex *index) {
+    free(index->hashes);
+    free(index->values);
+    memset(index, 0, sizeof(*index));
+}
+
+// Remove every value, keeping the table's storage
+void hash_index_clear(struct HashIndex *index) {
+    if (index->values) memset(index->values, 0xff, (index->mask + 1) * sizeof(size_t));
+    index->count = 0;
+}
+
+// Store value under hash. Several values may share a hash; the table grows to
+// stay at most half full.
+int hash_index_insert(struct HashIndex *index, uint64_t hash, size_t value) {
+    if ((index->count + 1) * 2 > index->mask + 1) {
+        struct HashIndex grown;
+        if (hash_index_init(&grown, index->mask + 1) != 0) return -1;
+        for (size_t i = 0; i <= index->mask; i++) {
+            if (index->values[i] != HASH_INDEX_EMPTY) {
+                hash_index_insert(&grown, index->hashes[i], index->values[i]);
+            }
+        }
+        hash_index_free(index);
+        *index = grown;
+    }
+    
+    size_t slot = hash & index->mask;
+    while (index->values[slot] != HASH_INDEX_EMPTY) slot = (slot + 1) & index->mask;
+    index->hashes[slot] = hash;
+    index->values[slot] = value;
+    index->count++;
+    return 0;
+}
+
+// Iterate over the values stored under hash. Start with *pos = 0; returns 1 and
+// sets *value for each candidate, 0 when there are no more.
+int hash_index_next(const struct HashIndex *index, uint64_t hash, size_t *pos, size_t *value) {
+    if (!index->values) return 0;
+    
+    for (size_t probe = *pos; probe <= index->mask; probe++) {
+        size_t slot = (hash + probe) & index->mask;
+        if (index->values[slot] == HASH_INDEX_EMPTY) return 0;
+        if (index->hashes[slot] == hash) {
+            *pos = probe + 1;
+            *value = index->values[slot];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Hash a string case-insensitively (host names and record types)
+uint64_t fnv1a_hash_lower(const char *str, uint64_t hash) {
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        hash ^= (unsigned char)tolower(*p);
+        hash *= 0x100000001b3ULL;
+    }
+    return fnv1a_hash("", 1, hash);
+}
+
+// Identity of a record within a zone: (host, type, data)
+uint64_t record_key_hash(const struct DNSRecord *record) {
+    uint64_t hash = fnv1a_hash_lower(record->host, FNV1A_SEED);
+    hash = fnv1a_hash_lower(record->type, hash);
+    return fnv1a_hash(record->data, strlen(record->data), hash);
+}
+
+int record_key_equal(const struct DNSRecord *a, const struct DNSRecord *b) {
+    return strcasecmp(a->host, b->host) == 0 && strcasecmp(a->type, b->type) == 0 &&
+           strcmp(a->data, b->data) == 0;
+}
+
+// Append a copy of record to the set
+int record_set_add(struct RecordSet *set, const struct DNSRecord *record, int read_only) {
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 64;
+        struct ZoneRecord *items = realloc(set->items, cap * sizeof(*items));
+        if (!items) return -1;
+        set->items = items;
+        set->cap = cap;
+    }
+    
+    struct ZoneRecord *item = &set->items[set->count];
+    memset(item, 0, sizeof(*item));
+    item->record.domain = arena_strdup(&set->strings, record->domain ? record->domain : "");
+    item->record.host = arena_strdup(&set->strings, record->host ? record->host : "");
+    item->record.type = arena_strdup(&set->strings, record->type ? record->type : "");
+    item->record.data = arena_strdup(&set->strings, record->data ? record->data : "");
+    item->record.ttl = record->ttl;
+    item->record.priority = record->priority;
+    item->read_only = read_only;
+    if (!item->record.domain || !item->record.host || !item->record.type || !item->record.data) return -1;
+    item->key_hash = record_key_hash(&item->record);
+    set->count++;
+    return 0;
+}
+
+void gidinet_record_set_free(struct RecordSet *set) {
+    arena_free(&set->strings);
+    free(set->items);
+    memset(set, 0, sizeof(*set));
+}
+
+// Parser callback collecting listed records into a RecordSet
+void record_set_collect(void *ctx, const struct ListRecord *listed) {
+    struct RecordSet *set = ctx;
+    struct DNSRecord record = { (char *)listed->domain, (char *)listed->host, (char *)listed->type,
+                                (char *)listed->data, listed->ttl, listed->priority };
+    if (record_set_add(set, &record, listed->read_only || listed->suspended) != 0) set->failed = 1;
+}
+
+// Post a SOAP envelope on an existing handle, streaming the response into parser
+CURLcode perform_soap_request_parsed(CURL *curl, enum SoapAction action, const struct GrowBuffer *body,
+                                     struct SoapParser *parser) {
+    setup_soap_request(curl, action, body, SoapParserWriteCallback, parser);
+    CURLcode res = curl_easy_perform(curl);
+    if (res == CURLE_WRITE_ERROR && parser->done) res = CURLE_OK;
+    // A truncated response has no header to report yet
+    if (res == CURLE_OK) soap_parser_finish(parser);
+    return res;
+}
+
+struct GidinetClient* gidinet_client_new(const char *username, const char *passwordB64) {
+    struct GidinetClient *client = calloc(1, sizeof(*client));
+    if (!client) return NULL;
+    
+    client->username = strdup(username ? username : "");
+    client->passwordB64 = strdup(passwordB64 ? passwordB64 : "");
+    client->curl = curl_easy_init();
+    client->share = curl_share_init();
+    if (!client->username || !client->passwordB64 || !client->curl || !client->share) {
+        gidinet_client_free(client);
+        return NULL;
+    }
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_easy_setopt(client->curl, CURLOPT_SHARE, client->share);
+    soap_handle_init(client->curl, NULL);
+    curl_easy_setopt(client->curl, CURLOPT_ERRORBUFFER, client->error);
+    retry_policy_default(&client->policy);
+    client->rng = random_seed(client);
+    return client;
+}
+
+void gidinet_client_free(struct GidinetClient *client) {
+    if (!client) return;
+    prewarm_finish(&client->prewarm);
+    if (client->curl) curl_easy_cleanup(client->curl);
+    if (client->share) curl_share_cleanup(client->share);
+    free(client->request.data);
+    free(client->response.data);
+    free(client->username);
+    free(client->passwordB64);
+    free(client);
+}
+
+// Send the client's requests to endpoint instead of the default one
+int gidinet_client_set_endpoint(struct GidinetClient *client, const char *endpoint) {
+    return curl_easy_setopt(client->curl, CURLOPT_URL, endpoint ? endpoint : gidinet_default_endpoint()) == CURLE_OK
+        ? 0 : -1;
+}
+
+// CURL_HTTP_VERSION_* for the client's requests
+int gidinet_client_set_http_version(struct GidinetClient *client, long version) {
+    return curl_easy_setopt(client->curl, CURLOPT_HTTP_VERSION, version) == CURLE_OK ? 0 : -1;
+}
+
+int gidinet_client_prewarm(struct GidinetClient *client) {
+    if (client->prewarm.running) return -1;
+    set_attempt_timeouts(client->curl, &client->policy, client->policy.attempt_timeout);
+    return prewarm_start(&client->prewarm, client->curl, client->share);
+}
+
+// Message describing the last failed call
+const char* gidinet_client_error(const struct GidinetClient *client) {
+    if (client->error[0]) return client->error;
+    return curl_easy_strerror(client->last_error);
+}
+
+void gidinet_result_free(struct APIResult *result) {
+    free(result->text);
+    result->text = NULL;
+}
+
+// Remember why a call failed; CURLE_OUT_OF_MEMORY also covers failing to build the request
+static int client_fail(struct GidinetClient *client, CURLcode res) {
+    client->last_error = res;
+    return -1;
+}
+
+static void client_sleep(double seconds) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+// Post the envelope in client->request under the client's retry policy and circuit
+// breaker. A buffered response is parsed into result. With a parser the response
+// streams into it instead, and is only retried while the parser has seen none of it.
+static int client_execute(struct GidinetClient *client, enum SoapAction action, struct SoapParser *parser,
+                          struct APIResult *result) {
+    const struct RetryPolicy *policy = &client->policy;
+    double deadline = policy->operation_budget > 0 ? monotonic_seconds() + policy->operation_budget : 0;
+    int attempts = 0;
+    double retry_wait = 0;
+    struct APIResponse *response = &client->response;
+    CURLcode res;
+    enum FailureClass failure;
+    int result_code;
+    
+    prewarm_finish(&client->prewarm);
+    for (;;) {
+        double now = monotonic_seconds();
+        double left = attempt_time_left(policy, deadline, now);
+        if (left < 0 || circuit_allow(&client->breaker, policy, now) != 0) {
+            // Report the last attempt's failure if there was one
+            if (attempts > 0) break;
+            snprintf(client->error, sizeof(client->error), "%s",
+                     left < 0 ? "Deadline exceeded, request not sent" : "Circuit breaker open, request not sent");
+            return client_fail(client, left < 0 ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT);
+        }
+        
+        attempts++;
+        client->error[0] = '\0';
+        if (parser) {
+            setup_soap_request(client->curl, action, &client->request,
+                               client->list_write ? client->list_write : SoapParserWriteCallback, parser);
+        } else {
+            api_response_reset(response);
+            setup_soap_request(client->curl, action, &client->request, WriteCallback, response);
+        }
+        set_attempt_timeouts(client->curl, policy, left);
+        res = curl_easy_perform(client->curl);
+        // The parser stopped the transfer on purpose at its filter limit
+        if (res == CURLE_WRITE_ERROR && parser && parser->done) res = CURLE_OK;
+        request_timings_collect(client->curl, res, &client->timings);
+        
+        result_code = -1;
+        if (parser) {
+            client->timings.parse = parser->parse_time;
+            result_code = parser->result_code;
+        } else if (res == CURLE_OK) {
+            gidinet_result_free(result);
+            double started = monotonic_seconds();
+            parse_simple_result(response->data, result);
+            client->timings.parse = monotonic_seconds() - started;
+            result_code = result->code;
+        }
+        failure = classify_failure(res, &client->timings, client->request.len, result_code);
+        now = monotonic_seconds();
+        circuit_record(&client->breaker, policy, failure, now);
+        
+        if (attempts > policy->retries || !failure_retryable(failure, action)) break;
+        if (parser && client->timings.bytes_received > 0) break;
+        double delay = retry_delay(policy, attempts, client->curl, &client->rng);
+        if (deadline > 0 && now + delay >= deadline) break;
+        
+        client_sleep(delay);
+        retry_wait += delay;
+    }
+    
+    client->timings.attempts = attempts;
+    client->timings.retry_wait = retry_wait;
+    // An error status without an API result (e.g. a proxy's 503 page) is a failure too
+    if (res == CURLE_OK && failure == FAILURE_HTTP_5XX && result_code == -1) {
+        snprintf(client->error, sizeof(client->error), "%s", http_status_error(client->timings.http_code));
+        res = CURLE_HTTP_RETURNED_ERROR;
+    }
+    if (res != CURLE_OK) {
+        if (result) {
+            gidinet_result_free(result);
+            result->code = -1;
+        }
+        return client_fail(client, res);
+    }
+    // A truncated response has no header to report yet
+    if (parser) soap_parser_finish(parser);
+    return 0;
+}
+
+// Post the envelope built in client->request (build_rc tells whether building it
+// succeeded) and parse the simple result
+static int client_call(struct GidinetClient *client, enum SoapAction action, int build_rc,
+                       struct APIResult *result) {
+    result->code = -1;
+    result->subcode = 0;
+    result->text = NULL;
+    client->error[0] = '\0';
+    if (build_rc != 0) return client_fail(client, CURLE_OUT_OF_MEMORY);
+    return client_execute(client, action, NULL, result);
+}
+
+int gidinet_record_add(struct GidinetClient *client, const struct DNSRecord *record, struct APIResult *result) {
+    return client_call(client, SOAP_ACTION_ADD,
+                       build_record_add_request(&client->request, client->username, client->passwordB64, record),
+                       result);
+}
+
+int gidinet_record_delete(struct GidinetClient *client, const struct DNSRecord *record, struct APIResult *result) {
+    return client_call(client, SOAP_ACTION_DELETE,
+                       build_record_delete_request(&client->request, client->username, client->passwordB64,
+                                                   record),
+                       result);
+}
+
+int gidinet_record_update(struct GidinetClient *client, const struct DNSRecord *oldRecord,
+                          const struct DNSRecord *newRecord, struct APIResult *result) {
+    return client_call(client, SOAP_ACTION_UPDATE,
+                       build_record_update_request(&client->request, client->username, client->passwordB64,
+                                                   oldRecord, newRecord),
+                       result);
+}
+
+int gidinet_record_list_parse(struct GidinetClient *client, const char *domain, struct SoapParser *parser) {
+    client->error[0] = '\0';
+    if (build_record_list_request(&client->request, client->username, client->passwordB64, domain) != 0) {
+        return client_fail(client, CURLE_OUT_OF_MEMORY);
+    }
+    
+    return client_execute(client, SOAP_ACTION_LIST, parser, NULL);
+}
+
+int gidinet_record_list(struct GidinetClient *client, const char *domain, struct APIResult *result,
+                        struct RecordSet *records) {
+    struct SoapParser parser;
+    memset(records, 0, sizeof(*records));
+    soap_parser_init(&parser, NULL, record_set_collect, records);
+    
+    int rc = gidinet_record_list_parse(client, domain, &parser);
+    soap_parser_get_result(&parser, result);
+    soap_parser_free(&parser);
+    if (rc == 0 && records->failed) rc = client_fail(client, CURLE_OUT_OF_MEMORY);
+    if (rc != 0) gidinet_record_set_free(records);
+    return rc;
+}
@@ -0,0 +1,93 @@
+// libgidinet - DIGINET DNS API client library
+// Builds SOAP envelopes, posts them with libcurl and parses the responses
+// into plain C structs. Nothing in the library prints. This header declares
+// the public API; everything else is internal to the library and the CLI.
+#ifndef GIDINET_H
+#define GIDINET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Parsed resultCode / resultSubCode / resultText of an API response
+struct APIResult {
+    int code;
+    int subcode;
+    char *text;
+};
+
+// A DNS record as sent to recordAdd / recordDelete / recordUpdate
+struct DNSRecord {
+    char *domain;
+    char *host;
+    char *type;
+    char *data;
+    int ttl;
+    int priority;
+};
+
+// Region allocator: small allocations are carved out of large blocks and
+// released together, so freeing a region costs one free() per block
+struct ArenaBlock {
+    struct ArenaBlock *next;      // Previously filled block
+    size_t size;
+    char data[];
+};
+
+struct Arena {
+    struct ArenaBlock *head;      // Block being filled
+    size_t used;                  // Bytes of head handed out
+};
+
+// A record of a zone, as listed or as desired
+struct ZoneRecord {
+    struct DNSRecord record;
+    uint64_t key_hash;            // Hash of (host, type, data)
+    int read_only;
+    int matched;
+};
+
+struct RecordSet {
+    struct ZoneRecord *items;
+    size_t count;
+    size_t cap;
+    int failed;
+    struct Arena strings;         // Owns the strings of the records
+};
+
+// Client for one account. It owns a persistent CURL handle, so successive calls
+// reuse the same connection and TLS session instead of reconnecting.
+struct GidinetClient;
+
+// Client handle. Calls return 0 once the API answered (the API result code is in
+// result->code) and -1 on a transport or memory failure, see gidinet_client_error().
+// Results own their text: release them with gidinet_result_free().
+struct GidinetClient* gidinet_client_new(const char *username, const char *passwordB64);
+void gidinet_client_free(struct GidinetClient *client);
+int gidinet_client_set_endpoint(struct GidinetClient *client, const char *endpoint);
+const char* gidinet_client_error(const struct GidinetClient *client);
+int gidinet_client_set_http_version(struct GidinetClient *client, long version);
+// Start setting up the connection in the background; the next call waits for it
+int gidinet_client_prewarm(struct GidinetClient *client);
+int gidinet_record_add(struct GidinetClient *client, const struct DNSRecord *record, struct APIResult *result);
+int gidinet_record_delete(struct GidinetClient *client, const struct DNSRecord *record, struct APIResult *result);
+int gidinet_record_update(struct GidinetClient *client, const struct DNSRecord *oldRecord,
+                          const struct DNSRecord *newRecord, struct APIResult *result);
+// Fill records with the zone (suspended records are flagged read-only); free it with gidinet_record_set_free()
+int gidinet_record_list(struct GidinetClient *client, const char *domain, struct APIResult *result,
+                        struct RecordSet *records);
+void gidinet_record_set_free(struct RecordSet *set);
+void gidinet_result_free(struct APIResult *result);
+// Description of an API result code
+const char* gidinet_result_code_message(int result_code);
+// Endpoint of new clients: $GIDINET_ENDPOINT, or the built-in API endpoint
+const char* gidinet_default_endpoint(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
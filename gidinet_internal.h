@@ -0,0 +1,635 @@
+// libgidinet internals, shared by the library sources and the CLI. Not
+// installed: these symbols have hidden visibility, so the shared library only
+// exports the gidinet_* API of gidinet.h.
+#ifndef GIDINET_INTERNAL_H
+#define GIDINET_INTERNAL_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include "gidinet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma GCC visibility push(hidden)
+
+#ifndef API_ENDPOINT
+#define API_ENDPOINT "https://api.quickservicebox.com/API/Beta/DNSAPI.asmx"
+#endif
+#define API_NAMESPACE "https://api.quickservicebox.com/DNS/DNSAPI"
+
+// Raw response body of a SOAP call. The buffer grows geometrically and may be
+// kept for the next response by resetting size.
+struct APIResponse {
+    char *data;
+    size_t size;
+    size_t cap;
+};
+
+// Growable byte buffer, NUL-terminated once allocated
+struct GrowBuffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// Values captured by the SOAP response parser
+enum SoapField {
+    SOAP_FIELD_NONE = 0,
+    SOAP_FIELD_RESULT_CODE,
+    SOAP_FIELD_RESULT_SUBCODE,
+    SOAP_FIELD_RESULT_TEXT,
+    SOAP_FIELD_RESULT_ITEM_COUNT,
+    SOAP_FIELD_DOMAIN,
+    SOAP_FIELD_HOST,
+    SOAP_FIELD_TYPE,
+    SOAP_FIELD_DATA,
+    SOAP_FIELD_TTL,
+    SOAP_FIELD_PRIORITY,
+    SOAP_FIELD_READONLY,
+    SOAP_FIELD_SUSPENDED,
+    SOAP_FIELD_SUSPENSION_REASON,
+    SOAP_FIELD_COUNT
+};
+
+// Bit of ListRecord.fields telling that a record field was present
+#define LIST_FIELD_BIT(field) (1u << ((field) - SOAP_FIELD_DOMAIN))
+
+// A DNSRecordListItem as returned by recordGetList. Strings point into the
+// parser and are only valid for the duration of the record callback.
+struct ListRecord {
+    const char *domain;
+    const char *host;
+    const char *type;
+    const char *data;
+    const char *suspension_reason;
+    int ttl;
+    int priority;
+    int read_only;
+    int suspended;
+    unsigned int fields;
+};
+
+// How RecordFilter.host is compared with the host of a record
+enum HostMatch {
+    HOST_MATCH_EXACT = 0,         // Whole name, case-insensitive
+    HOST_MATCH_PREFIX,            // "www*": names starting with "www"
+    HOST_MATCH_GLOB               // Shell pattern (* ? [...]), case-insensitive
+};
+
+// Predicates evaluated by the parser as each field of a record closes. A record
+// that fails one has its remaining fields skipped and is never handed to the
+// record callback. NULL members match anything.
+struct RecordFilter {
+    const char *host;
+    enum HostMatch host_match;    // Set by record_filter_set_host()
+    size_t host_len;              // Length of the prefix for HOST_MATCH_PREFIX
+    const char *type;             // Case-insensitive
+    const char *data;             // Exact
+    long limit;                   // Stop parsing after this many matches, 0 for no limit
+};
+
+enum SoapState {
+    SOAP_STATE_TEXT = 0,
+    SOAP_STATE_ENTITY,
+    SOAP_STATE_TAG_START,
+    SOAP_STATE_TAG_NAME,
+    SOAP_STATE_TAG_ATTRS,
+    SOAP_STATE_MARKUP,            // After "<!": a CDATA section, comment or DOCTYPE
+    SOAP_STATE_CDATA,
+    SOAP_STATE_SKIP
+};
+
+struct SoapParser;
+// Called once the result code/subcode/text are known (before the first record)
+typedef void (*soap_header_cb)(void *ctx, const struct SoapParser *parser);
+// Called for every DNSRecordListItem as soon as it closes
+typedef void (*soap_record_cb)(void *ctx, const struct ListRecord *record);
+
+// Incremental single-pass tokenizer for API responses
+struct SoapParser {
+    enum SoapState state;
+    char tag[64];
+    size_t tag_len;
+    int closing;
+    int self_closing;
+    char quote;
+    char entity[16];
+    size_t entity_len;
+    int cdata_brackets;           // "]" seen in a CDATA section that may start its "]]>"
+    int capture;                  // SoapField receiving text, or SOAP_FIELD_NONE
+    int in_items;
+    int in_record;
+    unsigned int record_fields;
+    struct GrowBuffer fields[SOAP_FIELD_COUNT];
+    int result_code;
+    int result_subcode;
+    int has_result_text;
+    int item_count;               // resultItemCount, -1 if absent
+    long record_count;
+    int header_done;
+    double parse_time;            // Seconds spent feeding the parser, callbacks included
+    const struct RecordFilter *filter;  // Optional, set after init/reset
+    int skip_record;              // The current record failed the filter
+    long matched;                 // Records that passed the filter
+    int done;                     // The filter limit was reached; further input is ignored
+    soap_header_cb on_header;
+    soap_record_cb on_record;
+    void *ctx;
+};
+
+// SOAP operations of the DNS API
+enum SoapAction {
+    SOAP_ACTION_NONE = 0,
+    SOAP_ACTION_ADD,
+    SOAP_ACTION_DELETE,
+    SOAP_ACTION_UPDATE,
+    SOAP_ACTION_LIST,
+    SOAP_ACTION_COUNT
+};
+
+// Where the time of one request went. Times are in seconds since the request
+// started, as reported by libcurl (so they are cumulative), plus the time spent
+// parsing the response. Connection phases are 0 when a connection was reused.
+struct RequestTimings {
+    double name_lookup;
+    double connect;
+    double app_connect;           // TLS handshake complete, 0 for plain HTTP
+    double start_transfer;        // First response byte
+    double total;
+    double parse;
+    curl_off_t bytes_sent;
+    curl_off_t bytes_received;
+    long http_code;
+    CURLcode curl_result;
+    int attempts;                 // Attempts made; the fields above are for the last one
+    double retry_wait;            // Seconds spent backing off between attempts
+};
+
+// Phases a request's time is split into for metrics
+enum RequestPhase {
+    REQUEST_PHASE_DNS = 0,
+    REQUEST_PHASE_CONNECT,
+    REQUEST_PHASE_TLS,
+    REQUEST_PHASE_SERVER,         // Request sent until first response byte
+    REQUEST_PHASE_TRANSFER,
+    REQUEST_PHASE_PARSE,
+    REQUEST_PHASE_COUNT
+};
+
+#define METRICS_BUCKET_COUNT 12
+
+// Aggregated latency of one SOAP operation
+struct OperationMetrics {
+    unsigned long requests;
+    unsigned long api_errors;
+    unsigned long transport_errors;
+    unsigned long retries;
+    unsigned long buckets[METRICS_BUCKET_COUNT];  // Non-cumulative; +Inf is requests
+    double duration_sum;
+    double phase_sum[REQUEST_PHASE_COUNT];
+    curl_off_t bytes_sent;
+    curl_off_t bytes_received;
+};
+
+// Priority class of a queued operation, most urgent first
+enum RequestLane {
+    LANE_URGENT = 0,              // e.g. failover updates; may use the engine's reserved slots
+    LANE_NORMAL,
+    LANE_BULK,
+    LANE_COUNT
+};
+
+// Time operations of one lane spent queued before they were dispatched
+struct LaneMetrics {
+    unsigned long dispatched;
+    unsigned long buckets[METRICS_BUCKET_COUNT];  // Non-cumulative; +Inf is dispatched
+    double wait_sum;
+};
+
+struct RequestMetrics {
+    struct OperationMetrics ops[SOAP_ACTION_COUNT];
+    struct LaneMetrics lanes[LANE_COUNT];
+};
+
+// Why an attempt failed, which decides whether it is retried
+enum FailureClass {
+    FAILURE_NONE = 0,
+    FAILURE_CONNECT,              // Transient, and the envelope never fully reached the API
+    FAILURE_TRANSPORT,            // Transient, after the envelope was sent (timeout, reset)
+    FAILURE_HTTP_5XX,             // HTTP 5xx or 429 from the endpoint
+    FAILURE_API_TRANSIENT,        // API result 4, undefined error
+    FAILURE_API,                  // Any other API result: retrying cannot change it
+    FAILURE_PERMANENT,            // Transport failure retrying cannot fix (bad URL, certificate, memory)
+    FAILURE_CIRCUIT_OPEN,         // Not sent: the circuit breaker is open
+    FAILURE_DEADLINE              // Not sent: the deadline budget is spent
+};
+
+// How requests are retried and timed out. Times are in seconds; 0 disables a limit.
+struct RetryPolicy {
+    int retries;                  // Attempts after the first
+    double base_delay;            // Backoff before the first retry, doubled for each next one
+    double max_delay;             // Cap on one backoff
+    double attempt_timeout;       // CURLOPT_TIMEOUT of one attempt
+    double connect_timeout;       // CURLOPT_CONNECTTIMEOUT of one attempt
+    double operation_budget;      // Total time for one operation, retries and backoff included
+    int breaker_threshold;        // Consecutive failed attempts that open the circuit
+    double breaker_cooldown;      // Time the circuit stays open before one trial request
+};
+
+// Circuit breaker state. While open, requests fail fast instead of queueing behind
+// a dead endpoint; after the cooldown a single trial request decides whether it closes.
+struct CircuitBreaker {
+    int failures;                 // Consecutive failed attempts
+    double open_until;            // Monotonic time the circuit may half-open, 0 when closed
+    int trial;                    // A trial request is in flight
+    unsigned long opened;         // Times the circuit opened
+    unsigned long rejected;       // Requests failed fast while it was open
+};
+
+// Token bucket and adaptive concurrency limit of the requests of one account (an
+// engine talks for a single account). Tokens refill at rate per second up to burst
+// and every attempt takes one. When adaptive, the concurrency limit starts at 1 and
+// doubles every round trip while completions are healthy (slow start), then grows
+// by one per round trip (additive increase). Timeouts, HTTP 429/5xx and API result
+// 4 halve it, at most once per round trip (multiplicative decrease), and a window
+// of completions all slower than twice the baseline latency lowers it by one. A
+// completion is healthy when it got an API answer within twice the baseline.
+struct RateLimiter {
+    double rate;                  // Attempts per second, 0 for no rate limit
+    double burst;
+    double tokens;
+    double refilled_at;           // Monotonic time tokens were last added
+    int adaptive;
+    double limit;                 // Concurrency limit, between 1 and max_limit
+    int max_limit;
+    int peak;                     // Highest concurrency limit reached
+    int slow_start;               // Set until the first sign of overload
+    double baseline;              // Latency of an unloaded API, 0 until known
+    double window_min;
+    int window_count;
+    double cut_at;                // Overload from attempts started before this is the same episode
+    unsigned long decreases;
+};
+
+// A SOAP request queued on the request engine
+struct PendingRequest {
+    enum SoapAction action;       // SOAP_ACTION_NONE if the item needs no request
+    struct GrowBuffer body;       // Envelope; the engine keeps its storage for the next request
+    struct APIResponse response;  // Buffered response, unless parser is set
+    struct SoapParser *parser;    // Optional: stream the response into this parser
+    struct APIResult result;      // Parsed from the buffered response when the API answered
+    CURLcode curl_result;
+    enum FailureClass failure;    // Of the last attempt
+    struct RequestTimings timings;  // Filled when the transfer completes
+    CURL *curl;
+    int done;
+    int delivered;                // Handed to done ahead of an earlier request (engine->unordered)
+    double started;               // When the first attempt was submitted
+    double retry_at;              // Waiting to be retried at this time, 0 if not
+    void *userdata;
+};
+
+// Fill the next request; return 0 if one was produced, REQUEST_SOURCE_WAIT if none
+// is ready yet, any other value when exhausted
+#define REQUEST_SOURCE_WAIT 2
+typedef int (*request_source_cb)(void *ctx, struct PendingRequest *request);
+// Called once per request, in the order they were produced
+typedef void (*request_done_cb)(void *ctx, struct PendingRequest *request);
+// Called on every turn of the engine, whether or not a request may start; return
+// nonzero when the source has a request ready
+typedef int (*request_tick_cb)(void *ctx);
+
+// Background HEAD request that resolves the endpoint and sets up a connection
+// (TCP, TLS, HTTP/2) in the shared connection cache of the handle it was cloned
+// from. That cache must not be used by anyone else until prewarm_finish().
+struct Prewarm {
+    pthread_t thread;
+    CURL *curl;
+    CURLcode result;
+    int running;
+};
+
+// Runs many SOAP requests concurrently on curl_multi with a cap on transfers in flight
+struct RequestEngine {
+    CURLM *multi;
+    CURLSH *share;
+    CURL **idle;        // Easy handles not currently in use
+    int idle_count;
+    int parallel;
+    struct RetryPolicy policy;
+    struct CircuitBreaker breaker;
+    struct RateLimiter limiter;
+    int reserved;       // Transfer slots kept free for urgent requests (see engine_has_room)
+    double deadline;    // Monotonic time after which no request is started, 0 for none
+    unsigned long retries;
+    uint64_t rng;       // Backoff jitter
+    struct Prewarm prewarm;
+    struct curl_waitfd *source_fds;   // Polled with the transfers while the source waits (always with tick)
+    unsigned int source_fd_count;
+    double source_wake; // When a waiting source expects a request to be ready, 0 if unknown
+    request_tick_cb tick;   // Optional, see request_tick_cb
+    int unordered;      // Hand requests to done as they finish rather than in submission order
+};
+
+// Open-addressing hash table mapping 64-bit hashes to indices (duplicates allowed)
+#define HASH_INDEX_EMPTY ((size_t)-1)
+
+struct HashIndex {
+    uint64_t *hashes;
+    size_t *values;
+    size_t mask;
+    size_t count;
+};
+
+// Zone snapshot file, see snapshot.c for the layout
+#define SNAPSHOT_MAGIC "GDSN"
+#define SNAPSHOT_VERSION 1
+
+// Columns of a snapshot: string ids first, then the numeric columns
+enum SnapshotColumn {
+    SNAPSHOT_COL_DOMAIN = 0,
+    SNAPSHOT_COL_HOST,
+    SNAPSHOT_COL_TYPE,
+    SNAPSHOT_COL_DATA,
+    SNAPSHOT_COL_REASON,
+    SNAPSHOT_STRING_COLUMNS,
+    SNAPSHOT_COL_TTL = SNAPSHOT_STRING_COLUMNS,
+    SNAPSHOT_COL_PRIORITY,
+    SNAPSHOT_COL_FLAGS,
+    SNAPSHOT_COLUMNS
+};
+
+// Bits of the flags column
+#define SNAPSHOT_READ_ONLY 0x01
+#define SNAPSHOT_SUSPENDED 0x02
+
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t created_at;
+    uint32_t record_count;
+    uint32_t string_count;
+    uint32_t domain;              // String id of the listed domain
+    uint32_t reserved;
+    uint64_t offsets;             // Section offsets from the start of the file
+    uint64_t strings;
+    uint64_t columns[SNAPSHOT_COLUMNS];
+    uint64_t size;
+};
+
+// Collects listed records with their strings interned; snapshot_writer_save()
+// sorts them and writes the file
+struct SnapshotWriter {
+    struct GrowBuffer strings;    // Distinct strings, NUL-terminated
+    uint32_t *offsets;            // Of each string id in strings
+    uint32_t string_count;
+    uint32_t string_cap;
+    struct HashIndex index;       // String hash -> string id
+    uint32_t *ids[SNAPSHOT_STRING_COLUMNS];
+    int32_t *ttl;
+    int32_t *priority;
+    uint8_t *flags;
+    uint32_t record_count;
+    uint32_t record_cap;
+    int failed;
+};
+
+// A validated snapshot file, mapped read-only. String ids follow strcmp() order
+// and records are sorted on (domain, host, type, data).
+struct Snapshot {
+    const char *map;
+    size_t size;
+    const struct SnapshotHeader *header;
+    const uint32_t *offsets;
+    const char *strings;
+    const uint32_t *ids[SNAPSHOT_STRING_COLUMNS];
+    const int32_t *ttl;
+    const int32_t *priority;
+    const uint8_t *flags;
+    uint32_t record_count;
+    uint32_t string_count;
+};
+
+enum SnapshotChange {
+    SNAPSHOT_ADDED = 0,
+    SNAPSHOT_REMOVED,
+    SNAPSHOT_CHANGED
+};
+
+// Record index passed for the side a change has no record on
+#define SNAPSHOT_NO_RECORD UINT32_MAX
+
+struct SnapshotDiffStats {
+    unsigned long added;
+    unsigned long removed;
+    unsigned long changed;
+    unsigned long unchanged;
+};
+
+// Called for every difference, in key order, with the record index in each snapshot
+typedef void (*snapshot_diff_cb)(void *ctx, enum SnapshotChange change, uint32_t old_index, uint32_t new_index);
+
+// Operation journal and its index, see journal.c for the formats
+#define JOURNAL_INDEX_MAGIC "GDJI"
+#define JOURNAL_INDEX_VERSION 1
+#define JOURNAL_SYNC_RECORDS 1024   // Buffered records that force a sync
+
+// Last event journaled for an operation
+enum JournalState {
+    JOURNAL_UNKNOWN = 0,          // Never journaled
+    JOURNAL_QUEUED,
+    JOURNAL_SENT,                 // No result journaled: it may or may not have been applied
+    JOURNAL_FAILED,
+    JOURNAL_DONE                  // Applied, or there was nothing to send
+};
+
+// An operation: the input line it came from and a hash of its contents
+struct JournalEntry {
+    uint64_t key;
+    uint32_t line;
+    uint32_t state;
+};
+
+struct JournalIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t covered;             // Bytes of the journal the entries account for
+    uint64_t tail_hash;           // Hash of the bytes just before covered
+    uint64_t entry_count;
+};
+
+// Append-only journal of batch operations with the last state of each. Records
+// are buffered, then written and synced together once JOURNAL_SYNC_RECORDS are
+// pending or the oldest has waited sync_interval seconds.
+struct Journal {
+    char *path;
+    int fd;
+    uint64_t size;                // Bytes written to the file
+    struct GrowBuffer pending;    // Records not written yet
+    size_t pending_records;
+    double pending_since;
+    double sync_interval;
+    int error;                    // errno of the first failed write, 0 if none
+    struct JournalEntry *entries;
+    size_t count;
+    size_t cap;
+    struct HashIndex index;       // Hash of (line, key) -> entry
+};
+
+struct GidinetClient {
+    char *username;
+    char *passwordB64;
+    CURL *curl;
+    CURLSH *share;                // Connection, DNS and TLS session cache, shared with the pre-warm
+    struct GrowBuffer request;    // Envelope of the current call, reused across calls
+    struct APIResponse response;  // Receive buffer, reused across calls
+    struct RequestTimings timings; // Of the last call
+    CURLcode last_error;          // Transport error of the last failed call
+    char error[CURL_ERROR_SIZE];  // libcurl's detailed message for it, may be empty
+    struct RetryPolicy policy;
+    struct CircuitBreaker breaker;
+    uint64_t rng;                 // Backoff jitter
+    // Write callback for gidinet_record_list_parse(), SoapParserWriteCallback if NULL
+    size_t (*list_write)(void *, size_t, size_t, void *);
+    struct Prewarm prewarm;
+};
+
+// 64-bit FNV-1a offset basis
+#define FNV1A_SEED 0xcbf29ce484222325ULL
+
+// Stream the zone into a parser set up by the caller with its own callbacks
+int gidinet_record_list_parse(struct GidinetClient *client, const char *domain, struct SoapParser *parser);
+
+// Buffers
+int buffer_append(struct GrowBuffer *buf, const char *bytes, size_t len);
+void api_response_reset(struct APIResponse *response);
+void* arena_alloc(struct Arena *arena, size_t size);
+char* arena_strdup(struct Arena *arena, const char *str);
+void arena_reset(struct Arena *arena);
+void arena_free(struct Arena *arena);
+
+// Response parsing
+void soap_parser_init(struct SoapParser *parser, soap_header_cb on_header, soap_record_cb on_record, void *ctx);
+void soap_parser_reset(struct SoapParser *parser, soap_header_cb on_header, soap_record_cb on_record, void *ctx);
+void soap_parser_free(struct SoapParser *parser);
+int soap_parser_feed(struct SoapParser *parser, const char *data, size_t len);
+void soap_parser_finish(struct SoapParser *parser);
+void soap_parser_get_result(const struct SoapParser *parser, struct APIResult *result);
+void parse_simple_result(const char *response_data, struct APIResult *result);
+void record_filter_set_host(struct RecordFilter *filter, const char *pattern);
+int record_filter_active(const struct RecordFilter *filter);
+int record_filter_match(const struct RecordFilter *filter, const struct ListRecord *record);
+size_t SoapParserWriteCallback(void *contents, size_t size, size_t nmemb, void *userp);
+
+// Request building. Envelopes replace the contents of out, with values XML-escaped;
+// reusing out makes building allocation-free. Return -1 when out of memory.
+int build_record_update_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                                const struct DNSRecord *oldRecord, const struct DNSRecord *newRecord);
+int build_record_add_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                             const struct DNSRecord *record);
+int build_record_delete_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                                const struct DNSRecord *record);
+int build_record_list_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                              const char *domain);
+
+// Transport
+void soap_handle_init(CURL *curl, const char *endpoint);
+void setup_soap_request(CURL *curl, enum SoapAction action, const struct GrowBuffer *body,
+                        size_t (*write_fn)(void *, size_t, size_t, void *), void *write_data);
+CURLcode perform_soap_request(CURL *curl, enum SoapAction action, const struct GrowBuffer *body,
+                              struct APIResponse *response);
+CURLcode perform_soap_request_parsed(CURL *curl, enum SoapAction action, const struct GrowBuffer *body,
+                                     struct SoapParser *parser);
+
+// Failure handling
+void retry_policy_default(struct RetryPolicy *policy);
+enum FailureClass classify_failure(CURLcode res, const struct RequestTimings *timings, size_t body_len,
+                                   int result_code);
+const char* failure_class_name(enum FailureClass failure);
+int failure_retryable(enum FailureClass failure, enum SoapAction action);
+double retry_delay(const struct RetryPolicy *policy, int attempt, CURL *curl, uint64_t *rng);
+int circuit_allow(struct CircuitBreaker *breaker, const struct RetryPolicy *policy, double now);
+void rate_limiter_init(struct RateLimiter *limiter, double rate, double burst, int adaptive, int max_limit);
+int rate_limiter_ready(struct RateLimiter *limiter, int in_flight, double now, double *wake);
+void rate_limiter_take(struct RateLimiter *limiter);
+void rate_limiter_record(struct RateLimiter *limiter, enum FailureClass failure, CURLcode res, double latency,
+                         double now);
+int rate_limiter_concurrency(const struct RateLimiter *limiter);
+void circuit_record(struct CircuitBreaker *breaker, const struct RetryPolicy *policy, enum FailureClass failure,
+                    double now);
+const char* pending_request_error(const struct PendingRequest *request);
+
+// Connection set-up
+int prewarm_start(struct Prewarm *prewarm, CURL *from, CURLSH *share);
+CURLcode prewarm_finish(struct Prewarm *prewarm);
+int tls_sessions_load(CURL *curl, const char *path);
+int tls_sessions_save(CURL *curl, const char *path);
+
+// Request engine
+int engine_init(struct RequestEngine *engine, int parallel, const char *endpoint);
+void engine_cleanup(struct RequestEngine *engine);
+void engine_set_http_version(struct RequestEngine *engine, long version);
+void engine_set_rate_limit(struct RequestEngine *engine, double rate, double burst, int adaptive);
+int engine_prewarm(struct RequestEngine *engine);
+int engine_has_room(const struct RequestEngine *engine, int urgent);
+int engine_run(struct RequestEngine *engine, request_source_cb source, request_done_cb done, void *ctx);
+
+// Instrumentation
+double monotonic_seconds(void);
+const char* soap_action_name(enum SoapAction action);
+const char* request_lane_name(enum RequestLane lane);
+void request_timings_collect(CURL *curl, CURLcode res, struct RequestTimings *timings);
+void metrics_observe(struct RequestMetrics *metrics, enum SoapAction action, const struct RequestTimings *timings,
+                     int result_code);
+void metrics_observe_queue_wait(struct RequestMetrics *metrics, enum RequestLane lane, double wait);
+int metrics_write_prometheus(const struct RequestMetrics *metrics, const char *path);
+
+// Records, hashing and indexing
+void free_dns_record(struct DNSRecord *record);
+uint64_t fnv1a_hash(const void *data, size_t len, uint64_t seed);
+uint64_t fnv1a_hash_lower(const char *str, uint64_t hash);
+uint64_t record_key_hash(const struct DNSRecord *record);
+int record_key_equal(const struct DNSRecord *a, const struct DNSRecord *b);
+int hash_index_init(struct HashIndex *index, size_t expected);
+void hash_index_free(struct HashIndex *index);
+void hash_index_clear(struct HashIndex *index);
+int hash_index_insert(struct HashIndex *index, uint64_t hash, size_t value);
+int hash_index_next(const struct HashIndex *index, uint64_t hash, size_t *pos, size_t *value);
+int record_set_add(struct RecordSet *set, const struct DNSRecord *record, int read_only);
+void record_set_collect(void *ctx, const struct ListRecord *listed);
+
+// Snapshots. snapshot_writer_add() is a parser record callback taking the writer.
+int snapshot_writer_init(struct SnapshotWriter *writer);
+void snapshot_writer_add(void *ctx, const struct ListRecord *record);
+int snapshot_writer_write(struct SnapshotWriter *writer, const char *domain, FILE *fp);
+int snapshot_writer_save(struct SnapshotWriter *writer, const char *domain, const char *path);
+void snapshot_writer_free(struct SnapshotWriter *writer);
+int snapshot_open(struct Snapshot *snapshot, const char *path);
+void snapshot_close(struct Snapshot *snapshot);
+const char* snapshot_string(const struct Snapshot *snapshot, uint32_t id);
+void snapshot_record(const struct Snapshot *snapshot, uint32_t index, struct ListRecord *record);
+int snapshot_diff(const struct Snapshot *from, const struct Snapshot *to, snapshot_diff_cb cb, void *ctx,
+                  struct SnapshotDiffStats *stats);
+
+// Journal. Appends return -1 when out of memory; journal_sync() writes.
+int journal_open(struct Journal *journal, const char *path, double sync_interval);
+int journal_close(struct Journal *journal);
+enum JournalState journal_state(const struct Journal *journal, uint32_t line, uint64_t key);
+int journal_queued(struct Journal *journal, uint32_t line, uint64_t key, const char *op, const char *lane,
+                   const struct DNSRecord *record, const struct DNSRecord *new_record);
+int journal_sent(struct Journal *journal, uint32_t line, uint64_t key);
+int journal_result(struct Journal *journal, uint32_t line, uint64_t key, const struct APIResult *result,
+                   const char *error, const char *skipped);
+double journal_sync_due(const struct Journal *journal);
+int journal_sync(struct Journal *journal, double now, int force);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
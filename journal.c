@@ -0,0 +1,383 @@
+// libgidinet - operation journal
+// The journal is an append-only file of NDJSON records, one per event in the
+// life of a batch operation, so it doubles as an audit log:
+//
+//   {"event":"run","time":T}                            a run opened the journal
+//   {"event":"queued","line":L,"key":"K","time":T,"op":...,"record":{...}[,"new":{...}]}
+//   {"event":"sent","line":L,"key":"K","time":T}
+//   {"event":"done","line":L,"key":"K","time":T,"code":0,"text":...}
+//   {"event":"done",...,"skipped":"noop"}               nothing needed sending
+//   {"event":"failed",...,"code":C,"text":...} or {"event":"failed",...,"error":...}
+//
+// An operation is identified by its input line L and K, a hash of its contents
+// in hex. Records are buffered and written with one write() and fdatasync()
+// per group. The caller forces a sync after each "sent" record, before the
+// request goes out; a crash loses at most the other records buffered since. A
+// torn last line is skipped when the journal is read back.
+//
+// The index (the journal's path with ".idx") caches the state of every
+// operation that was sent or done, so that opening a journal of millions of
+// lines only parses the records appended since the index was written. Layout
+// (native byte order): JournalIndexHeader, then JournalEntry[entry_count]. It
+// is trusted only while the journal still holds the bytes it was built from.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "gidinet_internal.h"
+
+// Bytes before the covered offset whose hash ties an index to its journal
+#define JOURNAL_TAIL_BYTES 256
+
+static const char *journal_event_names[] = { "", "queued", "sent", "failed", "done" };
+
+static uint64_t journal_entry_hash(uint32_t line, uint64_t key) {
+    return key ^ ((uint64_t)line * 0x9e3779b97f4a7c15ULL);
+}
+
+static struct JournalEntry* journal_find(const struct Journal *journal, uint32_t line, uint64_t key) {
+    size_t pos = 0, value;
+    while (hash_index_next(&journal->index, journal_entry_hash(line, key), &pos, &value)) {
+        struct JournalEntry *entry = &journal->entries[value];
+        if (entry->line == line && entry->key == key) return entry;
+    }
+    return NULL;
+}
+
+// Remember the last event of an operation. Returns 0, or -1 when out of memory.
+static int journal_note(struct Journal *journal, uint32_t line, uint64_t key, enum JournalState state) {
+    struct JournalEntry *entry = journal_find(journal, line, key);
+    if (entry) {
+        entry->state = state;
+        return 0;
+    }
+    
+    if (journal->count == journal->cap) {
+        size_t cap = journal->cap ? journal->cap * 2 : 1024;
+        struct JournalEntry *entries = realloc(journal->entries, cap * sizeof(*entries));
+        if (!entries) {
+            journal->error = ENOMEM;
+            return -1;
+        }
+        journal->entries = entries;
+        journal->cap = cap;
+    }
+    if (hash_index_insert(&journal->index, journal_entry_hash(line, key), journal->count) != 0) {
+        journal->error = ENOMEM;
+        return -1;
+    }
+    journal->entries[journal->count++] = (struct JournalEntry){key, line, state};
+    return 0;
+}
+
+enum JournalState journal_state(const struct Journal *journal, uint32_t line, uint64_t key) {
+    const struct JournalEntry *entry = journal_find(journal, line, key);
+    return entry ? (enum JournalState)entry->state : JOURNAL_UNKNOWN;
+}
+
+// Hash of the bytes of the journal just before offset
+static int journal_tail_hash(int fd, uint64_t offset, uint64_t *hash) {
+    char tail[JOURNAL_TAIL_BYTES];
+    size_t len = offset < sizeof(tail) ? (size_t)offset : sizeof(tail);
+    
+    if (pread(fd, tail, len, (off_t)(offset - len)) != (ssize_t)len) return -1;
+    *hash = fnv1a_hash(tail, len, FNV1A_SEED);
+    return 0;
+}
+
+// Load the entries of a valid index. Returns the journal offset they account
+// for, or 0 when there is no usable index.
+static uint64_t journal_load_index(struct Journal *journal, const char *index_path) {
+    FILE *fp = fopen(index_path, "rb");
+    if (!fp) return 0;
+    
+    struct JournalIndexHeader header;
+    uint64_t hash;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, JOURNAL_INDEX_MAGIC, 4) != 0 ||
+        header.version != JOURNAL_INDEX_VERSION || header.covered == 0 || header.covered > journal->size ||
+        journal_tail_hash(journal->fd, header.covered, &hash) != 0 || hash != header.tail_hash) {
+        fclose(fp);
+        return 0;
+    }
+    
+    struct JournalEntry entry;
+    uint64_t loaded = 0;
+    while (loaded < header.entry_count && fread(&entry, sizeof(entry), 1, fp) == 1) {
+        if (entry.state > JOURNAL_DONE || journal_note(journal, entry.line, entry.key, entry.state) != 0) break;
+        loaded++;
+    }
+    fclose(fp);
+    if (loaded == header.entry_count) return header.covered;
+    
+    // A short or corrupt index: forget it and read the whole journal
+    journal->count = 0;
+    hash_index_clear(&journal->index);
+    return 0;
+}
+
+// Replay the records from offset to the end of the journal
+static int journal_scan(struct Journal *journal, uint64_t offset) {
+    FILE *fp = fopen(journal->path, "r");
+    if (!fp) return -1;
+    if (fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    int rc = 0;
+    while (rc == 0 && (line_len = getline(&line, &line_cap, fp)) != -1) {
+        char event[16];
+        uint32_t op_line;
+        uint64_t key;
+        if (line[line_len - 1] != '\n') break;
+        if (sscanf(line, "{\"event\":\"%15[a-z]\",\"line\":%" SCNu32 ",\"key\":\"%16" SCNx64 "\"",
+                   event, &op_line, &key) != 3) {
+            continue;
+        }
+        for (int state = JOURNAL_QUEUED; state <= JOURNAL_DONE; state++) {
+            if (strcmp(event, journal_event_names[state]) == 0) {
+                rc = journal_note(journal, op_line, key, state);
+                break;
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+    return rc;
+}
+
+static int journal_append(struct Journal *journal, const char *str) {
+    return buffer_append(&journal->pending, str, strlen(str));
+}
+
+static int journal_append_json(struct Journal *journal, const char *str) {
+    int rc = journal_append(journal, "\"");
+    for (const unsigned char *p = (const unsigned char *)(str ? str : ""); *p && rc == 0; p++) {
+        char escaped[8];
+        if (*p == '"' || *p == '\\') {
+            snprintf(escaped, sizeof(escaped), "\\%c", *p);
+        } else if (*p < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", *p);
+        } else {
+            escaped[0] = (char)*p;
+            escaped[1] = '\0';
+        }
+        rc = journal_append(journal, escaped);
+    }
+    return rc == 0 ? journal_append(journal, "\"") : -1;
+}
+
+// Open the record of an event; it is ended by journal_end()
+static int journal_begin(struct Journal *journal, const char *event, uint32_t line, uint64_t key) {
+    struct timespec ts;
+    char head[160];
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (journal->pending_records == 0) journal->pending_since = monotonic_seconds();
+    if (line == 0) {
+        snprintf(head, sizeof(head), "{\"event\":\"%s\",\"time\":%lld.%03ld", event, (long long)ts.tv_sec,
+                 ts.tv_nsec / 1000000);
+    } else {
+        snprintf(head, sizeof(head),
+                 "{\"event\":\"%s\",\"line\":%" PRIu32 ",\"key\":\"%016" PRIx64 "\",\"time\":%lld.%03ld",
+                 event, line, key, (long long)ts.tv_sec, ts.tv_nsec / 1000000);
+    }
+    return journal_append(journal, head);
+}
+
+static int journal_end(struct Journal *journal, int rc) {
+    if (rc != 0 || journal_append(journal, "}\n") != 0) {
+        if (!journal->error) journal->error = ENOMEM;
+        return -1;
+    }
+    journal->pending_records++;
+    return 0;
+}
+
+// Open or create the journal at path and load the state of its operations.
+// Returns 0, or -1 with errno set.
+int journal_open(struct Journal *journal, const char *path, double sync_interval) {
+    memset(journal, 0, sizeof(*journal));
+    journal->sync_interval = sync_interval;
+    journal->path = strdup(path);
+    journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    struct stat st;
+    if (!journal->path || journal->fd < 0 || fstat(journal->fd, &st) != 0 ||
+        hash_index_init(&journal->index, 1024) != 0) {
+        int saved = journal->path ? errno : ENOMEM;
+        journal_close(journal);
+        errno = saved;
+        return -1;
+    }
+    journal->size = (uint64_t)st.st_size;
+    
+    char index_path[PATH_MAX + 8];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    uint64_t offset = journal->size ? journal_load_index(journal, index_path) : 0;
+    if (offset < journal->size && journal_scan(journal, offset) != 0) {
+        int saved = errno ? errno : ENOMEM;
+        journal_close(journal);
+        errno = saved;
+        return -1;
+    }
+    
+    // A torn last line is closed off so that the next record starts a line
+    char last = '\n';
+    if (journal->size > 0 && pread(journal->fd, &last, 1, (off_t)journal->size - 1) == 1 && last != '\n') {
+        journal_append(journal, "\n");
+    }
+    journal_end(journal, journal_begin(journal, "run", 0, 0));
+    return journal->error ? -1 : 0;
+}
+
+int journal_queued(struct Journal *journal, uint32_t line, uint64_t key, const char *op, const char *lane,
+                   const struct DNSRecord *record, const struct DNSRecord *new_record) {
+    const struct DNSRecord *records[2] = { record, new_record };
+    const char *names[2] = { ",\"record\":{", ",\"new\":{" };
+    char number[64];
+    
+    int rc = journal_begin(journal, "queued", line, key);
+    rc |= journal_append(journal, ",\"op\":");
+    rc |= journal_append_json(journal, op);
+    rc |= journal_append(journal, ",\"lane\":");
+    rc |= journal_append_json(journal, lane);
+    for (int i = 0; i < 2 && records[i]; i++) {
+        rc |= journal_append(journal, names[i]);
+        rc |= journal_append(journal, "\"domain\":");
+        rc |= journal_append_json(journal, records[i]->domain);
+        rc |= journal_append(journal, ",\"host\":");
+        rc |= journal_append_json(journal, records[i]->host);
+        rc |= journal_append(journal, ",\"type\":");
+        rc |= journal_append_json(journal, records[i]->type);
+        rc |= journal_append(journal, ",\"data\":");
+        rc |= journal_append_json(journal, records[i]->data);
+        snprintf(number, sizeof(number), ",\"ttl\":%d,\"priority\":%d}", records[i]->ttl, records[i]->priority);
+        rc |= journal_append(journal, number);
+    }
+    if (journal_end(journal, rc) != 0) return -1;
+    return journal_note(journal, line, key, JOURNAL_QUEUED);
+}
+
+int journal_sent(struct Journal *journal, uint32_t line, uint64_t key) {
+    if (journal_end(journal, journal_begin(journal, "sent", line, key)) != 0) return -1;
+    return journal_note(journal, line, key, JOURNAL_SENT);
+}
+
+// The outcome of an operation: the API result, a transport error (result is
+// then NULL), or why it was not sent
+int journal_result(struct Journal *journal, uint32_t line, uint64_t key, const struct APIResult *result,
+                   const char *error, const char *skipped) {
+    enum JournalState state = skipped || (result && result->code == 0) ? JOURNAL_DONE : JOURNAL_FAILED;
+    char number[32];
+    
+    int rc = journal_begin(journal, journal_event_names[state], line, key);
+    if (skipped) {
+        rc |= journal_append(journal, ",\"skipped\":");
+        rc |= journal_append_json(journal, skipped);
+    } else if (result) {
+        snprintf(number, sizeof(number), ",\"code\":%d,\"text\":", result->code);
+        rc |= journal_append(journal, number);
+        rc |= journal_append_json(journal, result->text);
+    } else {
+        rc |= journal_append(journal, ",\"error\":");
+        rc |= journal_append_json(journal, error);
+    }
+    if (journal_end(journal, rc) != 0) return -1;
+    return journal_note(journal, line, key, state);
+}
+
+// When the buffered records are due to be synced, 0 if there are none
+double journal_sync_due(const struct Journal *journal) {
+    return journal->pending.len ? journal->pending_since + journal->sync_interval : 0;
+}
+
+// Write and sync the buffered records once JOURNAL_SYNC_RECORDS are pending or
+// the oldest has waited sync_interval, or now if force. Returns 0, or -1 once a
+// write has failed (journal->error tells why).
+int journal_sync(struct Journal *journal, double now, int force) {
+    if (journal->error) return -1;
+    if (journal->pending.len == 0) return 0;
+    if (!force && journal->pending_records < JOURNAL_SYNC_RECORDS && now < journal_sync_due(journal)) return 0;
+    
+    size_t written = 0;
+    while (written < journal->pending.len) {
+        ssize_t n = write(journal->fd, journal->pending.data + written, journal->pending.len - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            journal->error = errno;
+            return -1;
+        }
+        written += (size_t)n;
+        journal->size += (uint64_t)n;
+    }
+    journal->pending.len = 0;
+    journal->pending_records = 0;
+    if (fdatasync(journal->fd) != 0) {
+        journal->error = errno;
+        return -1;
+    }
+    return 0;
+}
+
+// Write the index of the operations that were sent or done, replacing it atomically
+static int journal_save_index(struct Journal *journal) {
+    char index_path[PATH_MAX + 8], tmp_path[PATH_MAX + 40];
+    snprintf(index_path, sizeof(index_path), "%s.idx", journal->path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", index_path, (long)getpid());
+    
+    struct JournalIndexHeader header = {0};
+    memcpy(header.magic, JOURNAL_INDEX_MAGIC, 4);
+    header.version = JOURNAL_INDEX_VERSION;
+    header.covered = journal->size;
+    for (size_t i = 0; i < journal->count; i++) {
+        if (journal->entries[i].state == JOURNAL_SENT || journal->entries[i].state == JOURNAL_DONE) {
+            header.entry_count++;
+        }
+    }
+    if (journal_tail_hash(journal->fd, header.covered, &header.tail_hash) != 0) return -1;
+    
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) return -1;
+    int failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+    for (size_t i = 0; i < journal->count && !failed; i++) {
+        const struct JournalEntry *entry = &journal->entries[i];
+        if (entry->state != JOURNAL_SENT && entry->state != JOURNAL_DONE) continue;
+        failed = fwrite(entry, sizeof(*entry), 1, fp) != 1;
+    }
+    failed |= fclose(fp) != 0;
+    if (failed || rename(tmp_path, index_path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Sync what is buffered, update the index and release the journal. Returns 0,
+// or the errno of a record that could not be written; failing to update the
+// index only makes the journal slower to open.
+int journal_close(struct Journal *journal) {
+    int rc = 0;
+    if (journal->fd >= 0 && journal->path) {
+        journal_sync(journal, 0, 1);
+        rc = journal->error;
+        if (rc == 0 && journal->size > 0) journal_save_index(journal);
+    }
+    if (journal->fd >= 0) close(journal->fd);
+    free(journal->path);
+    free(journal->pending.data);
+    free(journal->entries);
+    hash_index_free(&journal->index);
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    return rc;
+}
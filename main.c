@@ -1,29 +1,557 @@
 // DIGINET DNS API Client using libcurl
 // Manual SOAP XML construction for exact format compatibility
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
+#include "gidinet_internal.h"
 
 #define VERSION "v0.1"
 
-struct APIResponse {
-    char *data;
-    size_t size;
+struct ZoneCacheWriter;
+
+// Output formats of the list command (--format)
+enum OutputFormat {
+    OUTPUT_JSON = 0,              // One JSON document
+    OUTPUT_NDJSON,                // One line per record, then a result line
+    OUTPUT_CSV,                   // A header row, then one row per record
+    OUTPUT_BIND,                  // Zone file lines, as read by sync --file
+    OUTPUT_BINARY                 // A snapshot file, as written by the snapshot command
+};
+
+// Output state of a listing
+struct ListDisplay {
+    const char *domain;           // Added to the result when listing several domains
+    const char *zone;             // Domain being listed, NULL if unknown
+    int header_printed;
+    int result_code;
+    int failed;                   // Formats without a result member: the listing failed
+    long record_count;
+    struct SnapshotWriter snapshot; // Collects the records in the binary format
+    struct ZoneCacheWriter *cache; // Receives parsed records when refreshing the cache
+    const struct RequestTimings *timings; // Of the request, NULL when served from the cache
+};
+
+// On-disk zone cache file layout: header, key (username NUL domain), records,
+// result text. Each record is u32 fields, i32 ttl, i32 priority, u8 readOnly,
+// u8 suspended, then domain/host/type/data/suspensionReason as u32 length +
+// bytes + NUL, so that strings can be used in place from a mapping.
+#define ZONE_CACHE_MAGIC "GDZC"
+#define ZONE_CACHE_VERSION 1
+
+struct ZoneCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t fetched_at;
+    int32_t result_code;
+    int32_t result_subcode;
+    int32_t item_count;
+    uint32_t record_count;
+    uint32_t key_len;
+    uint32_t text_len;
+};
+
+struct ZoneCacheWriter {
+    FILE *fp;
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 32];
+    uint32_t record_count;
+    uint32_t key_len;
+    int failed;
+};
+
+enum BatchOpType {
+    BATCH_OP_INVALID = 0,
+    BATCH_OP_ADD,
+    BATCH_OP_UPDATE,
+    BATCH_OP_DELETE
+};
+
+// One line of batch input
+struct BatchOperation {
+    enum BatchOpType type;
+    struct DNSRecord record;      // Record to add/delete, or the old record for update
+    struct DNSRecord new_record;  // New record for update
+    enum RequestLane lane;        // "lane" member; CSV lines are normal
+};
+
+typedef int (*json_member_cb)(const char *key, const char *value, void *ctx);
+
+// Line-at-a-time reader over a file descriptor that can wait for input with a
+// timeout, which stdio cannot do without hiding lines in its own buffer
+struct LineReader {
+    int fd;
+    struct GrowBuffer buf;
+    size_t start;                 // First unread byte of buf
+    int eof;
+};
+
+struct BatchItem {
+    int line;
+    struct BatchOperation op;
+    const char *error;
+    const char *skipped;          // Not sent: "noop" or "journaled"
+    int *merged;                  // Later input lines folded into this operation
+    uint64_t *merged_keys;        // and their journal keys
+    int merged_count;
+    uint64_t key;                 // Hash of the operation, with its line its identity in the journal
+    int journaled;                // Its queued record was journaled
+    int in_doubt;                 // A previous run sent it without journaling a result
+    double ready_at;              // When a held operation is due to be sent
+    double queued_at;             // When it entered its lane
+};
+
+#define COALESCE_MAX_HELD 65536  // Held operations beyond this are sent right away
+
+// Operations held back for a while so that later ones on the same record can
+// be folded into them (--coalesce). Items are released oldest first.
+struct CoalesceQueue {
+    struct BatchItem **items;
+    size_t head;                  // Next item to release
+    size_t count;
+    size_t cap;
+    struct HashIndex index;       // Hash of (domain, host, type) -> position of an item touching it
+    double window;                // Seconds an operation is held
+};
+
+#define BATCH_MAX_QUEUED 65536   // Input is not read further ahead than this
+
+// Operations of one priority lane waiting for a transfer slot, oldest first
+struct LaneQueue {
+    struct BatchItem **items;
+    size_t head;
+    size_t count;
+    size_t cap;
+    unsigned long dispatched;
+    double wait_sum, wait_max;    // Seconds dispatched operations spent queued
+};
+
+// State of a running batch command
+struct BatchContext {
+    const char *username;
+    const char *passwordB64;
+    struct LineReader reader;     // Input is read ahead into the lanes
+    int eof;
+    int poll_input;               // The input is a pipe or terminal, not a regular file
+    int line_no;
+    int total, succeeded, failed, errors;
+    int coalesced, skipped;
+    struct LaneQueue lanes[LANE_COUNT];
+    size_t queued;                // Operations in all lanes
+    int lanes_used;               // Some operation asked for a lane other than normal
+    struct RequestEngine *engine;
+    struct RequestMetrics *metrics;   // NULL unless --metrics was given
+    struct CoalesceQueue *coalesce;   // NULL unless --coalesce was given
+    struct Journal *journal;          // NULL unless --journal was given
+    int resumed, in_doubt;
+};
+
+// What became of one operation of a transaction
+enum TxnOutcome {
+    TXN_NOT_APPLIED = 0,          // Never sent, or its rollback found nothing to undo
+    TXN_APPLIED,
+    TXN_FAILED,                   // The API refused it
+    TXN_UNKNOWN,                  // Transport error: it may or may not have been applied
+    TXN_ROLLED_BACK,
+    TXN_ROLLBACK_FAILED
+};
+
+// One operation of a transaction with its compensating operation
+struct TxnItem {
+    int line;
+    struct BatchOperation op;
+    struct BatchOperation undo;   // Borrows the strings of op and of the zone snapshot
+    enum TxnOutcome outcome;
+    struct APIResult result;
+    const char *error;            // Transport error of the operation, or NULL
+    struct RequestTimings timings;
+    int submitted;                // The operation was handed to the engine
+    int undone;                   // A compensating operation was sent
+    struct APIResult undo_result;
+    const char *undo_error;
+    struct RequestTimings undo_timings;
+};
+
+// State of a batch run as a transaction
+struct TxnContext {
+    const char *username;
+    const char *passwordB64;
+    struct TxnItem *items;
+    size_t count;
+    size_t cap;
+    size_t next;
+    int aborting;                 // An operation failed: start no more and roll back
+    char **domains;               // Domains the operations touch
+    size_t domain_count;
+    struct SoapParser *parsers;   // One per domain, filling current
+    struct RecordSet current;
+    const char *list_error;
+};
+
+// State of a list command over several domains
+struct ListContext {
+    const char *username;
+    const char *passwordB64;
+    char **domains;               // From --domain options, listed first
+    int domain_count;
+    int next_domain;
+    FILE *input;                  // Then one domain per line, NULL if none
+    char *line;
+    size_t line_cap;
+    int merge;                    // One JSON document instead of a line per domain
+    int total, succeeded, failed, errors;
+    long records;
+    struct SoapParser parser;     // Reused by every listing
+    struct RequestMetrics *metrics;   // NULL unless --metrics was given
+};
+
+// Settings of the daemon command
+struct DaemonConfig {
+    const char *username;
+    const char *passwordB64;
+    const char *domain;
+    const char *host;
+    const char *type;             // A or AAAA
+    const char *interface;        // NULL: any interface
+    int ttl;                      // 0: keep the TTL/priority of the existing record
+    int priority;
+    int interval;                 // Seconds between address polls
+    int debounce;                 // Seconds a new address must be stable
+    int jitter;                   // Random extra delay before pushing, in seconds
+    const char *metrics_path;     // Prometheus text file rewritten after each request, or NULL
+};
+
+struct DaemonState {
+    const struct DaemonConfig *config;
+    struct GidinetClient *client; // Kept open for the life of the daemon
+    char pushed[256];             // Data of the record as last seen or pushed
+    int ttl;
+    int priority;
+    int have_record;
+    int synced;
+    struct RequestMetrics metrics;
+    struct SoapParser parser;     // Reused by every listing
+};
+
+// A watched zone and what its last listing held
+struct WatchZone {
+    const char *domain;
+    double due;                   // When it is next polled
+    int polled;                   // digest and records hold a listing
+    uint64_t digest;              // Hash of the last listing's response body
+    struct RecordSet records;
+    struct HashIndex index;       // Record key hash -> position in records
+};
+
+// State of a running watch command
+struct WatchContext {
+    const char *username;
+    const char *passwordB64;
+    struct WatchZone *zones;
+    size_t zone_count;
+    struct WatchZone **queue;     // Zones not being polled, a min-heap on due
+    size_t queued;
+    int interval;
+    int jitter;
+    struct RequestEngine *engine;
+    struct SoapParser parser;
+    unsigned long polls, unchanged, changed, errors;
+};
+
+// A connection to the gateway (serve)
+struct ServeClient {
+    int fd;                       // -1 once closed
+    struct GrowBuffer in;         // Received bytes not yet handled
+    struct GrowBuffer out;        // Response bytes not yet written
+    size_t sent;                  // Bytes of out already written
+    int busy;                     // Its current request waits for the API; later ones stay in in
+    int continued;                // 100 Continue was sent for the request at the start of in
+    int eof;                      // The peer sent everything it will send
+    int close_after;              // Close once out is written
+};
+
+enum ServeKind {
+    SERVE_READ,                   // Answer with the records of a zone
+    SERVE_LIST,                   // Refresh the records of a zone
+    SERVE_WRITE                   // Apply a change
+};
+
+struct ServeZone;
+
+struct ServeRequest {
+    enum ServeKind kind;
+    struct ServeClient *client;   // NULL for a listing
+    struct ServeZone *zone;
+    struct BatchOperation op;     // Change to apply
+    char *host, *type;            // Read filter, NULL for any
+    unsigned long generation;     // Of the zone when a listing started
+    double ready_at;              // A held write is sent at this time (--coalesce)
+    struct ServeRequest *merged;  // Writes folded into this one, answered along with it
+    const char *skipped;          // Not sent: "noop"
+    struct ServeRequest *next;    // In the upstream queue, the held writes or a zone's waiting list
 };
 
-// Function to translate result codes to human-readable messages
-const char* get_result_code_message(int result_code) {
-    switch (result_code) {
-        case 0: return "Operation successful";
-        case 1: return "Authentication failed";
-        case 2: return "Operation failed - cannot modify read-only value";
-        case 3: return "Operation failed - invalid parameters";
-        case 4: return "Operation failed - undefined error";
-        case 5: return "Operation failed - object not found";
-        case 6: return "Operation failed - object in use";
-        default: return "Unknown result code";
+// Cached records of one domain
+struct ServeZone {
+    char *domain;
+    struct RecordSet records;
+    struct HashIndex index;       // Hash of (host, type) -> record
+    double listed_at;
+    int current;                  // No change was made through the gateway since the listing
+    unsigned long generation;     // Bumped by every change made through the gateway
+    int listing;                  // A listing is in flight
+    struct ServeRequest *waiting; // Reads waiting for it
+};
+
+// State of the gateway. A single event loop: the request engine waits on the
+// listening socket and the clients along with its transfers, serves them through
+// serve_tick on every turn, and calls serve_source whenever it could start a
+// request. Responses go out as their requests finish, in any order.
+struct ServeContext {
+    const char *username;
+    const char *passwordB64;
+    int listen_fd;
+    int accept_paused;            // Out of descriptors: accept again once a client closes
+    int stopping;                 // Stop requested: no more input is read
+    int cache_ttl;
+    struct RequestEngine *engine;
+    struct ServeClient **clients;
+    size_t client_count;
+    size_t client_cap;
+    struct pollfd *polls;         // Listening socket, then the clients
+    struct curl_waitfd *wait_fds; // The same, for the engine to wait on
+    struct ServeZone **zones;
+    size_t zone_count;
+    size_t zone_cap;
+    struct HashIndex zone_index;  // Hash of the domain -> zone
+    struct ServeRequest *queue;   // Waiting for an engine slot
+    struct ServeRequest *queue_tail;
+    double coalesce;              // Seconds writes are held for later ones to fold into, -1 for none
+    struct ServeRequest *held;    // Writes being held, oldest first
+    struct ServeRequest *held_tail;
+    struct SoapParser parser;     // Reused by every listing
+    struct GrowBuffer body;       // Response body being built
+    unsigned long requests;
+    unsigned long coalesced;
+};
+
+// One step of a sync plan, referring to records by index
+struct SyncOperation {
+    enum BatchOpType type;
+    size_t current;               // Record to delete / old record of an update
+    size_t desired;               // Record to add / new record of an update
+};
+
+#define SYNC_KEEP_CURRENT INT_MIN  // Desired ttl/priority left out: keep the current value
+#define ZONE_DEFAULT_TTL 3600      // TTL of a new record that gives none, as in a zone file
+
+struct SyncPlan {
+    struct SyncOperation *ops;
+    size_t count;
+    size_t adds, updates, deletes, unchanged, kept_read_only;
+};
+
+// State of a running sync command
+struct SyncContext {
+    const char *username;
+    const char *passwordB64;
+    const char *domain;
+    struct RecordSet *current;
+    struct RecordSet *desired;
+    struct SoapParser parser;
+    int listed;
+    CURLcode list_result;
+    const char *list_error;
+    struct SyncPlan plan;
+    size_t next;
+    int succeeded, failed, errors;
+};
+
+// Buffered output. Everything the commands print goes through one writer that
+// hands stdout large blocks instead of making a stdio call per field. Usage
+// texts and argument errors, printed before any output, still use printf.
+#define OUTPUT_BUFFER_SIZE 65536
+
+struct OutputWriter {
+    size_t len;
+    int csv_header_printed;       // The CSV header goes before the first row only
+    struct GrowBuffer *capture;   // While set, output is collected here instead (serve responses)
+    int capture_failed;
+    char buf[OUTPUT_BUFFER_SIZE];
+};
+
+static struct OutputWriter out;
+
+// Set by --format (or --stream for ndjson)
+static enum OutputFormat output_format = OUTPUT_JSON;
+
+// Set by --host, --type, --data and --limit of list; NULL lists every record
+static const struct RecordFilter *list_filter = NULL;
+
+// Select the output format by name. Returns -1 if there is no such format.
+int set_output_format(const char *name) {
+    static const char *names[] = { "json", "ndjson", "csv", "bind", "binary" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            output_format = (enum OutputFormat)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void out_sink(const char *data, size_t len) {
+    if (!out.capture) {
+        fwrite(data, 1, len, stdout);
+    } else if (buffer_append(out.capture, data, len) != 0) {
+        out.capture_failed = 1;
+    }
+}
+
+// Hand the buffered bytes to stdio
+static void out_drain(void) {
+    if (out.len > 0) out_sink(out.buf, out.len);
+    out.len = 0;
+}
+
+// Collect the output in buf instead of writing it to stdout, until out_capture_end()
+static void out_capture_begin(struct GrowBuffer *buf) {
+    out_drain();
+    buf->len = 0;
+    out.capture = buf;
+    out.capture_failed = 0;
+}
+
+// Returns -1 if some of the output could not be collected
+static int out_capture_end(void) {
+    out_drain();
+    out.capture = NULL;
+    return out.capture_failed ? -1 : 0;
+}
+
+// Push the buffered output all the way out, for lines someone is waiting for
+void out_flush(void) {
+    out_drain();
+    fflush(stdout);
+}
+
+void out_write(const char *data, size_t len) {
+    if (len > sizeof(out.buf) - out.len) {
+        out_drain();
+        if (len > sizeof(out.buf)) {
+            out_sink(data, len);
+            return;
+        }
+    }
+    memcpy(out.buf + out.len, data, len);
+    out.len += len;
+}
+
+// Append a string literal, its length known at compile time
+#define out_literal(str) out_write(str, sizeof(str) - 1)
+
+static void out_str(const char *str) {
+    out_write(str, strlen(str));
+}
+
+static void out_char(char c) {
+    if (out.len == sizeof(out.buf)) out_drain();
+    out.buf[out.len++] = c;
+}
+
+static void out_long(long value) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long v = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) *--p = '-';
+    out_write(p, (size_t)(digits + sizeof(digits) - p));
+}
+
+// Format into the buffer; for the rare numbers and summaries off the hot paths
+void out_printf(const char *format, ...) {
+    size_t room = sizeof(out.buf) - out.len;
+    va_list args;
+    
+    va_start(args, format);
+    int n = vsnprintf(out.buf + out.len, room, format, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n < room) {
+        out.len += n;
+        return;
+    }
+    
+    // Did not fit: start a fresh buffer, or leave very long text to stdio
+    out_drain();
+    va_start(args, format);
+    if ((size_t)n < sizeof(out.buf)) {
+        vsnprintf(out.buf, sizeof(out.buf), format, args);
+        out.len = n;
+    } else if (out.capture) {
+        char *text;
+        if (vasprintf(&text, format, args) < 0) {
+            out.capture_failed = 1;
+        } else {
+            out_sink(text, (size_t)n);
+            free(text);
+        }
+    } else {
+        vfprintf(stdout, format, args);
+    }
+    va_end(args);
+}
+
+// Word-at-a-time byte tests, checking eight bytes with a few integer operations.
+// Either is nonzero if some byte of the word x is below n (n <= 128) or equals c.
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_HAS_LESS(x, n) (((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+#define SWAR_HAS_BYTE(x, c) SWAR_HAS_LESS((x) ^ (SWAR_ONES * (unsigned char)(c)), 1)
+
+static int json_safe_byte(unsigned char c) {
+    return c >= 0x20 && c != '"' && c != '\\';
+}
+
+// Length of the leading run of str that goes into a JSON string unchanged
+static size_t json_safe_run(const char *str, size_t len) {
+    size_t i = 0;
+    
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, str + i, 8);
+        if (SWAR_HAS_LESS(word, 0x20) | SWAR_HAS_BYTE(word, '"') | SWAR_HAS_BYTE(word, '\\')) break;
     }
+    while (i < len && json_safe_byte((unsigned char)str[i])) i++;
+    return i;
 }
 
 // Function to decode result sub code flags (basic implementation)
@@ -32,638 +560,4506 @@ void print_result_subcode_info(int sub_code) {
         return; // No additional information
     }
     
-    printf("Additional error details (sub-code %d):\n", sub_code);
+    out_printf("Additional error details (sub-code %d):\n", sub_code);
     
     // Common DNS-related bit flags (these would need to be specific per API operation)
-    if (sub_code & (1 << 0)) printf("  - Bit 0: Domain validation issue\n");
-    if (sub_code & (1 << 1)) printf("  - Bit 1: Host validation issue\n");
-    if (sub_code & (1 << 2)) printf("  - Bit 2: Record type validation issue\n");
-    if (sub_code & (1 << 3)) printf("  - Bit 3: Data validation issue\n");
-    if (sub_code & (1 << 4)) printf("  - Bit 4: TTL validation issue\n");
-    if (sub_code & (1 << 5)) printf("  - Bit 5: Priority validation issue\n");
+    if (sub_code & (1 << 0)) out_literal("  - Bit 0: Domain validation issue\n");
+    if (sub_code & (1 << 1)) out_literal("  - Bit 1: Host validation issue\n");
+    if (sub_code & (1 << 2)) out_literal("  - Bit 2: Record type validation issue\n");
+    if (sub_code & (1 << 3)) out_literal("  - Bit 3: Data validation issue\n");
+    if (sub_code & (1 << 4)) out_literal("  - Bit 4: TTL validation issue\n");
+    if (sub_code & (1 << 5)) out_literal("  - Bit 5: Priority validation issue\n");
     // Add more specific mappings as needed per API operation
 }
 
-static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct APIResponse *response = (struct APIResponse *)userp;
+// Helper function to escape JSON strings. Runs of plain bytes are copied in
+// one go; only quotes, backslashes and control characters are escaped singly.
+void print_json_string(const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    if (!str) return;
     
-    char *ptr = realloc(response->data, response->size + realsize + 1);
-    if (!ptr) {
-        printf("Not enough memory (realloc returned NULL)\n");
-        return 0;
+    size_t len = strlen(str);
+    out_char('"');
+    for (;;) {
+        size_t run = json_safe_run(str, len);
+        out_write(str, run);
+        if (run == len) break;
+        
+        unsigned char c = (unsigned char)str[run];
+        switch (c) {
+            case '"':
+                out_literal("\\\"");
+                break;
+            case '\\':
+                out_literal("\\\\");
+                break;
+            case '\b':
+                out_literal("\\b");
+                break;
+            case '\f':
+                out_literal("\\f");
+                break;
+            case '\n':
+                out_literal("\\n");
+                break;
+            case '\r':
+                out_literal("\\r");
+                break;
+            case '\t':
+                out_literal("\\t");
+                break;
+            default: {
+                char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+                out_write(escape, sizeof(escape));
+                break;
+            }
+        }
+        str += run + 1;
+        len -= run + 1;
+    }
+    out_char('"');
+}
+
+// Print the "result" member of a JSON object
+void print_result_json(const struct APIResult *result) {
+    out_literal("\"result\":{\"code\":");
+    out_long(result->code);
+    out_literal(",\"message\":");
+    print_json_string(gidinet_result_code_message(result->code));
+    out_literal(",\"subCode\":");
+    out_long(result->subcode);
+    if (result->text) {
+        out_literal(",\"text\":");
+        print_json_string(result->text);
+    }
+    out_char('}');
+}
+
+// Set by --timings: results carry a "timings" member
+static int show_timings = 0;
+
+// Set by --endpoint; NULL uses $GIDINET_ENDPOINT or the built-in endpoint
+static const char *endpoint = NULL;
+
+// Retries, timeouts and circuit breaker (--retries, --timeout, --deadline, ...)
+static struct RetryPolicy policy;
+
+// Set by --batch-deadline: seconds a whole batch or sync may take, 0 for no limit
+static double batch_deadline = 0;
+
+// Set by --reserve: batch transfer slots only urgent operations may take
+static int reserved_slots = 1;
+
+// Set by --journal, --journal-sync and --resume: journal batch operations and
+// their results, and skip the operations a previous run completed
+static const char *journal_path = NULL;
+static int journal_sync_ms = 50;
+static int resume = 0;
+
+// Set by --rate, --burst and --adaptive: pace the requests of the account
+static double rate_limit = 0, rate_burst = 0;
+static int adaptive = 0;
+
+// Set by --prewarm: set up the connection while the input is still being read
+static int prewarm = 0;
+
+// Set by --http1.1: do not negotiate HTTP/2
+static int force_http1 = 0;
+
+// Set by --tls-session-cache or $GIDINET_TLS_SESSION_CACHE: file keeping TLS sessions
+// between runs, so that the next run resumes with an abbreviated handshake
+static const char *tls_session_cache = NULL;
+
+// Print ,"timings":{...} when --timings was given
+void print_timings_json(const struct RequestTimings *timings) {
+    if (!show_timings || !timings) return;
+    out_printf(",\"timings\":{\"nameLookup\":%.6f,\"connect\":%.6f,\"appConnect\":%.6f,\"startTransfer\":%.6f,"
+               "\"total\":%.6f,\"parse\":%.6f,\"bytesSent\":%" CURL_FORMAT_CURL_OFF_T
+               ",\"bytesReceived\":%" CURL_FORMAT_CURL_OFF_T ",\"httpCode\":%ld,\"attempts\":%d,\"retryWait\":%.6f}",
+               timings->name_lookup, timings->connect, timings->app_connect, timings->start_transfer,
+               timings->total, timings->parse, timings->bytes_sent, timings->bytes_received, timings->http_code,
+               timings->attempts, timings->retry_wait);
+}
+
+// Print one record of a list result as a JSON object
+void print_list_record_json(const struct ListRecord *record) {
+    const char *sep = "";
+    
+    out_char('{');
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_DOMAIN)) {
+        out_literal("\"domain\":");
+        print_json_string(record->domain);
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_HOST)) {
+        out_str(sep);
+        out_literal("\"host\":");
+        print_json_string(record->host);
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_TYPE)) {
+        out_str(sep);
+        out_literal("\"type\":");
+        print_json_string(record->type);
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_DATA)) {
+        out_str(sep);
+        out_literal("\"data\":");
+        print_json_string(record->data);
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_TTL)) {
+        out_str(sep);
+        out_literal("\"ttl\":");
+        out_long(record->ttl);
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_PRIORITY)) {
+        out_str(sep);
+        out_literal("\"priority\":");
+        out_long(record->priority);
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_READONLY)) {
+        out_str(sep);
+        out_str(record->read_only ? "\"readOnly\":true" : "\"readOnly\":false");
+        sep = ",";
+    }
+    if (record->fields & LIST_FIELD_BIT(SOAP_FIELD_SUSPENDED)) {
+        out_str(sep);
+        out_str(record->suspended ? "\"suspended\":true" : "\"suspended\":false");
+        sep = ",";
+    }
+    if (record->suspension_reason[0]) {
+        out_str(sep);
+        out_literal("\"suspensionReason\":");
+        print_json_string(record->suspension_reason);
+    }
+    out_char('}');
+}
+
+// Append a CSV field, quoted only when it holds a separator, quote or line break
+static void print_csv_field(const char *str) {
+    size_t len = strlen(str);
+    if (strcspn(str, ",\"\r\n") == len) {
+        out_write(str, len);
+        return;
+    }
+    
+    out_char('"');
+    for (;;) {
+        const char *quote = strchr(str, '"');
+        if (!quote) break;
+        out_write(str, (size_t)(quote - str));
+        out_literal("\"\"");
+        str = quote + 1;
+    }
+    out_str(str);
+    out_char('"');
+}
+
+// Print one record as a CSV row, in the columns of the header
+static void print_list_record_csv(const struct ListRecord *record) {
+    print_csv_field(record->domain);
+    out_char(',');
+    print_csv_field(record->host);
+    out_char(',');
+    print_csv_field(record->type);
+    out_char(',');
+    print_csv_field(record->data);
+    out_char(',');
+    out_long(record->ttl);
+    out_char(',');
+    out_long(record->priority);
+    out_str(record->read_only ? ",true," : ",false,");
+    out_str(record->suspended ? "true," : "false,");
+    print_csv_field(record->suspension_reason);
+    out_char('\n');
+}
+
+// Print a zone file character string, with quotes and backslashes escaped
+static void print_zone_string(const char *str) {
+    out_char('"');
+    for (;;) {
+        size_t run = strcspn(str, "\"\\");
+        out_write(str, run);
+        if (!str[run]) break;
+        out_char('\\');
+        out_char(str[run]);
+        str += run + 1;
+    }
+    out_char('"');
+}
+
+// Print one record as a zone file line: owner ttl IN type [priority] rdata.
+// TXT data, and data the zone file reader would split or cut, is quoted.
+static void print_list_record_bind(const struct ListRecord *record) {
+    int has_priority = strcmp(record->type, "MX") == 0 || strcmp(record->type, "SRV") == 0;
+    
+    out_str(record->host[0] ? record->host : "@");
+    out_char(' ');
+    out_long(record->ttl);
+    out_literal(" IN ");
+    out_str(record->type);
+    out_char(' ');
+    if (has_priority) {
+        out_long(record->priority);
+        out_char(' ');
+    }
+    if (strcmp(record->type, "TXT") == 0 || !record->data[0] || strpbrk(record->data, "\";\\")) {
+        print_zone_string(record->data);
+    } else {
+        out_str(record->data);
+    }
+    out_char('\n');
+}
+
+// Print "domain":"...", leading the result of a multi-domain listing
+static void print_list_domain_json(const struct ListDisplay *display) {
+    if (!display->domain) return;
+    out_literal("\"domain\":");
+    print_json_string(display->domain);
+    out_char(',');
+}
+
+// Prepare a display for a listing of zone (NULL if unknown) in the output format
+int list_display_init(struct ListDisplay *display, const char *zone) {
+    memset(display, 0, sizeof(*display));
+    display->zone = zone;
+    if (output_format == OUTPUT_BINARY && snapshot_writer_init(&display->snapshot) != 0) return -1;
+    return 0;
+}
+
+void list_display_free(struct ListDisplay *display) {
+    if (output_format == OUTPUT_BINARY) snapshot_writer_free(&display->snapshot);
+}
+
+// Print the result header of the listing
+void list_display_begin(struct ListDisplay *display, const struct APIResult *result) {
+    display->result_code = result->code;
+    display->header_printed = 1;
+    
+    switch (output_format) {
+        case OUTPUT_JSON:
+            out_char('{');
+            print_list_domain_json(display);
+            print_result_json(result);
+            // If successful, records follow
+            if (result->code == 0) out_literal(",\"records\":[");
+            break;
+        case OUTPUT_CSV:
+            if (result->code == 0 && !out.csv_header_printed) {
+                out_literal("domain,host,type,data,ttl,priority,readOnly,suspended,suspensionReason\n");
+                out.csv_header_printed = 1;
+            }
+            break;
+        case OUTPUT_BIND:
+            if (result->code == 0 && display->zone) {
+                out_literal("$ORIGIN ");
+                out_str(display->zone);
+                out_literal(".\n");
+            }
+            break;
+        default:
+            // NDJSON puts the result on the last line, after the records;
+            // a snapshot is written once all records are known
+            break;
+    }
+}
+
+// Print one record, as soon as it is known
+void list_display_record(struct ListDisplay *display, const struct ListRecord *record) {
+    if (display->result_code != 0) return;
+    switch (output_format) {
+        case OUTPUT_JSON:
+            if (display->record_count > 0) out_char(',');
+            print_list_record_json(record);
+            break;
+        case OUTPUT_NDJSON:
+            print_list_record_json(record);
+            out_char('\n');
+            break;
+        case OUTPUT_CSV:
+            print_list_record_csv(record);
+            break;
+        case OUTPUT_BIND:
+            print_list_record_bind(record);
+            break;
+        case OUTPUT_BINARY:
+            snapshot_writer_add(&display->snapshot, record);
+            break;
+    }
+    display->record_count++;
+}
+
+// Close the list document. A transfer error after output started is reported
+// in an "error" member so that the output stays valid JSON. The formats that
+// only carry records report failures on stderr and set display->failed.
+void list_display_end(struct ListDisplay *display, const struct APIResult *result, int item_count,
+                      const char *error) {
+    if (output_format != OUTPUT_JSON && output_format != OUTPUT_NDJSON) {
+        const char *zone = display->zone ? display->zone : "records";
+        if (error) {
+            fprintf(stderr, "Listing %s failed: %s\n", zone, error);
+            display->failed = 1;
+        } else if (result->code != 0) {
+            fprintf(stderr, "Listing %s failed: %s (result code %d)\n", zone,
+                    result->text ? result->text : gidinet_result_code_message(result->code), result->code);
+            display->failed = 1;
+        } else if (output_format == OUTPUT_BINARY) {
+            out_drain();
+            if (snapshot_writer_write(&display->snapshot, display->zone, stdout) != 0) {
+                fprintf(stderr, "Failed to write snapshot of %s\n", zone);
+                display->failed = 1;
+            }
+        }
+        return;
+    }
+    
+    if (output_format == OUTPUT_NDJSON) {
+        out_char('{');
+        print_list_domain_json(display);
+        print_result_json(result);
+        if (result->code == 0) {
+            out_literal(",\"recordCount\":");
+            out_long(display->record_count);
+        }
+    } else if (display->result_code == 0) {
+        out_char(']');
+        // Add record count if available; filtered, it is the count of matches
+        if (list_filter) {
+            out_literal(",\"recordCount\":");
+            out_long(display->record_count);
+        } else if (item_count >= 0) {
+            out_literal(",\"recordCount\":");
+            out_long(item_count);
+        }
+    }
+    if (error) {
+        out_literal(",\"error\":");
+        print_json_string(error);
+    }
+    print_timings_json(display->timings);
+    out_literal("}\n");
+}
+
+void zone_cache_writer_add(struct ZoneCacheWriter *writer, const struct ListRecord *record);
+
+// Parser callbacks driving the list display
+static void list_parser_header(void *ctx, const struct SoapParser *parser) {
+    struct APIResult result;
+    soap_parser_get_result(parser, &result);
+    list_display_begin(ctx, &result);
+    free(result.text);
+}
+
+static void list_parser_record(void *ctx, const struct ListRecord *record) {
+    struct ListDisplay *display = ctx;
+    if (display->cache && display->result_code == 0) zone_cache_writer_add(display->cache, record);
+    list_display_record(display, record);
+}
+
+static void list_parser_finish(struct ListDisplay *display, struct SoapParser *parser, const char *error) {
+    struct APIResult result;
+    soap_parser_finish(parser);
+    soap_parser_get_result(parser, &result);
+    list_display_end(display, &result, parser->item_count, error);
+    free(result.text);
+}
+
+void parse_and_display_list_result(const char *response_data) {
+    if (!response_data) {
+        out_literal("{\"error\": \"No response data to parse\"}\n");
+        return;
+    }
+    
+    struct ListDisplay display;
+    if (list_display_init(&display, NULL) != 0) {
+        fprintf(stderr, "Not enough memory\n");
+        return;
+    }
+    struct SoapParser parser;
+    soap_parser_init(&parser, list_parser_header, list_parser_record, &display);
+    parser.filter = list_filter;
+    soap_parser_feed(&parser, response_data, strlen(response_data));
+    list_parser_finish(&display, &parser, NULL);
+    soap_parser_free(&parser);
+    list_display_free(&display);
+}
+
+void parse_and_display_simple_result(const char *response_data) {
+    if (!response_data) {
+        out_literal("{\"error\":\"No response data to parse\"}\n");
+        return;
+    }
+    
+    struct APIResult result;
+    parse_simple_result(response_data, &result);
+    
+    // Output JSON
+    out_char('{');
+    print_result_json(&result);
+    out_literal("}\n");
+    
+    free(result.text);
+}
+
+void parse_and_display_result(const char *response_data) {
+    if (!response_data) {
+        out_literal("No response data to parse.\n");
+        return;
+    }
+    
+    struct APIResult result;
+    parse_simple_result(response_data, &result);
+    
+    out_literal("\n=== API Result ===\n");
+    out_printf("Result Code: %d - %s\n", result.code, gidinet_result_code_message(result.code));
+    
+    if (result.text) {
+        out_printf("Result Text: %s\n", result.text);
+    }
+    
+    if (result.subcode > 0) {
+        print_result_subcode_info(result.subcode);
+    }
+    
+    out_literal("==================\n\n");
+    free(result.text);
+}
+
+// Directory holding cached zone listings: $GIDINET_CACHE_DIR, else
+// $XDG_CACHE_HOME/gidinet, else ~/.cache/gidinet. Created on demand.
+static int zone_cache_dir(char *dir, size_t size, int create) {
+    const char *env = getenv("GIDINET_CACHE_DIR");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    
+    if (env && *env) {
+        snprintf(dir, size, "%s", env);
+    } else if (xdg && *xdg) {
+        snprintf(dir, size, "%s/gidinet", xdg);
+    } else if (home && *home) {
+        snprintf(dir, size, "%s/.cache", home);
+        if (create) mkdir(dir, 0700);
+        snprintf(dir, size, "%s/.cache/gidinet", home);
+    } else {
+        return -1;
+    }
+    
+    if (create && mkdir(dir, 0700) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+// Cache files are named after a hash of the account and domain
+int zone_cache_path(const char *username, const char *domain, char *path, size_t size, int create) {
+    char dir[PATH_MAX];
+    if (zone_cache_dir(dir, sizeof(dir), create) != 0) return -1;
+    
+    uint64_t hash = fnv1a_hash(username, strlen(username) + 1, FNV1A_SEED);
+    hash = fnv1a_hash(domain, strlen(domain), hash);
+    
+    int n = snprintf(path, size, "%s/%016llx.zone", dir, (unsigned long long)hash);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+static size_t zone_cache_key(const char *username, const char *domain, char *key, size_t size) {
+    int n = snprintf(key, size, "%s%c%s", username, '\0', domain);
+    return (n < 0 || (size_t)n >= size) ? 0 : (size_t)n;
+}
+
+// Read a length-prefixed, NUL-terminated string from a mapped cache file
+static const char* zone_cache_read_string(const char **p, const char *end) {
+    uint32_t len;
+    if (end - *p < 4) return NULL;
+    memcpy(&len, *p, 4);
+    if ((size_t)(end - *p - 4) < (size_t)len + 1) return NULL;
+    const char *str = *p + 4;
+    *p += 4 + len + 1;
+    return str;
+}
+
+// Replay a cached listing through the list display if it is no older than
+// max_age seconds. Strings are handed out straight from the mapped file.
+// Returns 0 if the listing was served from the cache, -1 on a miss.
+int zone_cache_replay(const char *path, const char *username, const char *domain, int max_age,
+                      struct ListDisplay *display) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct ZoneCacheHeader)) {
+        close(fd);
+        return -1;
     }
     
-    response->data = ptr;
-    memcpy(&(response->data[response->size]), contents, realsize);
-    response->size += realsize;
-    response->data[response->size] = 0;
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
     
-    return realsize;
+    const char *end = map + st.st_size;
+    struct ZoneCacheHeader header;
+    memcpy(&header, map, sizeof(header));
+    
+    char key[1024];
+    size_t key_len = zone_cache_key(username, domain, key, sizeof(key));
+    int64_t age = (int64_t)time(NULL) - header.fetched_at;
+    
+    if (memcmp(header.magic, ZONE_CACHE_MAGIC, 4) != 0 || header.version != ZONE_CACHE_VERSION ||
+        age < 0 || age > max_age || header.key_len != key_len ||
+        (size_t)st.st_size < sizeof(header) + key_len + header.text_len ||
+        memcmp(map + sizeof(header), key, key_len) != 0) {
+        munmap((void *)map, st.st_size);
+        return -1;
+    }
+    
+    // The result text is stored after the records
+    end -= header.text_len;
+    char *text = strndup(end, header.text_len);
+    struct APIResult result = { header.result_code, header.result_subcode, text };
+    
+    list_display_begin(display, &result);
+    
+    const char *p = map + sizeof(header) + key_len;
+    for (uint32_t i = 0; i < header.record_count; i++) {
+        struct ListRecord record;
+        int32_t ttl, priority;
+        
+        if (end - p < 14) break;
+        memcpy(&record.fields, p, 4);
+        memcpy(&ttl, p + 4, 4);
+        memcpy(&priority, p + 8, 4);
+        record.ttl = ttl;
+        record.priority = priority;
+        record.read_only = p[12];
+        record.suspended = p[13];
+        p += 14;
+        
+        record.domain = zone_cache_read_string(&p, end);
+        record.host = record.domain ? zone_cache_read_string(&p, end) : NULL;
+        record.type = record.host ? zone_cache_read_string(&p, end) : NULL;
+        record.data = record.type ? zone_cache_read_string(&p, end) : NULL;
+        record.suspension_reason = record.data ? zone_cache_read_string(&p, end) : NULL;
+        if (!record.suspension_reason) break;
+        
+        if (list_filter && !record_filter_match(list_filter, &record)) continue;
+        list_display_record(display, &record);
+        if (list_filter && list_filter->limit > 0 && display->record_count >= list_filter->limit) break;
+    }
+    
+    list_display_end(display, &result, header.item_count, NULL);
+    
+    free(text);
+    munmap((void *)map, st.st_size);
+    return 0;
+}
+
+static int zone_cache_write_string(FILE *fp, const char *str) {
+    uint32_t len = (uint32_t)strlen(str);
+    if (fwrite(&len, 4, 1, fp) != 1) return -1;
+    return fwrite(str, 1, len + 1, fp) == len + 1 ? 0 : -1;
+}
+
+// Start writing a cache file next to its final path; records are appended as
+// they are parsed and the file only replaces the old one on commit
+int zone_cache_writer_open(struct ZoneCacheWriter *writer, const char *path,
+                           const char *username, const char *domain) {
+    memset(writer, 0, sizeof(*writer));
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+    snprintf(writer->tmp_path, sizeof(writer->tmp_path), "%s.%ld.tmp", path, (long)getpid());
+    
+    int fd = open(writer->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return -1;
+    writer->fp = fdopen(fd, "wb");
+    if (!writer->fp) {
+        close(fd);
+        unlink(writer->tmp_path);
+        return -1;
+    }
+    
+    char key[1024];
+    struct ZoneCacheHeader header = {0};
+    header.key_len = (uint32_t)zone_cache_key(username, domain, key, sizeof(key));
+    
+    // The header is rewritten with the final values on commit
+    if (header.key_len == 0 || fwrite(&header, sizeof(header), 1, writer->fp) != 1 ||
+        fwrite(key, 1, header.key_len, writer->fp) != header.key_len) {
+        writer->failed = 1;
+    }
+    writer->key_len = header.key_len;
+    return 0;
+}
+
+void zone_cache_writer_add(struct ZoneCacheWriter *writer, const struct ListRecord *record) {
+    if (!writer->fp || writer->failed) return;
+    
+    char fixed[14];
+    int32_t ttl = record->ttl, priority = record->priority;
+    memcpy(fixed, &record->fields, 4);
+    memcpy(fixed + 4, &ttl, 4);
+    memcpy(fixed + 8, &priority, 4);
+    fixed[12] = (char)record->read_only;
+    fixed[13] = (char)record->suspended;
+    
+    if (fwrite(fixed, sizeof(fixed), 1, writer->fp) != 1 ||
+        zone_cache_write_string(writer->fp, record->domain) != 0 ||
+        zone_cache_write_string(writer->fp, record->host) != 0 ||
+        zone_cache_write_string(writer->fp, record->type) != 0 ||
+        zone_cache_write_string(writer->fp, record->data) != 0 ||
+        zone_cache_write_string(writer->fp, record->suspension_reason) != 0) {
+        writer->failed = 1;
+    }
+    writer->record_count++;
+}
+
+void zone_cache_writer_abort(struct ZoneCacheWriter *writer) {
+    if (writer->fp) {
+        fclose(writer->fp);
+        unlink(writer->tmp_path);
+    }
+    writer->fp = NULL;
+}
+
+// Finish the file and atomically move it into place. Only successful listings are kept.
+int zone_cache_writer_commit(struct ZoneCacheWriter *writer, const struct APIResult *result, int item_count) {
+    if (!writer->fp) return -1;
+    if (writer->failed || result->code != 0) {
+        zone_cache_writer_abort(writer);
+        return -1;
+    }
+    
+    struct ZoneCacheHeader header = {0};
+    memcpy(header.magic, ZONE_CACHE_MAGIC, 4);
+    header.version = ZONE_CACHE_VERSION;
+    header.fetched_at = (int64_t)time(NULL);
+    header.result_code = result->code;
+    header.result_subcode = result->subcode;
+    header.item_count = item_count;
+    header.record_count = writer->record_count;
+    header.key_len = writer->key_len;
+    header.text_len = result->text ? (uint32_t)strlen(result->text) : 0;
+    
+    int failed = (header.text_len && fwrite(result->text, 1, header.text_len, writer->fp) != header.text_len) ||
+                 fseek(writer->fp, 0, SEEK_SET) != 0 ||
+                 fwrite(&header, sizeof(header), 1, writer->fp) != 1;
+    failed |= fclose(writer->fp) != 0;
+    writer->fp = NULL;
+    
+    if (failed || rename(writer->tmp_path, writer->path) != 0) {
+        unlink(writer->tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Drop the cached listing of a domain after this client changed it
+void zone_cache_invalidate(const char *username, const char *domain) {
+    char path[PATH_MAX];
+    if (username && domain && zone_cache_path(username, domain, path, sizeof(path), 0) == 0) {
+        unlink(path);
+    }
+}
+
+// Print the outcome of a client call as JSON and release the result.
+// Returns the process exit code.
+static int print_call_result(const struct GidinetClient *client, int rc, struct APIResult *result) {
+    if (rc != 0) {
+        fprintf(stderr, "Request failed: %s\n", gidinet_client_error(client));
+        gidinet_result_free(result);
+        return 1;
+    }
+    
+    out_char('{');
+    print_result_json(result);
+    print_timings_json(&client->timings);
+    out_literal("}\n");
+    gidinet_result_free(result);
+    return 0;
+}
+
+static struct GidinetClient* open_client(const char *username, const char *passwordB64) {
+    struct GidinetClient *client = gidinet_client_new(username, passwordB64);
+    if (!client) {
+        fprintf(stderr, "Failed to initialize CURL\n");
+        return NULL;
+    }
+    if (endpoint) gidinet_client_set_endpoint(client, endpoint);
+    client->policy = policy;
+    if (force_http1) gidinet_client_set_http_version(client, CURL_HTTP_VERSION_1_1);
+    if (tls_session_cache) tls_sessions_load(client->curl, tls_session_cache);
+    if (prewarm) gidinet_client_prewarm(client);
+    return client;
+}
+
+static void close_client(struct GidinetClient *client) {
+    if (tls_session_cache) tls_sessions_save(client->curl, tls_session_cache);
+    gidinet_client_free(client);
+}
+
+int call_record_update(const char *username, const char *passwordB64,
+                       const char *oldDomain, const char *oldHost, const char *oldType, 
+                       const char *oldData, int oldTTL, int oldPriority,
+                       const char *newDomain, const char *newHost, const char *newType, 
+                       const char *newData, int newTTL, int newPriority) {
+    struct DNSRecord oldRecord = { (char *)oldDomain, (char *)oldHost, (char *)oldType, (char *)oldData,
+                                   oldTTL, oldPriority };
+    struct DNSRecord newRecord = { (char *)newDomain, (char *)newHost, (char *)newType, (char *)newData,
+                                   newTTL, newPriority };
+    
+    struct GidinetClient *client = open_client(username, passwordB64);
+    if (!client) return 1;
+    
+    struct APIResult result;
+    int rc = gidinet_record_update(client, &oldRecord, &newRecord, &result);
+    if (rc == 0 && result.code == 0) {
+        zone_cache_invalidate(username, oldDomain);
+        if (strcmp(oldDomain, newDomain) != 0) zone_cache_invalidate(username, newDomain);
+    }
+    rc = print_call_result(client, rc, &result);
+    close_client(client);
+    return rc;
+}
+
+int call_record_add(const char *username, const char *passwordB64,
+                   const char *domain, const char *host, const char *type, 
+                   const char *data, int ttl, int priority) {
+    struct DNSRecord record = { (char *)domain, (char *)host, (char *)type, (char *)data, ttl, priority };
+    
+    struct GidinetClient *client = open_client(username, passwordB64);
+    if (!client) return 1;
+    
+    struct APIResult result;
+    int rc = gidinet_record_add(client, &record, &result);
+    if (rc == 0 && result.code == 0) zone_cache_invalidate(username, domain);
+    rc = print_call_result(client, rc, &result);
+    close_client(client);
+    return rc;
+}
+
+int call_record_delete(const char *username, const char *passwordB64,
+                      const char *domain, const char *host, const char *type, 
+                      const char *data, int ttl, int priority) {
+    struct DNSRecord record = { (char *)domain, (char *)host, (char *)type, (char *)data, ttl, priority };
+    
+    struct GidinetClient *client = open_client(username, passwordB64);
+    if (!client) return 1;
+    
+    struct APIResult result;
+    int rc = gidinet_record_delete(client, &record, &result);
+    if (rc == 0 && result.code == 0) zone_cache_invalidate(username, domain);
+    rc = print_call_result(client, rc, &result);
+    close_client(client);
+    return rc;
+}
+
+// Feed the parser and flush whatever records the chunk completed, so that
+// streamed output keeps pace with the download
+static size_t ListStreamWriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t written = SoapParserWriteCallback(contents, size, nmemb, userp);
+    out_flush();
+    return written;
+}
+
+int call_record_list(const char *username, const char *passwordB64, const char *domain, int cache_ttl) {
+    struct ListDisplay display;
+    if (list_display_init(&display, domain) != 0) {
+        fprintf(stderr, "Not enough memory\n");
+        return 1;
+    }
+    
+    // Serve from the local cache while it is fresh enough
+    char cache_path[PATH_MAX];
+    int use_cache = cache_ttl > 0 && zone_cache_path(username, domain, cache_path, sizeof(cache_path), 1) == 0;
+    if (use_cache && zone_cache_replay(cache_path, username, domain, cache_ttl, &display) == 0) {
+        list_display_free(&display);
+        return display.failed;
+    }
+    
+    struct GidinetClient *client = open_client(username, passwordB64);
+    if (!client) {
+        list_display_free(&display);
+        return 1;
+    }
+    
+    // The response is parsed as it arrives and records are printed as they complete.
+    // A filtered listing is partial, so it is not cached.
+    struct ZoneCacheWriter cache;
+    if (use_cache && !list_filter && zone_cache_writer_open(&cache, cache_path, username, domain) == 0) {
+        display.cache = &cache;
+    }
+    struct SoapParser parser;
+    soap_parser_init(&parser, list_parser_header, list_parser_record, &display);
+    parser.filter = list_filter;
+    
+    if (output_format == OUTPUT_NDJSON) client->list_write = ListStreamWriteCallback;
+    int rc = gidinet_record_list_parse(client, domain, &parser);
+    
+    display.timings = &client->timings;
+    if (rc != 0) {
+        const char *error = gidinet_client_error(client);
+        fprintf(stderr, "Request failed: %s\n", error);
+        if (display.header_printed) list_parser_finish(&display, &parser, error);
+        if (display.cache) zone_cache_writer_abort(display.cache);
+        rc = 1;
+    } else {
+        list_parser_finish(&display, &parser, NULL);
+        if (display.cache) {
+            struct APIResult result;
+            soap_parser_get_result(&parser, &result);
+            zone_cache_writer_commit(display.cache, &result, parser.item_count);
+            gidinet_result_free(&result);
+        }
+        rc = display.failed;
+    }
+    
+    // Cleanup
+    soap_parser_free(&parser);
+    list_display_free(&display);
+    close_client(client);
+    
+    return rc;
+}
+
+// Read the four hex digits of a \u escape, all before end. Returns 0 or -1.
+static int parse_json_hex4(const char *p, const char *end, unsigned int *value) {
+    if (end - p < 4) return -1;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (!isxdigit(c)) return -1;
+        *value = *value * 16 + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+    }
+    return 0;
+}
+
+// Parse a JSON string literal starting at the opening quote. The unescaped
+// value is returned in *out (caller frees); returns a pointer past the closing quote.
+static const char* parse_json_string(const char *p, char **out) {
+    if (*p != '"') return NULL;
+    p++;
+    
+    const char *end = p;
+    while (*end && *end != '"') {
+        if (*end == '\\' && end[1]) end++;
+        end++;
+    }
+    if (*end != '"') return NULL;
+    
+    // Unescaping never makes the value longer than its literal
+    char *value = malloc(end - p + 1);
+    if (!value) return NULL;
+    
+    char *w = value;
+    while (p < end) {
+        if (*p != '\\') {
+            *w++ = *p++;
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case 'b': *w++ = '\b'; p++; break;
+            case 'f': *w++ = '\f'; p++; break;
+            case 'n': *w++ = '\n'; p++; break;
+            case 'r': *w++ = '\r'; p++; break;
+            case 't': *w++ = '\t'; p++; break;
+            case 'u': {
+                // A high surrogate must be followed by a low one, the pair making one
+                // code point. NUL would cut the value short, so it is rejected too.
+                unsigned int cp = 0, lo = 0;
+                int bad = parse_json_hex4(p + 1, end, &cp) != 0;
+                p += 5;
+                if (!bad && cp >= 0xD800 && cp <= 0xDBFF) {
+                    bad = end - p < 6 || p[0] != '\\' || p[1] != 'u' || parse_json_hex4(p + 2, end, &lo) != 0 ||
+                          lo < 0xDC00 || lo > 0xDFFF;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                } else if (cp == 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+                    bad = 1;
+                }
+                if (bad) {
+                    free(value);
+                    return NULL;
+                }
+                if (cp < 0x80) {
+                    *w++ = (char)cp;
+                } else if (cp < 0x800) {
+                    *w++ = (char)(0xC0 | (cp >> 6));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    *w++ = (char)(0xE0 | (cp >> 12));
+                    *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    *w++ = (char)(0xF0 | (cp >> 18));
+                    *w++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    *w++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *w++ = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default: *w++ = *p++; break;
+        }
+    }
+    *w = '\0';
+    
+    *out = value;
+    return end + 1;
+}
+
+// Parse one flat JSON object ({"key":"value","n":1,...}) and call cb for every
+// member. String values are unescaped, numbers and literals are passed verbatim.
+// Nested objects and arrays are rejected. Returns a pointer past the closing brace.
+const char* parse_flat_json_object(const char *p, json_member_cb cb, void *ctx) {
+    while (isspace((unsigned char)*p)) p++;
+    if (*p != '{') return NULL;
+    p++;
+    
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '}') return p + 1;
+        
+        char *key = NULL, *value = NULL;
+        p = parse_json_string(p, &key);
+        if (!p) return NULL;
+        
+        while (isspace((unsigned char)*p)) p++;
+        if (*p != ':') {
+            free(key);
+            return NULL;
+        }
+        p++;
+        while (isspace((unsigned char)*p)) p++;
+        
+        if (*p == '"') {
+            p = parse_json_string(p, &value);
+        } else if (*p && *p != '{' && *p != '[') {
+            const char *start = p;
+            while (*p && *p != ',' && *p != '}' && !isspace((unsigned char)*p)) p++;
+            value = strndup(start, p - start);
+        } else {
+            p = NULL;
+        }
+        
+        int rc = (p && value) ? cb(key, value, ctx) : -1;
+        free(key);
+        free(value);
+        if (rc != 0) return NULL;
+        
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '}') {
+            return NULL;
+        }
+    }
+}
+
+// Split a CSV line in place. Double-quoted fields may contain commas and "" escapes.
+// Returns the number of fields stored in fields[].
+int split_csv_line(char *line, char **fields, int max_fields) {
+    int count = 0;
+    char *p = line;
+    
+    while (count < max_fields) {
+        if (*p == '"') {
+            char *w = ++p;
+            fields[count++] = w;
+            while (*p) {
+                if (*p == '"' && p[1] == '"') {
+                    *w++ = '"';
+                    p += 2;
+                } else if (*p == '"') {
+                    p++;
+                    break;
+                } else {
+                    *w++ = *p++;
+                }
+            }
+            while (*p && *p != ',') p++;
+            char sep = *p;
+            *w = '\0';
+            if (sep != ',') break;
+            p++;
+        } else {
+            fields[count++] = p;
+            while (*p && *p != ',') p++;
+            if (*p != ',') break;
+            *p++ = '\0';
+        }
+    }
+    return count;
+}
+
+const char* batch_op_name(enum BatchOpType type) {
+    switch (type) {
+        case BATCH_OP_ADD: return "add";
+        case BATCH_OP_UPDATE: return "update";
+        case BATCH_OP_DELETE: return "delete";
+        default: return "unknown";
+    }
+}
+
+void free_batch_operation(struct BatchOperation *op) {
+    free_dns_record(&op->record);
+    free_dns_record(&op->new_record);
+}
+
+// Assign one named field (domain, host, type, data, ttl, priority) of a record
+int set_record_field(struct DNSRecord *record, const char *field, const char *value) {
+    if (strcasecmp(field, "domain") == 0) {
+        free(record->domain);
+        record->domain = strdup(value);
+    } else if (strcasecmp(field, "host") == 0) {
+        free(record->host);
+        record->host = strdup(value);
+    } else if (strcasecmp(field, "type") == 0) {
+        free(record->type);
+        record->type = strdup(value);
+    } else if (strcasecmp(field, "data") == 0) {
+        free(record->data);
+        record->data = strdup(value);
+    } else if (strcasecmp(field, "ttl") == 0) {
+        record->ttl = atoi(value);
+    } else if (strcasecmp(field, "priority") == 0) {
+        record->priority = atoi(value);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Assign one named field of a batch operation. Field names match the command line
+// options of the add/delete/update commands (without the leading dashes).
+static int set_batch_field(const char *key, const char *value, void *ctx) {
+    struct BatchOperation *op = ctx;
+    
+    if (strcmp(key, "op") == 0) {
+        if (strcmp(value, "add") == 0) op->type = BATCH_OP_ADD;
+        else if (strcmp(value, "update") == 0) op->type = BATCH_OP_UPDATE;
+        else if (strcmp(value, "delete") == 0) op->type = BATCH_OP_DELETE;
+        else return -1;
+        return 0;
+    }
+    if (strcmp(key, "lane") == 0) {
+        for (int lane = 0; lane < LANE_COUNT; lane++) {
+            if (strcmp(value, request_lane_name(lane)) == 0) {
+                op->lane = (enum RequestLane)lane;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    
+    if (strncmp(key, "old", 3) == 0 && key[3]) {
+        return set_record_field(&op->record, key + 3, value);
+    } else if (strncmp(key, "new", 3) == 0 && key[3]) {
+        return set_record_field(&op->new_record, key + 3, value);
+    }
+    return set_record_field(&op->record, key, value);
+}
+
+static int record_is_complete(const struct DNSRecord *record) {
+    return record->domain && record->host && record->type && record->data;
+}
+
+// Parse one input line (JSON object or CSV) into a batch operation. Returns 0 on
+// success, 1 for a CSV header row, otherwise -1 with a static message in *error.
+int parse_batch_line(char *line, struct BatchOperation *op, const char **error) {
+    op->type = BATCH_OP_INVALID;
+    op->lane = LANE_NORMAL;
+    
+    if (*line == '{') {
+        const char *rest = parse_flat_json_object(line, set_batch_field, op);
+        if (!rest) {
+            *error = "Invalid JSON operation";
+            return -1;
+        }
+        while (isspace((unsigned char)*rest)) rest++;
+        if (*rest) {
+            *error = "Unexpected text after JSON operation";
+            return -1;
+        }
+    } else {
+        // CSV: op,domain,host,type,data,ttl,priority
+        //      update,oldDomain,...,oldPriority,newDomain,...,newPriority
+        char *fields[13];
+        int count = split_csv_line(line, fields, 13);
+        if (strcmp(fields[0], "op") == 0) {
+            return 1; // Header row
+        }
+        if (set_batch_field("op", fields[0], op) != 0) {
+            *error = "Unknown operation";
+            return -1;
+        }
+        int expected = (op->type == BATCH_OP_UPDATE) ? 13 : 7;
+        if (count != expected) {
+            *error = "Wrong number of CSV fields";
+            return -1;
+        }
+        static const char *names[] = { "domain", "host", "type", "data", "ttl", "priority" };
+        char key[16];
+        for (int i = 0; i < 6; i++) {
+            if (op->type == BATCH_OP_UPDATE) {
+                snprintf(key, sizeof(key), "old%s", names[i]);
+                set_batch_field(key, fields[1 + i], op);
+                snprintf(key, sizeof(key), "new%s", names[i]);
+                set_batch_field(key, fields[7 + i], op);
+            } else {
+                set_batch_field(names[i], fields[1 + i], op);
+            }
+        }
+    }
+    
+    if (op->type == BATCH_OP_INVALID) {
+        *error = "Missing or unknown operation";
+        return -1;
+    }
+    if (!record_is_complete(&op->record) ||
+        (op->type == BATCH_OP_UPDATE && !record_is_complete(&op->new_record))) {
+        *error = "Missing required record fields";
+        return -1;
+    }
+    return 0;
+}
+
+static int build_batch_request(struct GrowBuffer *out, const char *username, const char *passwordB64,
+                               const struct BatchOperation *op) {
+    switch (op->type) {
+        case BATCH_OP_ADD: return build_record_add_request(out, username, passwordB64, &op->record);
+        case BATCH_OP_DELETE: return build_record_delete_request(out, username, passwordB64, &op->record);
+        case BATCH_OP_UPDATE:
+            return build_record_update_request(out, username, passwordB64, &op->record, &op->new_record);
+        default: return -1;
+    }
+}
+
+static enum SoapAction batch_soap_action(enum BatchOpType type) {
+    switch (type) {
+        case BATCH_OP_ADD: return SOAP_ACTION_ADD;
+        case BATCH_OP_UPDATE: return SOAP_ACTION_UPDATE;
+        case BATCH_OP_DELETE: return SOAP_ACTION_DELETE;
+        default: return SOAP_ACTION_NONE;
+    }
+}
+
+// The "lane" member of a result line, for operations outside the normal lane
+static void print_batch_lane(const struct BatchOperation *op) {
+    if (op->lane != LANE_NORMAL) out_printf("\"lane\":\"%s\",", request_lane_name(op->lane));
+}
+
+static void print_batch_error(int line, const struct BatchOperation *op, const char *error) {
+    out_printf("{\"line\":%d,", line);
+    if (op && op->type != BATCH_OP_INVALID) {
+        out_printf("\"op\":\"%s\",", batch_op_name(op->type));
+        print_batch_lane(op);
+    }
+    out_literal("\"error\":");
+    print_json_string(error);
+    out_literal("}\n");
+}
+
+static void free_batch_item(struct BatchItem *item) {
+    free_batch_operation(&item->op);
+    free(item->merged);
+    free(item->merged_keys);
+    free(item);
+}
+
+// Parse one input line into a new item. Returns 0 with *item set, 1 for lines
+// without an operation (blank, comment, CSV header), -1 if out of memory.
+static int batch_parse_item(struct BatchContext *batch, char *line, size_t line_len, struct BatchItem **item) {
+    batch->line_no++;
+    while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+        line[--line_len] = '\0';
+    }
+    
+    char *text = line;
+    while (isspace((unsigned char)*text)) text++;
+    if (*text == '\0' || *text == '#') return 1;
+    
+    *item = calloc(1, sizeof(**item));
+    if (!*item) return -1;
+    (*item)->line = batch->line_no;
+    if (parse_batch_line(text, &(*item)->op, &(*item)->error) > 0) {
+        free_batch_item(*item);
+        return 1;
+    }
+    return 0;
+}
+
+// Hash of everything an operation sends. With the input line it identifies the
+// operation in the journal, so that an edited line is not taken for a done one.
+static uint64_t batch_operation_key(const struct BatchOperation *op) {
+    const struct DNSRecord *records[2] = { &op->record, &op->new_record };
+    uint64_t hash = fnv1a_hash(&op->type, sizeof(op->type), FNV1A_SEED);
+    
+    for (int i = 0; i < (op->type == BATCH_OP_UPDATE ? 2 : 1); i++) {
+        const char *fields[4] = { records[i]->domain, records[i]->host, records[i]->type, records[i]->data };
+        for (int f = 0; f < 4; f++) {
+            const char *field = fields[f] ? fields[f] : "";
+            hash = fnv1a_hash(field, strlen(field) + 1, hash);
+        }
+        int numbers[2] = { records[i]->ttl, records[i]->priority };
+        hash = fnv1a_hash(numbers, sizeof(numbers), hash);
+    }
+    return hash;
+}
+
+// Journal an operation as it is read. With --resume, one that a previous run
+// completed is skipped instead, and one it sent without a result is flagged.
+static void batch_journal_item(struct BatchContext *batch, struct BatchItem *item) {
+    struct Journal *journal = batch->journal;
+    if (!journal || item->error) return;
+    
+    item->key = batch_operation_key(&item->op);
+    enum JournalState state = journal_state(journal, item->line, item->key);
+    if (resume && state == JOURNAL_DONE) {
+        item->skipped = "journaled";
+        batch->resumed++;
+        return;
+    }
+    if (resume && state == JOURNAL_SENT) {
+        item->in_doubt = 1;
+        batch->in_doubt++;
+    }
+    item->journaled = 1;
+    journal_queued(journal, item->line, item->key, batch_op_name(item->op.type), request_lane_name(item->op.lane),
+                   &item->op.record, item->op.type == BATCH_OP_UPDATE ? &item->op.new_record : NULL);
+}
+
+// Journal the outcome of an operation and of the lines folded into it
+static void batch_journal_result(struct BatchContext *batch, const struct BatchItem *item,
+                                 const struct PendingRequest *request) {
+    const struct APIResult *result = NULL;
+    const char *error = NULL;
+    
+    if (item->skipped) {
+        // Reported below with the reason
+    } else if (request->action == SOAP_ACTION_NONE || request->curl_result != CURLE_OK) {
+        error = item->error ? item->error : pending_request_error(request);
+    } else {
+        result = &request->result;
+    }
+    journal_result(batch->journal, item->line, item->key, result, error, item->skipped);
+    for (int i = 0; i < item->merged_count; i++) {
+        journal_result(batch->journal, item->merged[i], item->merged_keys[i], result, error, item->skipped);
+    }
+}
+
+// Hand an item to the engine; items with an error or skipped complete without a request
+static void batch_submit(struct BatchContext *batch, struct BatchItem *item, struct PendingRequest *request) {
+    request->userdata = item;
+    if (item->error || item->skipped) return;
+    request->action = batch_soap_action(item->op.type);
+    if (build_batch_request(&request->body, batch->username, batch->passwordB64, &item->op) != 0) {
+        request->action = SOAP_ACTION_NONE;
+        item->error = "Not enough memory to build request";
+    } else if (item->journaled &&
+               (journal_sent(batch->journal, item->line, item->key) != 0 ||
+                journal_sync(batch->journal, monotonic_seconds(), 1) != 0)) {
+        // The request only goes out once the journal durably says it was sent
+        request->action = SOAP_ACTION_NONE;
+        item->error = "Failed to write journal";
+    }
+}
+
+// Next complete line of input, without its newline. Returns 1 with the line
+// (valid until the next call), 0 at end of input, -1 if no line is available
+// yet, or -2 on a read error or when out of memory.
+static int line_reader_next(struct LineReader *reader, char **line, size_t *line_len) {
+    struct GrowBuffer *buf = &reader->buf;
+    
+    for (;;) {
+        char *start = buf->data + reader->start;
+        size_t avail = buf->len - reader->start;
+        char *newline = avail ? memchr(start, '\n', avail) : NULL;
+        if (newline) {
+            *newline = '\0';
+            *line = start;
+            *line_len = (size_t)(newline - start);
+            reader->start += *line_len + 1;
+            return 1;
+        }
+        if (reader->eof) return 0;
+        
+        // Keep only the partial line before reading more
+        if (reader->start > 0) {
+            memmove(buf->data, start, avail);
+            buf->len = avail;
+            reader->start = 0;
+        }
+        struct pollfd pfd = {reader->fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) == 0) return -1;
+        
+        char chunk[16384];
+        ssize_t n = read(reader->fd, chunk, sizeof(chunk));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) return -1;
+            return -2;
+        }
+        if (n == 0) {
+            // A last line without a newline still counts
+            reader->eof = 1;
+            if (buf->len > 0 && buffer_append(buf, "\n", 1) != 0) return -2;
+            continue;
+        }
+        if (buffer_append(buf, chunk, (size_t)n) != 0) return -2;
+    }
+}
+
+static uint64_t coalesce_key(const struct DNSRecord *record) {
+    return fnv1a_hash_lower(record->type, fnv1a_hash_lower(record->host, fnv1a_hash_lower(record->domain, FNV1A_SEED)));
+}
+
+static int coalesce_same_key(const struct DNSRecord *a, const struct DNSRecord *b) {
+    return strcasecmp(a->domain, b->domain) == 0 && strcasecmp(a->host, b->host) == 0 &&
+           strcasecmp(a->type, b->type) == 0;
+}
+
+// Same record with the same ttl and priority
+static int records_identical(const struct DNSRecord *a, const struct DNSRecord *b) {
+    return strcasecmp(a->domain, b->domain) == 0 && record_key_equal(a, b) && a->ttl == b->ttl &&
+           a->priority == b->priority;
+}
+
+// An update between records of different names or types is held under both and never merged
+static int coalesce_two_keys(const struct BatchOperation *op) {
+    return op->type == BATCH_OP_UPDATE && !coalesce_same_key(&op->record, &op->new_record);
+}
+
+static int coalesce_touches(const struct BatchOperation *op, const struct DNSRecord *record) {
+    return coalesce_same_key(&op->record, record) ||
+           (op->type == BATCH_OP_UPDATE && coalesce_same_key(&op->new_record, record));
+}
+
+// Latest held item still to be sent that touches record's name and type, or NULL
+static struct BatchItem* coalesce_find(struct CoalesceQueue *queue, const struct DNSRecord *record) {
+    size_t pos = 0, value, latest = HASH_INDEX_EMPTY;
+    
+    while (hash_index_next(&queue->index, coalesce_key(record), &pos, &value)) {
+        if (value < queue->head || (latest != HASH_INDEX_EMPTY && value <= latest)) continue;
+        struct BatchItem *item = queue->items[value];
+        if (!item->skipped && coalesce_touches(&item->op, record)) latest = value;
+    }
+    return latest == HASH_INDEX_EMPTY ? NULL : queue->items[latest];
+}
+
+static void move_record(struct DNSRecord *to, struct DNSRecord *from) {
+    free_dns_record(to);
+    *to = *from;
+    memset(from, 0, sizeof(*from));
+}
+
+// Fold next into the held operation when their combined effect is a single
+// operation. Returns 0 if merged, -1 if not. A fold assumes the held operation
+// would have succeeded: if it would have failed, the folded one fails the same way
+// and that failure is reported for every line folded into it. A fold therefore
+// never does more than the operations it replaces, and never leaves nothing to
+// send: an add followed by an update, an add and a delete, and updates that end
+// where they started all depend on what the zone already holds, so each is sent.
+static int coalesce_merge(struct BatchOperation *held, struct BatchOperation *next) {
+    switch (held->type) {
+        case BATCH_OP_UPDATE:
+            // update a -> b + update b -> c = update a -> c; update a -> b + delete b = delete a
+            if (!record_key_equal(&held->new_record, &next->record)) return -1;
+            if (next->type == BATCH_OP_UPDATE) {
+                if (records_identical(&held->record, &next->new_record)) return -1;
+                move_record(&held->new_record, &next->new_record);
+            } else if (next->type == BATCH_OP_DELETE) {
+                free_dns_record(&held->new_record);
+                held->type = BATCH_OP_DELETE;
+            } else {
+                return -1;
+            }
+            // Sent as urgently as the more urgent of the two
+            if (next->lane < held->lane) held->lane = next->lane;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Index an item under the names it touches. Returns 0 or -1.
+static int coalesce_index(struct CoalesceQueue *queue, size_t pos) {
+    const struct BatchOperation *op = &queue->items[pos]->op;
+    if (hash_index_insert(&queue->index, coalesce_key(&op->record), pos) != 0) return -1;
+    if (coalesce_two_keys(op) && hash_index_insert(&queue->index, coalesce_key(&op->new_record), pos) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Append an item to a lane. Returns 0 or -1.
+static int lane_append(struct LaneQueue *lane, struct BatchItem *item) {
+    if (lane->count == lane->cap) {
+        // Reclaim the slots of items already dispatched once they are half the queue
+        if (lane->head >= lane->cap / 2) {
+            memmove(lane->items, lane->items + lane->head, (lane->count - lane->head) * sizeof(*lane->items));
+            lane->count -= lane->head;
+            lane->head = 0;
+        }
+        if (lane->count == lane->cap) {
+            size_t cap = lane->cap ? lane->cap * 2 : 64;
+            struct BatchItem **items = realloc(lane->items, cap * sizeof(*items));
+            if (!items) return -1;
+            lane->items = items;
+            lane->cap = cap;
+        }
+    }
+    lane->items[lane->count++] = item;
+    return 0;
+}
+
+// Whether queued must be sent before item: both touch the same name and type
+static int batch_same_record(const struct BatchItem *queued, const struct BatchItem *item) {
+    if (queued->error || queued->skipped) return 0;
+    return coalesce_touches(&queued->op, &item->op.record) ||
+           (item->op.type == BATCH_OP_UPDATE && coalesce_touches(&queued->op, &item->op.new_record));
+}
+
+// Queue an item in the lane it asked for. Operations of less urgent lanes on
+// the same record move along ahead of it, so that they keep their order.
+// Returns 0 or -1.
+static int batch_enqueue(struct BatchContext *batch, struct BatchItem *item, double now) {
+    enum RequestLane lane = item->op.lane;
+    struct LaneQueue *target = &batch->lanes[lane];
+    
+    if (lane != LANE_NORMAL) batch->lanes_used = 1;
+    for (int lower = lane + 1; lower < LANE_COUNT && !item->error && !item->skipped; lower++) {
+        struct LaneQueue *queue = &batch->lanes[lower];
+        size_t kept = queue->head;
+        for (size_t i = queue->head; i < queue->count; i++) {
+            struct BatchItem *queued = queue->items[i];
+            if (batch_same_record(queued, item) && lane_append(target, queued) == 0) continue;
+            queue->items[kept++] = queued;
+        }
+        queue->count = kept;
+    }
+    
+    item->queued_at = now;
+    if (lane_append(target, item) != 0) return -1;
+    batch->queued++;
+    return 0;
+}
+
+// Move the held operations that are due into their lanes; all of them once the
+// input has ended or too many are held. Returns 0 or -1.
+static int coalesce_release(struct BatchContext *batch, double now) {
+    struct CoalesceQueue *queue = batch->coalesce;
+    
+    while (queue->head < queue->count) {
+        struct BatchItem *item = queue->items[queue->head];
+        if (!batch->eof && queue->count - queue->head < COALESCE_MAX_HELD && item->ready_at > now) break;
+        queue->items[queue->head++] = NULL;
+        if (batch_enqueue(batch, item, now) != 0) {
+            free_batch_item(item);
+            return -1;
+        }
+    }
+    if (queue->head == queue->count) {
+        queue->head = queue->count = 0;
+        hash_index_clear(&queue->index);
+    }
+    return 0;
+}
+
+// Hold an item, or fold it into a held one. Returns 0 or -1.
+static int coalesce_push(struct BatchContext *batch, struct BatchItem *item, double now) {
+    struct CoalesceQueue *queue = batch->coalesce;
+    struct BatchOperation *op = &item->op;
+    
+    // Urgent operations are never held. Whatever is held is released ahead of them,
+    // so that they keep their place after earlier operations on the same record.
+    if (op->lane == LANE_URGENT) {
+        for (size_t i = queue->head; i < queue->count; i++) queue->items[i]->ready_at = now;
+        if (coalesce_release(batch, now) != 0) return -1;
+        return batch_enqueue(batch, item, now);
+    }
+    if (!item->error && op->type == BATCH_OP_UPDATE && records_identical(&op->record, &op->new_record)) {
+        item->skipped = "noop";
+    }
+    if (!item->error && !item->skipped && !coalesce_two_keys(op)) {
+        struct BatchItem *held = coalesce_find(queue, &op->record);
+        if (held && !coalesce_two_keys(&held->op)) {
+            int *merged = realloc(held->merged, (held->merged_count + 1) * sizeof(*merged));
+            if (!merged) return -1;
+            held->merged = merged;
+            uint64_t *merged_keys = realloc(held->merged_keys, (held->merged_count + 1) * sizeof(*merged_keys));
+            if (!merged_keys) return -1;
+            held->merged_keys = merged_keys;
+            if (coalesce_merge(&held->op, op) == 0) {
+                held->merged_keys[held->merged_count] = item->key;
+                held->merged[held->merged_count++] = item->line;
+                batch->coalesced++;
+                free_batch_item(item);
+                return 0;
+            }
+        }
+    }
+    
+    if (queue->count == queue->cap) {
+        // Reclaim the slots of items already sent once they are half the queue
+        if (queue->head >= queue->cap / 2) {
+            memmove(queue->items, queue->items + queue->head, (queue->count - queue->head) * sizeof(*queue->items));
+            queue->count -= queue->head;
+            queue->head = 0;
+            hash_index_clear(&queue->index);
+            for (size_t i = 0; i < queue->count; i++) {
+                const struct BatchItem *held = queue->items[i];
+                if (!held->error && !held->skipped && coalesce_index(queue, i) != 0) return -1;
+            }
+        }
+        if (queue->count == queue->cap) {
+            size_t cap = queue->cap ? queue->cap * 2 : 64;
+            struct BatchItem **items = realloc(queue->items, cap * sizeof(*items));
+            if (!items) return -1;
+            queue->items = items;
+            queue->cap = cap;
+        }
+    }
+    item->ready_at = now + queue->window;
+    queue->items[queue->count] = item;
+    if (!item->error && !item->skipped && coalesce_index(queue, queue->count) != 0) return -1;
+    queue->count++;
+    return 0;
+}
+
+// Read the input lines available now into the lanes (or the coalesce queue), up
+// to a bound on operations read ahead
+static int batch_fill(struct BatchContext *batch) {
+    struct CoalesceQueue *queue = batch->coalesce;
+    double now = monotonic_seconds();
+    char *line;
+    size_t line_len;
+    
+    while (!batch->eof && batch->queued < BATCH_MAX_QUEUED &&
+           (!queue || queue->count - queue->head < COALESCE_MAX_HELD)) {
+        int rc = line_reader_next(&batch->reader, &line, &line_len);
+        if (rc == -1) break;
+        if (rc == -2) {
+            fprintf(stderr, "Failed to read operations: %s\n", strerror(errno));
+            batch->eof = 1;
+            batch->errors++;
+            break;
+        }
+        if (rc == 0) {
+            batch->eof = 1;
+            break;
+        }
+        
+        struct BatchItem *item;
+        rc = batch_parse_item(batch, line, line_len, &item);
+        if (rc > 0) continue;
+        if (rc == 0) batch_journal_item(batch, item);
+        if (rc < 0 || (queue ? coalesce_push(batch, item, now) : batch_enqueue(batch, item, now)) != 0) {
+            if (rc == 0) free_batch_item(item);
+            fprintf(stderr, "Not enough memory to hold operations\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Nothing can be sent now: wait until wake (0 for no time), for input if more may
+// come, and for transfers to complete. Journal records are synced in time.
+static int batch_wait(struct BatchContext *batch, double wake) {
+    double sync_due = batch->journal ? journal_sync_due(batch->journal) : 0;
+    if (sync_due > 0 && (wake == 0 || sync_due < wake)) wake = sync_due;
+    batch->engine->source_wake = wake;
+    batch->engine->source_fd_count = batch->poll_input && !batch->eof && batch->queued < BATCH_MAX_QUEUED;
+    return REQUEST_SOURCE_WAIT;
+}
+
+// Dispatch the oldest operation of the most urgent lane that has one. Other than
+// urgent operations leave the engine's reserved slots free. With --coalesce,
+// operations only reach the lanes once they have been held for the window.
+static int batch_source(void *ctx, struct PendingRequest *request) {
+    struct BatchContext *batch = ctx;
+    struct CoalesceQueue *queue = batch->coalesce;
+    
+    // Nothing more is sent once the journal cannot record it
+    if (batch->journal && batch->journal->error) return 1;
+    if (batch_fill(batch) != 0) return -1;
+    double now = monotonic_seconds();
+    if (queue && coalesce_release(batch, now) != 0) return -1;
+    if (batch->journal) journal_sync(batch->journal, now, 0);
+    
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        struct LaneQueue *pending = &batch->lanes[lane];
+        if (pending->head == pending->count) continue;
+        
+        // Items with an error or skipped complete without taking a slot
+        struct BatchItem *item = pending->items[pending->head];
+        if (lane != LANE_URGENT && !item->error && !item->skipped && !engine_has_room(batch->engine, 0)) {
+            return batch_wait(batch, 0);
+        }
+        pending->items[pending->head++] = NULL;
+        batch->queued--;
+        
+        double wait = now - item->queued_at;
+        pending->dispatched++;
+        pending->wait_sum += wait;
+        if (wait > pending->wait_max) pending->wait_max = wait;
+        if (batch->metrics) metrics_observe_queue_wait(batch->metrics, lane, wait);
+        batch_submit(batch, item, request);
+        return 0;
+    }
+    
+    if (!queue || queue->head == queue->count) {
+        if (batch->eof) return 1;
+        return batch_wait(batch, 0);
+    }
+    // Wait for input, or until the oldest held operation is due
+    return batch_wait(batch, queue->items[queue->head]->ready_at);
+}
+
+static void print_coalesced_lines(const struct BatchItem *item) {
+    if (item->merged_count == 0) return;
+    out_literal("\"coalesced\":[");
+    for (int i = 0; i < item->merged_count; i++) {
+        if (i > 0) out_char(',');
+        out_long(item->merged[i]);
+    }
+    out_literal("],");
+}
+
+// Print the result line of one operation, in input order
+static void batch_done(void *ctx, struct PendingRequest *request) {
+    struct BatchContext *batch = ctx;
+    struct BatchItem *item = request->userdata;
+    
+    batch->total += 1 + item->merged_count;
+    if (item->error) {
+        print_batch_error(item->line, &item->op, item->error);
+        batch->errors++;
+    } else if (item->skipped) {
+        out_printf("{\"line\":%d,\"op\":\"%s\",", item->line, batch_op_name(item->op.type));
+        print_batch_lane(&item->op);
+        print_coalesced_lines(item);
+        out_literal("\"skipped\":");
+        print_json_string(item->skipped);
+        out_literal("}\n");
+        batch->skipped++;
+    } else if (request->curl_result != CURLE_OK) {
+        print_batch_error(item->line, &item->op, pending_request_error(request));
+        if (batch->metrics) metrics_observe(batch->metrics, request->action, &request->timings, -1);
+        batch->errors++;
+    } else {
+        const struct APIResult *result = &request->result;
+        if (batch->metrics) metrics_observe(batch->metrics, request->action, &request->timings, result->code);
+        
+        out_printf("{\"line\":%d,\"op\":\"%s\",", item->line, batch_op_name(item->op.type));
+        print_batch_lane(&item->op);
+        if (item->in_doubt) out_literal("\"inDoubt\":true,");
+        print_coalesced_lines(item);
+        print_result_json(result);
+        print_timings_json(&request->timings);
+        out_literal("}\n");
+        if (result->code == 0) {
+            batch->succeeded++;
+            zone_cache_invalidate(batch->username, item->op.record.domain);
+            if (item->op.type == BATCH_OP_UPDATE) zone_cache_invalidate(batch->username, item->op.new_record.domain);
+        } else {
+            batch->failed++;
+        }
+    }
+    if (item->journaled) {
+        batch_journal_result(batch, item, request);
+        journal_sync(batch->journal, monotonic_seconds(), 0);
+    }
+    out_flush();
+    free_batch_item(item);
+}
+
+// Set up an engine with the command line's transport options, retry policy and batch deadline
+static int open_engine(struct RequestEngine *engine, int parallel) {
+    if (engine_init(engine, parallel, endpoint) != 0) {
+        fprintf(stderr, "Failed to initialize CURL\n");
+        return -1;
+    }
+    engine->policy = policy;
+    if (rate_limit > 0 || adaptive) engine_set_rate_limit(engine, rate_limit, rate_burst, adaptive);
+    if (batch_deadline > 0) engine->deadline = monotonic_seconds() + batch_deadline;
+    if (force_http1) engine_set_http_version(engine, CURL_HTTP_VERSION_1_1);
+    // Handles share one session cache, so any of them can load or save it
+    if (tls_session_cache) tls_sessions_load(engine->idle[0], tls_session_cache);
+    if (prewarm) engine_prewarm(engine);
+    return 0;
+}
+
+// The "limits" member of a summary when requests were paced, else an empty string
+static const char* limits_json(const struct RequestEngine *engine, char *buf, size_t size) {
+    const struct RateLimiter *limiter = &engine->limiter;
+    if (limiter->rate == 0 && !limiter->adaptive) return "";
+    snprintf(buf, size, ",\"limits\":{\"rate\":%g,\"burst\":%g,\"concurrency\":%d,\"peakConcurrency\":%d,"
+             "\"maxConcurrency\":%d,\"decreases\":%lu}",
+             limiter->rate, limiter->burst, rate_limiter_concurrency(limiter), limiter->peak, limiter->max_limit,
+             limiter->decreases);
+    return buf;
+}
+
+static void close_engine(struct RequestEngine *engine) {
+    if (tls_session_cache) {
+        prewarm_finish(&engine->prewarm);
+        tls_sessions_save(engine->idle[0], tls_session_cache);
+    }
+    engine_cleanup(engine);
+}
+
+// Next domain to list: the --domain options first, then the lines of the input
+// (blank lines and # comments are skipped). Returns NULL when there are no more.
+static const char* list_next_domain(struct ListContext *list) {
+    if (list->next_domain < list->domain_count) return list->domains[list->next_domain++];
+    if (!list->input) return NULL;
+    
+    ssize_t line_len;
+    while ((line_len = getline(&list->line, &list->line_cap, list->input)) != -1) {
+        char *text = list->line;
+        while (line_len > 0 && isspace((unsigned char)text[line_len - 1])) text[--line_len] = '\0';
+        while (isspace((unsigned char)*text)) text++;
+        if (*text != '\0' && *text != '#') return text;
+    }
+    return NULL;
+}
+
+static int list_source(void *ctx, struct PendingRequest *request) {
+    struct ListContext *list = ctx;
+    const char *domain = list_next_domain(list);
+    if (!domain) return 1;
+    
+    // The domain must outlive the input line until its result is printed
+    char *copy = strdup(domain);
+    if (!copy) return -1;
+    request->userdata = copy;
+    request->action = SOAP_ACTION_LIST;
+    if (build_record_list_request(&request->body, list->username, list->passwordB64, copy) != 0) {
+        request->action = SOAP_ACTION_NONE;
+    }
+    return 0;
+}
+
+// Print the listing of one domain, in input order. The response was buffered so
+// that a failed attempt could be retried; it is parsed only now.
+static void list_done(void *ctx, struct PendingRequest *request) {
+    struct ListContext *list = ctx;
+    char *domain = request->userdata;
+    
+    if (list->merge && list->total > 0) out_char(',');
+    list->total++;
+    if (request->action == SOAP_ACTION_NONE || request->curl_result != CURLE_OK) {
+        const char *error = request->action == SOAP_ACTION_NONE ? "Not enough memory to build request"
+                                                                : pending_request_error(request);
+        if (output_format == OUTPUT_JSON || output_format == OUTPUT_NDJSON) {
+            out_literal("{\"domain\":");
+            print_json_string(domain);
+            out_literal(",\"error\":");
+            print_json_string(error);
+            out_literal("}\n");
+        } else {
+            fprintf(stderr, "Listing %s failed: %s\n", domain, error);
+        }
+        if (list->metrics && request->action != SOAP_ACTION_NONE) {
+            metrics_observe(list->metrics, request->action, &request->timings, -1);
+        }
+        list->errors++;
+    } else {
+        struct ListDisplay display;
+        struct SoapParser *parser = &list->parser;
+        list_display_init(&display, domain);  // Cannot fail: binary output lists one domain only
+        display.domain = domain;
+        display.timings = &request->timings;
+        soap_parser_reset(parser, list_parser_header, list_parser_record, &display);
+        parser->filter = list_filter;
+        double started = monotonic_seconds();
+        soap_parser_feed(parser, request->response.data, request->response.size);
+        request->timings.parse += monotonic_seconds() - started;
+        list_parser_finish(&display, parser, NULL);
+        
+        if (list->metrics) metrics_observe(list->metrics, request->action, &request->timings, parser->result_code);
+        if (parser->result_code == 0) {
+            list->succeeded++;
+            list->records += display.record_count;
+        } else {
+            list->failed++;
+        }
+        list_display_free(&display);
+    }
+    out_flush();
+    free(domain);
+}
+
+// List many domains through the request engine, up to parallel at a time over a
+// shared connection cache. Each domain's listing is printed in the output format
+// (as one JSON line, or one line per record then a result line for ndjson) in
+// input order, followed by a summary, which goes to stderr for the formats that
+// only carry records. With merge, the listings are the elements of a single JSON
+// document.
+int run_list_domains(const char *username, const char *passwordB64, char **domains, int domain_count,
+                     FILE *input, int parallel, int merge, const char *metrics_path) {
+    struct RequestEngine engine;
+    if (open_engine(&engine, parallel) != 0) return 1;
+    
+    struct ListContext list = {0};
+    list.username = username;
+    list.passwordB64 = passwordB64;
+    list.domains = domains;
+    list.domain_count = domain_count;
+    list.input = input;
+    list.merge = merge;
+    struct RequestMetrics metrics = {0};
+    if (metrics_path) list.metrics = &metrics;
+    
+    if (merge) out_literal("{\"domains\":[");
+    if (engine_run(&engine, list_source, list_done, &list) != 0) {
+        fprintf(stderr, "Not enough memory to list domains\n");
+        list.errors++;
+    }
+    if (metrics_path && metrics_write_prometheus(&metrics, metrics_path) != 0) {
+        fprintf(stderr, "Failed to write metrics to %s: %s\n", metrics_path, strerror(errno));
+    }
+    
+    char summary[512], limits[256];
+    snprintf(summary, sizeof(summary),
+             "\"domains\":%d,\"succeeded\":%d,\"failed\":%d,\"errors\":%d,\"records\":%ld,\"retries\":%lu,"
+             "\"circuitOpened\":%lu%s}}\n",
+             list.total, list.succeeded, list.failed, list.errors, list.records, engine.retries,
+             engine.breaker.opened, limits_json(&engine, limits, sizeof(limits)));
+    if (output_format == OUTPUT_JSON || output_format == OUTPUT_NDJSON) {
+        out_str(merge ? "],\"summary\":{" : "{\"summary\":{");
+        out_str(summary);
+    } else {
+        fprintf(stderr, "{\"summary\":{%s", summary);
+    }
+    
+    free(list.line);
+    soap_parser_free(&list.parser);
+    close_engine(&engine);
+    return list.errors || (list.failed && output_format != OUTPUT_JSON && output_format != OUTPUT_NDJSON) ? 1 : 0;
+}
+
+// Apply newline-delimited operations from input through the request engine. Up to
+// parallel operations are in flight at once over a shared connection cache and TLS
+// session cache. Input is read ahead into priority lanes: urgent operations go
+// before normal ones, which go before bulk ones, and only urgent ones may take
+// the engine's reserved slots. One JSON result line is written per operation in
+// the order they were sent (input order within a lane), followed by a summary.
+// With a coalesce window (in seconds, negative for none) each operation but the
+// urgent ones is held that long so that later ones on the same record can be
+// folded into it, and updates that change nothing are not sent. With --journal
+// each operation and its result are journaled, and with --resume operations a
+// previous run completed are skipped.
+int run_batch(const char *username, const char *passwordB64, FILE *input, int parallel, double coalesce,
+              const char *metrics_path) {
+    struct RequestEngine engine;
+    if (open_engine(&engine, parallel) != 0) return 1;
+    
+    struct BatchContext batch = {0};
+    batch.username = username;
+    batch.passwordB64 = passwordB64;
+    batch.engine = &engine;
+    struct RequestMetrics metrics = {0};
+    if (metrics_path) batch.metrics = &metrics;
+    engine.reserved = reserved_slots;
+    
+    // A regular file is always readable, so only pipes and terminals are polled
+    struct stat st;
+    struct curl_waitfd input_fd = {0};
+    batch.reader.fd = fileno(input);
+    batch.poll_input = fstat(batch.reader.fd, &st) != 0 || !S_ISREG(st.st_mode);
+    input_fd.fd = batch.reader.fd;
+    input_fd.events = CURL_WAIT_POLLIN;
+    engine.source_fds = &input_fd;
+    
+    struct Journal journal;
+    if (journal_path) {
+        if (journal_open(&journal, journal_path, journal_sync_ms / 1000.0) != 0) {
+            fprintf(stderr, "Cannot open journal %s: %s\n", journal_path, strerror(errno));
+            close_engine(&engine);
+            return 1;
+        }
+        batch.journal = &journal;
+    }
+    
+    struct CoalesceQueue queue = {0};
+    if (coalesce >= 0) {
+        if (hash_index_init(&queue.index, 64) != 0) {
+            fprintf(stderr, "Not enough memory to run batch\n");
+            if (batch.journal) journal_close(&journal);
+            close_engine(&engine);
+            return 1;
+        }
+        queue.window = coalesce;
+        batch.coalesce = &queue;
+    }
+    
+    int rc = engine_run(&engine, batch_source, batch_done, &batch);
+    int journal_error = batch.journal ? journal_close(&journal) : 0;
+    if (journal_error) {
+        fprintf(stderr, "Failed to write journal %s: %s\n", journal_path, strerror(journal_error));
+        batch.errors++;
+    } else if (rc != 0 || queue.head < queue.count || batch.queued > 0) {
+        fprintf(stderr, "Not enough memory to run batch\n");
+        batch.errors++;
+    }
+    if (metrics_path && metrics_write_prometheus(&metrics, metrics_path) != 0) {
+        fprintf(stderr, "Failed to write metrics to %s: %s\n", metrics_path, strerror(errno));
+    }
+    
+    out_printf("{\"summary\":{\"operations\":%d,\"succeeded\":%d,\"failed\":%d,\"errors\":%d,\"retries\":%lu,"
+               "\"circuitOpened\":%lu",
+               batch.total, batch.succeeded, batch.failed, batch.errors, engine.retries, engine.breaker.opened);
+    if (batch.coalesce) out_printf(",\"coalesced\":%d,\"skipped\":%d", batch.coalesced, batch.skipped);
+    if (batch.journal) out_printf(",\"resumed\":%d,\"inDoubt\":%d", batch.resumed, batch.in_doubt);
+    if (batch.lanes_used) {
+        // Time operations waited in their lane for a slot
+        out_literal(",\"lanes\":{");
+        for (int lane = 0; lane < LANE_COUNT; lane++) {
+            const struct LaneQueue *pending = &batch.lanes[lane];
+            out_printf("%s\"%s\":{\"operations\":%lu,\"waitAvg\":%.6f,\"waitMax\":%.6f}", lane ? "," : "",
+                       request_lane_name(lane), pending->dispatched,
+                       pending->dispatched ? pending->wait_sum / pending->dispatched : 0.0, pending->wait_max);
+        }
+        out_char('}');
+    }
+    char limits[256];
+    out_str(limits_json(&engine, limits, sizeof(limits)));
+    out_literal("}}\n");
+    
+    for (size_t i = queue.head; i < queue.count; i++) free_batch_item(queue.items[i]);
+    free(queue.items);
+    hash_index_free(&queue.index);
+    for (int lane = 0; lane < LANE_COUNT; lane++) {
+        struct LaneQueue *pending = &batch.lanes[lane];
+        for (size_t i = pending->head; i < pending->count; i++) free_batch_item(pending->items[i]);
+        free(pending->items);
+    }
+    free(batch.reader.buf.data);
+    close_engine(&engine);
+    return batch.errors ? 1 : 0;
+}
+
+static const char* txn_outcome_name(enum TxnOutcome outcome) {
+    switch (outcome) {
+        case TXN_APPLIED: return "applied";
+        case TXN_FAILED: return "failed";
+        case TXN_UNKNOWN: return "unknown";
+        case TXN_ROLLED_BACK: return "rolledBack";
+        case TXN_ROLLBACK_FAILED: return "rollbackFailed";
+        default: return "notApplied";
+    }
+}
+
+// Read every operation up front: a transaction only starts once all of them
+// parsed. Invalid lines are reported like batch errors. Returns 0 or -1.
+static int txn_read(struct TxnContext *txn, FILE *input) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    int line_no = 0, rc = 0;
+    
+    while ((line_len = getline(&line, &line_cap, input)) != -1) {
+        line_no++;
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+            line[--line_len] = '\0';
+        }
+        char *text = line;
+        while (isspace((unsigned char)*text)) text++;
+        if (*text == '\0' || *text == '#') continue;
+        
+        if (txn->count == txn->cap) {
+            size_t cap = txn->cap ? txn->cap * 2 : 64;
+            struct TxnItem *items = realloc(txn->items, cap * sizeof(*items));
+            if (!items) {
+                fprintf(stderr, "Not enough memory to read the transaction\n");
+                rc = -1;
+                break;
+            }
+            txn->items = items;
+            txn->cap = cap;
+        }
+        
+        struct TxnItem *item = &txn->items[txn->count];
+        const char *error = NULL;
+        memset(item, 0, sizeof(*item));
+        item->line = line_no;
+        int parsed = parse_batch_line(text, &item->op, &error);
+        if (parsed == 0) {
+            txn->count++;
+            continue;
+        }
+        if (parsed < 0) {
+            print_batch_error(line_no, &item->op, error);
+            rc = -1;
+        }
+        free_batch_operation(&item->op);
+    }
+    free(line);
+    return rc;
+}
+
+static int txn_add_domain(struct TxnContext *txn, char *domain) {
+    for (size_t i = 0; i < txn->domain_count; i++) {
+        if (strcasecmp(txn->domains[i], domain) == 0) return 0;
+    }
+    char **domains = realloc(txn->domains, (txn->domain_count + 1) * sizeof(*domains));
+    if (!domains) return -1;
+    txn->domains = domains;
+    txn->domains[txn->domain_count++] = domain;
+    return 0;
+}
+
+static int txn_list_source(void *ctx, struct PendingRequest *request) {
+    struct TxnContext *txn = ctx;
+    if (txn->next >= txn->domain_count) return 1;
+    
+    size_t i = txn->next++;
+    request->action = SOAP_ACTION_LIST;
+    if (build_record_list_request(&request->body, txn->username, txn->passwordB64, txn->domains[i]) != 0) {
+        request->action = SOAP_ACTION_NONE;
+    }
+    request->parser = &txn->parsers[i];
+    request->userdata = txn->domains[i];
+    return 0;
+}
+
+static void txn_list_done(void *ctx, struct PendingRequest *request) {
+    struct TxnContext *txn = ctx;
+    if (txn->list_error) return;
+    
+    if (request->action == SOAP_ACTION_NONE) {
+        txn->list_error = "Not enough memory to build request";
+    } else if (request->curl_result != CURLE_OK) {
+        txn->list_error = pending_request_error(request);
+    } else if (request->parser->result_code != 0) {
+        txn->list_error = gidinet_result_code_message(request->parser->result_code);
+    }
+    if (txn->list_error) fprintf(stderr, "Cannot list %s: %s\n", (const char *)request->userdata, txn->list_error);
+}
+
+// Fetch the current records of every domain the operations touch, one listing each
+static int txn_snapshot(struct TxnContext *txn, struct RequestEngine *engine) {
+    for (size_t i = 0; i < txn->count; i++) {
+        struct BatchOperation *op = &txn->items[i].op;
+        if (txn_add_domain(txn, op->record.domain) != 0 ||
+            (op->type == BATCH_OP_UPDATE && txn_add_domain(txn, op->new_record.domain) != 0)) {
+            fprintf(stderr, "Not enough memory to snapshot the zone\n");
+            return -1;
+        }
+    }
+    
+    txn->parsers = calloc(txn->domain_count, sizeof(*txn->parsers));
+    if (!txn->parsers) {
+        fprintf(stderr, "Not enough memory to snapshot the zone\n");
+        return -1;
+    }
+    for (size_t i = 0; i < txn->domain_count; i++) {
+        soap_parser_init(&txn->parsers[i], NULL, record_set_collect, &txn->current);
+    }
+    
+    txn->next = 0;
+    engine_run(engine, txn_list_source, txn_list_done, txn);
+    if (!txn->list_error && txn->current.failed) {
+        fprintf(stderr, "Not enough memory to snapshot the zone\n");
+        return -1;
+    }
+    return txn->list_error ? -1 : 0;
+}
+
+// Index of the record of set with the same domain and key as record, or -1
+static long txn_find(const struct RecordSet *set, const struct HashIndex *index, const struct DNSRecord *record) {
+    uint64_t hash = record_key_hash(record);
+    size_t pos = 0, value;
+    
+    while (hash_index_next(index, hash, &pos, &value)) {
+        const struct DNSRecord *candidate = &set->items[value].record;
+        if (record_key_equal(candidate, record) && strcasecmp(candidate->domain, record->domain) == 0) {
+            return (long)value;
+        }
+    }
+    return -1;
+}
+
+// Remember that an operation touches record; returns -1 if another one already does
+static int txn_touch(struct RecordSet *touched, struct HashIndex *index, const struct DNSRecord *record) {
+    if (txn_find(touched, index, record) >= 0) return -1;
+    if (record_set_add(touched, record, 0) != 0 ||
+        hash_index_insert(index, touched->items[touched->count - 1].key_hash, touched->count - 1) != 0) {
+        touched->failed = 1;
+    }
+    return 0;
+}
+
+// Check every operation against the snapshot and derive its compensating
+// operation from it. Nothing has been changed yet, so any problem aborts.
+static int txn_plan(struct TxnContext *txn) {
+    struct HashIndex index, touched_index;
+    struct RecordSet touched = {0};
+    int rc = 0;
+    
+    if (hash_index_init(&index, txn->current.count) != 0 || hash_index_init(&touched_index, txn->count) != 0) {
+        hash_index_free(&index);
+        fprintf(stderr, "Not enough memory to plan the transaction\n");
+        return -1;
+    }
+    for (size_t i = 0; i < txn->current.count; i++) {
+        if (hash_index_insert(&index, txn->current.items[i].key_hash, i) != 0) touched.failed = 1;
+    }
+    
+    for (size_t i = 0; i < txn->count; i++) {
+        struct TxnItem *item = &txn->items[i];
+        struct BatchOperation *op = &item->op, *undo = &item->undo;
+        long found = txn_find(&txn->current, &index, &op->record);
+        int same_key = op->type == BATCH_OP_UPDATE && record_key_equal(&op->record, &op->new_record) &&
+                       strcasecmp(op->record.domain, op->new_record.domain) == 0;
+        const char *error = NULL;
+        
+        switch (op->type) {
+            case BATCH_OP_ADD:
+                if (found >= 0) error = "Record already exists";
+                undo->type = BATCH_OP_DELETE;
+                undo->record = op->record;
+                break;
+            case BATCH_OP_DELETE:
+                if (found < 0) {
+                    error = "Record not found";
+                    break;
+                }
+                undo->type = BATCH_OP_ADD;
+                undo->record = txn->current.items[found].record;
+                break;
+            case BATCH_OP_UPDATE:
+                if (found < 0) {
+                    error = "Record not found";
+                    break;
+                }
+                if (!same_key && txn_find(&txn->current, &index, &op->new_record) >= 0) {
+                    error = "New record already exists";
+                    break;
+                }
+                undo->type = BATCH_OP_UPDATE;
+                undo->record = op->new_record;
+                undo->new_record = txn->current.items[found].record;
+                break;
+            default:
+                break;
+        }
+        
+        // Compensation assumes that each record is changed by one operation only
+        if (!error && (txn_touch(&touched, &touched_index, &op->record) != 0 ||
+                       (op->type == BATCH_OP_UPDATE && !same_key &&
+                        txn_touch(&touched, &touched_index, &op->new_record) != 0))) {
+            error = "Record also changed by another operation of the transaction";
+        }
+        if (error) {
+            print_batch_error(item->line, op, error);
+            rc = -1;
+        }
+    }
+    if (touched.failed) {
+        fprintf(stderr, "Not enough memory to plan the transaction\n");
+        rc = -1;
+    }
+    
+    hash_index_free(&index);
+    hash_index_free(&touched_index);
+    gidinet_record_set_free(&touched);
+    return rc;
+}
+
+static int txn_apply_source(void *ctx, struct PendingRequest *request) {
+    struct TxnContext *txn = ctx;
+    if (txn->aborting || txn->next >= txn->count) return 1;
+    
+    struct TxnItem *item = &txn->items[txn->next++];
+    item->submitted = 1;
+    request->action = batch_soap_action(item->op.type);
+    if (build_batch_request(&request->body, txn->username, txn->passwordB64, &item->op) != 0) {
+        request->action = SOAP_ACTION_NONE;
+    }
+    request->userdata = item;
+    return 0;
+}
+
+// Record what became of an operation as soon as it finishes; the first that did
+// not apply stops the transaction, and operations not started by then are never sent
+static void txn_apply_done(void *ctx, struct PendingRequest *request) {
+    struct TxnContext *txn = ctx;
+    struct TxnItem *item = request->userdata;
+    item->timings = request->timings;
+    
+    if (request->action == SOAP_ACTION_NONE) {
+        item->error = "Not enough memory to build request";
+        item->outcome = TXN_NOT_APPLIED;
+    } else if (request->curl_result != CURLE_OK) {
+        // Unless it never reached the API, the operation may have been applied
+        item->error = pending_request_error(request);
+        item->outcome = request->failure == FAILURE_CONNECT || request->failure == FAILURE_CIRCUIT_OPEN ||
+                        request->failure == FAILURE_DEADLINE ? TXN_NOT_APPLIED : TXN_UNKNOWN;
+    } else {
+        // The result text now belongs to the item
+        item->result = request->result;
+        memset(&request->result, 0, sizeof(request->result));
+        // An HTTP 5xx/429 or result 4 does not tell whether the API acted on it
+        if (item->result.code == 0) {
+            item->outcome = TXN_APPLIED;
+        } else if (request->failure == FAILURE_HTTP_5XX || request->failure == FAILURE_API_TRANSIENT) {
+            item->outcome = TXN_UNKNOWN;
+        } else {
+            item->outcome = TXN_FAILED;
+        }
+    }
+    if (item->outcome != TXN_APPLIED) txn->aborting = 1;
+}
+
+static int txn_undo_source(void *ctx, struct PendingRequest *request) {
+    struct TxnContext *txn = ctx;
+    
+    while (txn->next < txn->count) {
+        struct TxnItem *item = &txn->items[txn->next++];
+        if (item->outcome != TXN_APPLIED && item->outcome != TXN_UNKNOWN) continue;
+        
+        item->undone = 1;
+        request->action = batch_soap_action(item->undo.type);
+        if (build_batch_request(&request->body, txn->username, txn->passwordB64, &item->undo) != 0) {
+            request->action = SOAP_ACTION_NONE;
+        }
+        request->userdata = item;
+        return 0;
+    }
+    return 1;
+}
+
+static void txn_undo_done(void *ctx, struct PendingRequest *request) {
+    struct TxnItem *item = request->userdata;
+    int code = -1;
+    (void)ctx;
+    item->undo_timings = request->timings;
+    
+    if (request->action == SOAP_ACTION_NONE) {
+        item->undo_error = "Not enough memory to build request";
+    } else if (request->curl_result != CURLE_OK) {
+        item->undo_error = pending_request_error(request);
+    } else {
+        item->undo_result = request->result;
+        memset(&request->result, 0, sizeof(request->result));
+        code = item->undo_result.code;
+    }
+    
+    if (code == 0) item->outcome = TXN_ROLLED_BACK;
+    // Undoing an operation whose outcome was unknown shows whether it applied: the
+    // record to delete or update back is missing, or the one to add back exists
+    else if (item->outcome == TXN_UNKNOWN && (code == 5 || (item->undo.type == BATCH_OP_ADD && code == 6))) {
+        item->outcome = TXN_NOT_APPLIED;
+    }
+    else item->outcome = TXN_ROLLBACK_FAILED;
+}
+
+// Print the report line of one operation: its outcome, result and timing, and
+// those of its compensating operation if one was sent
+static void txn_print_item(const struct TxnItem *item) {
+    out_printf("{\"line\":%d,\"op\":\"%s\",\"outcome\":\"%s\"", item->line, batch_op_name(item->op.type),
+               txn_outcome_name(item->outcome));
+    if (item->error) {
+        out_literal(",\"error\":");
+        print_json_string(item->error);
+    } else if (item->submitted) {
+        out_char(',');
+        print_result_json(&item->result);
+    }
+    if (item->submitted) out_printf(",\"seconds\":%.6f", item->timings.total + item->timings.retry_wait);
+    print_timings_json(item->submitted ? &item->timings : NULL);
+    
+    if (item->undone) {
+        out_printf(",\"rollback\":{\"op\":\"%s\"", batch_op_name(item->undo.type));
+        if (item->undo_error) {
+            out_literal(",\"error\":");
+            print_json_string(item->undo_error);
+        } else {
+            out_char(',');
+            print_result_json(&item->undo_result);
+        }
+        out_printf(",\"seconds\":%.6f", item->undo_timings.total + item->undo_timings.retry_wait);
+        print_timings_json(&item->undo_timings);
+        out_char('}');
+    }
+    out_literal("}\n");
+}
+
+// Apply the operations of input as one transaction. The records they touch are
+// snapshotted with one listing per domain and every operation is checked against
+// them first. Operations then run concurrently; if any does not apply, no more are
+// started and those that did (or may have) are compensated, also concurrently.
+// One report line is written per operation in input order, then a summary.
+int run_transaction(const char *username, const char *passwordB64, FILE *input, int parallel) {
+    struct RequestEngine engine;
+    if (open_engine(&engine, parallel) != 0) return 1;
+    
+    struct TxnContext txn = {0};
+    txn.username = username;
+    txn.passwordB64 = passwordB64;
+    
+    const char *state = "aborted";
+    char limits[256];
+    int counts[TXN_ROLLBACK_FAILED + 1] = {0};
+    if (txn_read(&txn, input) == 0 && (txn.count == 0 || (txn_snapshot(&txn, &engine) == 0 && txn_plan(&txn) == 0))) {
+        txn.next = 0;
+        // Outcomes are recorded as each operation finishes, not in input order,
+        // so that a failure stops the next start rather than those after it
+        engine.unordered = 1;
+        engine_run(&engine, txn_apply_source, txn_apply_done, &txn);
+        
+        if (txn.aborting) {
+            // The rollback is not held back by the batch deadline or by failures
+            // of the operations it compensates
+            engine.deadline = 0;
+            engine.breaker.failures = 0;
+            engine.breaker.open_until = 0;
+            engine.breaker.trial = 0;
+            txn.next = 0;
+            engine_run(&engine, txn_undo_source, txn_undo_done, &txn);
+        }
+        
+        for (size_t i = 0; i < txn.count; i++) {
+            txn_print_item(&txn.items[i]);
+            counts[txn.items[i].outcome]++;
+        }
+        for (size_t i = 0; i < txn.domain_count; i++) zone_cache_invalidate(username, txn.domains[i]);
+        
+        if (!txn.aborting) state = "committed";
+        else if (counts[TXN_ROLLBACK_FAILED] || counts[TXN_UNKNOWN]) state = "incomplete";
+        else state = "rolledBack";
+    }
+    
+    out_printf("{\"summary\":{\"transaction\":\"%s\",\"operations\":%zu,\"applied\":%d,\"failed\":%d,\"unknown\":%d,"
+               "\"notApplied\":%d,\"rolledBack\":%d,\"rollbackFailed\":%d,\"retries\":%lu%s}}\n",
+               state, txn.count, counts[TXN_APPLIED], counts[TXN_FAILED], counts[TXN_UNKNOWN], counts[TXN_NOT_APPLIED],
+               counts[TXN_ROLLED_BACK], counts[TXN_ROLLBACK_FAILED], engine.retries,
+               limits_json(&engine, limits, sizeof(limits)));
+    
+    for (size_t i = 0; i < txn.count; i++) {
+        free_batch_operation(&txn.items[i].op);
+        gidinet_result_free(&txn.items[i].result);
+        gidinet_result_free(&txn.items[i].undo_result);
+    }
+    for (size_t i = 0; txn.parsers && i < txn.domain_count; i++) soap_parser_free(&txn.parsers[i]);
+    free(txn.parsers);
+    free(txn.domains);
+    free(txn.items);
+    gidinet_record_set_free(&txn.current);
+    close_engine(&engine);
+    return strcmp(state, "committed") == 0 ? 0 : 1;
+}
+
+// Hash of (host, type), used to turn a delete plus an add into one update
+static uint64_t record_slot_hash(const struct DNSRecord *record) {
+    return fnv1a_hash_lower(record->type, fnv1a_hash_lower(record->host, FNV1A_SEED));
+}
+
+// Print a record as a JSON object
+void print_record_json(const struct DNSRecord *record) {
+    out_literal("{\"domain\":");
+    print_json_string(record->domain);
+    out_literal(",\"host\":");
+    print_json_string(record->host);
+    out_literal(",\"type\":");
+    print_json_string(record->type);
+    out_literal(",\"data\":");
+    print_json_string(record->data);
+    out_printf(",\"ttl\":%d,\"priority\":%d}", record->ttl, record->priority);
+}
+
+// Print the "op" member and the record(s) of an operation
+void print_operation_json(const struct BatchOperation *op) {
+    out_printf("\"op\":\"%s\",", batch_op_name(op->type));
+    if (op->type == BATCH_OP_UPDATE) {
+        out_literal("\"old\":");
+        print_record_json(&op->record);
+        out_literal(",\"new\":");
+        print_record_json(&op->new_record);
+    } else {
+        out_literal("\"record\":");
+        print_record_json(&op->record);
+    }
+}
+
+static int desired_json_field(const char *key, const char *value, void *ctx) {
+    return set_record_field(ctx, key, value);
+}
+
+// Read desired records from a JSON array or from one JSON object per line
+static int load_desired_json(const char *text, const char *domain, struct RecordSet *desired,
+                             const char **error) {
+    const char *p = text;
+    int in_array = 0;
+    
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '[') {
+        in_array = 1;
+        p++;
+    }
+    
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || (in_array && *p == ']')) break;
+        
+        struct DNSRecord record = { .ttl = SYNC_KEEP_CURRENT, .priority = SYNC_KEEP_CURRENT };
+        p = parse_flat_json_object(p, desired_json_field, &record);
+        if (!p) {
+            free_dns_record(&record);
+            *error = "Invalid JSON in desired state";
+            return -1;
+        }
+        if (!record.domain) record.domain = strdup(domain);
+        if (!record.host || !record.type || !record.data) {
+            free_dns_record(&record);
+            *error = "Desired record is missing host, type or data";
+            return -1;
+        }
+        if ((record.ttl < 0 && record.ttl != SYNC_KEEP_CURRENT) ||
+            (record.priority < 0 && record.priority != SYNC_KEEP_CURRENT)) {
+            free_dns_record(&record);
+            *error = "Desired record has a negative ttl or priority";
+            return -1;
+        }
+        int rc = strcasecmp(record.domain, domain) == 0 ? record_set_add(desired, &record, 0) : -2;
+        free_dns_record(&record);
+        if (rc != 0) {
+            *error = rc == -2 ? "Desired record belongs to another domain" : "Not enough memory";
+            return -1;
+        }
+        
+        // Objects of an array are separated by commas
+        while (isspace((unsigned char)*p)) p++;
+        if (in_array && *p == ',') {
+            p++;
+        } else if (in_array && *p != ']') {
+            *error = "Invalid JSON in desired state";
+            return -1;
+        }
+    }
+    
+    // Nothing but whitespace may follow the closing bracket
+    if (in_array && *p++ != ']') {
+        *error = "Desired state array is not closed";
+        return -1;
+    }
+    while (isspace((unsigned char)*p)) p++;
+    if (*p) {
+        *error = "Unexpected text after desired state";
+        return -1;
+    }
+    return 0;
+}
+
+// Split a zone file line into tokens; quoted strings become single tokens
+// without their quotes. Comments (;) are dropped.
+static int tokenize_zone_line(char *line, char **tokens, int *quoted, int max_tokens) {
+    int count = 0;
+    char *p = line;
+    
+    while (*p && count < max_tokens) {
+        while (isspace((unsigned char)*p)) p++;
+        if (!*p || *p == ';') break;
+        
+        if (*p == '"') {
+            char *w = ++p;
+            tokens[count] = w;
+            quoted[count++] = 1;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1]) p++;
+                *w++ = *p++;
+            }
+            if (*p) p++;
+            *w = '\0';
+        } else {
+            tokens[count] = p;
+            quoted[count++] = 0;
+            while (*p && !isspace((unsigned char)*p)) p++;
+            if (*p) *p++ = '\0';
+        }
+    }
+    return count;
+}
+
+// Convert a zone file owner name to the API host name: @ for the apex,
+// otherwise the label(s) relative to the domain
+static void zone_owner_to_host(const char *owner, const char *origin, char *host, size_t size) {
+    size_t len = strlen(owner), origin_len = strlen(origin);
+    
+    if (strcmp(owner, "@") == 0) {
+        snprintf(host, size, "@");
+    } else if (len > 0 && owner[len - 1] == '.') {
+        len--;
+        if (len == origin_len && strncasecmp(owner, origin, len) == 0) {
+            snprintf(host, size, "@");
+        } else if (len > origin_len + 1 && owner[len - origin_len - 1] == '.' &&
+                   strncasecmp(owner + len - origin_len, origin, origin_len) == 0) {
+            snprintf(host, size, "%.*s", (int)(len - origin_len - 1), owner);
+        } else {
+            snprintf(host, size, "%.*s", (int)len, owner);
+        }
+    } else {
+        snprintf(host, size, "%s", owner);
+    }
+}
+
+static int is_zone_class(const char *token) {
+    return strcasecmp(token, "IN") == 0 || strcasecmp(token, "CH") == 0 || strcasecmp(token, "HS") == 0;
+}
+
+// Read desired records from a BIND-style zone file:
+//   [owner] [ttl] [class] type rdata   with $ORIGIN and $TTL directives
+static int load_desired_bind(char *text, const char *domain, struct RecordSet *desired,
+                             const char **error) {
+    char origin[256], owner[256] = "@";
+    int default_ttl = ZONE_DEFAULT_TTL;
+    snprintf(origin, sizeof(origin), "%s", domain);
+    
+    for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+        char *tokens[64];
+        int quoted[64];
+        int starts_blank = isspace((unsigned char)*line);
+        int count = tokenize_zone_line(line, tokens, quoted, 64);
+        if (count == 0) continue;
+        
+        if (strcasecmp(tokens[0], "$ORIGIN") == 0 && count > 1) {
+            snprintf(origin, sizeof(origin), "%s", tokens[1]);
+            size_t len = strlen(origin);
+            if (len > 0 && origin[len - 1] == '.') origin[len - 1] = '\0';
+            continue;
+        }
+        if (strcasecmp(tokens[0], "$TTL") == 0 && count > 1) {
+            default_ttl = atoi(tokens[1]);
+            continue;
+        }
+        if (tokens[0][0] == '$') continue;
+        
+        int t = 0;
+        if (!starts_blank) snprintf(owner, sizeof(owner), "%s", tokens[t++]);
+        
+        int ttl = default_ttl;
+        for (int k = 0; k < 2 && t < count; k++) {
+            if (isdigit((unsigned char)tokens[t][0])) ttl = atoi(tokens[t++]);
+            else if (is_zone_class(tokens[t])) t++;
+        }
+        if (t + 1 >= count) {
+            *error = "Zone file line has no record type or data";
+            return -1;
+        }
+        
+        char type[16], host[256];
+        snprintf(type, sizeof(type), "%s", tokens[t++]);
+        for (char *c = type; *c; c++) *c = (char)toupper((unsigned char)*c);
+        zone_owner_to_host(owner, origin, host, sizeof(host));
+        
+        int priority = 0;
+        if ((strcmp(type, "MX") == 0 || strcmp(type, "SRV") == 0) && t + 1 < count) {
+            priority = atoi(tokens[t++]);
+        }
+        
+        // TXT strings are concatenated, other rdata keeps its tokens space separated
+        char data[4096];
+        size_t used = 0;
+        data[0] = '\0';
+        for (; t < count; t++) {
+            int n = snprintf(data + used, sizeof(data) - used, "%s%s",
+                             (used && strcmp(type, "TXT") != 0) ? " " : "", tokens[t]);
+            if (n < 0 || (size_t)n >= sizeof(data) - used) {
+                *error = "Zone file record data too long";
+                return -1;
+            }
+            used += n;
+        }
+        
+        struct DNSRecord record = { (char *)domain, host, type, data, ttl, priority };
+        if (record_set_add(desired, &record, 0) != 0) {
+            *error = "Not enough memory";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Load the desired state of a zone, JSON if it starts with [ or {, else BIND
+int load_desired_state(FILE *input, const char *domain, struct RecordSet *desired, const char **error) {
+    struct GrowBuffer text = {0};
+    char chunk[8192];
+    size_t n;
+    
+    while ((n = fread(chunk, 1, sizeof(chunk), input)) > 0) {
+        if (buffer_append(&text, chunk, n) != 0) {
+            free(text.data);
+            *error = "Not enough memory";
+            return -1;
+        }
+    }
+    if (!text.data) return 0;
+    
+    const char *p = text.data;
+    while (isspace((unsigned char)*p)) p++;
+    
+    int rc = (*p == '[' || *p == '{') ? load_desired_json(text.data, domain, desired, error)
+                                      : load_desired_bind(text.data, domain, desired, error);
+    free(text.data);
+    return rc;
+}
+
+// Fill in the ttl and priority a desired record left out from the current record
+// it replaces, or with the zone file defaults for a new record
+static void sync_keep_current(struct DNSRecord *want, const struct DNSRecord *have) {
+    if (want->ttl == SYNC_KEEP_CURRENT) want->ttl = have ? have->ttl : ZONE_DEFAULT_TTL;
+    if (want->priority == SYNC_KEEP_CURRENT) want->priority = have ? have->priority : 0;
+}
+
+// Compute the minimal operations turning current into desired. Records are
+// matched on (host, type, data) through a hash index; matches with a different
+// TTL or priority become updates, and leftover deletes and adds sharing
+// (host, type) are paired into updates. Read-only current records are kept,
+// never updated or deleted.
+// A desired ttl or priority left out takes the value of the record it replaces.
+int compute_sync_plan(struct RecordSet *current, struct RecordSet *desired, struct SyncPlan *plan) {
+    struct HashIndex index;
+    size_t pending_adds = 0;
+    
+    memset(plan, 0, sizeof(*plan));
+    if (hash_index_init(&index, current->count) != 0) return -1;
+    for (size_t i = 0; i < current->count; i++) {
+        if (hash_index_insert(&index, current->items[i].key_hash, i) != 0) {
+            hash_index_free(&index);
+            return -1;
+        }
+    }
+    
+    plan->ops = calloc(current->count + desired->count + 1, sizeof(*plan->ops));
+    size_t *adds = calloc(desired->count + 1, sizeof(size_t));
+    if (!plan->ops || !adds) {
+        hash_index_free(&index);
+        free(adds);
+        return -1;
+    }
+    
+    for (size_t d = 0; d < desired->count; d++) {
+        struct ZoneRecord *want = &desired->items[d];
+        size_t pos = 0, c;
+        int found = 0, duplicate = 0;
+        
+        while (hash_index_next(&index, want->key_hash, &pos, &c)) {
+            struct ZoneRecord *have = &current->items[c];
+            if (!record_key_equal(&have->record, &want->record)) continue;
+            if (have->matched) {
+                duplicate = 1;
+                continue;
+            }
+            have->matched = 1;
+            found = 1;
+            sync_keep_current(&want->record, &have->record);
+            if (have->read_only) {
+                // Kept as it is, whatever ttl or priority the desired state asks for
+                plan->kept_read_only++;
+            } else if (have->record.ttl != want->record.ttl || have->record.priority != want->record.priority) {
+                struct SyncOperation *op = &plan->ops[plan->count++];
+                op->type = BATCH_OP_UPDATE;
+                op->current = c;
+                op->desired = d;
+                plan->updates++;
+            } else {
+                plan->unchanged++;
+            }
+            break;
+        }
+        if (!found && !duplicate) adds[pending_adds++] = d;
+    }
+    hash_index_free(&index);
+    
+    // Index the current records that are going away by (host, type)
+    if (hash_index_init(&index, current->count) != 0) {
+        free(adds);
+        return -1;
+    }
+    for (size_t c = 0; c < current->count; c++) {
+        if (!current->items[c].matched && !current->items[c].read_only) {
+            hash_index_insert(&index, record_slot_hash(&current->items[c].record), c);
+        }
+    }
+    
+    for (size_t a = 0; a < pending_adds; a++) {
+        struct ZoneRecord *want = &desired->items[adds[a]];
+        struct SyncOperation *op = &plan->ops[plan->count++];
+        size_t pos = 0, c;
+        
+        op->type = BATCH_OP_ADD;
+        op->desired = adds[a];
+        while (hash_index_next(&index, record_slot_hash(&want->record), &pos, &c)) {
+            struct ZoneRecord *have = &current->items[c];
+            if (have->matched || strcasecmp(have->record.host, want->record.host) != 0 ||
+                strcasecmp(have->record.type, want->record.type) != 0) {
+                continue;
+            }
+            have->matched = 1;
+            op->type = BATCH_OP_UPDATE;
+            op->current = c;
+            sync_keep_current(&want->record, &have->record);
+            break;
+        }
+        sync_keep_current(&want->record, NULL);
+        if (op->type == BATCH_OP_UPDATE) plan->updates++;
+        else plan->adds++;
+    }
+    hash_index_free(&index);
+    free(adds);
+    
+    for (size_t c = 0; c < current->count; c++) {
+        if (current->items[c].matched) continue;
+        if (current->items[c].read_only) {
+            plan->kept_read_only++;
+            continue;
+        }
+        struct SyncOperation *op = &plan->ops[plan->count++];
+        op->type = BATCH_OP_DELETE;
+        op->current = c;
+        plan->deletes++;
+    }
+    return 0;
+}
+
+// Fill a BatchOperation (borrowing the strings) from a plan entry
+static void sync_operation_to_batch(const struct SyncContext *sync, const struct SyncOperation *sop,
+                                    struct BatchOperation *op) {
+    memset(op, 0, sizeof(*op));
+    op->type = sop->type;
+    switch (sop->type) {
+        case BATCH_OP_ADD:
+            op->record = sync->desired->items[sop->desired].record;
+            break;
+        case BATCH_OP_DELETE:
+            op->record = sync->current->items[sop->current].record;
+            break;
+        default:
+            op->record = sync->current->items[sop->current].record;
+            op->new_record = sync->desired->items[sop->desired].record;
+            break;
+    }
+}
+
+static int sync_list_source(void *ctx, struct PendingRequest *request) {
+    struct SyncContext *sync = ctx;
+    if (sync->listed) return 1;
+    sync->listed = 1;
+    
+    request->action = SOAP_ACTION_LIST;
+    if (build_record_list_request(&request->body, sync->username, sync->passwordB64, sync->domain) != 0) {
+        request->action = SOAP_ACTION_NONE;
+    }
+    request->parser = &sync->parser;
+    return 0;
+}
+
+static void sync_list_done(void *ctx, struct PendingRequest *request) {
+    struct SyncContext *sync = ctx;
+    sync->list_result = request->action == SOAP_ACTION_NONE ? CURLE_OUT_OF_MEMORY : request->curl_result;
+    sync->list_error = request->action == SOAP_ACTION_NONE ? curl_easy_strerror(CURLE_OUT_OF_MEMORY)
+                                                           : pending_request_error(request);
+}
+
+static int sync_apply_source(void *ctx, struct PendingRequest *request) {
+    struct SyncContext *sync = ctx;
+    if (sync->next >= sync->plan.count) return 1;
+    
+    struct SyncOperation *sop = &sync->plan.ops[sync->next++];
+    struct BatchOperation op;
+    sync_operation_to_batch(sync, sop, &op);
+    request->action = batch_soap_action(op.type);
+    if (build_batch_request(&request->body, sync->username, sync->passwordB64, &op) != 0) {
+        request->action = SOAP_ACTION_NONE;
+    }
+    request->userdata = sop;
+    return 0;
+}
+
+static void sync_apply_done(void *ctx, struct PendingRequest *request) {
+    struct SyncContext *sync = ctx;
+    struct SyncOperation *sop = request->userdata;
+    struct BatchOperation op;
+    sync_operation_to_batch(sync, sop, &op);
+    
+    out_char('{');
+    print_operation_json(&op);
+    if (request->action == SOAP_ACTION_NONE) {
+        out_literal(",\"error\":\"Not enough memory to build request\"}\n");
+        sync->errors++;
+    } else if (request->curl_result != CURLE_OK) {
+        out_literal(",\"error\":");
+        print_json_string(pending_request_error(request));
+        out_literal("}\n");
+        sync->errors++;
+    } else {
+        out_char(',');
+        print_result_json(&request->result);
+        print_timings_json(&request->timings);
+        out_literal("}\n");
+        if (request->result.code == 0) sync->succeeded++;
+        else sync->failed++;
+    }
+    out_flush();
+}
+
+// Reconcile a domain with a desired-state file: one recordGetList, a diff, and
+// only the resulting add/update/delete calls, all in one session
+int run_sync(const char *username, const char *passwordB64, const char *domain, FILE *input,
+             int dry_run, int parallel) {
+    struct RecordSet current = {0}, desired = {0};
+    const char *error = NULL;
+    
+    // Opened first, so that a pre-warm overlaps with reading the desired state
+    struct RequestEngine engine;
+    if (open_engine(&engine, parallel) != 0) return 1;
+    
+    if (load_desired_state(input, domain, &desired, &error) != 0) {
+        fprintf(stderr, "Error: %s\n", error);
+        gidinet_record_set_free(&desired);
+        close_engine(&engine);
+        return 1;
+    }
+    
+    struct SyncContext sync = {0};
+    sync.username = username;
+    sync.passwordB64 = passwordB64;
+    sync.domain = domain;
+    sync.current = &current;
+    sync.desired = &desired;
+    soap_parser_init(&sync.parser, NULL, record_set_collect, &current);
+    
+    int rc = 1;
+    engine_run(&engine, sync_list_source, sync_list_done, &sync);
+    soap_parser_finish(&sync.parser);
+    
+    if (sync.list_result != CURLE_OK) {
+        fprintf(stderr, "Request failed: %s\n", sync.list_error);
+    } else if (sync.parser.result_code != 0) {
+        struct APIResult result;
+        soap_parser_get_result(&sync.parser, &result);
+        out_char('{');
+        print_result_json(&result);
+        out_literal("}\n");
+        free(result.text);
+    } else if (current.failed || compute_sync_plan(&current, &desired, &sync.plan) != 0) {
+        fprintf(stderr, "Not enough memory to compute sync plan\n");
+    } else {
+        if (dry_run) {
+            for (size_t i = 0; i < sync.plan.count; i++) {
+                struct BatchOperation op;
+                sync_operation_to_batch(&sync, &sync.plan.ops[i], &op);
+                out_char('{');
+                print_operation_json(&op);
+                out_literal("}\n");
+            }
+        } else {
+            engine_run(&engine, sync_apply_source, sync_apply_done, &sync);
+            if (sync.succeeded > 0) zone_cache_invalidate(username, domain);
+        }
+        
+        out_printf("{\"summary\":{\"dryRun\":%s,\"current\":%zu,\"desired\":%zu,\"unchanged\":%zu,"
+                   "\"readOnlyKept\":%zu,\"adds\":%zu,\"updates\":%zu,\"deletes\":%zu",
+                   dry_run ? "true" : "false", current.count, desired.count, sync.plan.unchanged,
+                   sync.plan.kept_read_only, sync.plan.adds, sync.plan.updates, sync.plan.deletes);
+        if (!dry_run) {
+            char limits[256];
+            out_printf(",\"succeeded\":%d,\"failed\":%d,\"errors\":%d,\"retries\":%lu%s", sync.succeeded,
+                       sync.failed, sync.errors, engine.retries, limits_json(&engine, limits, sizeof(limits)));
+        }
+        out_literal("}}\n");
+        rc = sync.errors ? 1 : 0;
+    }
+    
+    free(sync.plan.ops);
+    soap_parser_free(&sync.parser);
+    close_engine(&engine);
+    gidinet_record_set_free(&current);
+    gidinet_record_set_free(&desired);
+    return rc;
+}
+
+// Fetch the records of a domain and write them to a snapshot file, then print
+// the result with the record and distinct string counts
+int run_snapshot(const char *username, const char *passwordB64, const char *domain, const char *path) {
+    struct GidinetClient *client = open_client(username, passwordB64);
+    if (!client) return 1;
+    
+    // Records are interned as they are parsed; nothing else is kept per record
+    struct SnapshotWriter writer;
+    struct SoapParser parser;
+    if (snapshot_writer_init(&writer) != 0) {
+        fprintf(stderr, "Not enough memory to build a snapshot\n");
+        close_client(client);
+        return 1;
+    }
+    soap_parser_init(&parser, NULL, snapshot_writer_add, &writer);
+    
+    int rc = gidinet_record_list_parse(client, domain, &parser);
+    struct APIResult result;
+    soap_parser_get_result(&parser, &result);
+    
+    if (rc != 0) {
+        fprintf(stderr, "Request failed: %s\n", gidinet_client_error(client));
+        rc = 1;
+    } else if (result.code != 0) {
+        // Only complete listings are written
+        out_char('{');
+        print_result_json(&result);
+        print_timings_json(&client->timings);
+        out_literal("}\n");
+        rc = 1;
+    } else if (snapshot_writer_save(&writer, domain, path) != 0) {
+        fprintf(stderr, "Cannot write snapshot %s: %s\n", path, writer.failed ? "out of memory" : strerror(errno));
+        rc = 1;
+    } else {
+        out_char('{');
+        print_result_json(&result);
+        out_literal(",\"file\":");
+        print_json_string(path);
+        out_printf(",\"recordCount\":%u,\"stringCount\":%u", writer.record_count, writer.string_count);
+        print_timings_json(&client->timings);
+        out_literal("}\n");
+    }
+    
+    gidinet_result_free(&result);
+    soap_parser_free(&parser);
+    snapshot_writer_free(&writer);
+    close_client(client);
+    return rc;
+}
+
+static void print_snapshot_record_json(const struct Snapshot *snapshot, uint32_t index) {
+    struct ListRecord record;
+    snapshot_record(snapshot, index, &record);
+    print_list_record_json(&record);
+}
+
+// Print one difference as an NDJSON line; ctx is the (old, new) snapshot pair
+static void diff_print_change(void *ctx, enum SnapshotChange change, uint32_t old_index, uint32_t new_index) {
+    const struct Snapshot *snapshots = ctx;
+    
+    if (change == SNAPSHOT_ADDED) {
+        out_literal("{\"change\":\"added\",\"record\":");
+        print_snapshot_record_json(&snapshots[1], new_index);
+    } else if (change == SNAPSHOT_REMOVED) {
+        out_literal("{\"change\":\"removed\",\"record\":");
+        print_snapshot_record_json(&snapshots[0], old_index);
+    } else {
+        out_literal("{\"change\":\"changed\",\"old\":");
+        print_snapshot_record_json(&snapshots[0], old_index);
+        out_literal(",\"new\":");
+        print_snapshot_record_json(&snapshots[1], new_index);
+    }
+    out_literal("}\n");
+}
+
+// Compare two snapshot files in place. Exits like diff(1): 0 when they hold the
+// same records, 1 when they differ, 2 on error.
+int run_diff(const char *old_path, const char *new_path) {
+    struct Snapshot snapshots[2];
+    const char *paths[2] = { old_path, new_path };
+    
+    for (int i = 0; i < 2; i++) {
+        if (snapshot_open(&snapshots[i], paths[i]) != 0) {
+            fprintf(stderr, "Cannot read snapshot %s: %s\n", paths[i],
+                    errno == EINVAL ? "not a valid snapshot" : strerror(errno));
+            if (i > 0) snapshot_close(&snapshots[0]);
+            return 2;
+        }
+    }
+    
+    struct SnapshotDiffStats stats;
+    int rc = 2;
+    if (snapshot_diff(&snapshots[0], &snapshots[1], diff_print_change, snapshots, &stats) != 0) {
+        fprintf(stderr, "Not enough memory to compare snapshots\n");
+    } else {
+        out_printf("{\"summary\":{\"old\":%u,\"new\":%u,\"added\":%lu,\"removed\":%lu,\"changed\":%lu,"
+                   "\"unchanged\":%lu}}\n",
+                   snapshots[0].record_count, snapshots[1].record_count, stats.added, stats.removed, stats.changed,
+                   stats.unchanged);
+        rc = stats.added || stats.removed || stats.changed ? 1 : 0;
+    }
+    
+    snapshot_close(&snapshots[0]);
+    snapshot_close(&snapshots[1]);
+    return rc;
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_signal_handler(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+// Whether an address cannot be reached from the internet: RFC 1918 and shared
+// (100.64.0.0/10, CGNAT) IPv4 space, or IPv6 unique local (fc00::/7)
+static int is_private_address(int family, const void *addr) {
+    if (family == AF_INET) {
+        uint32_t a = ntohl(((const struct in_addr *)addr)->s_addr);
+        return (a >> 24) == 10 || (a >> 20) == 0xAC1 || (a >> 16) == 0xC0A8 || (a >> 22) == (100 << 2 | 1);
+    }
+    return (((const struct in6_addr *)addr)->s6_addr[0] & 0xFE) == 0xFC;
+}
+
+// Find a usable address of the requested family, optionally on one interface.
+// Loopback and link-local addresses are always skipped, private ones unless the
+// interface was named. Returns 0 if one was found.
+int find_interface_address(const char *interface, int family, char *address, size_t size) {
+    struct ifaddrs *addrs, *ifa;
+    int found = -1;
+    
+    if (getifaddrs(&addrs) != 0) return -1;
+    
+    for (ifa = addrs; ifa && found != 0; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family) continue;
+        if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK)) continue;
+        if (interface && strcmp(ifa->ifa_name, interface) != 0) continue;
+        
+        if (family == AF_INET) {
+            struct in_addr *in = &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            uint32_t host_order = ntohl(in->s_addr);
+            if ((host_order >> 16) == 0xA9FE || (host_order >> 24) == 127) continue; // 169.254.0.0/16, 127.0.0.0/8
+            if (!interface && is_private_address(AF_INET, in)) continue;
+            if (inet_ntop(AF_INET, in, address, size)) found = 0;
+        } else {
+            struct in6_addr *in6 = &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+            if (IN6_IS_ADDR_LINKLOCAL(in6) || IN6_IS_ADDR_LOOPBACK(in6)) continue;
+            if (!interface && is_private_address(AF_INET6, in6)) continue;
+            if (inet_ntop(AF_INET6, in6, address, size)) found = 0;
+        }
+    }
+    
+    freeifaddrs(addrs);
+    return found;
+}
+
+// Parser callback remembering the listed record the daemon manages
+static void daemon_find_record(void *ctx, const struct ListRecord *listed) {
+    struct DaemonState *state = ctx;
+    if (state->have_record) return;
+    if (strcasecmp(listed->host, state->config->host) != 0 || strcasecmp(listed->type, state->config->type) != 0) {
+        return;
+    }
+    snprintf(state->pushed, sizeof(state->pushed), "%s", listed->data);
+    state->ttl = listed->ttl;
+    state->priority = listed->priority;
+    state->have_record = 1;
+}
+
+// Account the client's last request and refresh the metrics file
+static void daemon_observe(struct DaemonState *state, enum SoapAction action, int result_code) {
+    const char *path = state->config->metrics_path;
+    if (!path) return;
+    metrics_observe(&state->metrics, action, &state->client->timings, result_code);
+    if (metrics_write_prometheus(&state->metrics, path) != 0) {
+        fprintf(stderr, "Failed to write metrics to %s: %s\n", path, strerror(errno));
+    }
+}
+
+// Learn the current value of the record with one recordGetList
+static int daemon_fetch_record(struct DaemonState *state) {
+    const struct DaemonConfig *config = state->config;
+    state->have_record = 0;
+    soap_parser_reset(&state->parser, NULL, daemon_find_record, state);
+    int rc = gidinet_record_list_parse(state->client, config->domain, &state->parser);
+    int result_code = state->parser.result_code;
+    daemon_observe(state, SOAP_ACTION_LIST, rc != 0 ? -1 : result_code);
+    
+    if (rc != 0) {
+        out_literal("{\"event\":\"error\",\"error\":");
+        print_json_string(gidinet_client_error(state->client));
+        out_literal("}\n");
+        return -1;
+    }
+    if (result_code != 0) {
+        out_printf("{\"event\":\"error\",\"result\":{\"code\":%d,\"message\":", result_code);
+        print_json_string(gidinet_result_code_message(result_code));
+        out_literal("}}\n");
+        return -1;
+    }
+    
+    if (!state->have_record) {
+        state->pushed[0] = '\0';
+        state->ttl = config->ttl > 0 ? config->ttl : 300;
+        state->priority = config->priority;
+    }
+    state->synced = 1;
+    return 0;
+}
+
+// Push address with recordUpdate (or recordAdd if the record does not exist yet)
+static int daemon_push(struct DaemonState *state, const char *address) {
+    const struct DaemonConfig *config = state->config;
+    struct DNSRecord newRecord = { (char *)config->domain, (char *)config->host, (char *)config->type,
+                                   (char *)address, config->ttl > 0 ? config->ttl : state->ttl,
+                                   config->ttl > 0 ? config->priority : state->priority };
+    struct DNSRecord oldRecord = { (char *)config->domain, (char *)config->host, (char *)config->type,
+                                   state->pushed, state->ttl, state->priority };
+    enum SoapAction action = state->have_record ? SOAP_ACTION_UPDATE : SOAP_ACTION_ADD;
+    struct APIResult result;
+    int res = state->have_record
+        ? gidinet_record_update(state->client, &oldRecord, &newRecord, &result)
+        : gidinet_record_add(state->client, &newRecord, &result);
+    daemon_observe(state, action, res != 0 ? -1 : result.code);
+    
+    out_literal("{\"event\":\"change\",\"from\":");
+    print_json_string(state->have_record ? state->pushed : "");
+    out_literal(",\"to\":");
+    print_json_string(address);
+    
+    int rc = -1;
+    if (res != 0) {
+        out_literal(",\"error\":");
+        print_json_string(gidinet_client_error(state->client));
+    } else {
+        out_char(',');
+        print_result_json(&result);
+        if (result.code == 0) {
+            snprintf(state->pushed, sizeof(state->pushed), "%s", address);
+            state->ttl = newRecord.ttl;
+            state->priority = newRecord.priority;
+            state->have_record = 1;
+            zone_cache_invalidate(config->username, config->domain);
+            rc = 0;
+        } else {
+            // The record may have been changed elsewhere: re-read it before retrying
+            state->synced = 0;
+        }
+        print_timings_json(&state->client->timings);
+    }
+    gidinet_result_free(&result);
+    out_literal("}\n");
+    out_flush();
+    return rc;
+}
+
+// Track the address of a local interface and push it to the record whenever it
+// changes. The client stays open so that connection and TLS session are
+// reused between updates; no request is made while the address is unchanged.
+// A new address must be stable for the debounce period, and a random jitter is
+// added so that a fleet of hosts does not update in lockstep.
+int run_daemon(const struct DaemonConfig *config) {
+    int family = strcasecmp(config->type, "AAAA") == 0 ? AF_INET6 : AF_INET;
+    struct DaemonState state = {0};
+    state.config = config;
+    
+    state.client = open_client(config->username, config->passwordB64);
+    if (!state.client) return 1;
+    
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    srand((unsigned int)(time(NULL) ^ getpid()));
+    
+    out_literal("{\"event\":\"start\",\"domain\":");
+    print_json_string(config->domain);
+    out_literal(",\"host\":");
+    print_json_string(config->host);
+    out_literal(",\"type\":");
+    print_json_string(config->type);
+    out_printf(",\"interval\":%d,\"debounce\":%d,\"jitter\":%d}\n", config->interval, config->debounce, config->jitter);
+    out_flush();
+    
+    char candidate[INET6_ADDRSTRLEN] = "";
+    double push_at = 0;
+    
+    while (!stop_requested) {
+        double now = monotonic_seconds();
+        char address[INET6_ADDRSTRLEN];
+        
+        if (!state.synced && daemon_fetch_record(&state) != 0) {
+            out_flush();
+        } else if (find_interface_address(config->interface, family, address, sizeof(address)) == 0) {
+            if (state.have_record && strcmp(address, state.pushed) == 0) {
+                // Nothing to do; forget any pending change that reverted
+                candidate[0] = '\0';
+            } else if (strcmp(address, candidate) != 0) {
+                // New value: wait until it has been stable for the debounce period
+                snprintf(candidate, sizeof(candidate), "%s", address);
+                push_at = now + config->debounce +
+                          (config->jitter > 0 ? (double)rand() / RAND_MAX * config->jitter : 0);
+            } else if (now >= push_at) {
+                if (daemon_push(&state, candidate) == 0) {
+                    candidate[0] = '\0';
+                } else {
+                    push_at = now + config->interval;
+                }
+            }
+        }
+        
+        // Sleep until the next poll, or until a pending push is due
+        double wake = now + config->interval;
+        if (candidate[0] && push_at < wake) wake = push_at;
+        double delay = wake - monotonic_seconds();
+        if (delay > 0) {
+            struct timespec ts = { (time_t)delay, (long)((delay - (time_t)delay) * 1e9) };
+            nanosleep(&ts, NULL);
+        }
+    }
+    
+    out_literal("{\"event\":\"stop\"}\n");
+    soap_parser_free(&state.parser);
+    close_client(state.client);
+    return 0;
+}
+
+static void watch_push(struct WatchContext *watch, struct WatchZone *zone) {
+    size_t i = watch->queued++;
+    while (i > 0 && watch->queue[(i - 1) / 2]->due > zone->due) {
+        watch->queue[i] = watch->queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    watch->queue[i] = zone;
+}
+
+// Take the zone due first off the queue
+static struct WatchZone* watch_pop(struct WatchContext *watch) {
+    struct WatchZone *top = watch->queue[0];
+    struct WatchZone *last = watch->queue[--watch->queued];
+    size_t i = 0;
+    
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= watch->queued) break;
+        if (child + 1 < watch->queued && watch->queue[child + 1]->due < watch->queue[child]->due) child++;
+        if (last->due <= watch->queue[child]->due) break;
+        watch->queue[i] = watch->queue[child];
+        i = child;
+    }
+    if (watch->queued > 0) watch->queue[i] = last;
+    return top;
+}
+
+// Poll the zone due first once its time has come
+static int watch_source(void *ctx, struct PendingRequest *request) {
+    struct WatchContext *watch = ctx;
+    if (stop_requested) return 1;
+    
+    // Zones are only queued while no poll of theirs is in flight
+    watch->engine->source_wake = watch->queued ? watch->queue[0]->due : 0;
+    if (watch->queued == 0 || watch->queue[0]->due > monotonic_seconds()) return REQUEST_SOURCE_WAIT;
+    
+    struct WatchZone *zone = watch_pop(watch);
+    request->userdata = zone;
+    request->action = SOAP_ACTION_LIST;
+    if (build_record_list_request(&request->body, watch->username, watch->passwordB64, zone->domain) != 0) {
+        request->action = SOAP_ACTION_NONE;
+    }
+    return 0;
+}
+
+static void print_zone_record_json(const struct ZoneRecord *item) {
+    const struct DNSRecord *record = &item->record;
+    out_literal("{\"domain\":");
+    print_json_string(record->domain);
+    out_literal(",\"host\":");
+    print_json_string(record->host);
+    out_literal(",\"type\":");
+    print_json_string(record->type);
+    out_literal(",\"data\":");
+    print_json_string(record->data);
+    out_printf(",\"ttl\":%d,\"priority\":%d,\"readOnly\":%s}", record->ttl, record->priority,
+               item->read_only ? "true" : "false");
+}
+
+static void watch_print_event(const struct WatchZone *zone, const char *event, const struct ZoneRecord *old,
+                              const struct ZoneRecord *new) {
+    out_printf("{\"event\":\"%s\",\"domain\":", event);
+    print_json_string(zone->domain);
+    if (old && new) {
+        out_literal(",\"old\":");
+        print_zone_record_json(old);
+        out_literal(",\"new\":");
+        print_zone_record_json(new);
+    } else {
+        out_literal(",\"record\":");
+        print_zone_record_json(old ? old : new);
+    }
+    out_literal("}\n");
+}
+
+// Print what changed between the zone's last listing and fresh, then keep fresh.
+// Records are matched on (host, type, data) through the hash index of the last
+// listing; a matched record whose TTL, priority or read-only flag differ changed.
+// Returns the number of events, or -1 when out of memory.
+static long watch_diff(struct WatchZone *zone, struct RecordSet *fresh) {
+    long events = 0;
+    
+    for (size_t i = 0; zone->polled && i < fresh->count; i++) {
+        const struct ZoneRecord *now = &fresh->items[i];
+        struct ZoneRecord *was = NULL;
+        size_t pos = 0, value;
+        while (hash_index_next(&zone->index, now->key_hash, &pos, &value)) {
+            struct ZoneRecord *candidate = &zone->records.items[value];
+            if (!candidate->matched && record_key_equal(&candidate->record, &now->record)) {
+                was = candidate;
+                break;
+            }
+        }
+        if (!was) {
+            watch_print_event(zone, "added", NULL, now);
+            events++;
+            continue;
+        }
+        was->matched = 1;
+        if (was->record.ttl != now->record.ttl || was->record.priority != now->record.priority ||
+            was->read_only != now->read_only) {
+            watch_print_event(zone, "changed", was, now);
+            events++;
+        }
+    }
+    for (size_t i = 0; zone->polled && i < zone->records.count; i++) {
+        if (zone->records.items[i].matched) continue;
+        watch_print_event(zone, "removed", &zone->records.items[i], NULL);
+        events++;
+    }
+    
+    gidinet_record_set_free(&zone->records);
+    zone->records = *fresh;
+    memset(fresh, 0, sizeof(*fresh));
+    hash_index_clear(&zone->index);
+    for (size_t i = 0; i < zone->records.count; i++) {
+        if (hash_index_insert(&zone->index, zone->records.items[i].key_hash, i) != 0) return -1;
+    }
+    return events;
+}
+
+static void watch_print_error(const struct WatchZone *zone, const char *error, int result_code) {
+    out_literal("{\"event\":\"error\",\"domain\":");
+    print_json_string(zone->domain);
+    if (error) {
+        out_literal(",\"error\":");
+        print_json_string(error);
+    } else {
+        out_printf(",\"result\":{\"code\":%d,\"message\":", result_code);
+        print_json_string(gidinet_result_code_message(result_code));
+        out_char('}');
+    }
+    out_literal("}\n");
+}
+
+// Handle one poll. A listing whose body hashes to the zone's digest changed
+// nothing and is not parsed; otherwise its records are diffed against the last
+// ones. Then the zone is queued for its next poll.
+static void watch_done(void *ctx, struct PendingRequest *request) {
+    struct WatchContext *watch = ctx;
+    struct WatchZone *zone = request->userdata;
+    
+    watch->polls++;
+    if (request->action == SOAP_ACTION_NONE || request->curl_result != CURLE_OK) {
+        watch_print_error(zone, request->action == SOAP_ACTION_NONE ? "Not enough memory to build request"
+                                                                    : pending_request_error(request), 0);
+        watch->errors++;
+    } else if (request->result.code != 0) {
+        watch_print_error(zone, NULL, request->result.code);
+        watch->errors++;
+    } else {
+        uint64_t digest = fnv1a_hash(request->response.data, request->response.size, FNV1A_SEED);
+        struct RecordSet fresh = {0};
+        long events = 0;
+        if (zone->polled && digest == zone->digest) {
+            watch->unchanged++;
+        } else {
+            soap_parser_reset(&watch->parser, NULL, record_set_collect, &fresh);
+            soap_parser_feed(&watch->parser, request->response.data, request->response.size);
+            soap_parser_finish(&watch->parser);
+            if (fresh.failed || (events = watch_diff(zone, &fresh)) < 0) {
+                // Start over from the next listing
+                watch_print_error(zone, "Not enough memory to hold the zone", 0);
+                watch->errors++;
+                zone->polled = 0;
+            } else if (!zone->polled) {
+                // The first listing is the baseline changes are reported against
+                out_literal("{\"event\":\"ready\",\"domain\":");
+                print_json_string(zone->domain);
+                out_printf(",\"records\":%zu,\"digest\":\"%016" PRIx64 "\"}\n", zone->records.count, digest);
+                zone->digest = digest;
+                zone->polled = 1;
+            } else {
+                // The same records may come back in another order
+                if (events > 0) {
+                    watch->changed++;
+                } else {
+                    watch->unchanged++;
+                }
+                zone->digest = digest;
+            }
+            gidinet_record_set_free(&fresh);
+        }
+    }
+    out_flush();
+    
+    // One interval after the last poll was due, moved by up to half the jitter
+    // either way so that zones polled together drift apart
+    double now = monotonic_seconds();
+    zone->due += watch->interval + (watch->jitter > 0 ? ((double)rand() / RAND_MAX - 0.5) * watch->jitter : 0);
+    if (zone->due < now) zone->due = now;
+    watch_push(watch, zone);
+}
+
+// Poll the listing of every domain each interval and print the records added,
+// removed or changed since the last poll as JSON lines, until SIGINT or SIGTERM.
+// Polls are staggered across the interval and jittered; up to parallel run at
+// once over a shared connection cache.
+int run_watch(const char *username, const char *passwordB64, char **domains, int domain_count, FILE *input,
+              int parallel, int interval, int jitter) {
+    struct WatchContext watch = {0};
+    watch.username = username;
+    watch.passwordB64 = passwordB64;
+    watch.interval = interval;
+    watch.jitter = jitter;
+    
+    // Domains of the --domain options, then of the input lines
+    size_t cap = domain_count > 0 ? domain_count : 16;
+    char **names = malloc(cap * sizeof(*names));
+    size_t count = 0;
+    for (int i = 0; names && i < domain_count; i++) names[count++] = strdup(domains[i]);
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while (names && input && (line_len = getline(&line, &line_cap, input)) != -1) {
+        char *text = line;
+        while (line_len > 0 && isspace((unsigned char)text[line_len - 1])) text[--line_len] = '\0';
+        while (isspace((unsigned char)*text)) text++;
+        if (*text == '\0' || *text == '#') continue;
+        if (count == cap) {
+            char **grown = realloc(names, cap * 2 * sizeof(*names));
+            if (!grown) break;
+            names = grown;
+            cap *= 2;
+        }
+        names[count++] = strdup(text);
+    }
+    free(line);
+    
+    watch.zones = calloc(count ? count : 1, sizeof(*watch.zones));
+    watch.queue = malloc((count ? count : 1) * sizeof(*watch.queue));
+    int failed = !names || !watch.zones || !watch.queue;
+    double start = monotonic_seconds();
+    for (size_t i = 0; i < count && !failed; i++) {
+        struct WatchZone *zone = &watch.zones[i];
+        zone->domain = names[i];
+        zone->due = start + (double)interval * i / count;
+        failed = !zone->domain || hash_index_init(&zone->index, 64) != 0;
+        watch.zone_count++;
+        if (!failed) watch_push(&watch, zone);
+    }
+    
+    struct RequestEngine engine;
+    int rc = 1;
+    if (failed) {
+        fprintf(stderr, "Not enough memory to watch domains\n");
+    } else if (count == 0) {
+        fprintf(stderr, "No domains to watch\n");
+    } else if (open_engine(&engine, parallel) == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stop_signal_handler;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        srand((unsigned int)(time(NULL) ^ getpid()));
+        
+        out_printf("{\"event\":\"start\",\"domains\":%zu,\"interval\":%d,\"jitter\":%d}\n", count, interval, jitter);
+        out_flush();
+        watch.engine = &engine;
+        rc = 0;
+        if (engine_run(&engine, watch_source, watch_done, &watch) != 0) {
+            fprintf(stderr, "Not enough memory to watch domains\n");
+            rc = 1;
+        }
+        out_printf("{\"event\":\"stop\",\"polls\":%lu,\"unchanged\":%lu,\"changed\":%lu,\"errors\":%lu}\n",
+                   watch.polls, watch.unchanged, watch.changed, watch.errors);
+        close_engine(&engine);
+    }
+    
+    for (size_t i = 0; i < watch.zone_count; i++) {
+        gidinet_record_set_free(&watch.zones[i].records);
+        hash_index_free(&watch.zones[i].index);
+    }
+    for (size_t i = 0; names && i < count; i++) free(names[i]);
+    free(names);
+    free(watch.zones);
+    free(watch.queue);
+    soap_parser_free(&watch.parser);
+    return rc;
+}
+
+// Local HTTP/JSON gateway (serve)
+#define SERVE_MAX_CLIENTS 10000   // Further connections wait in the listen backlog
+#define SERVE_MAX_HEADER 16384
+#define SERVE_MAX_BODY 65536
+
+static const char* http_status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        default: return "Bad Gateway";
+    }
+}
+
+// HTTP status for an API result code
+static int serve_result_status(int code) {
+    switch (code) {
+        case 0: return 200;
+        case 2: return 403;
+        case 3: return 400;
+        case 5: return 404;
+        case 6: return 409;
+        default: return 502;
+    }
+}
+
+// Copy the value of a header of the request head (request line, then header
+// lines) into value. Returns 1 if the header is present.
+static int http_header(const char *head, size_t len, const char *name, char *value, size_t size) {
+    const char *end = head + len;
+    const char *line = memchr(head, '\n', len);
+    size_t name_len = strlen(name);
+    
+    while (line && ++line < end) {
+        const char *eol = memchr(line, '\n', end - line);
+        if (!eol) eol = end;
+        if ((size_t)(eol - line) > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0) {
+            const char *p = line + name_len + 1;
+            const char *q = eol;
+            while (p < q && (*p == ' ' || *p == '\t')) p++;
+            while (q > p && isspace((unsigned char)q[-1])) q--;
+            snprintf(value, size, "%.*s", (int)(q - p), p);
+            return 1;
+        }
+        line = eol;
+    }
+    return 0;
+}
+
+// Decode %XX escapes and + in place
+static void url_decode(char *str) {
+    char *out_p = str;
+    for (char *p = str; *p; p++) {
+        if (*p == '+') {
+            *out_p++ = ' ';
+        } else if (*p == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+            char hex[3] = { p[1], p[2], '\0' };
+            *out_p++ = (char)strtol(hex, NULL, 16);
+            p += 2;
+        } else {
+            *out_p++ = *p;
+        }
+    }
+    *out_p = '\0';
+}
+
+// Next key=value pair of a query string, decoded in place. Returns 0 when there are no more.
+static int query_next(char **query, char **key, char **value) {
+    while (*query && **query) {
+        char *pair = strsep(query, "&");
+        if (!*pair) continue;
+        char *eq = strchr(pair, '=');
+        if (eq) *eq = '\0';
+        *key = pair;
+        *value = eq ? eq + 1 : pair + strlen(pair);
+        url_decode(*key);
+        url_decode(*value);
+        return 1;
+    }
+    return 0;
+}
+
+static void serve_close(struct ServeContext *serve, struct ServeClient *client) {
+    if (client->fd < 0) return;
+    close(client->fd);
+    client->fd = -1;
+    serve->accept_paused = 0;
+}
+
+// Write as much of the pending output as the socket takes
+static void serve_flush(struct ServeContext *serve, struct ServeClient *client) {
+    while (client->fd >= 0 && client->sent < client->out.len) {
+        ssize_t n = write(client->fd, client->out.data + client->sent, client->out.len - client->sent);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) serve_close(serve, client);
+            return;
+        }
+        client->sent += (size_t)n;
+    }
+    client->out.len = client->sent = 0;
+    if (client->close_after) serve_close(serve, client);
+}
+
+// Queue a response for a client and let it send its next request
+static void serve_respond(struct ServeContext *serve, struct ServeClient *client, int status,
+                          const char *body, size_t len) {
+    client->busy = 0;
+    if (client->fd < 0) return;
+    
+    char head[192];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\n%s\r\n", status, http_status_text(status), len,
+                     client->close_after ? "Connection: close\r\n" : "");
+    if (buffer_append(&client->out, head, (size_t)n) != 0 || buffer_append(&client->out, body, len) != 0) {
+        serve_close(serve, client);
+        return;
+    }
+    serve_flush(serve, client);
+}
+
+// Send the body collected since out_capture_begin(&serve->body)
+static void serve_reply(struct ServeContext *serve, struct ServeClient *client, int status) {
+    out_char('\n');
+    if (out_capture_end() != 0) {
+        static const char error[] = "{\"error\":\"Not enough memory\"}\n";
+        serve_respond(serve, client, 500, error, sizeof(error) - 1);
+        return;
+    }
+    serve_respond(serve, client, status, serve->body.data, serve->body.len);
+}
+
+static void serve_error(struct ServeContext *serve, struct ServeClient *client, int status, const char *message) {
+    out_capture_begin(&serve->body);
+    out_literal("{\"error\":");
+    print_json_string(message);
+    out_char('}');
+    serve_reply(serve, client, status);
+}
+
+static void serve_request_free(struct ServeRequest *item) {
+    while (item->merged) {
+        struct ServeRequest *merged = item->merged;
+        item->merged = merged->next;
+        serve_request_free(merged);
+    }
+    free_batch_operation(&item->op);
+    free(item->host);
+    free(item->type);
+    free(item);
+}
+
+static void serve_queue(struct ServeContext *serve, struct ServeRequest *item) {
+    item->next = NULL;
+    if (serve->queue_tail) serve->queue_tail->next = item;
+    else serve->queue = item;
+    serve->queue_tail = item;
+}
+
+// The cached state of a domain, created if asked to. Returns NULL if there is none.
+static struct ServeZone* serve_zone(struct ServeContext *serve, const char *domain, int create) {
+    uint64_t hash = fnv1a_hash_lower(domain, FNV1A_SEED);
+    size_t pos = 0, value;
+    
+    while (hash_index_next(&serve->zone_index, hash, &pos, &value)) {
+        if (strcasecmp(serve->zones[value]->domain, domain) == 0) return serve->zones[value];
+    }
+    if (!create) return NULL;
+    
+    if (serve->zone_count == serve->zone_cap) {
+        size_t cap = serve->zone_cap ? serve->zone_cap * 2 : 16;
+        struct ServeZone **zones = realloc(serve->zones, cap * sizeof(*zones));
+        if (!zones) return NULL;
+        serve->zones = zones;
+        serve->zone_cap = cap;
+    }
+    struct ServeZone *zone = calloc(1, sizeof(*zone));
+    if (!zone) return NULL;
+    zone->domain = strdup(domain);
+    if (!zone->domain || hash_index_init(&zone->index, 64) != 0 ||
+        hash_index_insert(&serve->zone_index, hash, serve->zone_count) != 0) {
+        hash_index_free(&zone->index);
+        free(zone->domain);
+        free(zone);
+        return NULL;
+    }
+    serve->zones[serve->zone_count++] = zone;
+    return zone;
+}
+
+// A change was made to domain: its records are no longer current
+static void serve_changed(struct ServeContext *serve, const char *domain) {
+    struct ServeZone *zone = serve_zone(serve, domain, 0);
+    if (zone) {
+        zone->generation++;
+        zone->current = 0;
+    }
+    zone_cache_invalidate(serve->username, domain);
+}
+
+static int serve_zone_fresh(const struct ServeContext *serve, const struct ServeZone *zone) {
+    return zone->current && monotonic_seconds() - zone->listed_at < serve->cache_ttl;
 }
 
-// Helper function to extract text between XML tags
-char* extract_xml_value(const char *xml, const char *tag) {
-    char open_tag[256], close_tag[256];
-    snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
-    snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+// Answer a read from the cached records of its zone
+static void serve_answer_read(struct ServeContext *serve, struct ServeRequest *read) {
+    const struct ServeZone *zone = read->zone;
+    const char *sep = "";
     
-    char *start = strstr(xml, open_tag);
-    if (!start) return NULL;
+    out_capture_begin(&serve->body);
+    out_literal("{\"domain\":");
+    print_json_string(zone->domain);
+    out_literal(",\"records\":[");
+    if (read->host && read->type) {
+        // Both given: look the slot up
+        struct DNSRecord key = { NULL, read->host, read->type, NULL, 0, 0 };
+        size_t pos = 0, value;
+        while (hash_index_next(&zone->index, record_slot_hash(&key), &pos, &value)) {
+            const struct DNSRecord *record = &zone->records.items[value].record;
+            if (strcasecmp(record->host, read->host) != 0 || strcasecmp(record->type, read->type) != 0) continue;
+            out_str(sep);
+            print_record_json(record);
+            sep = ",";
+        }
+    } else {
+        for (size_t i = 0; i < zone->records.count; i++) {
+            const struct DNSRecord *record = &zone->records.items[i].record;
+            if (read->host && strcasecmp(record->host, read->host) != 0) continue;
+            if (read->type && strcasecmp(record->type, read->type) != 0) continue;
+            out_str(sep);
+            print_record_json(record);
+            sep = ",";
+        }
+    }
+    out_printf("],\"age\":%.3f}", monotonic_seconds() - zone->listed_at);
+    serve_reply(serve, read->client, 200);
+}
+
+// GET /records/DOMAIN[?host=HOST&type=TYPE]
+static void serve_read(struct ServeContext *serve, struct ServeClient *client, const char *domain, char *query) {
+    struct ServeRequest *read = calloc(1, sizeof(*read));
+    char *key, *value;
     
-    start += strlen(open_tag);
-    char *end = strstr(start, close_tag);
-    if (!end) return NULL;
+    if (!read) {
+        serve_error(serve, client, 500, "Not enough memory");
+        return;
+    }
+    read->kind = SERVE_READ;
+    read->client = client;
+    while (query_next(&query, &key, &value)) {
+        char **field = strcmp(key, "host") == 0 ? &read->host : strcmp(key, "type") == 0 ? &read->type : NULL;
+        if (!field) {
+            serve_error(serve, client, 400, "Unknown query parameter");
+            serve_request_free(read);
+            return;
+        }
+        free(*field);
+        *field = strdup(value);
+        if (!*field) {
+            serve_error(serve, client, 500, "Not enough memory");
+            serve_request_free(read);
+            return;
+        }
+    }
     
-    size_t len = end - start;
-    char *value = malloc(len + 1);
-    if (!value) return NULL;
+    read->zone = serve_zone(serve, domain, 1);
+    if (!read->zone) {
+        serve_error(serve, client, 500, "Not enough memory");
+        serve_request_free(read);
+        return;
+    }
+    if (serve_zone_fresh(serve, read->zone)) {
+        serve_answer_read(serve, read);
+        serve_request_free(read);
+        return;
+    }
     
-    strncpy(value, start, len);
-    value[len] = '\0';
-    return value;
+    // Wait for a listing, starting one unless another read already did
+    struct ServeZone *zone = read->zone;
+    if (!zone->listing) {
+        struct ServeRequest *list = calloc(1, sizeof(*list));
+        if (!list) {
+            serve_error(serve, client, 500, "Not enough memory");
+            serve_request_free(read);
+            return;
+        }
+        list->kind = SERVE_LIST;
+        list->zone = zone;
+        list->generation = zone->generation;
+        zone->listing = 1;
+        serve_queue(serve, list);
+    }
+    client->busy = 1;
+    read->next = zone->waiting;
+    zone->waiting = read;
 }
 
-// Helper function to escape JSON strings
-void print_json_string(const char *str) {
-    if (!str) return;
+// Fields of a change other than op
+// Answer a write, and the writes folded into it, with its result, the error that
+// kept it from the API, or why it was not sent. Frees item.
+static void serve_write_done(struct ServeContext *serve, struct ServeRequest *item, const struct APIResult *result,
+                             const char *error) {
+    static const char no_memory[] = "{\"error\":\"Not enough memory\"}\n";
+    int status = 200, coalesced = 0;
     
-    printf("\"");
-    for (const char *p = str; *p; p++) {
-        switch (*p) {
-            case '"':
-                printf("\\\"");
-                break;
-            case '\\':
-                printf("\\\\");
-                break;
-            case '\b':
-                printf("\\b");
-                break;
-            case '\f':
-                printf("\\f");
-                break;
-            case '\n':
-                printf("\\n");
-                break;
-            case '\r':
-                printf("\\r");
-                break;
-            case '\t':
-                printf("\\t");
-                break;
-            default:
-                if (*p < 0x20) {
-                    printf("\\u%04x", (unsigned char)*p);
-                } else {
-                    printf("%c", *p);
-                }
-                break;
+    for (const struct ServeRequest *merged = item->merged; merged; merged = merged->next) coalesced++;
+    out_capture_begin(&serve->body);
+    if (error) {
+        out_literal("{\"error\":");
+        print_json_string(error);
+        status = 502;
+    } else {
+        out_char('{');
+        print_operation_json(&item->op);
+        if (coalesced) out_printf(",\"coalesced\":%d", coalesced);
+        if (item->skipped) {
+            out_literal(",\"skipped\":");
+            print_json_string(item->skipped);
+        } else {
+            out_char(',');
+            print_result_json(result);
+            status = serve_result_status(result->code);
+            if (result->code == 0) {
+                serve_changed(serve, item->op.record.domain);
+                if (item->op.type == BATCH_OP_UPDATE) serve_changed(serve, item->op.new_record.domain);
+            }
         }
     }
-    printf("\"");
+    out_literal("}\n");
+    int failed = out_capture_end() != 0;
+    
+    serve_respond(serve, item->client, failed ? 500 : status, failed ? no_memory : serve->body.data,
+                  failed ? sizeof(no_memory) - 1 : serve->body.len);
+    for (struct ServeRequest *merged = item->merged; merged; merged = merged->next) {
+        serve_respond(serve, merged->client, failed ? 500 : status, failed ? no_memory : serve->body.data,
+                      failed ? sizeof(no_memory) - 1 : serve->body.len);
+    }
+    serve_request_free(item);
 }
 
-void parse_and_display_list_result(const char *response_data) {
-    if (!response_data) {
-        printf("{\"error\": \"No response data to parse\"}\n");
+// Hold a write for the coalesce window. A later write of the same record is folded
+// into the held one when coalesce_merge() allows it, and answered with its result.
+static void serve_hold(struct ServeContext *serve, struct ServeRequest *item) {
+    struct BatchOperation *op = &item->op;
+    
+    if (op->type == BATCH_OP_UPDATE && records_identical(&op->record, &op->new_record)) {
+        item->skipped = "noop";
+        serve_write_done(serve, item, NULL, NULL);
         return;
     }
-    
-    // Extract basic result information
-    int result_code = -1;
-    char *result_start = strstr(response_data, "<resultCode>");
-    if (result_start) {
-        result_start += 12;
-        result_code = atoi(result_start);
-    }
-    
-    int result_subcode = 0;
-    char *subcode_start = strstr(response_data, "<resultSubCode>");
-    if (subcode_start) {
-        subcode_start += 15;
-        result_subcode = atoi(subcode_start);
-    }
-    
-    char *result_text = extract_xml_value(response_data, "resultText");
-    
-    // Start JSON output
-    printf("{");
-    printf("\"result\":{");
-    printf("\"code\":%d,", result_code);
-    printf("\"message\":");
-    print_json_string(get_result_code_message(result_code));
-    printf(",\"subCode\":%d", result_subcode);
-    if (result_text) {
-        printf(",\"text\":");
-        print_json_string(result_text);
-        free(result_text);
-    }
-    printf("}");
-    
-    // If successful, parse and display records
-    if (result_code == 0) {
-        printf(",\"records\":[");
-        
-        // Find resultItems section
-        char *items_start = strstr(response_data, "<resultItems>");
-        char *items_end = strstr(response_data, "</resultItems>");
-        
-        if (items_start && items_end) {
-            items_start += 13; // length of "<resultItems>"
-            
-            // Parse each DNSRecordListItem
-            char *current = items_start;
-            int first_record = 1;
-            
-            while (current < items_end) {
-                char *record_start = strstr(current, "<DNSRecordListItem>");
-                if (!record_start || record_start >= items_end) break;
-                
-                char *record_end = strstr(record_start, "</DNSRecordListItem>");
-                if (!record_end || record_end >= items_end) break;
-                
-                record_start += 19; // length of "<DNSRecordListItem>"
-                
-                // Extract record fields
-                char record_xml[4096];
-                size_t record_len = record_end - record_start;
-                if (record_len < sizeof(record_xml)) {
-                    strncpy(record_xml, record_start, record_len);
-                    record_xml[record_len] = '\0';
-                    
-                    char *domain = extract_xml_value(record_xml, "DomainName");
-                    char *host = extract_xml_value(record_xml, "HostName");
-                    char *type = extract_xml_value(record_xml, "RecordType");
-                    char *data = extract_xml_value(record_xml, "Data");
-                    char *ttl_str = extract_xml_value(record_xml, "TTL");
-                    char *priority_str = extract_xml_value(record_xml, "Priority");
-                    char *readonly_str = extract_xml_value(record_xml, "ReadOnly");
-                    char *suspended_str = extract_xml_value(record_xml, "Suspended");
-                    char *suspension_reason = extract_xml_value(record_xml, "SuspensionReason");
-                    
-                    if (!first_record) printf(",");
-                    first_record = 0;
-                    
-                    printf("{");
-                    if (domain) {
-                        printf("\"domain\":");
-                        print_json_string(domain);
-                        printf(",");
-                    }
-                    if (host) {
-                        printf("\"host\":");
-                        print_json_string(host);
-                        printf(",");
-                    }
-                    if (type) {
-                        printf("\"type\":");
-                        print_json_string(type);
-                        printf(",");
-                    }
-                    if (data) {
-                        printf("\"data\":");
-                        print_json_string(data);
-                        printf(",");
-                    }
-                    if (ttl_str) printf("\"ttl\":%s,", ttl_str);
-                    if (priority_str) printf("\"priority\":%s,", priority_str);
-                    if (readonly_str) printf("\"readOnly\":%s,", 
-                        (strcmp(readonly_str, "true") == 0) ? "true" : "false");
-                    if (suspended_str) printf("\"suspended\":%s", 
-                        (strcmp(suspended_str, "true") == 0) ? "true" : "false");
-                    if (suspension_reason && strlen(suspension_reason) > 0) {
-                        printf(",\"suspensionReason\":");
-                        print_json_string(suspension_reason);
-                    }
-                    printf("}");
-                    
-                    // Free allocated memory
-                    free(domain);
-                    free(host);
-                    free(type);
-                    free(data);
-                    free(ttl_str);
-                    free(priority_str);
-                    free(readonly_str);
-                    free(suspended_str);
-                    free(suspension_reason);
-                }
-                
-                current = record_end + 20; // Move past </DNSRecordListItem>
-            }
+    if (!coalesce_two_keys(op)) {
+        struct ServeRequest *latest = NULL;
+        for (struct ServeRequest *held = serve->held; held; held = held->next) {
+            if (!held->skipped && coalesce_touches(&held->op, &op->record)) latest = held;
         }
-        
-        printf("]");
-        
-        // Add record count if available
-        char *count_str = extract_xml_value(response_data, "resultItemCount");
-        if (count_str) {
-            printf(",\"recordCount\":%s", count_str);
-            free(count_str);
+        if (latest && !coalesce_two_keys(&latest->op) && coalesce_merge(&latest->op, op) == 0) {
+            // Answered in the order they arrived
+            struct ServeRequest **tail = &latest->merged;
+            while (*tail) tail = &(*tail)->next;
+            item->next = NULL;
+            *tail = item;
+            serve->coalesced++;
+            return;
         }
     }
-    
-    printf("}\n");
+    item->ready_at = monotonic_seconds() + serve->coalesce;
+    item->next = NULL;
+    if (serve->held_tail) serve->held_tail->next = item;
+    else serve->held = item;
+    serve->held_tail = item;
 }
 
-void parse_and_display_simple_result(const char *response_data) {
-    if (!response_data) {
-        printf("{\"error\":\"No response data to parse\"}\n");
-        return;
+// Queue the held writes whose window is over, all of them once stopping
+static void serve_release(struct ServeContext *serve, double now) {
+    while (serve->held && (serve->stopping || serve->held->ready_at <= now)) {
+        struct ServeRequest *item = serve->held;
+        serve->held = item->next;
+        if (!serve->held) serve->held_tail = NULL;
+        if (item->skipped) serve_write_done(serve, item, NULL, NULL);
+        else serve_queue(serve, item);
     }
+    serve->engine->source_wake = serve->held ? serve->held->ready_at : 0;
+}
+
+static int serve_write_field(const char *key, const char *value, void *ctx) {
+    return strcmp(key, "op") == 0 ? -1 : set_batch_field(key, value, ctx);
+}
+
+static int copy_missing(char **field, const char *value) {
+    if (!*field) *field = strdup(value);
+    return *field ? 0 : -1;
+}
+
+// POST (add), PUT (update) or DELETE /records/DOMAIN. The record fields come from
+// the query string and/or a JSON object in the body, named like the batch fields.
+// The domain defaults to the one of the path; fields of the new record of an
+// update default to those of the old one.
+static void serve_write(struct ServeContext *serve, struct ServeClient *client, const char *method,
+                        const char *domain, char *query, const char *body) {
+    struct ServeRequest *item = calloc(1, sizeof(*item));
+    struct BatchOperation *op;
+    char *key, *value;
+    const char *error = NULL;
     
-    // Extract resultCode
-    int result_code = -1;
-    char *result_start = strstr(response_data, "<resultCode>");
-    if (result_start) {
-        result_start += 12; // length of "<resultCode>"
-        result_code = atoi(result_start);
+    if (!item) {
+        serve_error(serve, client, 500, "Not enough memory");
+        return;
     }
+    item->kind = SERVE_WRITE;
+    item->client = client;
+    op = &item->op;
+    op->type = strcmp(method, "POST") == 0 ? BATCH_OP_ADD : strcmp(method, "PUT") == 0 ? BATCH_OP_UPDATE
+                                                                                     : BATCH_OP_DELETE;
+    op->new_record.ttl = op->new_record.priority = -1;
     
-    // Extract resultSubCode
-    int result_subcode = 0;
-    char *subcode_start = strstr(response_data, "<resultSubCode>");
-    if (subcode_start) {
-        subcode_start += 15; // length of "<resultSubCode>"
-        result_subcode = atoi(subcode_start);
+    while (!error && query_next(&query, &key, &value)) {
+        if (serve_write_field(key, value, op) != 0) error = "Unknown query parameter";
+    }
+    while (isspace((unsigned char)*body)) body++;
+    if (!error && *body) {
+        const char *rest = parse_flat_json_object(body, serve_write_field, op);
+        while (rest && isspace((unsigned char)*rest)) rest++;
+        if (!rest || *rest) error = "Invalid JSON body";
     }
     
-    // Extract resultText
-    char *result_text = NULL;
-    char *text_start = strstr(response_data, "<resultText>");
-    char *text_end = strstr(response_data, "</resultText>");
-    if (text_start && text_end) {
-        text_start += 12; // length of "<resultText>"
-        int text_len = text_end - text_start;
-        result_text = malloc(text_len + 1);
-        if (result_text) {
-            strncpy(result_text, text_start, text_len);
-            result_text[text_len] = '\0';
+    if (!error) {
+        const struct DNSRecord *old = &op->record;
+        if (copy_missing(&op->record.domain, domain) != 0 ||
+            (op->type == BATCH_OP_UPDATE && old->host && old->type && old->data &&
+             (copy_missing(&op->new_record.domain, old->domain) != 0 ||
+              copy_missing(&op->new_record.host, old->host) != 0 ||
+              copy_missing(&op->new_record.type, old->type) != 0 ||
+              copy_missing(&op->new_record.data, old->data) != 0))) {
+            serve_error(serve, client, 500, "Not enough memory");
+            serve_request_free(item);
+            return;
+        }
+        if (op->new_record.ttl < 0) op->new_record.ttl = old->ttl;
+        if (op->new_record.priority < 0) op->new_record.priority = old->priority;
+        if (!record_is_complete(&op->record) ||
+            (op->type == BATCH_OP_UPDATE && !record_is_complete(&op->new_record))) {
+            error = "Missing required record fields";
         }
     }
-    
-    // Output JSON
-    printf("{");
-    printf("\"result\":{");
-    printf("\"code\":%d,", result_code);
-    printf("\"message\":");
-    print_json_string(get_result_code_message(result_code));
-    printf(",\"subCode\":%d", result_subcode);
-    if (result_text) {
-        printf(",\"text\":");
-        print_json_string(result_text);
+    if (error) {
+        serve_error(serve, client, 400, error);
+        serve_request_free(item);
+        return;
     }
-    printf("}");
-    printf("}\n");
-    
-    if (result_text) free(result_text);
+    client->busy = 1;
+    if (serve->coalesce >= 0) serve_hold(serve, item);
+    else serve_queue(serve, item);
 }
 
-void parse_and_display_result(const char *response_data) {
-    if (!response_data) {
-        printf("No response data to parse.\n");
+static void serve_dispatch(struct ServeContext *serve, struct ServeClient *client, const char *method,
+                           char *target, const char *body) {
+    char *query = strchr(target, '?');
+    if (query) *query++ = '\0';
+    serve->requests++;
+    
+    if (strcmp(target, "/health") == 0) {
+        out_capture_begin(&serve->body);
+        out_printf("{\"status\":\"ok\",\"clients\":%zu,\"zones\":%zu,\"requests\":%lu}", serve->client_count,
+                   serve->zone_count, serve->requests);
+        serve_reply(serve, client, 200);
         return;
     }
     
-    // Extract resultCode
-    int result_code = -1;
-    char *result_start = strstr(response_data, "<resultCode>");
-    if (result_start) {
-        result_start += 12; // length of "<resultCode>"
-        result_code = atoi(result_start);
+    char *domain = strncmp(target, "/records/", 9) == 0 ? target + 9 : NULL;
+    if (domain) {
+        size_t len = strlen(domain);
+        if (len > 0 && domain[len - 1] == '/') domain[len - 1] = '\0';
+        url_decode(domain);
     }
+    if (!domain || !*domain || strchr(domain, '/')) {
+        serve_error(serve, client, 404, "Not found");
+    } else if (strcmp(method, "GET") == 0) {
+        serve_read(serve, client, domain, query);
+    } else if (strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0 || strcmp(method, "DELETE") == 0) {
+        serve_write(serve, client, method, domain, query, body);
+    } else {
+        serve_error(serve, client, 405, "Method not allowed");
+    }
+}
+
+// Handle the request at the start of the client's input once it is complete.
+// Returns 1 if one was handled, 0 if more input is needed.
+static int serve_parse(struct ServeContext *serve, struct ServeClient *client) {
+    struct GrowBuffer *in = &client->in;
+    char value[64];
     
-    // Extract resultSubCode
-    int result_subcode = 0;
-    char *subcode_start = strstr(response_data, "<resultSubCode>");
-    if (subcode_start) {
-        subcode_start += 15; // length of "<resultSubCode>"
-        result_subcode = atoi(subcode_start);
+    if (in->len == 0) return 0;
+    char *end = memmem(in->data, in->len, "\r\n\r\n", 4);
+    if (!end) {
+        if (in->len <= SERVE_MAX_HEADER) return 0;
+        client->close_after = 1;
+        in->len = 0;
+        serve_error(serve, client, 431, "Request header too large");
+        return 1;
     }
+    size_t head_len = (size_t)(end - in->data) + 4;
     
-    // Extract resultText
-    char *text_start = strstr(response_data, "<resultText>");
-    char *text_end = strstr(response_data, "</resultText>");
+    long body_len = 0;
+    if (http_header(in->data, head_len, "Transfer-Encoding", value, sizeof(value))) {
+        client->close_after = 1;
+        in->len = 0;
+        serve_error(serve, client, 411, "A Content-Length is required");
+        return 1;
+    }
+    if (http_header(in->data, head_len, "Content-Length", value, sizeof(value))) {
+        char *rest;
+        body_len = strtol(value, &rest, 10);
+        if (*rest || body_len < 0 || body_len > SERVE_MAX_BODY) {
+            client->close_after = 1;
+            in->len = 0;
+            serve_error(serve, client, 413, "Request body too large");
+            return 1;
+        }
+    }
+    if (in->len < head_len + (size_t)body_len) {
+        if (!client->continued && http_header(in->data, head_len, "Expect", value, sizeof(value)) &&
+            strcasecmp(value, "100-continue") == 0) {
+            static const char proceed[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            client->continued = 1;
+            if (buffer_append(&client->out, proceed, sizeof(proceed) - 1) != 0) serve_close(serve, client);
+            serve_flush(serve, client);
+        }
+        return 0;
+    }
+    client->continued = 0;
     
-    printf("\n=== API Result ===\n");
-    printf("Result Code: %d - %s\n", result_code, get_result_code_message(result_code));
+    // HTTP/1.1 keeps the connection open unless asked not to; 1.0 only if asked to
+    int keep_alive = memmem(in->data, head_len, " HTTP/1.1\r\n", 11) != NULL;
+    if (http_header(in->data, head_len, "Connection", value, sizeof(value))) {
+        if (strcasecmp(value, "close") == 0) keep_alive = 0;
+        else if (strcasecmp(value, "keep-alive") == 0) keep_alive = 1;
+    }
+    if (!keep_alive) client->close_after = 1;
     
-    if (text_start && text_end) {
-        text_start += 12; // length of "<resultText>"
-        printf("Result Text: %.*s\n", (int)(text_end - text_start), text_start);
+    // Split the request line in place; the body is copied to be NUL-terminated
+    char *body = strndup(in->data + head_len, (size_t)body_len);
+    char *method = in->data;
+    *end = '\0';
+    char *line_end = strstr(method, "\r\n");
+    if (line_end) *line_end = '\0';
+    char *target = strchr(method, ' ');
+    if (target) {
+        *target++ = '\0';
+        char *version = strchr(target, ' ');
+        if (version) *version = '\0';
     }
     
-    if (result_subcode > 0) {
-        print_result_subcode_info(result_subcode);
+    if (!body) {
+        serve_error(serve, client, 500, "Not enough memory");
+    } else if (!target || *target != '/') {
+        client->close_after = 1;
+        serve_error(serve, client, 400, "Malformed request");
+    } else {
+        serve_dispatch(serve, client, method, target, body);
     }
+    free(body);
     
-    printf("==================\n\n");
+    size_t used = head_len + (size_t)body_len;
+    memmove(in->data, in->data + used, in->len - used);
+    in->len -= used;
+    return 1;
 }
 
-int call_record_update(const char *username, const char *passwordB64,
-                       const char *oldDomain, const char *oldHost, const char *oldType, 
-                       const char *oldData, int oldTTL, int oldPriority,
-                       const char *newDomain, const char *newHost, const char *newType, 
-                       const char *newData, int newTTL, int newPriority) {
+static void serve_read_input(struct ServeContext *serve, struct ServeClient *client) {
+    char chunk[16384];
     
-    CURL *curl;
-    CURLcode res;
-    struct APIResponse response = {0};
+    while (client->fd >= 0 && !client->eof && client->in.len < SERVE_MAX_HEADER + SERVE_MAX_BODY) {
+        ssize_t n = read(client->fd, chunk, sizeof(chunk));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) serve_close(serve, client);
+            return;
+        }
+        if (n == 0) {
+            client->eof = 1;
+            return;
+        }
+        if (buffer_append(&client->in, chunk, (size_t)n) != 0) {
+            serve_close(serve, client);
+            return;
+        }
+    }
+}
+
+static void serve_accept(struct ServeContext *serve) {
+    while (serve->client_count < SERVE_MAX_CLIENTS) {
+        int fd = accept(serve->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) serve->accept_paused = 1;
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // Fails harmlessly on unix sockets
+        
+        if (serve->client_count == serve->client_cap) {
+            size_t cap = serve->client_cap * 2;
+            struct ServeClient **clients = realloc(serve->clients, cap * sizeof(*clients));
+            struct pollfd *polls = clients ? realloc(serve->polls, (cap + 1) * sizeof(*polls)) : NULL;
+            struct curl_waitfd *wait_fds = polls ? realloc(serve->wait_fds, (cap + 1) * sizeof(*wait_fds)) : NULL;
+            if (clients) serve->clients = clients;
+            if (polls) serve->polls = polls;
+            if (!wait_fds) {
+                close(fd);
+                return;
+            }
+            serve->wait_fds = wait_fds;
+            serve->client_cap = cap;
+        }
+        struct ServeClient *client = calloc(1, sizeof(*client));
+        if (!client) {
+            close(fd);
+            return;
+        }
+        client->fd = fd;
+        serve->clients[serve->client_count++] = client;
+        // The request often comes with the connection
+        serve_read_input(serve, client);
+    }
+}
+
+// Events a client is waiting for
+static short serve_client_events(const struct ServeClient *client) {
+    short events = 0;
+    if (client->fd < 0) return 0;
+    if (!client->eof && client->in.len < SERVE_MAX_HEADER + SERVE_MAX_BODY) events |= POLLIN;
+    if (client->sent < client->out.len) events |= POLLOUT;
+    return events;
+}
+
+// Accept connections, move bytes, handle complete requests and drop closed clients
+static void serve_poll(struct ServeContext *serve) {
+    size_t count = serve->client_count;
     
-    curl = curl_easy_init();
-    if (!curl) {
-        printf("Failed to initialize CURL\n");
-        return 1;
+    serve->polls[0].fd = serve->listen_fd;
+    serve->polls[0].events = serve->accept_paused ? 0 : POLLIN;
+    for (size_t i = 0; i < count; i++) {
+        serve->polls[i + 1].fd = serve->clients[i]->fd;
+        serve->polls[i + 1].events = serve_client_events(serve->clients[i]);
+    }
+    if (poll(serve->polls, count + 1, 0) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            short revents = serve->polls[i + 1].revents;
+            if (revents & POLLOUT) serve_flush(serve, serve->clients[i]);
+            if (revents & (POLLIN | POLLHUP | POLLERR)) serve_read_input(serve, serve->clients[i]);
+        }
+        if (serve->polls[0].revents & POLLIN) serve_accept(serve);
     }
     
-    // Construct the exact XML format that works
-    char *xml_request;
-    asprintf(&xml_request,
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-        "<soap:Envelope xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
-        "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" "
-        "xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
-        " <soap:Body>\n"
-        "  <recordUpdate xmlns=\"https://api.quickservicebox.com/DNS/DNSAPI\">\n"
-        "   <accountUsername>%s</accountUsername>\n"
-        "   <accountPasswordB64>%s</accountPasswordB64>\n"
-        "   <oldRecord>\n"
-        "    <DomainName>%s</DomainName>\n"
-        "    <HostName>%s</HostName>\n"
-        "    <RecordType>%s</RecordType>\n"
-        "    <Data>%s</Data>\n"
-        "    <TTL>%d</TTL>\n"
-        "    <Priority>%d</Priority>\n"
-        "   </oldRecord>\n"
-        "   <newRecord>\n"
-        "    <DomainName>%s</DomainName>\n"
-        "    <HostName>%s</HostName>\n"
-        "    <RecordType>%s</RecordType>\n"
-        "    <Data>%s</Data>\n"
-        "    <TTL>%d</TTL>\n"
-        "    <Priority>%d</Priority>\n"
-        "   </newRecord>\n"
-        "  </recordUpdate>\n"
-        " </soap:Body>\n"
-        "</soap:Envelope>",
-        username, passwordB64,
-        oldDomain, oldHost, oldType, oldData ? oldData : "", oldTTL, oldPriority,
-        newDomain, newHost, newType, newData, newTTL, newPriority);
-    
-    // Set up the request
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.quickservicebox.com/API/Beta/DNSAPI.asmx");
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, xml_request);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(xml_request));
-    
-    // Set headers
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: text/xml; charset=utf-8");
-    headers = curl_slist_append(headers, "SOAPAction: https://api.quickservicebox.com/DNS/DNSAPI/recordUpdate");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    
-    // Set up response handling
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    
-    // Perform the request
-    res = curl_easy_perform(curl);
-    
-    if (res != CURLE_OK) {
-        printf("CURL request failed: %s\n", curl_easy_strerror(res));
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        free(xml_request);
-        if (response.data) free(response.data);
-        return 1;
+    size_t kept = 0;
+    for (size_t i = 0; i < serve->client_count; i++) {
+        struct ServeClient *client = serve->clients[i];
+        while (!client->busy && client->fd >= 0 && serve_parse(serve, client)) {}
+        // A client that is done is closed once its last response is out
+        if (client->eof && !client->busy && client->sent == client->out.len) serve_close(serve, client);
+        if (client->fd < 0 && !client->busy) {
+            free(client->in.data);
+            free(client->out.data);
+            free(client);
+            continue;
+        }
+        serve->clients[kept++] = client;
     }
+    serve->client_count = kept;
+}
+
+// Hand the engine what to wait on while there is nothing to send
+static void serve_wait_set(struct ServeContext *serve) {
+    unsigned int count = 0;
     
-    // Parse and display result with human-readable messages
-    parse_and_display_simple_result(response.data);
+    if (!serve->accept_paused) {
+        serve->wait_fds[count].fd = serve->listen_fd;
+        serve->wait_fds[count++].events = CURL_WAIT_POLLIN;
+    }
+    for (size_t i = 0; i < serve->client_count; i++) {
+        short events = serve_client_events(serve->clients[i]);
+        if (!events) continue;
+        serve->wait_fds[count].fd = serve->clients[i]->fd;
+        serve->wait_fds[count++].events = ((events & POLLIN) ? CURL_WAIT_POLLIN : 0) |
+                                          ((events & POLLOUT) ? CURL_WAIT_POLLOUT : 0);
+    }
+    serve->engine->source_fds = serve->wait_fds;
+    serve->engine->source_fd_count = count;
+}
+
+// Serve the clients on every turn of the engine, so that health checks, cached
+// reads and responses never wait for a free API slot or a rate limit token. Once
+// a stop is requested, no more input is read. Returns whether a request is queued.
+static int serve_tick(void *ctx) {
+    struct ServeContext *serve = ctx;
     
-    // Cleanup
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    free(xml_request);
-    if (response.data) free(response.data);
+    if (!serve->stopping) {
+        serve->stopping = stop_requested;
+        serve_poll(serve);
+    }
+    if (serve->stopping) serve->engine->source_fd_count = 0;
+    else serve_wait_set(serve);
+    serve_release(serve, monotonic_seconds());
+    return serve->queue != NULL;
+}
+
+// Next request for the API: listings and changes queued by the clients. Once a
+// stop is requested, the requests already received are still handled, then the
+// queue is drained.
+static int serve_source(void *ctx, struct PendingRequest *request) {
+    struct ServeContext *serve = ctx;
+    struct ServeRequest *item = serve->queue;
+    if (!item) return serve->stopping ? 1 : REQUEST_SOURCE_WAIT;
+    serve->queue = item->next;
+    if (!serve->queue) serve->queue_tail = NULL;
     
+    request->userdata = item;
+    if (item->kind == SERVE_LIST) {
+        request->action = SOAP_ACTION_LIST;
+        if (build_record_list_request(&request->body, serve->username, serve->passwordB64, item->zone->domain) != 0) {
+            request->action = SOAP_ACTION_NONE;
+        }
+    } else {
+        request->action = batch_soap_action(item->op.type);
+        if (build_batch_request(&request->body, serve->username, serve->passwordB64, &item->op) != 0) {
+            request->action = SOAP_ACTION_NONE;
+        }
+    }
     return 0;
 }
 
-int call_record_add(const char *username, const char *passwordB64,
-                   const char *domain, const char *host, const char *type, 
-                   const char *data, int ttl, int priority) {
+// A listing completed: keep the records and answer the reads waiting for them
+static void serve_list_done(struct ServeContext *serve, struct ServeRequest *list, struct PendingRequest *request,
+                            const char *error) {
+    struct ServeZone *zone = list->zone;
+    struct SoapParser *parser = &serve->parser;
+    struct RecordSet records = {0};
+    struct APIResult result = {0};
     
-    CURL *curl;
-    CURLcode res;
-    struct APIResponse response = {0};
-    
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "Failed to initialize CURL\n");
-        return 1;
+    zone->listing = 0;
+    if (!error) {
+        soap_parser_reset(parser, NULL, record_set_collect, &records);
+        soap_parser_feed(parser, request->response.data, request->response.size);
+        soap_parser_finish(parser);
+        soap_parser_get_result(parser, &result);
+        if (records.failed) error = "Not enough memory for the records";
     }
-    
-    // Construct XML for recordAdd
-    char *xml_request;
-    asprintf(&xml_request,
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-        "<soap:Envelope xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
-        "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" "
-        "xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
-        "<soap:Body>\n"
-        "<recordAdd xmlns=\"https://api.quickservicebox.com/DNS/DNSAPI\">\n"
-        "<accountUsername>%s</accountUsername>\n"
-        "<accountPasswordB64>%s</accountPasswordB64>\n"
-        "<record>\n"
-        "<DomainName>%s</DomainName>\n"
-        "<HostName>%s</HostName>\n"
-        "<RecordType>%s</RecordType>\n"
-        "<Data>%s</Data>\n"
-        "<TTL>%d</TTL>\n"
-        "<Priority>%d</Priority>\n"
-        "</record>\n"
-        "</recordAdd>\n"
-        "</soap:Body>\n"
-        "</soap:Envelope>",
-        username, passwordB64, domain, host, type, data, ttl, priority);
-    
-    // Setup headers
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: text/xml; charset=utf-8");
-    headers = curl_slist_append(headers, "SOAPAction: \"https://api.quickservicebox.com/DNS/DNSAPI/recordAdd\"");
-    
-    // Configure CURL
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.quickservicebox.com/API/Beta/DNSAPI.asmx");
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, xml_request);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-    
-    // Perform the request
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Request failed: %s\n", curl_easy_strerror(res));
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        free(xml_request);
-        if (response.data) free(response.data);
-        return 1;
+    if (!error && result.code == 0) {
+        gidinet_record_set_free(&zone->records);
+        zone->records = records;
+        memset(&records, 0, sizeof(records));
+        hash_index_clear(&zone->index);
+        for (size_t i = 0; i < zone->records.count && !error; i++) {
+            if (hash_index_insert(&zone->index, record_slot_hash(&zone->records.items[i].record), i) != 0) {
+                error = "Not enough memory for the records";
+            }
+        }
+        zone->listed_at = monotonic_seconds();
+        // A change made meanwhile may be missing from the listing
+        zone->current = !error && zone->generation == list->generation;
     }
+    gidinet_record_set_free(&records);
     
-    // Process response with JSON output
-    parse_and_display_simple_result(response.data);
-    
-    // Cleanup
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    free(xml_request);
-    if (response.data) free(response.data);
-    
-    return 0;
+    struct ServeRequest *read = zone->waiting;
+    zone->waiting = NULL;
+    while (read) {
+        struct ServeRequest *next = read->next;
+        if (error) {
+            serve_error(serve, read->client, 502, error);
+        } else if (result.code != 0) {
+            out_capture_begin(&serve->body);
+            out_literal("{\"domain\":");
+            print_json_string(zone->domain);
+            out_char(',');
+            print_result_json(&result);
+            out_char('}');
+            serve_reply(serve, read->client, serve_result_status(result.code));
+        } else {
+            serve_answer_read(serve, read);
+        }
+        serve_request_free(read);
+        read = next;
+    }
+    gidinet_result_free(&result);
 }
 
-int call_record_delete(const char *username, const char *passwordB64,
-                      const char *domain, const char *host, const char *type, 
-                      const char *data, int ttl, int priority) {
+static void serve_done(void *ctx, struct PendingRequest *request) {
+    struct ServeContext *serve = ctx;
+    struct ServeRequest *item = request->userdata;
+    const char *error = NULL;
     
-    CURL *curl;
-    CURLcode res;
-    struct APIResponse response = {0};
+    if (request->action == SOAP_ACTION_NONE) error = "Not enough memory to build request";
+    else if (request->curl_result != CURLE_OK) error = pending_request_error(request);
     
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "Failed to initialize CURL\n");
-        return 1;
+    if (item->kind == SERVE_LIST) {
+        serve_list_done(serve, item, request, error);
+        serve_request_free(item);
+    } else {
+        serve_write_done(serve, item, &request->result, error);
     }
+}
+
+// Open the listening socket: a unix socket at socket_path, or else a TCP socket
+// on listen_addr ([HOST:]PORT, loopback by default). Returns -1 on failure.
+static int serve_listen(const char *listen_addr, const char *socket_path) {
+    int fd = -1;
     
-    // Construct XML for recordDelete
-    char *xml_request;
-    asprintf(&xml_request,
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-        "<soap:Envelope xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
-        "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" "
-        "xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
-        "<soap:Body>\n"
-        "<recordDelete xmlns=\"https://api.quickservicebox.com/DNS/DNSAPI\">\n"
-        "<accountUsername>%s</accountUsername>\n"
-        "<accountPasswordB64>%s</accountPasswordB64>\n"
-        "<record>\n"
-        "<DomainName>%s</DomainName>\n"
-        "<HostName>%s</HostName>\n"
-        "<RecordType>%s</RecordType>\n"
-        "<Data>%s</Data>\n"
-        "<TTL>%d</TTL>\n"
-        "<Priority>%d</Priority>\n"
-        "</record>\n"
-        "</recordDelete>\n"
-        "</soap:Body>\n"
-        "</soap:Envelope>",
-        username, passwordB64, domain, host, type, data, ttl, priority);
-    
-    // Setup headers
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: text/xml; charset=utf-8");
-    headers = curl_slist_append(headers, "SOAPAction: \"https://api.quickservicebox.com/DNS/DNSAPI/recordDelete\"");
-    
-    // Configure CURL
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.quickservicebox.com/API/Beta/DNSAPI.asmx");
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, xml_request);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-    
-    // Perform the request
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Request failed: %s\n", curl_easy_strerror(res));
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        free(xml_request);
-        if (response.data) free(response.data);
-        return 1;
+    if (socket_path) {
+        struct sockaddr_un addr;
+        struct stat st;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", socket_path);
+            return -1;
+        }
+        strcpy(addr.sun_path, socket_path);
+        // Replace a socket left behind by an earlier run, never any other file
+        if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socket_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        char host[256] = "127.0.0.1";
+        const char *port = listen_addr;
+        const char *colon = strrchr(listen_addr, ':');
+        if (colon) {
+            const char *start = listen_addr;
+            size_t len = (size_t)(colon - listen_addr);
+            if (len >= 2 && start[0] == '[' && start[len - 1] == ']') {
+                start++;
+                len -= 2;
+            }
+            snprintf(host, sizeof(host), "%.*s", (int)len, start);
+            port = colon + 1;
+        }
+        
+        struct addrinfo hints, *addrs, *ai;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(*host ? host : NULL, port, &hints, &addrs) != 0) {
+            fprintf(stderr, "Cannot resolve listen address %s\n", listen_addr);
+            return -1;
+        }
+        for (ai = addrs; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addrs);
     }
     
-    // Process response with JSON output
-    parse_and_display_simple_result(response.data);
-    
-    // Cleanup
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    free(xml_request);
-    if (response.data) free(response.data);
-    
-    return 0;
+    if (fd < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socket_path ? socket_path : listen_addr, strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
 }
 
-int call_record_list(const char *username, const char *passwordB64, const char *domain) {
-    
-    CURL *curl;
-    CURLcode res;
-    struct APIResponse response = {0};
+// Run a local HTTP/JSON gateway to the API until SIGINT or SIGTERM. Reads are
+// answered from per-domain caches of the zone, listed at most once per
+// cache_ttl seconds and again after any change made through the gateway;
+// concurrent reads of a zone share one listing. Changes are sent as they come,
+// or held for coalesce seconds (unless negative) to fold later changes of the
+// same record into them, up to parallel at a time over one connection pool.
+int run_serve(const char *username, const char *passwordB64, const char *listen_addr, const char *socket_path,
+              int parallel, int cache_ttl, double coalesce) {
+    struct ServeContext serve = {0};
+    struct RequestEngine engine;
     
-    curl = curl_easy_init();
-    if (!curl) {
-        printf("Failed to initialize CURL\n");
+    serve.listen_fd = serve_listen(listen_addr, socket_path);
+    if (serve.listen_fd < 0) return 1;
+    if (open_engine(&engine, parallel) != 0) {
+        close(serve.listen_fd);
         return 1;
     }
-    
-    // Construct XML for recordGetList
-    char *xml_request;
-    asprintf(&xml_request,
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
-        "<soap:Envelope xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
-        "xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" "
-        "xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
-        "<soap:Body>\n"
-        "<recordGetList xmlns=\"https://api.quickservicebox.com/DNS/DNSAPI\">\n"
-        "<accountUsername>%s</accountUsername>\n"
-        "<accountPasswordB64>%s</accountPasswordB64>\n"
-        "<domainName>%s</domainName>\n"
-        "</recordGetList>\n"
-        "</soap:Body>\n"
-        "</soap:Envelope>",
-        username, passwordB64, domain);
-    
-    // Setup headers
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: text/xml; charset=utf-8");
-    headers = curl_slist_append(headers, "SOAPAction: \"https://api.quickservicebox.com/DNS/DNSAPI/recordGetList\"");
-    
-    // Configure CURL
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.quickservicebox.com/API/Beta/DNSAPI.asmx");
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, xml_request);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-    
-    // Perform the request
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        printf("Request failed: %s\n", curl_easy_strerror(res));
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        free(xml_request);
-        if (response.data) free(response.data);
+    serve.username = username;
+    serve.passwordB64 = passwordB64;
+    serve.cache_ttl = cache_ttl;
+    serve.coalesce = coalesce;
+    serve.engine = &engine;
+    engine.tick = serve_tick;
+    engine.unordered = 1;
+    soap_parser_init(&serve.parser, NULL, record_set_collect, NULL);
+    serve.client_cap = 64;
+    serve.clients = malloc(serve.client_cap * sizeof(*serve.clients));
+    serve.polls = malloc((serve.client_cap + 1) * sizeof(*serve.polls));
+    serve.wait_fds = malloc((serve.client_cap + 1) * sizeof(*serve.wait_fds));
+    if (!serve.clients || !serve.polls || !serve.wait_fds || hash_index_init(&serve.zone_index, 16) != 0) {
+        fprintf(stderr, "Not enough memory\n");
+        free(serve.clients);
+        free(serve.polls);
+        free(serve.wait_fds);
+        close_engine(&engine);
+        close(serve.listen_fd);
         return 1;
     }
     
-    // Process response - output JSON format for list command
-    parse_and_display_list_result(response.data);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    // One descriptor per client: allow as many as the hard limit does
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
     
-    // Cleanup
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    free(xml_request);
-    if (response.data) free(response.data);
+    out_literal("{\"event\":\"start\",\"listen\":");
+    print_json_string(socket_path ? socket_path : listen_addr);
+    out_printf(",\"parallel\":%d,\"cacheTTL\":%d}\n", engine.parallel, cache_ttl);
+    out_flush();
     
-    return 0;
+    int rc = 0;
+    if (engine_run(&engine, serve_source, serve_done, &serve) != 0) {
+        fprintf(stderr, "Not enough memory to run the gateway\n");
+        rc = 1;
+    }
+    
+    // Responses still pending get one last chance to go out
+    for (size_t i = 0; i < serve.client_count; i++) {
+        struct ServeClient *client = serve.clients[i];
+        serve_flush(&serve, client);
+        serve_close(&serve, client);
+        free(client->in.data);
+        free(client->out.data);
+        free(client);
+    }
+    for (size_t i = 0; i < serve.zone_count; i++) {
+        struct ServeZone *zone = serve.zones[i];
+        gidinet_record_set_free(&zone->records);
+        hash_index_free(&zone->index);
+        free(zone->domain);
+        free(zone);
+    }
+    
+    out_printf("{\"event\":\"stop\",\"requests\":%lu,\"coalesced\":%lu,\"retries\":%lu,\"circuitOpened\":%lu}\n",
+               serve.requests, serve.coalesced, engine.retries, engine.breaker.opened);
+    out_flush();
+    free(serve.clients);
+    free(serve.polls);
+    free(serve.wait_fds);
+    free(serve.zones);
+    free(serve.body.data);
+    hash_index_free(&serve.zone_index);
+    soap_parser_free(&serve.parser);
+    close(serve.listen_fd);
+    if (socket_path) unlink(socket_path);
+    close_engine(&engine);
+    return rc;
 }
 
 void print_usage(const char *prog) {
@@ -673,11 +5069,46 @@ void print_usage(const char *prog) {
     printf("  update    Update an existing DNS record\n");
     printf("  add       Add a new DNS record\n");
     printf("  delete    Delete an existing DNS record\n");
-    printf("  list      List DNS records for a domain\n");
+    printf("  list      List DNS records for one or more domains\n");
+    printf("  batch     Apply many add/update/delete operations over one connection\n");
+    printf("  sync      Make a domain match a desired-state file with minimal changes\n");
+    printf("  daemon    Keep an A/AAAA record in sync with a local interface address\n");
+    printf("  serve     Run a local HTTP/JSON gateway to the API for other services\n");
+    printf("  snapshot  Save the records of a domain to a compact snapshot file\n");
+    printf("  diff      Show the records added, removed or changed between two snapshots\n");
+    printf("  watch     Poll domains and print the records added, removed or changed\n");
     printf("  version   Show version information\n\n");
     printf("Global options (required for all commands):\n");
     printf("  --username USER       API username\n");
     printf("  --passwordB64 PASS    API password (base64 encoded)\n\n");
+    printf("Other options:\n");
+    printf("  --endpoint URL        DNSAPI.asmx URL to use (default: $GIDINET_ENDPOINT or\n");
+    printf("                        " API_ENDPOINT ")\n");
+    printf("  --timings             Add request timings (DNS, connect, TLS, first byte, total,\n");
+    printf("                        parse, bytes) to JSON results\n");
+    printf("  --prewarm             Resolve and connect (TLS, HTTP/2) in the background while\n");
+    printf("                        the input is read\n");
+    printf("  --http1.1             Use HTTP/1.1 even if the server offers HTTP/2\n");
+    printf("  --tls-session-cache PATH  Keep TLS sessions in PATH so that the next run resumes\n");
+    printf("                        them (default: $GIDINET_TLS_SESSION_CACHE)\n\n");
+    printf("Failure handling:\n");
+    printf("  --retries N           Retry transient failures up to N times (default: 2). Lists\n");
+    printf("                        are retried after any transient failure, adds, updates\n");
+    printf("                        and deletes only when the request never reached the API\n");
+    printf("  --timeout SECONDS     Time limit of one attempt (default: 30)\n");
+    printf("  --connect-timeout SECONDS  Time limit to connect (default: 10)\n");
+    printf("  --deadline SECONDS    Total time for one operation, retries included (default: 60)\n");
+    printf("  --batch-deadline SECONDS  Total time for a whole batch or sync (default: none)\n");
+    printf("  --breaker N           Fail fast after N consecutive failures (default: 5, 0: off)\n");
+    printf("  --breaker-cooldown SECONDS  Time before a trial request is let through (default: 10)\n\n");
+    printf("Pacing (list, batch, sync, serve, watch):\n");
+    printf("  --rate N              Send at most N requests per second for the account\n");
+    printf("  --burst N             Let up to N requests through at once after a pause\n");
+    printf("                        (default: --parallel)\n");
+    printf("  --adaptive            Adapt concurrency between 1 and --parallel: grow while\n");
+    printf("                        requests succeed at steady latency, halve on timeouts,\n");
+    printf("                        HTTP 429/5xx or result code 4\n");
+    printf("                        Summaries then carry the current \"limits\"\n\n");
     printf("For specific command usage, run: %s <command> --help\n\n", prog);
 }
 
@@ -731,11 +5162,197 @@ void print_delete_usage(const char *prog) {
 
 void print_list_usage(const char *prog) {
     printf("Usage: %s list [options]\n\n", prog);
-    printf("List DNS records for a domain.\n\n");
+    printf("List DNS records for one or more domains.\n\n");
+    printf("Required options:\n");
+    printf("  --username USER       API username\n");
+    printf("  --passwordB64 PASS    API password (base64 encoded)\n");
+    printf("  --domain DOMAIN       Domain name to list records for (repeat for several)\n");
+    printf("  --file PATH           And/or read domains from PATH, one per line (- for stdin)\n\n");
+    printf("Optional:\n");
+    printf("  --format FORMAT       Output format (default: json):\n");
+    printf("                          json    one JSON document with a result and the records\n");
+    printf("                          ndjson  one record per line as it is received, then a\n");
+    printf("                                  result line\n");
+    printf("                          csv     a header row, then one row per record\n");
+    printf("                          bind    zone file lines, readable by sync --file\n");
+    printf("                          binary  a snapshot file, as written by the snapshot command\n");
+    printf("                                  (single domain only)\n");
+    printf("                        With csv, bind and binary, failures go to stderr\n");
+    printf("  --stream              Same as --format ndjson\n");
+    printf("  --host PATTERN        Only records whose host matches PATTERN: a name, a prefix\n");
+    printf("                        ending in * (www*), or a glob with * ? [...] (case-insensitive)\n");
+    printf("  --type TYPE           Only records of this type\n");
+    printf("  --data DATA           Only records with exactly this data\n");
+    printf("  --limit N             Stop after N matching records per domain; for a single\n");
+    printf("                        domain the download also ends there\n");
+    printf("  --cache-ttl SECONDS   Serve the listing from the local cache if it is at most\n");
+    printf("                        SECONDS old, otherwise fetch it and refresh the cache\n");
+    printf("                        (single domain only)\n");
+    printf("  --timings             Add request timings to the result\n\n");
+    printf("Several domains:\n");
+    printf("  --parallel N          Fetch up to N domains concurrently (default: 1)\n");
+    printf("  --merge               Print one JSON document {\"domains\":[...],\"summary\":{...}}\n");
+    printf("                        instead of one line per domain and a summary line\n");
+    printf("  --metrics PATH        Write latency histograms to PATH (Prometheus text format)\n\n");
+}
+
+void print_batch_usage(const char *prog) {
+    printf("Usage: %s batch [options]\n\n", prog);
+    printf("Apply add/update/delete operations read one per line from a file or stdin.\n");
+    printf("All operations share one connection; one JSON result line is written per operation.\n\n");
+    printf("Required options:\n");
+    printf("  --username USER       API username\n");
+    printf("  --passwordB64 PASS    API password (base64 encoded)\n\n");
+    printf("Optional:\n");
+    printf("  --file PATH           Read operations from PATH instead of stdin (- for stdin)\n");
+    printf("  --parallel N          Run up to N operations concurrently (default: 1)\n");
+    printf("  --timings             Add request timings to each result line\n");
+    printf("  --metrics PATH        Write per-operation latency histograms to PATH in the\n");
+    printf("                        Prometheus text format when the batch completes\n");
+    printf("  --batch-deadline SECONDS  Fail operations not started within SECONDS\n");
+    printf("  --transaction         All or nothing: check the operations against a snapshot\n");
+    printf("                        of the zone, apply them, and if any fails undo those\n");
+    printf("                        applied. One report line is written per operation\n");
+    printf("  --coalesce MS         Hold each operation for MS milliseconds and fold later\n");
+    printf("                        updates and deletes of an updated record into it, so only\n");
+    printf("                        one update or delete is sent; updates that change nothing\n");
+    printf("                        are skipped\n");
+    printf("  --reserve N           Keep N of the --parallel slots for urgent operations\n");
+    printf("                        (default: 1)\n");
+    printf("  --journal PATH        Append each operation and its result to PATH, an NDJSON\n");
+    printf("                        audit log (with a PATH.idx index for fast reopening)\n");
+    printf("  --journal-sync MS     Write and sync journal records at least every MS\n");
+    printf("                        milliseconds (default: 50); a sent record is synced\n");
+    printf("                        before its request goes out\n");
+    printf("  --resume              Skip the operations the journal shows completed by a\n");
+    printf("                        previous run of the same input\n\n");
+    printf("Input lines are JSON objects or CSV rows (blank lines and # comments are skipped):\n");
+    printf("  {\"op\":\"add\",\"domain\":\"example.com\",\"host\":\"www\",\"type\":\"A\",\"data\":\"1.2.3.4\",\"ttl\":300,\"priority\":0}\n");
+    printf("  {\"op\":\"update\",\"oldDomain\":...,\"oldData\":...,\"newDomain\":...,\"newData\":...}\n");
+    printf("  {\"op\":\"delete\",...,\"lane\":\"urgent\"}   (lanes: urgent, normal, bulk)\n");
+    printf("  add,example.com,www,A,1.2.3.4,300,0\n");
+    printf("  update,example.com,www,A,1.2.3.4,300,0,example.com,www,A,5.6.7.8,300,0\n\n");
+}
+
+void print_sync_usage(const char *prog) {
+    printf("Usage: %s sync [options]\n\n", prog);
+    printf("Fetch the records of a domain once, diff them against a desired state and\n");
+    printf("apply only the add/update/delete operations needed, in one session.\n\n");
+    printf("Required options:\n");
+    printf("  --username USER       API username\n");
+    printf("  --passwordB64 PASS    API password (base64 encoded)\n");
+    printf("  --domain DOMAIN       Domain to reconcile\n\n");
+    printf("Optional:\n");
+    printf("  --file PATH           Desired state (default: stdin): a JSON array or one JSON\n");
+    printf("                        object per line with host/type/data/ttl/priority, or a\n");
+    printf("                        BIND-style zone file\n");
+    printf("  --dry-run             Print the plan without applying it\n");
+    printf("  --parallel N          Run up to N operations concurrently (default: 1)\n");
+    printf("  --timings             Add request timings to each applied operation\n");
+    printf("  --batch-deadline SECONDS  Fail operations not started within SECONDS\n\n");
+    printf("Records are matched on (host, type, data). Read-only records are never deleted.\n\n");
+}
+
+void print_daemon_usage(const char *prog) {
+    printf("Usage: %s daemon [options]\n\n", prog);
+    printf("Run in the foreground, watch the local interface addresses and update the\n");
+    printf("record only when the address changes. Events are printed as JSON lines.\n\n");
     printf("Required options:\n");
     printf("  --username USER       API username\n");
     printf("  --passwordB64 PASS    API password (base64 encoded)\n");
-    printf("  --domain DOMAIN       Domain name to list records for\n\n");
+    printf("  --domain DOMAIN       Domain name\n");
+    printf("  --host HOST           Hostname of the record to keep up to date\n\n");
+    printf("Optional:\n");
+    printf("  --type TYPE           A (IPv4, default) or AAAA (IPv6)\n");
+    printf("  --interface NAME      Only use addresses of this interface. Without it,\n");
+    printf("                        private addresses (10/8, 172.16/12, 192.168/16,\n");
+    printf("                        100.64/10, fc00::/7) are skipped; loopback and\n");
+    printf("                        link-local addresses always are\n");
+    printf("  --ttl TTL             TTL to set (default: keep the existing record's)\n");
+    printf("  --priority NUM        Priority to set together with --ttl\n");
+    printf("  --interval SECONDS    Seconds between address checks (default: 60)\n");
+    printf("  --debounce SECONDS    Time a new address must be stable before it is pushed (default: 10)\n");
+    printf("  --jitter SECONDS      Random extra delay before pushing (default: 5)\n");
+    printf("  --timings             Add request timings to change events\n");
+    printf("  --metrics PATH        Keep per-operation latency histograms in PATH in the\n");
+    printf("                        Prometheus text format, rewritten after each request\n\n");
+}
+
+void print_serve_usage(const char *prog) {
+    printf("Usage: %s serve [options]\n\n", prog);
+    printf("Run a local HTTP/JSON gateway in the foreground until SIGINT or SIGTERM. Reads\n");
+    printf("are answered from an in-memory copy of each zone; changes are sent to the API\n");
+    printf("over a shared connection pool. Start and stop events are printed as JSON lines.\n\n");
+    printf("Required options:\n");
+    printf("  --username USER       API username\n");
+    printf("  --passwordB64 PASS    API password (base64 encoded)\n\n");
+    printf("Optional:\n");
+    printf("  --listen [HOST:]PORT  TCP address to listen on (default: 127.0.0.1:8053)\n");
+    printf("  --socket PATH         Listen on a unix socket instead\n");
+    printf("  --parallel N          Send up to N requests to the API concurrently (default: 4)\n");
+    printf("  --cache-ttl SECONDS   Answer reads from a listing up to SECONDS old (default: 60,\n");
+    printf("                        0: list for every read). Changes made through the gateway\n");
+    printf("                        always cause a new listing\n");
+    printf("  --coalesce MS         Hold each change for MS milliseconds and fold later\n");
+    printf("                        changes of the same record into it, as batch does; the\n");
+    printf("                        folded requests get the response of the change sent\n\n");
+    printf("Requests:\n");
+    printf("  GET /records/DOMAIN[?host=HOST&type=TYPE]   List the records, optionally filtered\n");
+    printf("  POST /records/DOMAIN                       Add a record\n");
+    printf("  PUT /records/DOMAIN                        Update a record\n");
+    printf("  DELETE /records/DOMAIN                     Delete a record\n");
+    printf("  GET /health                                Gateway status\n\n");
+    printf("Record fields are given in a JSON body and/or the query string, named like the\n");
+    printf("batch fields (host, type, data, ttl, priority; oldData, newData, ... for PUT):\n");
+    printf("  curl -X PUT localhost:8053/records/example.com -d '{\"host\":\"www\",\"type\":\"A\",\n");
+    printf("       \"data\":\"1.2.3.4\",\"newData\":\"5.6.7.8\"}'\n\n");
+}
+
+void print_watch_usage(const char *prog) {
+    printf("Usage: %s watch [options]\n\n", prog);
+    printf("Poll the records of one or more domains in the foreground until SIGINT or SIGTERM\n");
+    printf("and print each record added, removed or changed since the last poll as a JSON\n");
+    printf("line. A listing identical to the last one is recognized by its digest and not\n");
+    printf("parsed.\n\n");
+    printf("Required options:\n");
+    printf("  --username USER       API username\n");
+    printf("  --passwordB64 PASS    API password (base64 encoded)\n");
+    printf("  --domain DOMAIN       Domain to watch (repeat for several)\n");
+    printf("  --file PATH           Also watch the domains listed in PATH, one per line\n");
+    printf("                        (- for stdin)\n\n");
+    printf("Optional:\n");
+    printf("  --interval SECONDS    Seconds between polls of a domain (default: 60). The\n");
+    printf("                        first polls are spread evenly over one interval\n");
+    printf("  --jitter SECONDS      Move each poll by a random offset of up to half of\n");
+    printf("                        SECONDS either way (default: 5)\n");
+    printf("  --parallel N          Poll up to N domains concurrently (default: 4)\n\n");
+    printf("Events:\n");
+    printf("  {\"event\":\"ready\",\"domain\":...,\"records\":N,\"digest\":...}   first listing\n");
+    printf("  {\"event\":\"added\",\"domain\":...,\"record\":{...}}             also \"removed\"\n");
+    printf("  {\"event\":\"changed\",\"domain\":...,\"old\":{...},\"new\":{...}}  TTL, priority, readOnly\n");
+    printf("  {\"event\":\"error\",\"domain\":...,\"error\":...}\n\n");
+}
+
+void print_snapshot_usage(const char *prog) {
+    printf("Usage: %s snapshot [options]\n\n", prog);
+    printf("Fetch the records of a domain and save them to a snapshot: a columnar file with\n");
+    printf("each distinct string stored once, read in place by diff.\n\n");
+    printf("Required options:\n");
+    printf("  --username USER       API username\n");
+    printf("  --passwordB64 PASS    API password (base64 encoded)\n");
+    printf("  --domain DOMAIN       Domain name to save\n");
+    printf("  --file PATH           Snapshot file to write (replaced atomically)\n\n");
+    printf("Optional:\n");
+    printf("  --timings             Add request timings to the result\n\n");
+}
+
+void print_diff_usage(const char *prog) {
+    printf("Usage: %s diff --old PATH --new PATH\n\n", prog);
+    printf("Compare two snapshot files without converting them. One JSON line is printed\n");
+    printf("per added, removed or changed record, then a summary line. Records match on\n");
+    printf("(domain, host, type, data); a match with another TTL, priority, read-only or\n");
+    printf("suspension state is changed. No credentials are needed.\n\n");
+    printf("Exit status: 0 if the snapshots hold the same records, 1 if they differ, 2 on error.\n\n");
 }
 
 int main(int argc, char **argv) {
@@ -756,6 +5373,20 @@ int main(int argc, char **argv) {
             print_delete_usage(argv[0]);
         } else if (strcmp(command, "list") == 0) {
             print_list_usage(argv[0]);
+        } else if (strcmp(command, "batch") == 0) {
+            print_batch_usage(argv[0]);
+        } else if (strcmp(command, "sync") == 0) {
+            print_sync_usage(argv[0]);
+        } else if (strcmp(command, "daemon") == 0) {
+            print_daemon_usage(argv[0]);
+        } else if (strcmp(command, "serve") == 0) {
+            print_serve_usage(argv[0]);
+        } else if (strcmp(command, "snapshot") == 0) {
+            print_snapshot_usage(argv[0]);
+        } else if (strcmp(command, "diff") == 0) {
+            print_diff_usage(argv[0]);
+        } else if (strcmp(command, "watch") == 0) {
+            print_watch_usage(argv[0]);
         } else {
             printf("Unknown command: %s\n", command);
             print_usage(argv[0]);
@@ -777,11 +5408,48 @@ int main(int argc, char **argv) {
     char *newDomain = NULL, *newHost = NULL, *newType = NULL, *newData = NULL;
     int newTTL = 0, newPriority = 0;
     
+    // Batch-specific parameters
+    char *file = NULL;
+    int parallel = 0;             // 0: the command's default (1, or 4 for serve and watch)
+    int dry_run = 0;
+    int transaction = 0;
+    int coalesce_ms = -1;
+    
+    // Daemon-specific parameters
+    char *interface = NULL;
+    int interval = 60, debounce = 10, jitter = 5;
+    
+    // List-specific parameters
+    int cache_ttl = -1;
+    int merge = 0;
+    long limit = 0;
+    char **domains = calloc(argc, sizeof(*domains));
+    int domain_count = 0;
+    if (!domains) {
+        fprintf(stderr, "Not enough memory\n");
+        return 1;
+    }
+    
+    // Serve-specific parameters
+    char *listen_addr = NULL, *socket_path = NULL;
+    
+    // Diff-specific parameters
+    char *old_path = NULL, *new_path = NULL;
+    
+    // Instrumentation
+    char *metrics_path = NULL;
+    
+    // Output is buffered until it is flushed or the program exits
+    atexit(out_flush);
+    retry_policy_default(&policy);
+    tls_session_cache = getenv("GIDINET_TLS_SESSION_CACHE");
+    if (tls_session_cache && !*tls_session_cache) tls_session_cache = NULL;
+    
     // Parse command line arguments starting from index 2 (after command)
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "--username") == 0 && i + 1 < argc) username = argv[++i];
         else if (strcmp(argv[i], "--passwordB64") == 0 && i + 1 < argc) passwordB64 = argv[++i];
-        else if (strcmp(argv[i], "--domain") == 0 && i + 1 < argc) domain = argv[++i];
+        else if (strcmp(argv[i], "--domain") == 0 && i + 1 < argc) domain = domains[domain_count++] = argv[++i];
         else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) host = argv[++i];
         else if (strcmp(argv[i], "--type") == 0 && i + 1 < argc) type = argv[++i];
         else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) data = argv[++i];
@@ -800,6 +5468,56 @@ int main(int argc, char **argv) {
         else if (strcmp(argv[i], "--newData") == 0 && i + 1 < argc) newData = argv[++i];
         else if (strcmp(argv[i], "--newTTL") == 0 && i + 1 < argc) newTTL = atoi(argv[++i]);
         else if (strcmp(argv[i], "--newPriority") == 0 && i + 1 < argc) newPriority = atoi(argv[++i]);
+        // List command specific parameters
+        else if (strcmp(argv[i], "--stream") == 0) output_format = OUTPUT_NDJSON;
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (set_output_format(argv[++i]) != 0) {
+                printf("Unknown format: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cache-ttl") == 0 && i + 1 < argc) cache_ttl = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--merge") == 0) merge = 1;
+        else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) limit = atol(argv[++i]);
+        // Batch command specific parameters
+        else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) file = argv[++i];
+        else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) parallel = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dry-run") == 0) dry_run = 1;
+        else if (strcmp(argv[i], "--transaction") == 0) transaction = 1;
+        else if (strcmp(argv[i], "--coalesce") == 0 && i + 1 < argc) coalesce_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reserve") == 0 && i + 1 < argc) reserved_slots = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) journal_path = argv[++i];
+        else if (strcmp(argv[i], "--journal-sync") == 0 && i + 1 < argc) journal_sync_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--resume") == 0) resume = 1;
+        // Serve command specific parameters
+        else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) listen_addr = argv[++i];
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) socket_path = argv[++i];
+        // Diff command specific parameters
+        else if (strcmp(argv[i], "--old") == 0 && i + 1 < argc) old_path = argv[++i];
+        else if (strcmp(argv[i], "--new") == 0 && i + 1 < argc) new_path = argv[++i];
+        // Daemon command specific parameters
+        else if (strcmp(argv[i], "--interface") == 0 && i + 1 < argc) interface = argv[++i];
+        else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc) debounce = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) jitter = atoi(argv[++i]);
+        // Instrumentation
+        else if (strcmp(argv[i], "--timings") == 0) show_timings = 1;
+        else if (strcmp(argv[i], "--endpoint") == 0 && i + 1 < argc) endpoint = argv[++i];
+        else if (strcmp(argv[i], "--prewarm") == 0) prewarm = 1;
+        else if (strcmp(argv[i], "--http1.1") == 0) force_http1 = 1;
+        else if (strcmp(argv[i], "--tls-session-cache") == 0 && i + 1 < argc) tls_session_cache = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) metrics_path = argv[++i];
+        // Failure handling
+        else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc) policy.retries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) policy.attempt_timeout = atof(argv[++i]);
+        else if (strcmp(argv[i], "--connect-timeout") == 0 && i + 1 < argc) policy.connect_timeout = atof(argv[++i]);
+        else if (strcmp(argv[i], "--deadline") == 0 && i + 1 < argc) policy.operation_budget = atof(argv[++i]);
+        else if (strcmp(argv[i], "--batch-deadline") == 0 && i + 1 < argc) batch_deadline = atof(argv[++i]);
+        else if (strcmp(argv[i], "--breaker") == 0 && i + 1 < argc) policy.breaker_threshold = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--breaker-cooldown") == 0 && i + 1 < argc) policy.breaker_cooldown = atof(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) rate_limit = atof(argv[++i]);
+        else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) rate_burst = atof(argv[++i]);
+        else if (strcmp(argv[i], "--adaptive") == 0) adaptive = 1;
         else {
             printf("Unknown option: %s\n", argv[i]);
             return 1;
@@ -831,12 +5549,147 @@ int main(int argc, char **argv) {
         }
         return call_record_delete(username, passwordB64, domain, host, type, data, ttl, priority);
     } else if (strcmp(command, "list") == 0) {
-        if (!username || !passwordB64 || !domain) {
+        if (!username || !passwordB64 || (!domain && !file)) {
             printf("Error: Missing required parameters for list command.\n\n");
             print_list_usage(argv[0]);
             return 1;
         }
-        return call_record_list(username, passwordB64, domain);
+        // Filters are evaluated by the parser, record by record
+        static struct RecordFilter filter;
+        if (host) record_filter_set_host(&filter, host);
+        filter.type = type;
+        filter.data = data;
+        filter.limit = limit;
+        if (record_filter_active(&filter)) list_filter = &filter;
+        if (domain_count == 1 && !file && !merge) {
+            return call_record_list(username, passwordB64, domain, cache_ttl < 0 ? 0 : cache_ttl);
+        }
+        if (output_format == OUTPUT_BINARY) {
+            fprintf(stderr, "--format binary lists a single domain\n");
+            return 1;
+        }
+        if (merge && output_format != OUTPUT_JSON && output_format != OUTPUT_NDJSON) {
+            fprintf(stderr, "--merge prints JSON and cannot be combined with --format %s\n",
+                    output_format == OUTPUT_CSV ? "csv" : "bind");
+            return 1;
+        }
+        if (merge) output_format = OUTPUT_JSON;
+        FILE *input = NULL;
+        if (file) {
+            input = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+            if (!input) {
+                fprintf(stderr, "Cannot open %s\n", file);
+                return 1;
+            }
+        }
+        int rc = run_list_domains(username, passwordB64, domains, domain_count, input, parallel, merge,
+                                  metrics_path);
+        if (input && input != stdin) fclose(input);
+        return rc;
+    } else if (strcmp(command, "batch") == 0) {
+        if (!username || !passwordB64) {
+            printf("Error: Missing required parameters for batch command.\n\n");
+            print_batch_usage(argv[0]);
+            return 1;
+        }
+        if (transaction && coalesce_ms >= 0) {
+            printf("Error: --coalesce cannot be used with --transaction.\n\n");
+            print_batch_usage(argv[0]);
+            return 1;
+        }
+        if (transaction && journal_path) {
+            printf("Error: --journal cannot be used with --transaction.\n\n");
+            print_batch_usage(argv[0]);
+            return 1;
+        }
+        if (resume && !journal_path) {
+            printf("Error: --resume needs --journal.\n\n");
+            print_batch_usage(argv[0]);
+            return 1;
+        }
+        FILE *input = stdin;
+        if (file && strcmp(file, "-") != 0) {
+            input = fopen(file, "r");
+            if (!input) {
+                fprintf(stderr, "Cannot open %s\n", file);
+                return 1;
+            }
+        }
+        int rc = transaction ? run_transaction(username, passwordB64, input, parallel)
+                             : run_batch(username, passwordB64, input, parallel,
+                                         coalesce_ms >= 0 ? coalesce_ms / 1000.0 : -1, metrics_path);
+        if (input != stdin) fclose(input);
+        return rc;
+    } else if (strcmp(command, "sync") == 0) {
+        if (!username || !passwordB64 || !domain) {
+            printf("Error: Missing required parameters for sync command.\n\n");
+            print_sync_usage(argv[0]);
+            return 1;
+        }
+        FILE *input = stdin;
+        if (file && strcmp(file, "-") != 0) {
+            input = fopen(file, "r");
+            if (!input) {
+                fprintf(stderr, "Cannot open %s\n", file);
+                return 1;
+            }
+        }
+        int rc = run_sync(username, passwordB64, domain, input, dry_run, parallel);
+        if (input != stdin) fclose(input);
+        return rc;
+    } else if (strcmp(command, "daemon") == 0) {
+        if (!username || !passwordB64 || !domain || !host) {
+            printf("Error: Missing required parameters for daemon command.\n\n");
+            print_daemon_usage(argv[0]);
+            return 1;
+        }
+        struct DaemonConfig config = {
+            username, passwordB64, domain, host, type ? type : "A", interface,
+            ttl, priority, interval > 0 ? interval : 1, debounce < 0 ? 0 : debounce, jitter < 0 ? 0 : jitter,
+            metrics_path
+        };
+        return run_daemon(&config);
+    } else if (strcmp(command, "serve") == 0) {
+        if (!username || !passwordB64) {
+            printf("Error: Missing required parameters for serve command.\n\n");
+            print_serve_usage(argv[0]);
+            return 1;
+        }
+        return run_serve(username, passwordB64, listen_addr ? listen_addr : "127.0.0.1:8053", socket_path,
+                         parallel > 0 ? parallel : 4, cache_ttl < 0 ? 60 : cache_ttl,
+                         coalesce_ms >= 0 ? coalesce_ms / 1000.0 : -1);
+    } else if (strcmp(command, "snapshot") == 0) {
+        if (!username || !passwordB64 || !domain || !file) {
+            printf("Error: Missing required parameters for snapshot command.\n\n");
+            print_snapshot_usage(argv[0]);
+            return 1;
+        }
+        return run_snapshot(username, passwordB64, domain, file);
+    } else if (strcmp(command, "diff") == 0) {
+        if (!old_path || !new_path) {
+            printf("Error: Missing required parameters for diff command.\n\n");
+            print_diff_usage(argv[0]);
+            return 2;
+        }
+        return run_diff(old_path, new_path);
+    } else if (strcmp(command, "watch") == 0) {
+        if (!username || !passwordB64 || (!domain && !file)) {
+            printf("Error: Missing required parameters for watch command.\n\n");
+            print_watch_usage(argv[0]);
+            return 1;
+        }
+        FILE *input = NULL;
+        if (file) {
+            input = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+            if (!input) {
+                fprintf(stderr, "Cannot open %s\n", file);
+                return 1;
+            }
+        }
+        int rc = run_watch(username, passwordB64, domains, domain_count, input, parallel > 0 ? parallel : 4,
+                           interval > 0 ? interval : 1, jitter < 0 ? 0 : jitter);
+        if (input && input != stdin) fclose(input);
+        return rc;
     } else if (strcmp(command, "version") == 0 || strcmp(command, "--version") == 0 || strcmp(command, "-v") == 0) {
         printf("DIGINET DNS API Client %s\n", VERSION);
         return 0;
@@ -845,4 +5698,4 @@ int main(int argc, char **argv) {
         print_usage(argv[0]);
         return 1;
     }
-}
\ No newline at end of file
+}
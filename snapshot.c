@@ -0,0 +1,464 @@
+// libgidinet - zone snapshots
+// A snapshot is a columnar, string-interned file that is used straight from a
+// read-only mapping. Layout (native byte order, each section 8-byte aligned):
+//
+//   SnapshotHeader
+//   u32 offsets[string_count + 1]   start of each string in the string data
+//   string data                     distinct strings, NUL-terminated, in strcmp() order
+//   u32 columns                     domain, host, type, data, suspensionReason (string ids)
+//   i32 columns                     ttl, priority
+//   u8 column                       flags (SNAPSHOT_READ_ONLY, SNAPSHOT_SUSPENDED)
+//
+// Records are sorted on (domain, host, type, data). Since string ids follow the
+// string order, records of one file compare as plain integers, and two files
+// are diffed with one merge over their string tables and one over their records.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gidinet_internal.h"
+
+#define SNAPSHOT_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+static const size_t snapshot_widths[SNAPSHOT_COLUMNS] = { 4, 4, 4, 4, 4, 4, 4, 1 };
+
+int snapshot_writer_init(struct SnapshotWriter *writer) {
+    memset(writer, 0, sizeof(*writer));
+    return hash_index_init(&writer->index, 256);
+}
+
+void snapshot_writer_free(struct SnapshotWriter *writer) {
+    free(writer->strings.data);
+    free(writer->offsets);
+    hash_index_free(&writer->index);
+    for (int c = 0; c < SNAPSHOT_STRING_COLUMNS; c++) free(writer->ids[c]);
+    free(writer->ttl);
+    free(writer->priority);
+    free(writer->flags);
+    memset(writer, 0, sizeof(*writer));
+}
+
+// Id of str in the writer's string table, adding it if it is new
+static int snapshot_intern(struct SnapshotWriter *writer, const char *str, uint32_t *id) {
+    size_t len = strlen(str);
+    uint64_t hash = fnv1a_hash(str, len, FNV1A_SEED);
+    size_t pos = 0, value;
+    
+    while (hash_index_next(&writer->index, hash, &pos, &value)) {
+        if (strcmp(writer->strings.data + writer->offsets[value], str) == 0) {
+            *id = (uint32_t)value;
+            return 0;
+        }
+    }
+    
+    if (writer->strings.len + len + 1 > UINT32_MAX || writer->string_count == UINT32_MAX - 1) return -1;
+    if (writer->string_count == writer->string_cap) {
+        uint32_t cap = writer->string_cap ? writer->string_cap * 2 : 256;
+        uint32_t *offsets = realloc(writer->offsets, cap * sizeof(*offsets));
+        if (!offsets) return -1;
+        writer->offsets = offsets;
+        writer->string_cap = cap;
+    }
+    
+    // Strings are stored with their NUL so that ids map to C strings
+    uint32_t offset = (uint32_t)writer->strings.len;
+    if (buffer_append(&writer->strings, str, len + 1) != 0 ||
+        hash_index_insert(&writer->index, hash, writer->string_count) != 0) {
+        return -1;
+    }
+    writer->offsets[writer->string_count] = offset;
+    *id = writer->string_count++;
+    return 0;
+}
+
+static int snapshot_writer_grow(struct SnapshotWriter *writer) {
+    uint32_t cap = writer->record_cap ? writer->record_cap * 2 : 256;
+    
+    for (int c = 0; c < SNAPSHOT_STRING_COLUMNS; c++) {
+        uint32_t *ids = realloc(writer->ids[c], cap * sizeof(*ids));
+        if (!ids) return -1;
+        writer->ids[c] = ids;
+    }
+    int32_t *ttl = realloc(writer->ttl, cap * sizeof(*ttl));
+    if (!ttl) return -1;
+    writer->ttl = ttl;
+    int32_t *priority = realloc(writer->priority, cap * sizeof(*priority));
+    if (!priority) return -1;
+    writer->priority = priority;
+    uint8_t *flags = realloc(writer->flags, cap);
+    if (!flags) return -1;
+    writer->flags = flags;
+    
+    writer->record_cap = cap;
+    return 0;
+}
+
+// Parser record callback: append one record, interning its strings
+void snapshot_writer_add(void *ctx, const struct ListRecord *record) {
+    struct SnapshotWriter *writer = ctx;
+    if (writer->failed) return;
+    
+    if (writer->record_count == UINT32_MAX ||
+        (writer->record_count == writer->record_cap && snapshot_writer_grow(writer) != 0)) {
+        writer->failed = 1;
+        return;
+    }
+    
+    const char *strings[SNAPSHOT_STRING_COLUMNS] = {
+        record->domain, record->host, record->type, record->data, record->suspension_reason
+    };
+    uint32_t n = writer->record_count;
+    for (int c = 0; c < SNAPSHOT_STRING_COLUMNS; c++) {
+        if (snapshot_intern(writer, strings[c] ? strings[c] : "", &writer->ids[c][n]) != 0) {
+            writer->failed = 1;
+            return;
+        }
+    }
+    writer->ttl[n] = record->ttl;
+    writer->priority[n] = record->priority;
+    writer->flags[n] = (record->read_only ? SNAPSHOT_READ_ONLY : 0) | (record->suspended ? SNAPSHOT_SUSPENDED : 0);
+    writer->record_count++;
+}
+
+struct SnapshotString {
+    const char *str;
+    uint32_t id;
+};
+
+static int snapshot_string_cmp(const void *a, const void *b) {
+    return strcmp(((const struct SnapshotString *)a)->str, ((const struct SnapshotString *)b)->str);
+}
+
+// A record during sorting, with string ids already renumbered in string order
+struct SnapshotRow {
+    uint32_t ids[SNAPSHOT_STRING_COLUMNS];
+    int32_t ttl;
+    int32_t priority;
+    uint8_t flags;
+};
+
+static int snapshot_row_cmp(const void *a, const void *b) {
+    const struct SnapshotRow *x = a, *y = b;
+    for (int c = 0; c < SNAPSHOT_STRING_COLUMNS; c++) {
+        if (x->ids[c] != y->ids[c]) return x->ids[c] < y->ids[c] ? -1 : 1;
+    }
+    if (x->ttl != y->ttl) return x->ttl < y->ttl ? -1 : 1;
+    if (x->priority != y->priority) return x->priority < y->priority ? -1 : 1;
+    return (int)x->flags - (int)y->flags;
+}
+
+// Write a section and pad it to the next 8-byte boundary
+static int snapshot_write_section(FILE *fp, const void *data, size_t len) {
+    static const char zeros[8];
+    if (len && fwrite(data, 1, len, fp) != len) return -1;
+    size_t pad = SNAPSHOT_ALIGN(len) - len;
+    return pad && fwrite(zeros, 1, pad, fp) != pad ? -1 : 0;
+}
+
+// Write the header, string table and columns of the sorted rows
+static int snapshot_write_file(FILE *fp, const struct SnapshotHeader *header, const uint32_t *offsets,
+                               const char *data, const struct SnapshotRow *rows, void *column) {
+    uint32_t strings = header->string_count, records = header->record_count;
+    
+    if (snapshot_write_section(fp, header, sizeof(*header)) != 0 ||
+        snapshot_write_section(fp, offsets, ((size_t)strings + 1) * 4) != 0 ||
+        snapshot_write_section(fp, data, offsets[strings]) != 0) {
+        return -1;
+    }
+    
+    // Columns are transposed out of the rows one at a time
+    for (int c = 0; c < SNAPSHOT_COLUMNS; c++) {
+        uint32_t *u32 = column;
+        int32_t *i32 = column;
+        uint8_t *u8 = column;
+        for (uint32_t r = 0; r < records; r++) {
+            if (c < SNAPSHOT_STRING_COLUMNS) u32[r] = rows[r].ids[c];
+            else if (c == SNAPSHOT_COL_TTL) i32[r] = rows[r].ttl;
+            else if (c == SNAPSHOT_COL_PRIORITY) i32[r] = rows[r].priority;
+            else u8[r] = rows[r].flags;
+        }
+        if (snapshot_write_section(fp, column, (size_t)records * snapshot_widths[c]) != 0) return -1;
+    }
+    return 0;
+}
+
+// Sort the collected records and write them as a snapshot file to fp, which
+// need not be seekable. Returns 0 on success, -1 on a memory or I/O failure.
+int snapshot_writer_write(struct SnapshotWriter *writer, const char *domain, FILE *fp) {
+    uint32_t domain_id;
+    if (writer->failed || snapshot_intern(writer, domain ? domain : "", &domain_id) != 0) return -1;
+    
+    uint32_t strings = writer->string_count, records = writer->record_count;
+    struct SnapshotString *order = malloc(strings * sizeof(*order));
+    uint32_t *rank = malloc(strings * sizeof(*rank));
+    uint32_t *offsets = malloc(((size_t)strings + 1) * sizeof(*offsets));
+    struct SnapshotRow *rows = malloc((records ? records : 1) * sizeof(*rows));
+    char *data = malloc(writer->strings.len + 1);
+    void *column = malloc((records ? records : 1) * sizeof(uint32_t));
+    int rc = -1;
+    
+    if (order && rank && offsets && rows && data && column) {
+        // Renumber strings in strcmp() order and lay them out in that order
+        for (uint32_t i = 0; i < strings; i++) {
+            order[i].str = writer->strings.data + writer->offsets[i];
+            order[i].id = i;
+        }
+        qsort(order, strings, sizeof(*order), snapshot_string_cmp);
+        uint32_t len = 0;
+        for (uint32_t i = 0; i < strings; i++) {
+            size_t n = strlen(order[i].str) + 1;
+            rank[order[i].id] = i;
+            offsets[i] = len;
+            memcpy(data + len, order[i].str, n);
+            len += (uint32_t)n;
+        }
+        offsets[strings] = len;
+        
+        for (uint32_t r = 0; r < records; r++) {
+            for (int c = 0; c < SNAPSHOT_STRING_COLUMNS; c++) rows[r].ids[c] = rank[writer->ids[c][r]];
+            rows[r].ttl = writer->ttl[r];
+            rows[r].priority = writer->priority[r];
+            rows[r].flags = writer->flags[r];
+        }
+        qsort(rows, records, sizeof(*rows), snapshot_row_cmp);
+        
+        struct SnapshotHeader header = {0};
+        memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+        header.version = SNAPSHOT_VERSION;
+        header.created_at = (int64_t)time(NULL);
+        header.record_count = records;
+        header.string_count = strings;
+        header.domain = rank[domain_id];
+        header.offsets = SNAPSHOT_ALIGN(sizeof(header));
+        header.strings = header.offsets + SNAPSHOT_ALIGN(((uint64_t)strings + 1) * 4);
+        uint64_t offset = header.strings + SNAPSHOT_ALIGN(len);
+        for (int c = 0; c < SNAPSHOT_COLUMNS; c++) {
+            header.columns[c] = offset;
+            offset += SNAPSHOT_ALIGN((uint64_t)records * snapshot_widths[c]);
+        }
+        header.size = offset;
+        rc = snapshot_write_file(fp, &header, offsets, data, rows, column);
+    }
+    
+    free(order);
+    free(rank);
+    free(offsets);
+    free(rows);
+    free(data);
+    free(column);
+    return rc;
+}
+
+// Write the snapshot to path, replacing it atomically.
+// Returns 0 on success, -1 on a memory or I/O failure.
+int snapshot_writer_save(struct SnapshotWriter *writer, const char *domain, const char *path) {
+    // Written next to its final path, so readers never see a partial file
+    char tmp_path[PATH_MAX + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!fp) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return -1;
+    }
+    
+    int failed = snapshot_writer_write(writer, domain, fp) != 0;
+    failed |= fclose(fp) != 0;
+    if (failed || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// A section of count items of width bytes lies within the file
+static int snapshot_section_ok(const struct Snapshot *snapshot, uint64_t offset, uint64_t count, size_t width) {
+    return offset % 8 == 0 && offset <= snapshot->size && count * width <= snapshot->size - offset;
+}
+
+// Check that the mapped file is consistent, so that readers can trust every
+// offset and id in it, and that it is sorted as the diff expects
+static int snapshot_validate(struct Snapshot *snapshot) {
+    const struct SnapshotHeader *header = snapshot->header;
+    uint32_t strings = header->string_count, records = header->record_count;
+    
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, 4) != 0 || header->version != SNAPSHOT_VERSION ||
+        header->size != snapshot->size || header->domain >= strings ||
+        !snapshot_section_ok(snapshot, header->offsets, (uint64_t)strings + 1, 4)) {
+        return -1;
+    }
+    snapshot->offsets = (const uint32_t *)(snapshot->map + header->offsets);
+    if (!snapshot_section_ok(snapshot, header->strings, snapshot->offsets[strings], 1)) return -1;
+    snapshot->strings = snapshot->map + header->strings;
+    for (int c = 0; c < SNAPSHOT_COLUMNS; c++) {
+        if (!snapshot_section_ok(snapshot, header->columns[c], records, snapshot_widths[c])) return -1;
+    }
+    
+    // Strings: NUL-terminated, distinct and in order
+    if (snapshot->offsets[0] != 0) return -1;
+    for (uint32_t i = 0; i < strings; i++) {
+        uint32_t start = snapshot->offsets[i], end = snapshot->offsets[i + 1];
+        if (end <= start || snapshot->strings[end - 1] != '\0' ||
+            memchr(snapshot->strings + start, '\0', end - start - 1) ||
+            (i > 0 && strcmp(snapshot->strings + snapshot->offsets[i - 1], snapshot->strings + start) >= 0)) {
+            return -1;
+        }
+    }
+    
+    for (int c = 0; c < SNAPSHOT_STRING_COLUMNS; c++) {
+        snapshot->ids[c] = (const uint32_t *)(snapshot->map + header->columns[c]);
+        for (uint32_t r = 0; r < records; r++) {
+            if (snapshot->ids[c][r] >= strings) return -1;
+        }
+    }
+    snapshot->ttl = (const int32_t *)(snapshot->map + header->columns[SNAPSHOT_COL_TTL]);
+    snapshot->priority = (const int32_t *)(snapshot->map + header->columns[SNAPSHOT_COL_PRIORITY]);
+    snapshot->flags = (const uint8_t *)(snapshot->map + header->columns[SNAPSHOT_COL_FLAGS]);
+    
+    // Records: sorted on their key
+    for (uint32_t r = 1; r < records; r++) {
+        for (int c = SNAPSHOT_COL_DOMAIN; c <= SNAPSHOT_COL_DATA; c++) {
+            if (snapshot->ids[c][r - 1] < snapshot->ids[c][r]) break;
+            if (snapshot->ids[c][r - 1] > snapshot->ids[c][r]) return -1;
+        }
+    }
+    
+    snapshot->record_count = records;
+    snapshot->string_count = strings;
+    return 0;
+}
+
+// Map and validate a snapshot file. Returns 0 on success, -1 if it cannot be
+// read or is not a valid snapshot (errno is EINVAL then).
+int snapshot_open(struct Snapshot *snapshot, const char *path) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct SnapshotHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    
+    snapshot->map = map;
+    snapshot->size = st.st_size;
+    snapshot->header = (const struct SnapshotHeader *)map;
+    if (snapshot_validate(snapshot) != 0) {
+        snapshot_close(snapshot);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void snapshot_close(struct Snapshot *snapshot) {
+    if (snapshot->map) munmap((void *)snapshot->map, snapshot->size);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+const char* snapshot_string(const struct Snapshot *snapshot, uint32_t id) {
+    return snapshot->strings + snapshot->offsets[id];
+}
+
+// View record index as a list record; its strings point into the mapping
+void snapshot_record(const struct Snapshot *snapshot, uint32_t index, struct ListRecord *record) {
+    record->domain = snapshot_string(snapshot, snapshot->ids[SNAPSHOT_COL_DOMAIN][index]);
+    record->host = snapshot_string(snapshot, snapshot->ids[SNAPSHOT_COL_HOST][index]);
+    record->type = snapshot_string(snapshot, snapshot->ids[SNAPSHOT_COL_TYPE][index]);
+    record->data = snapshot_string(snapshot, snapshot->ids[SNAPSHOT_COL_DATA][index]);
+    record->suspension_reason = snapshot_string(snapshot, snapshot->ids[SNAPSHOT_COL_REASON][index]);
+    record->ttl = snapshot->ttl[index];
+    record->priority = snapshot->priority[index];
+    record->read_only = (snapshot->flags[index] & SNAPSHOT_READ_ONLY) != 0;
+    record->suspended = (snapshot->flags[index] & SNAPSHOT_SUSPENDED) != 0;
+    record->fields = 0;
+    for (int field = SOAP_FIELD_DOMAIN; field <= SOAP_FIELD_SUSPENDED; field++) record->fields |= LIST_FIELD_BIT(field);
+}
+
+// Compare the keys of a record of each snapshot through their string ranks
+static int snapshot_key_cmp(const struct Snapshot *from, const uint32_t *from_rank, uint32_t i,
+                            const struct Snapshot *to, const uint32_t *to_rank, uint32_t j) {
+    for (int c = SNAPSHOT_COL_DOMAIN; c <= SNAPSHOT_COL_DATA; c++) {
+        uint32_t a = from_rank[from->ids[c][i]], b = to_rank[to->ids[c][j]];
+        if (a != b) return a < b ? -1 : 1;
+    }
+    return 0;
+}
+
+// Report the records added, removed or changed from one snapshot to the other.
+// Records match on (domain, host, type, data); a match whose TTL, priority,
+// flags or suspension reason differ is a change. Strings are only compared
+// while ranking the two string tables, never per record.
+int snapshot_diff(const struct Snapshot *from, const struct Snapshot *to, snapshot_diff_cb cb, void *ctx,
+                  struct SnapshotDiffStats *stats) {
+    uint32_t *from_rank = malloc((from->string_count ? from->string_count : 1) * sizeof(uint32_t));
+    uint32_t *to_rank = malloc((to->string_count ? to->string_count : 1) * sizeof(uint32_t));
+    memset(stats, 0, sizeof(*stats));
+    if (!from_rank || !to_rank) {
+        free(from_rank);
+        free(to_rank);
+        return -1;
+    }
+    
+    // Both tables are sorted: merge them into one ranking where equal strings
+    // share a rank
+    uint32_t i = 0, j = 0, rank = 0;
+    while (i < from->string_count && j < to->string_count) {
+        int cmp = strcmp(snapshot_string(from, i), snapshot_string(to, j));
+        if (cmp <= 0) from_rank[i++] = rank;
+        if (cmp >= 0) to_rank[j++] = rank;
+        rank++;
+    }
+    while (i < from->string_count) from_rank[i++] = rank++;
+    while (j < to->string_count) to_rank[j++] = rank++;
+    
+    i = j = 0;
+    while (i < from->record_count || j < to->record_count) {
+        int cmp = i == from->record_count ? 1 : j == to->record_count ? -1 :
+                  snapshot_key_cmp(from, from_rank, i, to, to_rank, j);
+        if (cmp < 0) {
+            stats->removed++;
+            if (cb) cb(ctx, SNAPSHOT_REMOVED, i, SNAPSHOT_NO_RECORD);
+            i++;
+        } else if (cmp > 0) {
+            stats->added++;
+            if (cb) cb(ctx, SNAPSHOT_ADDED, SNAPSHOT_NO_RECORD, j);
+            j++;
+        } else {
+            if (from->ttl[i] != to->ttl[j] || from->priority[i] != to->priority[j] ||
+                from->flags[i] != to->flags[j] ||
+                from_rank[from->ids[SNAPSHOT_COL_REASON][i]] != to_rank[to->ids[SNAPSHOT_COL_REASON][j]]) {
+                stats->changed++;
+                if (cb) cb(ctx, SNAPSHOT_CHANGED, i, j);
+            } else {
+                stats->unchanged++;
+            }
+            i++;
+            j++;
+        }
+    }
+    
+    free(from_rank);
+    free(to_rank);
+    return 0;
+}
@@ -0,0 +1,451 @@
+// Table-driven tests for the CLI
+// Covers the flat JSON parser, the folding of batch operations and sync planning.
+// main.c is compiled in with main() renamed, so its static helpers can be called.
+// With --endpoint, every coalescing and sync case is also applied to a DNSAPI.asmx
+// server such as bench/mock_server, and the zones it ends up with are compared.
+#define main gidinet_cli_main
+#include "../main.c"
+#undef main
+
+static int cases, failures;
+
+static void test_fail(const char *group, const char *name, const char *what) {
+    fprintf(stderr, "FAIL %s: %s: %s\n", group, name, what);
+    failures++;
+}
+
+// parse_flat_json_object: the members are listed as key=value; pairs, or NULL
+// when the object is rejected
+struct JsonCase {
+    const char *name;
+    const char *input;
+    const char *members;
+};
+
+static const struct JsonCase json_cases[] = {
+    { "empty object", "{}", "" },
+    { "string member", "{\"a\":\"b\"}", "a=b;" },
+    { "numbers and literals", " { \"ttl\" : 300 , \"x\":true,\"n\":null }", "ttl=300;x=true;n=null;" },
+    { "escapes", "{\"s\":\"a\\\"b\\\\c\\/d\\te\"}", "s=a\"b\\c/d\te;" },
+    { "unicode escapes", "{\"u\":\"\\u00e9\\u20AC\"}", "u=\xC3\xA9\xE2\x82\xAC;" },
+    { "surrogate pair", "{\"u\":\"\\ud83d\\ude00\"}", "u=\xF0\x9F\x98\x80;" },
+    { "short unicode escape", "{\"u\":\"\\u12\"}", NULL },
+    { "unicode escape with a non-hex digit", "{\"u\":\"\\u00g1\"}", NULL },
+    { "unicode escape with a sign", "{\"u\":\"\\u+123\"}", NULL },
+    { "unicode escape with a space", "{\"u\":\"\\u 123\"}", NULL },
+    { "escaped NUL", "{\"u\":\"a\\u0000b\"}", NULL },
+    { "lone high surrogate", "{\"u\":\"\\ud83d\"}", NULL },
+    { "high surrogate before another escape", "{\"u\":\"\\ud83d\\u0041\"}", NULL },
+    { "lone low surrogate", "{\"u\":\"\\ude00x\"}", NULL },
+    { "text after the object", "{\"a\":1} tail", "a=1;" },
+    { "nested object", "{\"a\":{\"b\":1}}", NULL },
+    { "array value", "{\"a\":[1]}", NULL },
+    { "missing colon", "{\"a\" \"b\"}", NULL },
+    { "missing comma", "{\"a\":\"b\" \"c\":\"d\"}", NULL },
+    { "unclosed object", "{\"a\":\"b\"", NULL },
+    { "unterminated string", "{\"a\":\"b}", NULL },
+    { "not an object", "[\"a\"]", NULL },
+};
+
+static int collect_member(const char *key, const char *value, void *ctx) {
+    struct GrowBuffer *buf = ctx;
+    if (buffer_append(buf, key, strlen(key)) != 0 || buffer_append(buf, "=", 1) != 0 ||
+        buffer_append(buf, value, strlen(value)) != 0 || buffer_append(buf, ";", 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void test_json(void) {
+    for (size_t i = 0; i < sizeof(json_cases) / sizeof(json_cases[0]); i++) {
+        const struct JsonCase *tc = &json_cases[i];
+        struct GrowBuffer buf = {0};
+        
+        cases++;
+        const char *rest = parse_flat_json_object(tc->input, collect_member, &buf);
+        if (!tc->members && rest) {
+            test_fail("json", tc->name, "accepted");
+        } else if (tc->members && !rest) {
+            test_fail("json", tc->name, "rejected");
+        } else if (tc->members && strcmp(buf.data ? buf.data : "", tc->members) != 0) {
+            test_fail("json", tc->name, "wrong members");
+        }
+        free(buf.data);
+    }
+}
+
+// Parse one CSV or JSON batch line into op and move it to domain
+static int test_operation(const char *line, const char *domain, struct BatchOperation *op) {
+    char text[512];
+    const char *error;
+    
+    memset(op, 0, sizeof(*op));
+    snprintf(text, sizeof(text), "%s", line);
+    if (parse_batch_line(text, op, &error) != 0) return -1;
+    if (domain) {
+        free(op->record.domain);
+        op->record.domain = strdup(domain);
+        if (op->type == BATCH_OP_UPDATE) {
+            free(op->new_record.domain);
+            op->new_record.domain = strdup(domain);
+        }
+    }
+    return 0;
+}
+
+// Send one operation; returns its API result code, or -1 if it was not answered
+static int test_apply(struct GidinetClient *client, const struct BatchOperation *op) {
+    struct APIResult result = {0};
+    int rc;
+    
+    switch (op->type) {
+        case BATCH_OP_ADD:
+            rc = gidinet_record_add(client, &op->record, &result);
+            break;
+        case BATCH_OP_DELETE:
+            rc = gidinet_record_delete(client, &op->record, &result);
+            break;
+        default:
+            rc = gidinet_record_update(client, &op->record, &op->new_record, &result);
+            break;
+    }
+    if (rc == 0) rc = result.code;
+    gidinet_result_free(&result);
+    return rc;
+}
+
+// The records of a domain on the server; a domain without records is empty
+static int test_list(struct GidinetClient *client, const char *domain, struct RecordSet *records) {
+    struct APIResult result = {0};
+    
+    memset(records, 0, sizeof(*records));
+    int rc = gidinet_record_list(client, domain, &result, records);
+    if (rc == 0 && result.code != 0 && result.code != 5) rc = -1;
+    gidinet_result_free(&result);
+    return rc;
+}
+
+// Whether every record of zone is in expected, whatever their domains. Records
+// left with SYNC_KEEP_CURRENT in expected match any ttl or priority.
+static int test_zone_within(const struct RecordSet *zone, const struct RecordSet *expected) {
+    for (size_t i = 0; i < zone->count; i++) {
+        const struct DNSRecord *have = &zone->items[i].record;
+        int found = 0;
+        for (size_t j = 0; j < expected->count && !found; j++) {
+            const struct DNSRecord *want = &expected->items[j].record;
+            found = record_key_equal(have, want) &&
+                    (want->ttl == SYNC_KEEP_CURRENT || have->ttl == want->ttl) &&
+                    (want->priority == SYNC_KEEP_CURRENT || have->priority == want->priority);
+        }
+        if (!found) return 0;
+    }
+    return 1;
+}
+
+static int test_same_zone(const struct RecordSet *zone, const struct RecordSet *expected) {
+    return test_zone_within(zone, expected) && test_zone_within(expected, zone);
+}
+
+// coalesce_merge: held and next are batch lines, merged the single operation
+// they fold into, or NULL when both must be sent. The seed record is in the zone
+// before held runs, so that held succeeds as a fold assumes.
+struct CoalesceCase {
+    const char *name;
+    const char *seed;
+    const char *held;
+    const char *next;
+    const char *merged;
+};
+
+static const struct CoalesceCase coalesce_cases[] = {
+    { "update chain", "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      "update,t,www,A,2.2.2.2,300,0,t,www,A,3.3.3.3,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,3.3.3.3,300,0" },
+    { "update then ttl change", "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      "update,t,www,A,2.2.2.2,300,0,t,www,A,2.2.2.2,600,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,600,0" },
+    { "update then delete", "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      "delete,t,www,A,2.2.2.2,300,0",
+      "delete,t,www,A,1.1.1.1,300,0" },
+    { "bulk update then normal update", "add,t,www,A,1.1.1.1,300,0",
+      "{\"op\":\"update\",\"lane\":\"bulk\",\"oldDomain\":\"t\",\"oldHost\":\"www\",\"oldType\":\"A\","
+      "\"oldData\":\"1.1.1.1\",\"newDomain\":\"t\",\"newHost\":\"www\",\"newType\":\"A\",\"newData\":\"2.2.2.2\"}",
+      "update,t,www,A,2.2.2.2,0,0,t,www,A,3.3.3.3,0,0",
+      "update,t,www,A,1.1.1.1,0,0,t,www,A,3.3.3.3,0,0" },
+    { "update back to the start", "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      "update,t,www,A,2.2.2.2,300,0,t,www,A,1.1.1.1,300,0",
+      NULL },
+    { "update of another record", "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,3.3.3.3,300,0",
+      NULL },
+    { "update then add", "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      "add,t,www,A,2.2.2.2,300,0",
+      NULL },
+    { "add then update", NULL,
+      "add,t,www,A,1.1.1.1,300,0",
+      "update,t,www,A,1.1.1.1,300,0,t,www,A,2.2.2.2,300,0",
+      NULL },
+    { "add then delete", NULL,
+      "add,t,www,A,1.1.1.1,300,0",
+      "delete,t,www,A,1.1.1.1,300,0",
+      NULL },
+    { "delete then add", "add,t,www,A,1.1.1.1,300,0",
+      "delete,t,www,A,1.1.1.1,300,0",
+      "add,t,www,A,1.1.1.1,300,0",
+      NULL },
+};
+
+// Apply the operations of a case to domain, the unfolded ones or the folded one
+static int test_coalesce_run(struct GidinetClient *client, const struct CoalesceCase *tc, const char *domain,
+                             int folded, struct RecordSet *zone) {
+    const char *lines[] = { tc->seed, folded ? tc->merged : tc->held, folded ? NULL : tc->next };
+    
+    for (int i = 0; i < 3; i++) {
+        struct BatchOperation op;
+        if (!lines[i]) continue;
+        if (test_operation(lines[i], domain, &op) != 0) return -1;
+        int rc = test_apply(client, &op);
+        free_batch_operation(&op);
+        // The seed and the held operation must succeed
+        if (rc != 0 && i < 2) return -1;
+    }
+    return test_list(client, domain, zone);
+}
+
+static void test_coalesce(struct GidinetClient *client) {
+    for (size_t i = 0; i < sizeof(coalesce_cases) / sizeof(coalesce_cases[0]); i++) {
+        const struct CoalesceCase *tc = &coalesce_cases[i];
+        struct BatchOperation held, next, merged;
+        
+        cases++;
+        if (test_operation(tc->held, NULL, &held) != 0 || test_operation(tc->next, NULL, &next) != 0 ||
+            (tc->merged && test_operation(tc->merged, NULL, &merged) != 0)) {
+            test_fail("coalesce", tc->name, "invalid case");
+            continue;
+        }
+        int rc = coalesce_merge(&held, &next);
+        if (!tc->merged && rc == 0) {
+            test_fail("coalesce", tc->name, "folded");
+        } else if (tc->merged && rc != 0) {
+            test_fail("coalesce", tc->name, "not folded");
+        } else if (tc->merged && (held.type != merged.type || held.lane != merged.lane ||
+                   !records_identical(&held.record, &merged.record) ||
+                   (held.type == BATCH_OP_UPDATE && !records_identical(&held.new_record, &merged.new_record)))) {
+            test_fail("coalesce", tc->name, "wrong folded operation");
+        }
+        free_batch_operation(&held);
+        free_batch_operation(&next);
+        if (tc->merged) free_batch_operation(&merged);
+        
+        // The folded operation leaves the zone as the two it replaces do
+        if (!client || !tc->merged) continue;
+        char unfolded_domain[64], folded_domain[64];
+        struct RecordSet unfolded_zone = {0}, folded_zone = {0};
+        snprintf(unfolded_domain, sizeof(unfolded_domain), "coalesce%zu-unfolded.test", i);
+        snprintf(folded_domain, sizeof(folded_domain), "coalesce%zu-folded.test", i);
+        if (test_coalesce_run(client, tc, unfolded_domain, 0, &unfolded_zone) != 0 ||
+            test_coalesce_run(client, tc, folded_domain, 1, &folded_zone) != 0) {
+            test_fail("coalesce", tc->name, "server run failed");
+        } else if (!test_same_zone(&folded_zone, &unfolded_zone)) {
+            test_fail("coalesce", tc->name, "folded run left a different zone");
+        }
+        gidinet_record_set_free(&unfolded_zone);
+        gidinet_record_set_free(&folded_zone);
+    }
+}
+
+// compute_sync_plan: current and desired are JSON objects, one per line, without
+// a domain. A current record with "readOnly":true is read-only; such cases are
+// not run against the server, which cannot hold one.
+struct SyncCase {
+    const char *name;
+    const char *current;
+    const char *desired;
+    size_t adds, updates, deletes, unchanged, kept_read_only;
+};
+
+#define WWW_1 "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":300,\"priority\":0}\n"
+#define WWW_2 "{\"host\":\"www\",\"type\":\"A\",\"data\":\"2.2.2.2\",\"ttl\":300,\"priority\":0}\n"
+#define MAIL "{\"host\":\"@\",\"type\":\"MX\",\"data\":\"mail.t\",\"ttl\":300,\"priority\":10}\n"
+
+static const struct SyncCase sync_cases[] = {
+    { "identical", WWW_1 MAIL, MAIL WWW_1, 0, 0, 0, 2, 0 },
+    { "empty zone", "", WWW_1 MAIL, 2, 0, 0, 0, 0 },
+    { "empty desired state", WWW_1 MAIL, "", 0, 0, 2, 0, 0 },
+    { "ttl change", WWW_1, "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":600}\n", 0, 1, 0, 0, 0 },
+    { "ttl left out", WWW_1 MAIL, "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\"}\n" MAIL, 0, 0, 0, 2, 0 },
+    { "data change", WWW_1 MAIL, WWW_2 MAIL, 0, 1, 0, 1, 0 },
+    { "another host", WWW_1, "{\"host\":\"api\",\"type\":\"A\",\"data\":\"1.1.1.1\"}\n", 1, 0, 1, 0, 0 },
+    { "another type", WWW_1, "{\"host\":\"www\",\"type\":\"TXT\",\"data\":\"1.1.1.1\"}\n", 1, 0, 1, 0, 0 },
+    { "extra record kept apart", WWW_1, WWW_1 WWW_2, 1, 0, 0, 1, 0 },
+    { "duplicate desired record", WWW_1, WWW_1 WWW_1, 0, 0, 0, 1, 0 },
+    { "read-only record left out",
+      "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":300,\"readOnly\":true}\n", "",
+      0, 0, 0, 0, 1 },
+    { "read-only record desired as it is",
+      "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":300,\"readOnly\":true}\n", WWW_1,
+      0, 0, 0, 0, 1 },
+    { "read-only record with another ttl",
+      "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":300,\"readOnly\":true}\n",
+      "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":600}\n", 0, 0, 0, 0, 1 },
+    { "read-only record not replaced",
+      "{\"host\":\"www\",\"type\":\"A\",\"data\":\"1.1.1.1\",\"ttl\":300,\"readOnly\":true}\n", WWW_2,
+      1, 0, 0, 0, 1 },
+};
+
+struct CurrentRecord {
+    struct DNSRecord record;
+    int read_only;
+};
+
+static int current_field(const char *key, const char *value, void *ctx) {
+    struct CurrentRecord *current = ctx;
+    if (strcmp(key, "readOnly") == 0) {
+        current->read_only = strcmp(value, "true") == 0;
+        return 0;
+    }
+    return set_record_field(&current->record, key, value);
+}
+
+// Fill a record set from the current records of a case
+static int test_current(const char *text, const char *domain, struct RecordSet *set) {
+    const char *p = text;
+    
+    memset(set, 0, sizeof(*set));
+    while (*p) {
+        struct CurrentRecord current = { { .domain = strdup(domain) }, 0 };
+        p = parse_flat_json_object(p, current_field, &current);
+        int rc = p ? record_set_add(set, &current.record, current.read_only) : -1;
+        free_dns_record(&current.record);
+        if (rc != 0) return -1;
+        while (isspace((unsigned char)*p)) p++;
+    }
+    return 0;
+}
+
+static int test_desired(const char *text, const char *domain, struct RecordSet *set) {
+    const char *error;
+    
+    memset(set, 0, sizeof(*set));
+    FILE *input = fmemopen((void *)text, strlen(text), "r");
+    if (!input) return -1;
+    int rc = load_desired_state(input, domain, set, &error);
+    fclose(input);
+    return rc;
+}
+
+static int test_has_read_only(const struct RecordSet *set) {
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->items[i].read_only) return 1;
+    }
+    return 0;
+}
+
+// Seed the server with the current records, apply the plan and compare the zone
+// it ends up with to the desired state
+static void test_sync_run(struct GidinetClient *client, const struct SyncCase *tc, size_t index) {
+    char domain[64];
+    struct RecordSet seeded, current, desired, zone;
+    struct SyncPlan plan = {0};
+    
+    snprintf(domain, sizeof(domain), "sync%zu.test", index);
+    if (test_current(tc->current, domain, &seeded) != 0 || test_desired(tc->desired, domain, &desired) != 0) {
+        test_fail("sync", tc->name, "invalid case");
+        gidinet_record_set_free(&seeded);
+        gidinet_record_set_free(&desired);
+        return;
+    }
+    int rc = 0;
+    for (size_t i = 0; i < seeded.count && rc == 0; i++) {
+        struct BatchOperation op = { .type = BATCH_OP_ADD, .record = seeded.items[i].record };
+        rc = test_apply(client, &op);
+    }
+    if (rc != 0 || test_list(client, domain, &current) != 0) {
+        test_fail("sync", tc->name, "server run failed");
+        gidinet_record_set_free(&seeded);
+        gidinet_record_set_free(&desired);
+        return;
+    }
+    
+    struct SyncContext sync = { .current = &current, .desired = &desired };
+    if (compute_sync_plan(&current, &desired, &plan) != 0) rc = -1;
+    for (size_t i = 0; i < plan.count && rc == 0; i++) {
+        struct BatchOperation op;
+        sync_operation_to_batch(&sync, &plan.ops[i], &op);
+        rc = test_apply(client, &op);
+    }
+    if (rc != 0 || test_list(client, domain, &zone) != 0) {
+        test_fail("sync", tc->name, "server run failed");
+    } else {
+        if (!test_same_zone(&zone, &desired)) test_fail("sync", tc->name, "zone differs");
+        gidinet_record_set_free(&zone);
+    }
+    free(plan.ops);
+    gidinet_record_set_free(&seeded);
+    gidinet_record_set_free(&current);
+    gidinet_record_set_free(&desired);
+}
+
+static void test_sync(struct GidinetClient *client) {
+    for (size_t i = 0; i < sizeof(sync_cases) / sizeof(sync_cases[0]); i++) {
+        const struct SyncCase *tc = &sync_cases[i];
+        struct RecordSet current, desired;
+        struct SyncPlan plan = {0};
+        
+        cases++;
+        if (test_current(tc->current, "t.test", &current) != 0 || test_desired(tc->desired, "t.test", &desired) != 0 ||
+            compute_sync_plan(&current, &desired, &plan) != 0) {
+            test_fail("sync", tc->name, "invalid case");
+        } else {
+            if (plan.adds != tc->adds || plan.updates != tc->updates || plan.deletes != tc->deletes ||
+                plan.unchanged != tc->unchanged || plan.kept_read_only != tc->kept_read_only) {
+                test_fail("sync", tc->name, "wrong plan");
+            }
+            if (plan.count != plan.adds + plan.updates + plan.deletes) {
+                test_fail("sync", tc->name, "plan count does not add up");
+            }
+            if (client && !test_has_read_only(&current)) test_sync_run(client, tc, i);
+        }
+        free(plan.ops);
+        gidinet_record_set_free(&current);
+        gidinet_record_set_free(&desired);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *endpoint = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--endpoint") == 0 && i + 1 < argc) {
+            endpoint = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--endpoint URL]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    struct GidinetClient *client = NULL;
+    if (endpoint) {
+        client = gidinet_client_new("test", "dGVzdA==");
+        if (!client || gidinet_client_set_endpoint(client, endpoint) != 0) {
+            fprintf(stderr, "Error: cannot create a client for %s\n", endpoint);
+            return 1;
+        }
+    }
+    
+    test_json();
+    test_coalesce(client);
+    test_sync(client);
+    
+    printf("%d cases, %d failed%s\n", cases, failures, client ? "" : " (without a server)");
+    if (client) gidinet_client_free(client);
+    curl_global_cleanup();
+    return failures ? 1 : 0;
+}